@@ -35,6 +35,7 @@
 #include <string.h>
 #include <stdarg.h>
 #include <ctype.h>
+#include <time.h>
 #include <sys/types.h>
 
 #ifdef HAVE_STDLIB_H
@@ -87,6 +88,9 @@ librdf_init_hash(librdf_world *world)
   librdf_init_hash_datums(world);
 #ifdef HAVE_BDB_HASH
   librdf_init_hash_bdb(world);
+#endif
+#ifdef HAVE_LMDB_HASH
+  librdf_init_hash_lmdb(world);
 #endif
   /* Always have hash in memory implementation available */
   librdf_init_hash_memory(world);
@@ -235,6 +239,238 @@ librdf_free_hash_datum(librdf_hash_datum *datum)
 }
 
 
+/* key hash functions */
+
+/*
+ * wyhash final version 4 by Wang Yi <godspeed_china@yeah.net>
+ * released into the public domain (The Unlicense)
+ * https://github.com/wangyi-fudan/wyhash
+ *
+ * Reads 8 bytes at a time and keeps three independent multiply lanes
+ * busy for long keys.  The byte order of the loads is that of the host
+ * so the values are not portable between machines; they are only used
+ * in memory.
+ */
+
+static const u64 librdf_hash_wyhash_secret[4] = {
+  0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+  0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL
+};
+
+/* 64x64 -> 128 bit multiply: *A gets the low half, *B the high half */
+static REDLAND_INLINE void
+librdf_hash_wyhash_mum(u64 *A, u64 *B)
+{
+#if defined(__SIZEOF_INT128__)
+  __uint128_t r = *A;
+
+  r *= *B;
+  *A = (u64)r;
+  *B = (u64)(r >> 64);
+#else
+  u64 ha = *A >> 32, hb = *B >> 32, la = (u32)*A, lb = (u32)*B;
+  u64 rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  u64 t = rl + (rm0 << 32), c = t < rl;
+  u64 lo = t + (rm1 << 32);
+
+  c += lo < t;
+  *A = lo;
+  *B = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static REDLAND_INLINE u64
+librdf_hash_wyhash_mix(u64 A, u64 B)
+{
+  librdf_hash_wyhash_mum(&A, &B);
+  return A ^ B;
+}
+
+static REDLAND_INLINE u64
+librdf_hash_wyhash_r8(const unsigned char *p)
+{
+  u64 v;
+
+  memcpy(&v, p, 8);
+  return v;
+}
+
+static REDLAND_INLINE u64
+librdf_hash_wyhash_r4(const unsigned char *p)
+{
+  u32 v;
+
+  memcpy(&v, p, 4);
+  return v;
+}
+
+
+/**
+ * librdf_hash_function_wyhash:
+ * @data: bytes to hash
+ * @size: number of bytes
+ * @seed: seed
+ *
+ * INTERNAL - Hash bytes with wyhash.
+ *
+ * This is the default key hash function of the memory hash.
+ *
+ * Return value: 64 bit hash
+ **/
+u64
+librdf_hash_function_wyhash(const void *data, size_t size, u64 seed)
+{
+  const u64 *secret = librdf_hash_wyhash_secret;
+  const unsigned char *p = (const unsigned char*)data;
+  u64 a, b;
+
+  seed ^= librdf_hash_wyhash_mix(seed ^ secret[0], secret[1]);
+
+  if(size <= 16) {
+    if(size >= 4) {
+      size_t mid = (size >> 3) << 2;
+
+      a = (librdf_hash_wyhash_r4(p) << 32) | librdf_hash_wyhash_r4(p + mid);
+      b = (librdf_hash_wyhash_r4(p + size - 4) << 32) |
+          librdf_hash_wyhash_r4(p + size - 4 - mid);
+    } else if(size > 0) {
+      a = ((u64)p[0] << 16) | ((u64)p[size >> 1] << 8) | p[size - 1];
+      b = 0;
+    } else
+      a = b = 0;
+  } else {
+    size_t i = size;
+
+    if(i > 48) {
+      u64 see1 = seed, see2 = seed;
+
+      do {
+        seed = librdf_hash_wyhash_mix(librdf_hash_wyhash_r8(p) ^ secret[1],
+                                      librdf_hash_wyhash_r8(p + 8) ^ seed);
+        see1 = librdf_hash_wyhash_mix(librdf_hash_wyhash_r8(p + 16) ^ secret[2],
+                                      librdf_hash_wyhash_r8(p + 24) ^ see1);
+        see2 = librdf_hash_wyhash_mix(librdf_hash_wyhash_r8(p + 32) ^ secret[3],
+                                      librdf_hash_wyhash_r8(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while(i > 48);
+      seed ^= see1 ^ see2;
+    }
+
+    while(i > 16) {
+      seed = librdf_hash_wyhash_mix(librdf_hash_wyhash_r8(p) ^ secret[1],
+                                    librdf_hash_wyhash_r8(p + 8) ^ seed);
+      i -= 16;
+      p += 16;
+    }
+
+    a = librdf_hash_wyhash_r8(p + i - 16);
+    b = librdf_hash_wyhash_r8(p + i - 8);
+  }
+
+  a ^= secret[1];
+  b ^= seed;
+  librdf_hash_wyhash_mum(&a, &b);
+  return librdf_hash_wyhash_mix(a ^ secret[0] ^ (u64)size, b ^ secret[1]);
+}
+
+
+/**
+ * librdf_hash_function_one_at_a_time:
+ * @data: bytes to hash
+ * @size: number of bytes
+ * @seed: seed
+ *
+ * INTERNAL - Hash bytes with Bob Jenkins "One-at-a-Time" hash.
+ *
+ * This was the memory hash function before wyhash.  It hashes the
+ * string backwards to help do URIs better.  The result is only 32 bits
+ * wide.
+ *
+ * Return value: hash
+ **/
+u64
+librdf_hash_function_one_at_a_time(const void *data, size_t size, u64 seed)
+{
+  const unsigned char *c = (const unsigned char*)data + size;
+  u32 hash = (u32)(seed ^ (seed >> 32));
+
+  while(size--) {
+    hash += *--c;
+    hash += (hash << 10);
+    hash ^= (hash >> 6);
+  }
+  hash += (hash << 3);
+  hash ^= (hash >> 11);
+  hash += (hash << 15);
+
+  return hash;
+}
+
+
+static const struct {
+  const char *name;
+  librdf_hash_function function;
+} librdf_hash_functions[] = {
+  { "wyhash",        librdf_hash_function_wyhash },
+  { "one-at-a-time", librdf_hash_function_one_at_a_time },
+  { NULL,            NULL }
+};
+
+
+/**
+ * librdf_get_hash_function:
+ * @name: hash function name or NULL for the default
+ *
+ * INTERNAL - Get a key hash function by name
+ *
+ * Return value: hash function or NULL if @name is not known
+ **/
+librdf_hash_function
+librdf_get_hash_function(const char *name)
+{
+  int i;
+
+  if(!name)
+    return librdf_hash_functions[0].function;
+
+  for(i = 0; librdf_hash_functions[i].name; i++) {
+    if(!strcmp(librdf_hash_functions[i].name, name))
+      return librdf_hash_functions[i].function;
+  }
+
+  return NULL;
+}
+
+
+/**
+ * librdf_hash_random_seed:
+ *
+ * INTERNAL - Make a seed for a key hash function
+ *
+ * Mixes the time, clock and some addresses so that seeds differ
+ * between processes and between calls.  This makes the hash of a key
+ * hard to predict from outside; it is not a cryptographic random
+ * number.
+ *
+ * Return value: seed
+ **/
+u64
+librdf_hash_random_seed(void)
+{
+  static u64 counter = 0;
+  u64 entropy[4];
+
+  entropy[0] = (u64)time(NULL);
+  entropy[1] = (u64)clock();
+  entropy[2] = (u64)(size_t)&entropy;
+  entropy[3] = ++counter;
+
+  return librdf_hash_function_wyhash(entropy, sizeof(entropy),
+                                     (u64)(size_t)&librdf_hash_functions);
+}
+
+
 /* class methods */
 
 /**
@@ -669,6 +905,7 @@ librdf_hash_datum*
 librdf_hash_get_one(librdf_hash* hash, librdf_hash_datum *key)
 {
   librdf_hash_datum *value;
+  librdf_hash_datum cursor_key; /* on stack */
   librdf_hash_cursor *cursor;
   int status;
   char *new_value;
@@ -683,7 +920,10 @@ librdf_hash_get_one(librdf_hash* hash, librdf_hash_datum *key)
     return NULL;
   }
 
-  status=librdf_hash_cursor_get_next(cursor, key, value);
+  /* look up by the key, on a copy so the caller's key is not
+   * pointed at data owned by the cursor */
+  cursor_key=*key;
+  status=librdf_hash_cursor_set(cursor, &cursor_key, value);
   if(!status) {
     /* value->data will point to SHARED area, so copy it */
     new_value = LIBRDF_MALLOC(char*, value->size);
@@ -966,6 +1206,143 @@ librdf_hash_delete(librdf_hash* hash, librdf_hash_datum *key,
 }
 
 
+/**
+ * librdf_hash_put_many:
+ * @hash: hash object
+ * @keys: array of keys
+ * @values: array of values
+ * @count: number of key/value pairs
+ *
+ * Insert many key/value pairs into the hash.
+ * 
+ * The pairs should be sorted by key so that hashes stored in key
+ * order can write them in one pass; the result is the same as
+ * librdf_hash_put() on each pair in turn.
+ * 
+ * Return value: non 0 on failure
+ **/
+int
+librdf_hash_put_many(librdf_hash* hash, librdf_hash_datum *keys,
+                     librdf_hash_datum *values, int count)
+{
+  int i;
+
+  if(hash->factory->put_many)
+    return hash->factory->put_many(hash->context, keys, values, count);
+
+  for(i=0; i < count; i++) {
+    if(hash->factory->put(hash->context, &keys[i], &values[i]))
+      return 1;
+  }
+  return 0;
+}
+
+
+/**
+ * librdf_hash_delete_many:
+ * @hash: hash object
+ * @keys: array of keys
+ * @values: array of values
+ * @count: number of key/value pairs
+ *
+ * Delete many key/value pairs from the hash.
+ * 
+ * The pairs should be sorted by key as for librdf_hash_put_many().
+ * Every pair present is deleted even if some are not.
+ * 
+ * Return value: non 0 on failure (including any pair not present)
+ **/
+int
+librdf_hash_delete_many(librdf_hash* hash, librdf_hash_datum *keys,
+                        librdf_hash_datum *values, int count)
+{
+  int i;
+  int status=0;
+
+  if(hash->factory->delete_many)
+    return hash->factory->delete_many(hash->context, keys, values, count);
+
+  for(i=0; i < count; i++) {
+    if(hash->factory->delete_key_value(hash->context, &keys[i], &values[i]))
+      status=1;
+  }
+  return status;
+}
+
+
+/**
+ * librdf_hash_put_if_absent:
+ * @hash: hash object
+ * @key: key
+ * @value: value
+ *
+ * Insert a key/value pair into the hash unless it is already present.
+ * 
+ * Hashes that can do so find the pair and insert it in one lookup,
+ * otherwise this is librdf_hash_exists() followed by librdf_hash_put().
+ * 
+ * Return value: 0 if the pair was inserted, >0 if it was already
+ * present, <0 on failure
+ **/
+int
+librdf_hash_put_if_absent(librdf_hash* hash, librdf_hash_datum *key,
+                          librdf_hash_datum *value)
+{
+  int status;
+
+  if(hash->factory->put_if_absent)
+    return hash->factory->put_if_absent(hash->context, key, value);
+
+  if(librdf_hash_prepare_key(hash, key))
+    return -1;
+
+  status=librdf_hash_exists_prepared(hash, key, value);
+  if(status)
+    return status;
+
+  return librdf_hash_put_prepared(hash, key, value) ? -1 : 0;
+}
+
+
+/**
+ * librdf_hash_key_values_count:
+ * @hash: hash object
+ * @key: key
+ *
+ * Count the values of a key in the hash.
+ * 
+ * Hashes that keep the number of values of each key return it
+ * directly, otherwise the values are counted with a cursor.
+ * 
+ * Return value: the number of values or <0 on failure
+ **/
+int
+librdf_hash_key_values_count(librdf_hash* hash, librdf_hash_datum *key)
+{
+  librdf_hash_cursor* cursor;
+  librdf_hash_datum next_key, next_value; /* on stack */
+  int count=0;
+  int status;
+
+  if(hash->factory->key_values_count)
+    return hash->factory->key_values_count(hash->context, key);
+
+  cursor=librdf_new_hash_cursor(hash);
+  if(!cursor)
+    return -1;
+
+  next_key.data=NULL;
+  next_value.data=NULL;
+  for(status=librdf_hash_cursor_set(cursor, key, &next_value);
+      !status;
+      status=librdf_hash_cursor_get_next_value(cursor, &next_key, &next_value))
+    count++;
+
+  librdf_free_hash_cursor(cursor);
+  return count;
+}
+
+
 /**
  * librdf_hash_delete_all:
  * @hash: hash object
@@ -982,6 +1359,122 @@ librdf_hash_delete_all(librdf_hash* hash, librdf_hash_datum *key)
 }
 
 
+/**
+ * librdf_hash_prepare_key:
+ * @hash: hash object
+ * @key: key
+ *
+ * Precompute the hash of a key before passing it to several operations.
+ * 
+ * The hash is saved in @key and used only by librdf_hash_put_prepared(),
+ * librdf_hash_exists_prepared() and librdf_hash_delete_prepared() on
+ * @hash or any other hash using the same key hash function and seed.
+ * It becomes stale when the key data changes, so the key must then be
+ * prepared again before it is given to those.  All other operations
+ * hash the key themselves and ignore any saved hash.
+ * 
+ * Hashes that do not hash keys themselves ignore this.
+ * 
+ * Return value: non 0 on failure
+ **/
+int
+librdf_hash_prepare_key(librdf_hash* hash, librdf_hash_datum *key)
+{
+  if(!hash->factory->prepare_key)
+    return 0;
+
+  return hash->factory->prepare_key(hash->context, key);
+}
+
+
+/**
+ * librdf_hash_put_prepared:
+ * @hash: hash object
+ * @key: key prepared with librdf_hash_prepare_key()
+ * @value: value
+ *
+ * Insert a key/value pair into the hash as librdf_hash_put() does,
+ * using the hash saved in @key.
+ * 
+ * Return value: non 0 on failure
+ **/
+int
+librdf_hash_put_prepared(librdf_hash* hash, librdf_hash_datum *key, 
+                         librdf_hash_datum *value)
+{
+  if(hash->factory->put_prepared)
+    return hash->factory->put_prepared(hash->context, key, value);
+
+  return hash->factory->put(hash->context, key, value);
+}
+
+
+/**
+ * librdf_hash_exists_prepared:
+ * @hash: hash object
+ * @key: key prepared with librdf_hash_prepare_key()
+ * @value: value
+ *
+ * Check if a given key/value is in the hash as librdf_hash_exists()
+ * does, using the hash saved in @key.
+ * 
+ * Return value: >0 if the key/value exists in the hash, 0 if not, <0 on failure
+ **/
+int
+librdf_hash_exists_prepared(librdf_hash* hash, librdf_hash_datum *key,
+                            librdf_hash_datum *value)
+{
+  if(hash->factory->exists_prepared)
+    return hash->factory->exists_prepared(hash->context, key, value);
+
+  return hash->factory->exists(hash->context, key, value);
+}
+
+
+/**
+ * librdf_hash_delete_prepared:
+ * @hash: hash object
+ * @key: key prepared with librdf_hash_prepare_key()
+ * @value: value
+ *
+ * Delete a key/value pair from the hash as librdf_hash_delete() does,
+ * using the hash saved in @key.
+ * 
+ * Return value: non 0 on failure (including pair not present)
+ **/
+int
+librdf_hash_delete_prepared(librdf_hash* hash, librdf_hash_datum *key,
+                            librdf_hash_datum *value)
+{
+  if(hash->factory->delete_prepared)
+    return hash->factory->delete_prepared(hash->context, key, value);
+
+  return hash->factory->delete_key_value(hash->context, key, value);
+}
+
+
+/**
+ * librdf_hash_get_option:
+ * @hash: hash object
+ * @name: option name
+ *
+ * Get the value of a hash implementation option or statistic.
+ * 
+ * The names available depend on the hash type.  The value returned
+ * is from newly allocated memory which the caller must free.
+ * 
+ * Return value: the value or NULL if @name is not known
+ **/
+char*
+librdf_hash_get_option(librdf_hash* hash, const char *name)
+{
+  if(!hash->factory->get_option)
+    return NULL;
+
+  return hash->factory->get_option(hash->context, name);
+}
+
+
 typedef struct {
   librdf_hash* hash;
   librdf_hash_cursor* cursor;
@@ -1871,12 +2364,22 @@ librdf_hash_interpret_template(const unsigned char* template_string,
 /* one more prototype */
 int main(int argc, char *argv[]);
 
+/* number of keys/values in the put_many/delete_many test */
+#define TEST_BATCH_COUNT 100
+
+/* number of keys in the cursor walk test and of keys added during it */
+#define TEST_CURSOR_KEYS_COUNT 100
+#define TEST_CURSOR_ADD_COUNT 150
+
+/* size of the long key and value, more than LMDB stores inline */
+#define TEST_LONG_SIZE 1000
+
 
 int
 main(int argc, char *argv[]) 
 {
   librdf_hash *h, *h2, *ch;
-  const char *test_hash_types[]={"bdb", "memory", NULL};
+  const char *test_hash_types[]={"bdb", "lmdb", "memory", NULL};
   const char *test_hash_values[]={"colour","yellow", /* Made in UK, can you guess? */
 			    "age", "new",
 			    "size", "large",
@@ -1894,6 +2397,12 @@ main(int argc, char *argv[])
                                  NULL};
   const char * const test_hash_string="field1='value1', field2='\\'value2', field3='\\\\', field4='\\\\\\'', field5 = 'a' ";
   const char *test_hash_delete_key="size";
+  const int test_many_keys_count=1000;
+  char batch_key_buffers[TEST_BATCH_COUNT][32];
+  char long_key[TEST_LONG_SIZE];
+  char long_value[TEST_LONG_SIZE];
+  librdf_hash_datum batch_keys[TEST_BATCH_COUNT];
+  librdf_hash_datum batch_values[TEST_BATCH_COUNT];
   const unsigned char* template_string=(const unsigned char*)"the shape is %{shape} and the sides are %{sides} created by %{rubik}";
   const unsigned char* template_expected=(const unsigned char*)"the shape is cube and the sides are 6 created by ";
   const char * filter_string[] = {"field1", NULL};
@@ -1904,6 +2413,7 @@ main(int argc, char *argv[])
   int b;
   long l;
   char* string_result;
+  char* string_result2;
   unsigned char* template_result;
   librdf_world *world;
   
@@ -1993,11 +2503,426 @@ main(int argc, char *argv[])
       fprintf(stderr, "%s: Failed to clone %s hash\n", program, type);
     }
 
+    /* enough keys to make the hash grow several times */
+    fprintf(stdout, "%s: Adding %d keys with 2 values each\n", program,
+            test_many_keys_count);
+    b=librdf_hash_values_count(h);
+    for(j=0; j < test_many_keys_count * 2; j++) {
+      char key_buffer[32];
+
+      sprintf(key_buffer, "key%d", j / 2);
+      hd_key.data=key_buffer;
+      hd_key.size=strlen(key_buffer);
+      hd_value.data=(char*)((j & 1) ? "odd" : "even");
+      hd_value.size=strlen((char*)hd_value.data);
+      if(librdf_hash_put(h, &hd_key, &hd_value)) {
+        fprintf(stderr, "%s: Failed to add key %s\n", program, key_buffer);
+        return(1);
+      }
+    }
+
+    /* delete one value from even keys and the whole key for odd keys */
+    for(j=0; j < test_many_keys_count; j++) {
+      char key_buffer[32];
+
+      sprintf(key_buffer, "key%d", j);
+      hd_key.data=key_buffer;
+      hd_key.size=strlen(key_buffer);
+      hd_value.data=(char*)"odd";
+      hd_value.size=3;
+      if((j & 1) ? librdf_hash_delete_all(h, &hd_key) :
+                   librdf_hash_delete(h, &hd_key, &hd_value)) {
+        fprintf(stderr, "%s: Failed to delete key %s\n", program,
+                key_buffer);
+        return(1);
+      }
+    }
+
+    for(j=0; j < test_many_keys_count; j++) {
+      char key_buffer[32];
+
+      sprintf(key_buffer, "key%d", j);
+      hd_key.data=key_buffer;
+      hd_key.size=strlen(key_buffer);
+      hd_value.data=(char*)"even";
+      hd_value.size=4;
+      if((librdf_hash_exists(h, &hd_key, &hd_value) > 0) != !(j & 1)) {
+        fprintf(stderr, "%s: Key %s has wrong existence after deletes\n",
+                program, key_buffer);
+        return(1);
+      }
+    }
+
+    if(librdf_hash_values_count(h) >= 0 &&
+       librdf_hash_values_count(h) != b + test_many_keys_count / 2) {
+      fprintf(stderr, "%s: Got values count %d expected %d\n", program,
+              librdf_hash_values_count(h), b + test_many_keys_count / 2);
+      return(1);
+    }
+
+    /* the hash saved in a prepared key is only used by the prepared
+     * operations, so one left stale by changing the key is ignored by
+     * the others
+     */
+    hd_key.data=(char*)"key0";
+    hd_key.size=4;
+    hd_value.data=(char*)"even";
+    hd_value.size=4;
+    librdf_hash_prepare_key(h, &hd_key);
+    hd_key.data=(char*)"key2";
+    if(librdf_hash_exists(h, &hd_key, &hd_value) <= 0) {
+      fprintf(stderr, "%s: Key with a stale prepared hash not found\n",
+              program);
+      return(1);
+    }
+    librdf_hash_prepare_key(h, &hd_key);
+    hd_value.data=(char*)"prepared";
+    hd_value.size=8;
+    if(librdf_hash_put_prepared(h, &hd_key, &hd_value) ||
+       librdf_hash_exists_prepared(h, &hd_key, &hd_value) <= 0 ||
+       librdf_hash_exists(h, &hd_key, &hd_value) <= 0 ||
+       librdf_hash_delete_prepared(h, &hd_key, &hd_value) ||
+       librdf_hash_exists_prepared(h, &hd_key, &hd_value)) {
+      fprintf(stderr, "%s: Prepared key operations failed\n", program);
+      return(1);
+    }
+
+    /* add and remove a value of every other key together */
+    fprintf(stdout, "%s: Adding and deleting %d values in a batch\n",
+            program, TEST_BATCH_COUNT);
+    for(j=0; j < TEST_BATCH_COUNT; j++) {
+      sprintf(batch_key_buffers[j], "key%d", j * 2);
+      batch_keys[j].data=batch_key_buffers[j];
+      batch_keys[j].size=strlen(batch_key_buffers[j]);
+      batch_values[j].data=(char*)"batch";
+      batch_values[j].size=5;
+    }
+    if(librdf_hash_put_many(h, batch_keys, batch_values, TEST_BATCH_COUNT)) {
+      fprintf(stderr, "%s: Failed to add a batch\n", program);
+      return(1);
+    }
+    for(j=0; j < TEST_BATCH_COUNT; j++) {
+      if(librdf_hash_exists(h, &batch_keys[j], &batch_values[j]) <= 0) {
+        fprintf(stderr, "%s: Key %s batch value not found\n", program,
+                batch_key_buffers[j]);
+        return(1);
+      }
+    }
+    for(j=0; j < TEST_BATCH_COUNT; j++) {
+      int count=librdf_hash_key_values_count(h, &batch_keys[j]);
+
+      if(count != 2) {
+        fprintf(stderr, "%s: Key %s has %d values expected 2\n", program,
+                batch_key_buffers[j], count);
+        return(1);
+      }
+    }
+    if(librdf_hash_delete_many(h, batch_keys, batch_values, TEST_BATCH_COUNT)) {
+      fprintf(stderr, "%s: Failed to delete a batch\n", program);
+      return(1);
+    }
+    for(j=0; j < TEST_BATCH_COUNT; j++) {
+      if(librdf_hash_exists(h, &batch_keys[j], &batch_values[j]) > 0) {
+        fprintf(stderr, "%s: Key %s batch value found after delete\n",
+                program, batch_key_buffers[j]);
+        return(1);
+      }
+    }
+
+    /* only the first of two puts of the same pair is inserted */
+    for(j=0; j < TEST_BATCH_COUNT; j++) {
+      if(librdf_hash_put_if_absent(h, &batch_keys[j], &batch_values[j]) ||
+         librdf_hash_put_if_absent(h, &batch_keys[j], &batch_values[j]) <= 0) {
+        fprintf(stderr, "%s: Key %s put if absent failed\n", program,
+                batch_key_buffers[j]);
+        return(1);
+      }
+    }
+    if(librdf_hash_delete_many(h, batch_keys, batch_values, TEST_BATCH_COUNT)) {
+      fprintf(stderr, "%s: Failed to delete a batch\n", program);
+      return(1);
+    }
+
+    /* keys and values longer than some hashes store inline, and a
+     * one byte value
+     */
+    fprintf(stdout, "%s: Adding long keys and values\n", program);
+    b=librdf_hash_values_count(h);
+    for(j=0; j < TEST_LONG_SIZE; j++) {
+      long_key[j]=(char)('a' + j % 26);
+      long_value[j]=(char)('A' + j % 26);
+    }
+    {
+      librdf_hash_datum *lkey, *lvalue;
+      librdf_hash_datum short_key, byte_key, byte_value;
+      librdf_hash_datum *pairs[4][2];
+      librdf_hash_cursor* cursor;
+
+      lkey=librdf_new_hash_datum(world, long_key, TEST_LONG_SIZE);
+      lvalue=librdf_new_hash_datum(world, long_value, TEST_LONG_SIZE);
+      short_key.data=(char*)"short";
+      short_key.size=5;
+      byte_key.data=(char*)"byte";
+      byte_key.size=4;
+      byte_value.data=(char*)"\xff";
+      byte_value.size=1;
+      pairs[0][0]=&short_key; pairs[0][1]=lvalue;
+      pairs[1][0]=lkey;       pairs[1][1]=&short_key;
+      pairs[2][0]=lkey;       pairs[2][1]=lvalue;
+      pairs[3][0]=&byte_key;  pairs[3][1]=&byte_value;
+
+      for(j=0; j < 4; j++) {
+        if(librdf_hash_put(h, pairs[j][0], pairs[j][1]) ||
+           librdf_hash_put_if_absent(h, pairs[j][0], pairs[j][1]) <= 0 ||
+           librdf_hash_exists(h, pairs[j][0], pairs[j][1]) <= 0) {
+          fprintf(stderr, "%s: Failed to add long pair %d\n", program, j);
+          return(1);
+        }
+      }
+      if(librdf_hash_values_count(h) >= 0 &&
+         librdf_hash_values_count(h) != b + 4) {
+        fprintf(stderr, "%s: Got values count %d expected %d\n", program,
+                librdf_hash_values_count(h), b + 4);
+        return(1);
+      }
+      if(librdf_hash_key_values_count(h, lkey) != 2) {
+        fprintf(stderr, "%s: Long key has %d values expected 2\n", program,
+                librdf_hash_key_values_count(h, lkey));
+        return(1);
+      }
+
+      cursor=librdf_new_hash_cursor(h);
+      hd_key=*lkey;
+      if(!cursor || librdf_hash_cursor_set(cursor, &hd_key, &hd_value) ||
+         hd_key.size != TEST_LONG_SIZE ||
+         memcmp(hd_key.data, long_key, TEST_LONG_SIZE)) {
+        fprintf(stderr, "%s: Long key read back wrongly\n", program);
+        return(1);
+      }
+      librdf_free_hash_cursor(cursor);
+      cursor=librdf_new_hash_cursor(h);
+      hd_key=short_key;
+      if(!cursor || librdf_hash_cursor_set(cursor, &hd_key, &hd_value) ||
+         hd_value.size != TEST_LONG_SIZE ||
+         memcmp(hd_value.data, long_value, TEST_LONG_SIZE)) {
+        fprintf(stderr, "%s: Long value read back wrongly\n", program);
+        return(1);
+      }
+      librdf_free_hash_cursor(cursor);
+
+      if(librdf_hash_delete(h, lkey, lvalue) ||
+         librdf_hash_exists(h, lkey, lvalue) ||
+         librdf_hash_exists(h, lkey, NULL) <= 0 ||
+         librdf_hash_delete_all(h, lkey) ||
+         librdf_hash_exists(h, lkey, NULL) ||
+         librdf_hash_delete(h, &short_key, lvalue) ||
+         librdf_hash_delete(h, &byte_key, &byte_value) ||
+         librdf_hash_exists(h, &byte_key, &byte_value)) {
+        fprintf(stderr, "%s: Failed to delete long pairs\n", program);
+        return(1);
+      }
+      if(librdf_hash_values_count(h) >= 0 &&
+         librdf_hash_values_count(h) != b) {
+        fprintf(stderr, "%s: Got values count %d expected %d\n", program,
+                librdf_hash_values_count(h), b);
+        return(1);
+      }
+
+      lkey->data=NULL;
+      lvalue->data=NULL;
+      librdf_free_hash_datum(lkey);
+      librdf_free_hash_datum(lvalue);
+    }
+
+    /* changes to a file hash are seen at once by another handle on
+     * it, which can also make changes while the first stays open
+     */
+    if(!strcmp(type, "lmdb")) {
+      h2=librdf_new_hash(world, type);
+      if(!h2 || librdf_hash_open(h2, "test", 0644, 1, 0, NULL)) {
+        fprintf(stderr, "%s: Failed to open %s hash again\n", program, type);
+        return(1);
+      }
+      hd_key.data=(char*)"shared";
+      hd_key.size=6;
+      hd_value.data=(char*)"yes";
+      hd_value.size=3;
+      if(librdf_hash_put(h, &hd_key, &hd_value) ||
+         librdf_hash_exists(h2, &hd_key, &hd_value) <= 0 ||
+         librdf_hash_delete_all(h2, &hd_key) ||
+         librdf_hash_exists(h, &hd_key, NULL)) {
+        fprintf(stderr, "%s: Changes not shared between %s hash handles\n",
+                program, type);
+        return(1);
+      }
+      librdf_hash_close(h2);
+      librdf_free_hash(h2);
+    }
+
+    /* hashes keeping allocation statistics should have none wasted
+     * after a sync
+     */
+    string_result=librdf_hash_get_option(h, "arena-bytes-wasted");
+    if(string_result) {
+      fprintf(stdout, "%s: %s bytes wasted after deletes\n", program,
+              string_result);
+      LIBRDF_FREE(char*, string_result);
+
+      librdf_hash_sync(h);
+      string_result=librdf_hash_get_option(h, "arena-bytes-wasted");
+      if(!string_result || strcmp(string_result, "0")) {
+        fprintf(stderr, "%s: Got %s bytes wasted after sync, expected 0\n",
+                program, string_result ? string_result : "NULL");
+        return(1);
+      }
+      LIBRDF_FREE(char*, string_result);
+    }
+
     librdf_hash_close(h);
       
     fprintf(stdout, "%s: Freeing hash\n", program);
     librdf_free_hash(h);
   }
+
+
+  /* a memory hash sized up front should not need to grow */
+  fprintf(stdout, "%s: Opening memory hash with expected size %d\n", program,
+          test_many_keys_count);
+  h=librdf_new_hash(world, "memory");
+  h2=librdf_new_hash_from_string(world, NULL, "expected-size='1000'");
+  if(!h || !h2 || librdf_hash_open(h, "test", 0644, 1, 1, h2)) {
+    fprintf(stderr, "%s: Failed to open memory hash with expected size\n",
+            program);
+    return(1);
+  }
+  librdf_free_hash(h2);
+
+  string_result=librdf_hash_get_option(h, "table-capacity");
+  for(j=0; j < test_many_keys_count; j++) {
+    char key_buffer[32];
+
+    sprintf(key_buffer, "key%d", j);
+    hd_key.data=key_buffer;
+    hd_key.size=strlen(key_buffer);
+    hd_value.data=key_buffer;
+    hd_value.size=hd_key.size;
+    librdf_hash_put(h, &hd_key, &hd_value);
+  }
+  string_result2=librdf_hash_get_option(h, "table-capacity");
+  if(!string_result || !string_result2 ||
+     strcmp(string_result, string_result2)) {
+    fprintf(stderr, "%s: Table capacity changed from %s to %s\n", program,
+            string_result ? string_result : "NULL",
+            string_result2 ? string_result2 : "NULL");
+    return(1);
+  }
+  LIBRDF_FREE(char*, string_result);
+  LIBRDF_FREE(char*, string_result2);
+
+  if(librdf_hash_values_count(h) != test_many_keys_count) {
+    fprintf(stderr, "%s: Got values count %d expected %d\n", program,
+            librdf_hash_values_count(h), test_many_keys_count);
+    return(1);
+  }
+
+  librdf_hash_close(h);
+  librdf_free_hash(h);
+
+
+  /* keys added while a cursor is open must not make the memory hash
+   * move the keys the cursor has still to visit
+   */
+  fprintf(stdout, "%s: Adding %d keys to a memory hash during a cursor walk\n",
+          program, TEST_CURSOR_ADD_COUNT);
+  h=librdf_new_hash(world, "memory");
+  if(!h || librdf_hash_open(h, "test", 0644, 1, 1, NULL)) {
+    fprintf(stderr, "%s: Failed to open memory hash\n", program);
+    return(1);
+  }
+  for(j=0; j < TEST_CURSOR_KEYS_COUNT; j++) {
+    char key_buffer[32];
+
+    sprintf(key_buffer, "key%d", j);
+    hd_key.data=key_buffer;
+    hd_key.size=strlen(key_buffer);
+    hd_value.data=key_buffer;
+    hd_value.size=hd_key.size;
+    librdf_hash_put(h, &hd_key, &hd_value);
+  }
+  {
+    librdf_hash_cursor* cursor;
+    int seen[TEST_CURSOR_KEYS_COUNT];
+    int added=0;
+    int status;
+    int k;
+
+    memset(seen, 0, sizeof(seen));
+    cursor=librdf_new_hash_cursor(h);
+    if(!cursor) {
+      fprintf(stderr, "%s: Failed to create memory hash cursor\n", program);
+      return(1);
+    }
+    hd_key.data=NULL;
+    for(status=librdf_hash_cursor_get_first(cursor, &hd_key, &hd_value);
+        !status;
+        hd_key.data=NULL,
+          status=librdf_hash_cursor_get_next(cursor, &hd_key, &hd_value)) {
+      char key_buffer[32];
+
+      if(hd_key.size > 3 && hd_key.size < sizeof(key_buffer) &&
+         !memcmp(hd_key.data, "key", 3)) {
+        memcpy(key_buffer, hd_key.data, hd_key.size);
+        key_buffer[hd_key.size]='\0';
+        seen[atoi(key_buffer + 3)]++;
+      }
+
+      for(k=0; k < 2 && added < TEST_CURSOR_ADD_COUNT; k++, added++) {
+        sprintf(key_buffer, "new%d", added);
+        hd_key.data=key_buffer;
+        hd_key.size=strlen(key_buffer);
+        hd_value.data=key_buffer;
+        hd_value.size=hd_key.size;
+        librdf_hash_put(h, &hd_key, &hd_value);
+      }
+    }
+    librdf_free_hash_cursor(cursor);
+
+    for(j=0; j < TEST_CURSOR_KEYS_COUNT; j++) {
+      if(seen[j] != 1) {
+        fprintf(stderr, "%s: Cursor saw key%d %d times, expected once\n",
+                program, j, seen[j]);
+        return(1);
+      }
+    }
+  }
+
+  /* the hash grows again once the cursor is gone */
+  hd_key.data=(char*)"last";
+  hd_key.size=4;
+  librdf_hash_put(h, &hd_key, &hd_key);
+  if(librdf_hash_values_count(h) != TEST_CURSOR_KEYS_COUNT + TEST_CURSOR_ADD_COUNT + 1) {
+    fprintf(stderr, "%s: Got values count %d expected %d\n", program,
+            librdf_hash_values_count(h),
+            TEST_CURSOR_KEYS_COUNT + TEST_CURSOR_ADD_COUNT + 1);
+    return(1);
+  }
+  for(j=0; j < TEST_CURSOR_ADD_COUNT; j++) {
+    char key_buffer[32];
+
+    sprintf(key_buffer, "new%d", j);
+    hd_key.data=key_buffer;
+    hd_key.size=strlen(key_buffer);
+    if(librdf_hash_exists(h, &hd_key, NULL) <= 0) {
+      fprintf(stderr, "%s: Key %s added during the cursor walk is missing\n",
+              program, key_buffer);
+      return(1);
+    }
+  }
+
+  librdf_hash_close(h);
+  librdf_free_hash(h);
+
+
   fprintf(stdout, "%s: Getting default hash factory\n", program);
   h2=librdf_new_hash(world, NULL);
   if(!h2) {
@@ -2136,6 +3061,98 @@ main(int argc, char *argv[])
 
   librdf_free_hash(h2);
 
+
+  /* micro-benchmark of the key hash functions on sp2o index keys */
+  {
+    const char *bench_function_names[] = { "one-at-a-time", "wyhash", NULL };
+    const char *bench_predicates[] = {
+      "http://www.w3.org/1999/02/22-rdf-syntax-ns#type",
+      "http://purl.org/dc/elements/1.1/title",
+      "http://xmlns.com/foaf/0.1/name",
+      "http://www.w3.org/2000/01/rdf-schema#label",
+      NULL
+    };
+    const int bench_keys_count=10000;
+    const int bench_rounds=100;
+    librdf_statement_part bench_fields;
+    unsigned char **bench_keys;
+    size_t *bench_key_lens;
+    size_t bench_bytes=0;
+
+    bench_fields=(librdf_statement_part)(LIBRDF_STATEMENT_SUBJECT | LIBRDF_STATEMENT_PREDICATE);
+    bench_keys = LIBRDF_CALLOC(unsigned char**, LIBRDF_GOOD_CAST(size_t, bench_keys_count),
+                               sizeof(unsigned char*));
+    bench_key_lens = LIBRDF_CALLOC(size_t*, LIBRDF_GOOD_CAST(size_t, bench_keys_count),
+                                   sizeof(size_t));
+    if(!bench_keys || !bench_key_lens) {
+      fprintf(stderr, "%s: Failed to allocate benchmark keys\n", program);
+      return(1);
+    }
+
+    for(j=0; j < bench_keys_count; j++) {
+      char uri_string[64];
+      librdf_statement* statement;
+
+      sprintf(uri_string, "http://example.org/resource/%d", j);
+      statement=librdf_new_statement_from_nodes(world,
+        librdf_new_node_from_uri_string(world, (const unsigned char*)uri_string),
+        librdf_new_node_from_uri_string(world, (const unsigned char*)bench_predicates[j % 4]),
+        NULL);
+      if(!statement) {
+        fprintf(stderr, "%s: Failed to create benchmark statement\n", program);
+        return(1);
+      }
+
+      bench_key_lens[j]=librdf_statement_encode_parts2(world, statement, NULL,
+                                                       NULL, 0, bench_fields);
+      bench_keys[j] = LIBRDF_MALLOC(unsigned char*, bench_key_lens[j]);
+      if(!bench_keys[j] ||
+         !librdf_statement_encode_parts2(world, statement, NULL, bench_keys[j],
+                                         bench_key_lens[j], bench_fields)) {
+        fprintf(stderr, "%s: Failed to encode benchmark statement\n", program);
+        return(1);
+      }
+      bench_bytes += bench_key_lens[j];
+      librdf_free_statement(statement);
+    }
+
+    fprintf(stdout, "%s: Benchmarking key hash functions on %d keys of %d bytes average\n",
+            program, bench_keys_count, (int)(bench_bytes / bench_keys_count));
+
+    for(i=0; bench_function_names[i]; i++) {
+      librdf_hash_function hash_function;
+      u64 hash_sum=0;
+      clock_t start;
+      double seconds;
+      int round;
+
+      hash_function=librdf_get_hash_function(bench_function_names[i]);
+      if(!hash_function) {
+        fprintf(stderr, "%s: Failed to get hash function %s\n", program,
+                bench_function_names[i]);
+        return(1);
+      }
+
+      start=clock();
+      for(round=0; round < bench_rounds; round++) {
+        for(j=0; j < bench_keys_count; j++)
+          hash_sum += hash_function(bench_keys[j], bench_key_lens[j],
+                                    (u64)round);
+      }
+      seconds=(double)(clock() - start) / CLOCKS_PER_SEC;
+
+      fprintf(stdout, "%s: hash function %s took %.1f ns per key (checksum %08lx)\n",
+              program, bench_function_names[i],
+              seconds * 1e9 / ((double)bench_rounds * bench_keys_count),
+              (unsigned long)(hash_sum & 0xffffffffUL));
+    }
+
+    for(j=0; j < bench_keys_count; j++)
+      LIBRDF_FREE(char*, bench_keys[j]);
+    LIBRDF_FREE(char*, bench_keys);
+    LIBRDF_FREE(char*, bench_key_lens);
+  }
+
    
   librdf_free_world(world);
   
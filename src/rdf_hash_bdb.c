@@ -42,6 +42,13 @@
 #endif
 
 
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
 #ifdef HAVE_DB_H
 #include <db.h>
 #endif
@@ -50,15 +57,49 @@
 #include <rdf_hash.h>
 
 
+#if defined(HAVE_DB_CREATE) && defined(HAVE_BDB_OPEN_7_ARGS)
+/* BDB V4.1+ has the environment and transaction methods used */
+#define LIBRDF_HASH_BDB_ENV 1
+#endif
+
+#if defined(HAVE_BDB_DB_TXN) && defined(DB_MULTIPLE_KEY) && defined(DB_DBT_BULK) && defined(DB_MULTIPLE_KEY_WRITE_NEXT)
+/* BDB V4.8+ can put and delete many key/value pairs in one call */
+#define LIBRDF_HASH_BDB_BULK 1
+#endif
+
+
+#ifdef LIBRDF_HASH_BDB_ENV
+/* A BDB environment shared by all bdb hashes in a world opened with
+ * the same home directory, so that they use one cache
+ */
+typedef struct librdf_hash_bdb_env_s
+{
+  struct librdf_hash_bdb_env_s* next;
+  char* home;
+  DB_ENV* env;
+  int is_txn;
+  int usage;
+} librdf_hash_bdb_env;
+#endif
+
+
 typedef struct 
 {
   librdf_hash *hash;
   int mode;
   int is_writable;
   int is_new;
+  /* environment options, kept for clone */
+  char* env_home;
+  u64 cache_size;
+  unsigned long page_size;
+  int is_txn;
   /* for BerkeleyDB only */
   DB* db;
   char* file_name;
+#ifdef LIBRDF_HASH_BDB_ENV
+  librdf_hash_bdb_env* env;
+#endif
 } librdf_hash_bdb_context;
 
 
@@ -81,10 +122,249 @@ static int librdf_hash_bdb_delete_key(void* context, librdf_hash_datum *key);
 static int librdf_hash_bdb_delete_key_value(void* context, librdf_hash_datum *key, librdf_hash_datum *value);
 static int librdf_hash_bdb_sync(void* context);
 static int librdf_hash_bdb_get_fd(void* context);
+#ifdef LIBRDF_HASH_BDB_ENV
+static int librdf_hash_bdb_key_values_count(void* context, librdf_hash_datum *key);
+#endif
+#ifdef LIBRDF_HASH_BDB_BULK
+static int librdf_hash_bdb_put_many(void* context, librdf_hash_datum *keys, librdf_hash_datum *values, int count);
+static int librdf_hash_bdb_delete_many(void* context, librdf_hash_datum *keys, librdf_hash_datum *values, int count);
+#endif
 
 static void librdf_hash_bdb_register_factory(librdf_hash_factory *factory);
 
 
+/* environment helpers */
+
+/*
+ * librdf_hash_bdb_get_size:
+ * @options: hash options
+ * @name: option name
+ *
+ * INTERNAL - Get a size option in bytes with an optional K, M or G suffix
+ *
+ * Return value: the size or 0 if the option is missing or not a size
+ */
+static u64
+librdf_hash_bdb_get_size(librdf_hash* options, const char *name)
+{
+  char *string;
+  char *end;
+  u64 size;
+
+  string=librdf_hash_get(options, name);
+  if(!string)
+    return 0;
+
+  size=(u64)strtoul(string, &end, 10);
+  switch(*end) {
+    case 'G': case 'g':
+      size <<= 10;
+      /* FALLTHROUGH */
+    case 'M': case 'm':
+      size <<= 10;
+      /* FALLTHROUGH */
+    case 'K': case 'k':
+      size <<= 10;
+      end++;
+      break;
+    default:
+      break;
+  }
+  if(*end || end == string)
+    size=0;
+
+  LIBRDF_FREE(char*, string);
+  return size;
+}
+
+
+#ifdef LIBRDF_HASH_BDB_ENV
+/*
+ * librdf_hash_bdb_get_env:
+ * @bdb_context: BerkeleyDB hash context
+ *
+ * INTERNAL - Find or open the environment for the hash's home directory
+ *
+ * The first hash to open an environment sets its cache size and
+ * whether it is transactional.
+ *
+ * Return value: shared environment or NULL on failure
+ */
+static librdf_hash_bdb_env*
+librdf_hash_bdb_get_env(librdf_hash_bdb_context* bdb_context)
+{
+  librdf_world *world=bdb_context->hash->world;
+  librdf_hash_bdb_env* henv;
+  DB_ENV* env=NULL;
+  u_int32_t flags;
+  int ret;
+
+  for(henv=(librdf_hash_bdb_env*)world->hash_bdb_envs; henv;
+      henv=henv->next) {
+    if(!strcmp(henv->home, bdb_context->env_home)) {
+      henv->usage++;
+      return henv;
+    }
+  }
+
+  henv=LIBRDF_CALLOC(librdf_hash_bdb_env*, 1, sizeof(*henv));
+  if(!henv)
+    return NULL;
+  henv->home=LIBRDF_MALLOC(char*, strlen(bdb_context->env_home) + 1);
+  if(!henv->home) {
+    LIBRDF_FREE(librdf_hash_bdb_env*, henv);
+    return NULL;
+  }
+  strcpy(henv->home, bdb_context->env_home);
+
+  ret=db_env_create(&env, 0);
+  if(!ret && bdb_context->cache_size)
+    /* one cache region of gigabytes + bytes */
+    ret=env->set_cachesize(env,
+                           (u_int32_t)(bdb_context->cache_size >> 30),
+                           (u_int32_t)(bdb_context->cache_size & ((1UL << 30) - 1)),
+                           1);
+  if(!ret) {
+    flags = DB_CREATE | DB_INIT_MPOOL;
+    if(bdb_context->is_txn)
+      flags |= DB_INIT_TXN | DB_INIT_LOG | DB_INIT_LOCK | DB_RECOVER;
+    ret=env->open(env, henv->home, flags, bdb_context->mode);
+  }
+  if(ret) {
+    librdf_log(world, 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+               "BDB environment open in '%s' failed - %s", henv->home,
+               db_strerror(ret));
+    if(env)
+      env->close(env, 0);
+    LIBRDF_FREE(char*, henv->home);
+    LIBRDF_FREE(librdf_hash_bdb_env*, henv);
+    return NULL;
+  }
+
+  henv->env=env;
+  henv->is_txn=bdb_context->is_txn;
+  henv->usage=1;
+  henv->next=(librdf_hash_bdb_env*)world->hash_bdb_envs;
+  world->hash_bdb_envs=henv;
+
+  return henv;
+}
+
+
+/*
+ * librdf_hash_bdb_absolute_file:
+ * @file: file name
+ *
+ * INTERNAL - Make a file name absolute so that BDB does not look for
+ * it in the environment home directory
+ *
+ * Return value: new file name or NULL on failure
+ */
+static char*
+librdf_hash_bdb_absolute_file(const char *file)
+{
+  char *cwd=NULL;
+  char *result;
+  size_t len=256;
+
+  /* FIXME: Implies Unix filenames */
+  if(*file == '/') {
+    result=LIBRDF_MALLOC(char*, strlen(file) + 1);
+    if(result)
+      strcpy(result, file);
+    return result;
+  }
+
+  while(1) {
+    cwd=LIBRDF_MALLOC(char*, len);
+    if(!cwd)
+      return NULL;
+    if(getcwd(cwd, len))
+      break;
+    LIBRDF_FREE(char*, cwd);
+    if(errno != ERANGE)
+      return NULL;
+    len <<= 1;
+  }
+
+  result=LIBRDF_MALLOC(char*, strlen(cwd) + 1 + strlen(file) + 1);
+  if(result)
+    sprintf(result, "%s/%s", cwd, file);
+  LIBRDF_FREE(char*, cwd);
+  return result;
+}
+
+
+/*
+ * librdf_hash_bdb_real_path:
+ * @path: directory name
+ *
+ * INTERNAL - Get the canonical name of a directory, so that hashes
+ * naming one environment home in different ways share it
+ *
+ * Falls back to the absolute name if it cannot be resolved.
+ *
+ * Return value: new directory name or NULL on failure
+ */
+static char*
+librdf_hash_bdb_real_path(const char *path)
+{
+#ifdef HAVE_REALPATH
+  char *real;
+  char *result;
+
+  real=realpath(path, NULL);
+  if(real) {
+    /* allocated by the C library, so copied */
+    result=LIBRDF_MALLOC(char*, strlen(real) + 1);
+    if(result)
+      strcpy(result, real);
+    free(real);
+    return result;
+  }
+#endif
+
+  return librdf_hash_bdb_absolute_file(path);
+}
+#endif
+
+
+/*
+ * librdf_hash_bdb_release_env:
+ * @bdb_context: BerkeleyDB hash context
+ *
+ * INTERNAL - Stop using the shared environment, closing it when no
+ * other hash uses it
+ */
+static void
+librdf_hash_bdb_release_env(librdf_hash_bdb_context* bdb_context)
+{
+#ifdef LIBRDF_HASH_BDB_ENV
+  librdf_world *world=bdb_context->hash->world;
+  librdf_hash_bdb_env *henv=bdb_context->env;
+  librdf_hash_bdb_env *h, *prev=NULL;
+
+  if(!henv)
+    return;
+  bdb_context->env=NULL;
+
+  if(--henv->usage)
+    return;
+
+  for(h=(librdf_hash_bdb_env*)world->hash_bdb_envs; h != henv; h=h->next)
+    prev=h;
+  if(prev)
+    prev->next=henv->next;
+  else
+    world->hash_bdb_envs=henv->next;
+
+  henv->env->close(henv->env, 0);
+  LIBRDF_FREE(char*, henv->home);
+  LIBRDF_FREE(librdf_hash_bdb_env*, henv);
+#endif
+}
+
+
 /* functions implementing hash api */
 
 /**
@@ -117,7 +397,10 @@ librdf_hash_bdb_create(librdf_hash* hash, void* context)
 static int
 librdf_hash_bdb_destroy(void* context) 
 {
-  /* NOP */
+  librdf_hash_bdb_context* bdb_context=(librdf_hash_bdb_context*)context;
+
+  if(bdb_context->env_home)
+    LIBRDF_FREE(char*, bdb_context->env_home);
   return 0;
 }
 
@@ -129,10 +412,21 @@ librdf_hash_bdb_destroy(void* context)
  * @mode: file creation mode
  * @is_writable: is hash writable?
  * @is_new: is hash new?
- * @options: hash options (currently unused)
+ * @options: hash options
  *
  * Open and maybe create a BerkeleyDB hash.
  * 
+ * Options used:
+ *   bdb-page-size - page size in bytes, a power of 2 from 512 to 64K
+ *   bdb-cache-size - cache size in bytes
+ *   bdb-env-dir - home directory of the BDB environment
+ *   bdb-txn - boolean; use transactions and logging for recovery
+ * 
+ * Sizes may end in K, M or G.  Any of the last three opens the
+ * hash in a BDB environment (BDB V4.1+) in bdb-env-dir, by default
+ * the directory of the hash file.  All bdb hashes in a world with
+ * the same environment home share it and its cache.
+ * 
  * Return value: non 0 on failure.
  **/
 static int
@@ -143,8 +437,12 @@ librdf_hash_bdb_open(void* context, const char *identifier,
   librdf_hash_bdb_context* bdb_context=(librdf_hash_bdb_context*)context;
   DB* bdb;
   char *file;
+  char *open_file;
   int ret;
   u_int32_t flags = 0;
+#ifdef HAVE_DB_CREATE
+  DB_ENV* env = NULL;
+#endif
 
   LIBRDF_ASSERT_OBJECT_POINTER_RETURN_VALUE(identifier, cstring, 1);
   
@@ -152,35 +450,98 @@ librdf_hash_bdb_open(void* context, const char *identifier,
   DB_INFO bdb_info;
 #endif
   
-  /* NOTE: If the options parameter is ever used here, the data must be
-   * copied into a private part of the context so that the clone
-   * method can access them
+  /* options are copied into the context so that the clone method
+   * can use them
    */
   bdb_context->mode=mode;
   bdb_context->is_writable=is_writable;
   bdb_context->is_new=is_new;
+  if(options) {
+    if(bdb_context->env_home)
+      LIBRDF_FREE(char*, bdb_context->env_home);
+    bdb_context->env_home=librdf_hash_get(options, "bdb-env-dir");
+    bdb_context->cache_size=librdf_hash_bdb_get_size(options, "bdb-cache-size");
+    bdb_context->page_size=(unsigned long)librdf_hash_bdb_get_size(options, "bdb-page-size");
+    bdb_context->is_txn=(librdf_hash_get_as_boolean(options, "bdb-txn") > 0);
+  }
   
   file = LIBRDF_MALLOC(char*, strlen(identifier) + 4);
   if(!file)
     return 1;
   sprintf(file, "%s.db", identifier);
+  open_file = file;
+
+#ifdef LIBRDF_HASH_BDB_ENV
+  if(bdb_context->env_home || bdb_context->cache_size || bdb_context->is_txn) {
+    if(!bdb_context->env_home) {
+      /* default to the directory of the hash file */
+      const char *slash = strrchr(identifier, '/');
+      size_t len = slash ? LIBRDF_GOOD_CAST(size_t, slash - identifier) : 1;
+
+      bdb_context->env_home = LIBRDF_MALLOC(char*, len + 1);
+      if(!bdb_context->env_home) {
+        LIBRDF_FREE(char*, file);
+        return 1;
+      }
+      if(slash)
+        memcpy(bdb_context->env_home, identifier, len);
+      else
+        bdb_context->env_home[0] = '.';
+      bdb_context->env_home[len] = '\0';
+    }
+
+    /* environments are shared by the real home directory name */
+    open_file = librdf_hash_bdb_real_path(bdb_context->env_home);
+    if(!open_file) {
+      LIBRDF_FREE(char*, file);
+      return 1;
+    }
+    LIBRDF_FREE(char*, bdb_context->env_home);
+    bdb_context->env_home = open_file;
+    open_file = file;
+
+    bdb_context->env = librdf_hash_bdb_get_env(bdb_context);
+    if(bdb_context->env)
+      /* else the file is looked for relative to the home directory */
+      open_file = librdf_hash_bdb_absolute_file(file);
+    if(!bdb_context->env || !open_file) {
+      librdf_hash_bdb_release_env(bdb_context);
+      LIBRDF_FREE(char*, file);
+      return 1;
+    }
+    env = bdb_context->env->env;
+  }
+#endif
 
 #ifdef HAVE_DB_CREATE
   /* V3 prototype:
    * int db_create(DB **dbp, DB_ENV *dbenv, u_int32_t flags);
    */
-  ret = db_create(&bdb, NULL, flags);
+  ret = db_create(&bdb, env, flags);
   if(ret) {
     LIBRDF_DEBUG2("Failed to create BDB context - %d\n", ret);
-    return 1;
+    goto failed;
   }
   
 #ifdef HAVE_BDB_SET_FLAGS
   if((ret=bdb->set_flags(bdb, DB_DUP))) {
     LIBRDF_DEBUG2("Failed to set BDB duplicate flag - %d\n", ret);
-    return 1;
+    bdb->close(bdb, 0);
+    goto failed;
   }
 #endif
+
+  /* V3 prototype:
+   * int DB->set_pagesize(DB *db, u_int32_t pagesize);
+   */
+  if(bdb_context->page_size &&
+     (ret=bdb->set_pagesize(bdb, (u_int32_t)bdb_context->page_size))) {
+    librdf_log(bdb_context->hash->world, 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+               "BDB page size %lu is not valid - %s", bdb_context->page_size,
+               db_strerror(ret));
+    bdb->close(bdb, 0);
+    goto failed;
+  }
   
   /* V3 prototype:
    * int DB->open(DB *db, const char *file, const char *database,
@@ -189,6 +550,20 @@ librdf_hash_bdb_open(void* context, const char *identifier,
   flags = is_writable ? DB_CREATE : DB_RDONLY;
   if(is_new)
     flags |= DB_TRUNCATE;
+
+#ifdef LIBRDF_HASH_BDB_ENV
+  if(bdb_context->env && bdb_context->env->is_txn) {
+    /* truncation cannot be transaction protected so remove the file
+     * instead; it need not exist
+     */
+    flags &= ~(u_int32_t)DB_TRUNCATE;
+    if(is_new && is_writable)
+      env->dbremove(env, NULL, open_file, NULL, DB_AUTO_COMMIT);
+
+    /* make all changes through this handle transaction protected */
+    flags |= DB_AUTO_COMMIT;
+  }
+#endif
 #endif
 
 #if defined(HAVE_BDB_OPEN_6_ARGS) || defined(HAVE_BDB_OPEN_7_ARGS)
@@ -212,12 +587,12 @@ librdf_hash_bdb_open(void* context, const char *identifier,
  * int DB->open(DB *db, DB_TXN *txnid, const char *file,
  *              const char *database, DBTYPE type, u_int32_t flags, int mode);
  */
-  ret = bdb->open(bdb, NULL, file, NULL, DB_BTREE, flags, mode);
+  ret = bdb->open(bdb, NULL, open_file, NULL, DB_BTREE, flags, mode);
   if(ret) {
     librdf_log(bdb_context->hash->world, 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
                "BDB V4.1+ open of '%s' failed - %s", file, db_strerror(ret));
-    LIBRDF_FREE(char*, file);
-    return 1;
+    bdb->close(bdb, 0);
+    goto failed;
   }
 #endif
 
@@ -275,7 +650,18 @@ ERROR - no idea how to use Berkeley DB
 
   bdb_context->db=bdb;
   bdb_context->file_name=file;
+  if(open_file != file)
+    LIBRDF_FREE(char*, open_file);
   return 0;
+
+#ifdef HAVE_DB_CREATE
+  failed:
+  librdf_hash_bdb_release_env(bdb_context);
+  if(open_file != file)
+    LIBRDF_FREE(char*, open_file);
+  LIBRDF_FREE(char*, file);
+  return 1;
+#endif
 }
 
 
@@ -304,6 +690,7 @@ librdf_hash_bdb_close(void* context)
   /* V1 */
   ret=db->close(db);
 #endif
+  librdf_hash_bdb_release_env(bdb_context);
   LIBRDF_FREE(char*, bdb_context->file_name);
   return ret;
 }
@@ -336,8 +723,17 @@ librdf_hash_bdb_clone(librdf_hash *hash, void* context, char *new_identifier,
   /* copy data fields that might change */
   hcontext->hash=hash;
 
-  /* Note: The options are not used at present, so no need to make a copy 
-   */
+  /* copy the options */
+  if(old_hcontext->env_home) {
+    hcontext->env_home=LIBRDF_MALLOC(char*, strlen(old_hcontext->env_home) + 1);
+    if(!hcontext->env_home)
+      return 1;
+    strcpy(hcontext->env_home, old_hcontext->env_home);
+  }
+  hcontext->cache_size=old_hcontext->cache_size;
+  hcontext->page_size=old_hcontext->page_size;
+  hcontext->is_txn=old_hcontext->is_txn;
+
   if(librdf_hash_bdb_open(context, new_identifier,
                           old_hcontext->mode, old_hcontext->is_writable,
                           old_hcontext->is_new, NULL))
@@ -905,6 +1301,51 @@ librdf_hash_bdb_delete_key(void* context, librdf_hash_datum *key)
 }
 
 
+#ifdef LIBRDF_HASH_BDB_ENV
+/*
+ * librdf_hash_bdb_delete_key_value_txn:
+ * @bdb_context: BerkeleyDB hash context
+ * @bdb_key: key
+ * @bdb_value: value
+ *
+ * INTERNAL - Delete given key/value from a transaction protected hash
+ *
+ * Changes through a cursor are not auto committed so the cursor is
+ * used in an explicit transaction.
+ *
+ * Return value: non 0 on failure
+ */
+static int
+librdf_hash_bdb_delete_key_value_txn(librdf_hash_bdb_context* bdb_context,
+                                     DBT* bdb_key, DBT* bdb_value)
+{
+  DB_ENV* env=bdb_context->env->env;
+  DB* bdb=bdb_context->db;
+  DB_TXN* txn;
+  DBC* dbc;
+  int ret;
+
+  if(env->txn_begin(env, NULL, &txn, 0))
+    return 1;
+
+  ret=bdb->cursor(bdb, txn, &dbc, 0);
+  if(!ret) {
+    ret=dbc->c_get(dbc, bdb_key, bdb_value, DB_GET_BOTH);
+    if(!ret)
+      ret=dbc->c_del(dbc, 0);
+    dbc->c_close(dbc);
+  }
+
+  if(ret) {
+    txn->abort(txn);
+    return 1;
+  }
+
+  return (txn->commit(txn, 0) != 0);
+}
+#endif
+
+
 /**
  * librdf_hash_bdb_delete_key_value:
  * @context: BerkeleyDB hash context
@@ -938,6 +1379,12 @@ librdf_hash_bdb_delete_key_value(void* context,
   bdb_value.data = (char*)value->data;
   bdb_value.size = LIBRDF_BAD_CAST(u_int32_t, value->size);
   
+#ifdef LIBRDF_HASH_BDB_ENV
+  if(bdb_context->env && bdb_context->env->is_txn)
+    return librdf_hash_bdb_delete_key_value_txn(bdb_context,
+                                                &bdb_key, &bdb_value);
+#endif
+
 #ifdef HAVE_BDB_CURSOR
 #ifdef HAVE_BDB_CURSOR_4_ARGS
   /* V3 prototype:
@@ -995,6 +1442,172 @@ librdf_hash_bdb_delete_key_value(void* context,
 }
 
 
+#ifdef LIBRDF_HASH_BDB_BULK
+/*
+ * librdf_hash_bdb_bulk:
+ * @bdb_context: BerkeleyDB hash context
+ * @keys: array of keys
+ * @values: array of values
+ * @count: number of key/value pairs
+ * @is_put: non 0 to put the pairs, 0 to delete them
+ *
+ * INTERNAL - Put or delete key/value pairs with one DB_MULTIPLE_KEY call
+ *
+ * Return value: non 0 on failure
+ */
+static int
+librdf_hash_bdb_bulk(librdf_hash_bdb_context* bdb_context,
+                     librdf_hash_datum *keys, librdf_hash_datum *values,
+                     int count, int is_put)
+{
+  DB* db=bdb_context->db;
+  DBT bdb_bulk;
+  DBT bdb_unused;
+  void *p;
+  size_t size;
+  int i;
+  int ret;
+
+  /* keys and values are packed from the start of the buffer and an
+   * offset and length for each from the end
+   */
+  size = 2 * sizeof(u_int32_t);
+  for(i=0; i < count; i++)
+    size += keys[i].size + values[i].size + 4 * sizeof(u_int32_t);
+  size = (size + 3) & ~(size_t)3;
+
+  memset(&bdb_bulk, 0, sizeof(DBT));
+  memset(&bdb_unused, 0, sizeof(DBT));
+
+  bdb_bulk.data = LIBRDF_MALLOC(void*, size);
+  if(!bdb_bulk.data)
+    return 1;
+  bdb_bulk.ulen = LIBRDF_BAD_CAST(u_int32_t, size);
+  bdb_bulk.flags = DB_DBT_USERMEM | DB_DBT_BULK;
+
+  DB_MULTIPLE_WRITE_INIT(p, &bdb_bulk);
+  for(i=0; p && i < count; i++) {
+    DB_MULTIPLE_KEY_WRITE_NEXT(p, &bdb_bulk,
+                               keys[i].data, LIBRDF_BAD_CAST(u_int32_t, keys[i].size),
+                               values[i].data, LIBRDF_BAD_CAST(u_int32_t, values[i].size));
+  }
+
+  if(!p)
+    ret = 1;
+  else if(is_put)
+    ret = db->put(db, NULL, &bdb_bulk, &bdb_unused, DB_MULTIPLE_KEY);
+  else
+    ret = db->del(db, NULL, &bdb_bulk, DB_MULTIPLE_KEY);
+#ifdef LIBRDF_DEBUG
+  if(ret)
+    LIBRDF_DEBUG2("BDB bulk put/del failed - %d\n", ret);
+#endif
+
+  LIBRDF_FREE(void*, bdb_bulk.data);
+  return (ret != 0);
+}
+
+
+/**
+ * librdf_hash_bdb_put_many:
+ * @context: BerkeleyDB hash context
+ * @keys: array of keys
+ * @values: array of values
+ * @count: number of key/value pairs
+ *
+ * Store many key/value pairs in the hash with one bulk write.
+ *
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_hash_bdb_put_many(void* context, librdf_hash_datum *keys,
+                         librdf_hash_datum *values, int count)
+{
+  librdf_hash_bdb_context* bdb_context=(librdf_hash_bdb_context*)context;
+
+  if(!count)
+    return 0;
+
+  return librdf_hash_bdb_bulk(bdb_context, keys, values, count, 1);
+}
+
+
+/**
+ * librdf_hash_bdb_delete_many:
+ * @context: BerkeleyDB hash context
+ * @keys: array of keys
+ * @values: array of values
+ * @count: number of key/value pairs
+ *
+ * Delete many key/value pairs from the hash with one bulk delete.
+ *
+ * If that fails, for example because a pair is not present, the
+ * pairs are deleted one at a time so that all those present go.
+ *
+ * Return value: non 0 on failure (including any pair not present)
+ **/
+static int
+librdf_hash_bdb_delete_many(void* context, librdf_hash_datum *keys,
+                            librdf_hash_datum *values, int count)
+{
+  librdf_hash_bdb_context* bdb_context=(librdf_hash_bdb_context*)context;
+  int i;
+
+  if(!count || !librdf_hash_bdb_bulk(bdb_context, keys, values, count, 0))
+    return 0;
+
+  for(i=0; i < count; i++)
+    librdf_hash_bdb_delete_key_value(context, &keys[i], &values[i]);
+
+  return 1;
+}
+#endif
+
+
+#ifdef LIBRDF_HASH_BDB_ENV
+/**
+ * librdf_hash_bdb_key_values_count:
+ * @context: BerkeleyDB hash context
+ * @key: pointer to key
+ *
+ * Get the number of values of a key.
+ * 
+ * Return value: the number of values or <0 on failure
+ **/
+static int
+librdf_hash_bdb_key_values_count(void* context, librdf_hash_datum *key)
+{
+  librdf_hash_bdb_context* bdb_context=(librdf_hash_bdb_context*)context;
+  DB* db=bdb_context->db;
+  DBC* dbc=NULL;
+  DBT bdb_key;
+  DBT bdb_value;
+  db_recno_t count=0;
+  int ret;
+
+  /* docs say you must zero DBT's before use */
+  memset(&bdb_key, 0, sizeof(DBT));
+  memset(&bdb_value, 0, sizeof(DBT));
+
+  bdb_key.data = (char*)key->data;
+  bdb_key.size = LIBRDF_BAD_CAST(u_int32_t, key->size);
+
+  if(db->cursor(db, NULL, &dbc, 0))
+    return -1;
+
+  ret = dbc->c_get(dbc, &bdb_key, &bdb_value, DB_SET);
+  if(!ret)
+    ret = dbc->c_count(dbc, &count, 0);
+  dbc->c_close(dbc);
+
+  if(ret == DB_NOTFOUND)
+    return 0;
+
+  return ret ? -1 : (int)count;
+}
+#endif
+
+
 /**
  * librdf_hash_bdb_sync:
  * @context: BerkeleyDB hash context
@@ -1011,6 +1624,12 @@ librdf_hash_bdb_sync(void* context)
   int ret;
 
   ret = db->sync(db, 0);
+
+#ifdef LIBRDF_HASH_BDB_ENV
+  /* bound the log replayed by recovery */
+  if(!ret && bdb_context->env && bdb_context->env->is_txn)
+    ret = bdb_context->env->env->txn_checkpoint(bdb_context->env->env, 0, 0, 0);
+#endif
   
   return ret;
 }
@@ -1076,6 +1695,14 @@ librdf_hash_bdb_register_factory(librdf_hash_factory *factory)
   factory->cursor_init   = librdf_hash_bdb_cursor_init;
   factory->cursor_get    = librdf_hash_bdb_cursor_get;
   factory->cursor_finish = librdf_hash_bdb_cursor_finish;
+
+#ifdef LIBRDF_HASH_BDB_ENV
+  factory->key_values_count = librdf_hash_bdb_key_values_count;
+#endif
+#ifdef LIBRDF_HASH_BDB_BULK
+  factory->put_many    = librdf_hash_bdb_put_many;
+  factory->delete_many = librdf_hash_bdb_delete_many;
+#endif
 }
 
 
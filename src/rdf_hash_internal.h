@@ -30,6 +30,12 @@
 extern "C" {
 #endif
 
+#include <rdf_types.h>
+
+/* A key hash function returning a 64 bit hash of size bytes of data
+ * perturbed by seed */
+typedef u64 (*librdf_hash_function)(const void *data, size_t size, u64 seed);
+
 /** data type used to describe hash key and data */
 struct librdf_hash_datum_s
 {
@@ -38,6 +44,12 @@ struct librdf_hash_datum_s
   size_t size;
   /* used internally to build lists of these  */
   struct librdf_hash_datum_s *next;
+  /* hash of data computed by hash_function with hash_seed, set by
+   * librdf_hash_prepare_key() and read only by the *_prepared()
+   * operations.  Other operations always hash the key themselves */
+  librdf_hash_function hash_function;
+  u64 hash_seed;
+  u64 hash_value;
 };
 typedef struct librdf_hash_datum_s librdf_hash_datum;
 
@@ -104,6 +116,26 @@ struct librdf_hash_factory_s {
   int (*cursor_init)(void *cursor_context, void* hash_context);
   int (*cursor_get)(void *cursor, librdf_hash_datum *key, librdf_hash_datum *value, unsigned int flags);
   void (*cursor_finish)(void *context);
+
+  /* OPTIONAL: precompute the hash of a key and use it in later
+   * put, exists and delete_key_value calls */
+  int (*prepare_key)(void* context, librdf_hash_datum *key);
+  int (*put_prepared)(void* context, librdf_hash_datum *key, librdf_hash_datum *value);
+  int (*exists_prepared)(void* context, librdf_hash_datum *key, librdf_hash_datum *value);
+  int (*delete_prepared)(void* context, librdf_hash_datum *key, librdf_hash_datum *value);
+
+  /* OPTIONAL: get the value of a named option or statistic */
+  char* (*get_option)(void* context, const char *name);
+
+  /* OPTIONAL: insert or delete count key/value pairs sorted by key */
+  int (*put_many)(void* context, librdf_hash_datum *keys, librdf_hash_datum *values, int count);
+  int (*delete_many)(void* context, librdf_hash_datum *keys, librdf_hash_datum *values, int count);
+
+  /* OPTIONAL: insert a key/value pair unless it is already present */
+  int (*put_if_absent)(void* context, librdf_hash_datum *key, librdf_hash_datum *value);
+
+  /* OPTIONAL: count the values of a key */
+  int (*key_values_count)(void* context, librdf_hash_datum *key);
 };
 typedef struct librdf_hash_factory_s librdf_hash_factory;
 
@@ -112,6 +144,12 @@ void librdf_hash_register_factory(librdf_world *world, const char *name, void (*
 librdf_hash_factory* librdf_get_hash_factory(librdf_world *world, const char *name);
 
 
+/* key hash functions */
+u64 librdf_hash_function_wyhash(const void *data, size_t size, u64 seed);
+u64 librdf_hash_function_one_at_a_time(const void *data, size_t size, u64 seed);
+librdf_hash_function librdf_get_hash_function(const char *name);
+u64 librdf_hash_random_seed(void);
+
 /* module init */
 void librdf_init_hash(librdf_world *world);
 
@@ -159,6 +197,21 @@ int librdf_hash_sync(librdf_hash* hash);
 /* get the file descriptor for the hash, if it is file based (for locking) */
 int librdf_hash_get_fd(librdf_hash* hash);
 
+/* precompute the hash of a key for several operations on the hash */
+int librdf_hash_prepare_key(librdf_hash* hash, librdf_hash_datum *key);
+int librdf_hash_put_prepared(librdf_hash* hash, librdf_hash_datum *key, librdf_hash_datum *value);
+int librdf_hash_exists_prepared(librdf_hash* hash, librdf_hash_datum *key, librdf_hash_datum *value);
+int librdf_hash_delete_prepared(librdf_hash* hash, librdf_hash_datum *key, librdf_hash_datum *value);
+
+/* get the value of a hash option or statistic */
+char* librdf_hash_get_option(librdf_hash* hash, const char *name);
+
+/* insert or delete many key/value pairs at once */
+int librdf_hash_put_many(librdf_hash* hash, librdf_hash_datum *keys, librdf_hash_datum *values, int count);
+int librdf_hash_delete_many(librdf_hash* hash, librdf_hash_datum *keys, librdf_hash_datum *values, int count);
+int librdf_hash_put_if_absent(librdf_hash* hash, librdf_hash_datum *key, librdf_hash_datum *value);
+int librdf_hash_key_values_count(librdf_hash* hash, librdf_hash_datum *key);
+
 /* init a hash from an array of strings */
 int librdf_hash_from_array_of_strings(librdf_hash* hash, const char *array[]);
 
@@ -175,6 +228,9 @@ int librdf_hash_cursor_get_next(librdf_hash_cursor *cursor, librdf_hash_datum *k
 #ifdef HAVE_BDB_HASH
 void librdf_init_hash_bdb(librdf_world *world);
 #endif
+#ifdef HAVE_LMDB_HASH
+void librdf_init_hash_lmdb(librdf_world *world);
+#endif
 void librdf_init_hash_memory(librdf_world *world);
 
 
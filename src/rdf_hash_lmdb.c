@@ -0,0 +1,1478 @@
+/* -*- Mode: c; c-basic-offset: 2 -*-
+ *
+ * rdf_hash_lmdb.c - RDF hash LMDB Interface Implementation
+ *
+ * This package is Free Software and part of Redland http://librdf.org/
+ *
+ * It is licensed under the following three licenses as alternatives:
+ *   1. GNU Lesser General Public License (LGPL) V2.1 or any newer version
+ *   2. GNU General Public License (GPL) V2 or any newer version
+ *   3. Apache License, V2.0 or any newer version
+ *
+ * You may not use this file except in compliance with at least one of
+ * the above three licenses.
+ *
+ * See LICENSE.html or LICENSE.txt at the top of this package for the
+ * complete terms and further detail along with the license texts for
+ * the licenses in COPYING.LIB, COPYING and LICENSE-2.0.txt respectively.
+ *
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <rdf_config.h>
+#endif
+
+#ifdef WIN32
+#include <win32_rdf_config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include <sys/types.h>
+
+/* for the memory allocation functions */
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#include <lmdb.h>
+
+#include <redland.h>
+#include <rdf_hash.h>
+
+
+/*
+ * Each hash is one LMDB environment in a single file holding two
+ * named databases.  "values" is MDB_DUPSORT and holds every value of
+ * a key as a sorted duplicate.  LMDB limits its keys and duplicate
+ * values to mdb_env_get_maxkeysize() bytes (511 by default), so a
+ * key or value that is longer (or is empty, or starts with the
+ * reference marker byte) is stored out of line in "long" and
+ * "values" holds a reference to it instead:
+ *
+ *   marker byte, 4 byte hash of the data, 4 byte sequence number
+ *
+ * all big-endian.  "long" maps each reference to a 4 byte big-endian
+ * count of the pairs using it followed by the data.  The sequence
+ * number tells apart data with the same hash.
+ *
+ * Each change is made and committed in its own write transaction, and
+ * put_many/delete_many make the whole batch in one, so the LMDB
+ * writer lock is only held during a call and other processes see
+ * changes as soon as the call returns.  The environment is opened
+ * with MDB_NOSYNC so commits do not flush the file; that is done when
+ * the hash is synced or closed, as for the bdb hash.
+ *
+ * Reads use a read-only transaction which takes no locks, so any
+ * number of processes can read the file while another one writes to
+ * it.  Keys and values returned by cursors point straight into the
+ * map and stay valid until the cursor moves or is finished, since
+ * each cursor reads its own snapshot.
+ */
+
+/* Default size of the map - the most the file can grow to.  It is
+ * only address space; the file grows as it is written.
+ */
+#if SIZEOF_UNSIGNED_LONG >= 8
+#define LIBRDF_HASH_LMDB_DEFAULT_MAP_SIZE (16UL << 30)
+#else
+#define LIBRDF_HASH_LMDB_DEFAULT_MAP_SIZE (256UL << 20)
+#endif
+
+/* First byte of a reference to data stored out of line */
+#define LIBRDF_HASH_LMDB_REF_MARKER 0xFF
+/* Size of a reference: marker, hash, sequence number */
+#define LIBRDF_HASH_LMDB_REF_SIZE 9
+/* Size of the use count before out of line data */
+#define LIBRDF_HASH_LMDB_COUNT_SIZE 4
+
+
+typedef struct
+{
+  librdf_hash *hash;
+  int mode;
+  int is_writable;
+  int is_new;
+  size_t map_size;
+
+  MDB_env* env;
+  /* key/values database */
+  MDB_dbi dbi;
+  /* out of line keys and values */
+  MDB_dbi long_dbi;
+  /* longest key or value stored in dbi itself */
+  size_t max_inline;
+  char* file_name;
+
+  /* read-only transaction reused for reads */
+  MDB_txn* read_txn;
+  int read_txn_started;
+} librdf_hash_lmdb_context;
+
+
+/* Implementing the hash cursor */
+static int librdf_hash_lmdb_cursor_init(void *cursor_context, void *hash_context);
+static int librdf_hash_lmdb_cursor_get(void *context, librdf_hash_datum* key, librdf_hash_datum* value, unsigned int flags);
+static void librdf_hash_lmdb_cursor_finish(void* context);
+
+
+/* prototypes for local functions */
+static int librdf_hash_lmdb_create(librdf_hash* hash, void* context);
+static int librdf_hash_lmdb_destroy(void* context);
+static int librdf_hash_lmdb_open(void* context, const char *identifier, int mode, int is_writable, int is_new, librdf_hash* options);
+static int librdf_hash_lmdb_close(void* context);
+static int librdf_hash_lmdb_clone(librdf_hash* new_hash, void *new_context, char *new_identifier, void* old_context);
+static int librdf_hash_lmdb_values_count(void *context);
+static int librdf_hash_lmdb_put(void* context, librdf_hash_datum *key, librdf_hash_datum *data);
+static int librdf_hash_lmdb_put_if_absent(void* context, librdf_hash_datum *key, librdf_hash_datum *value);
+static int librdf_hash_lmdb_put_many(void* context, librdf_hash_datum *keys, librdf_hash_datum *values, int count);
+static int librdf_hash_lmdb_key_values_count(void* context, librdf_hash_datum *key);
+static int librdf_hash_lmdb_exists(void* context, librdf_hash_datum *key, librdf_hash_datum *value);
+static int librdf_hash_lmdb_delete_key(void* context, librdf_hash_datum *key);
+static int librdf_hash_lmdb_delete_key_value(void* context, librdf_hash_datum *key, librdf_hash_datum *value);
+static int librdf_hash_lmdb_delete_many(void* context, librdf_hash_datum *keys, librdf_hash_datum *values, int count);
+static int librdf_hash_lmdb_sync(void* context);
+static int librdf_hash_lmdb_get_fd(void* context);
+
+static void librdf_hash_lmdb_register_factory(librdf_hash_factory *factory);
+
+
+/* transaction helpers */
+
+/*
+ * librdf_hash_lmdb_read_txn:
+ * @lmdb_context: LMDB hash context
+ *
+ * INTERNAL - Get the read-only transaction to read the hash with
+ *
+ * It must be given back with librdf_hash_lmdb_end_read().
+ *
+ * Return value: transaction or NULL on failure
+ */
+static MDB_txn*
+librdf_hash_lmdb_read_txn(librdf_hash_lmdb_context* lmdb_context)
+{
+  int ret;
+
+  if(!lmdb_context->read_txn)
+    ret = mdb_txn_begin(lmdb_context->env, NULL, MDB_RDONLY,
+                        &lmdb_context->read_txn);
+  else
+    ret = mdb_txn_renew(lmdb_context->read_txn);
+
+  if(ret) {
+    librdf_log(lmdb_context->hash->world, 0, LIBRDF_LOG_ERROR,
+               LIBRDF_FROM_HASH, NULL,
+               "LMDB read transaction on '%s' failed - %s",
+               lmdb_context->file_name, mdb_strerror(ret));
+    return NULL;
+  }
+
+  lmdb_context->read_txn_started = 1;
+  return lmdb_context->read_txn;
+}
+
+
+/*
+ * librdf_hash_lmdb_end_read:
+ * @lmdb_context: LMDB hash context
+ * @txn: transaction from librdf_hash_lmdb_read_txn()
+ *
+ * INTERNAL - Finish reading, releasing the snapshot of the read-only
+ * transaction.
+ */
+static void
+librdf_hash_lmdb_end_read(librdf_hash_lmdb_context* lmdb_context,
+                          MDB_txn* txn)
+{
+  if(txn == lmdb_context->read_txn && lmdb_context->read_txn_started) {
+    mdb_txn_reset(txn);
+    lmdb_context->read_txn_started = 0;
+  }
+}
+
+
+/*
+ * librdf_hash_lmdb_begin_write:
+ * @lmdb_context: LMDB hash context
+ *
+ * INTERNAL - Start a write transaction for one change or batch
+ *
+ * It must be finished with librdf_hash_lmdb_end_write().
+ *
+ * Return value: transaction or NULL on failure
+ */
+static MDB_txn*
+librdf_hash_lmdb_begin_write(librdf_hash_lmdb_context* lmdb_context)
+{
+  MDB_txn* txn;
+  int ret;
+
+  ret = mdb_txn_begin(lmdb_context->env, NULL, 0, &txn);
+  if(ret) {
+    librdf_log(lmdb_context->hash->world, 0, LIBRDF_LOG_ERROR,
+               LIBRDF_FROM_HASH, NULL,
+               "LMDB write transaction on '%s' failed - %s",
+               lmdb_context->file_name, mdb_strerror(ret));
+    return NULL;
+  }
+
+  return txn;
+}
+
+
+/*
+ * librdf_hash_lmdb_end_write:
+ * @lmdb_context: LMDB hash context
+ * @txn: transaction from librdf_hash_lmdb_begin_write()
+ * @ret: LMDB result of the changes
+ *
+ * INTERNAL - Commit the changes made in a write transaction, or
+ * abort it if they failed.
+ *
+ * MDB_NOTFOUND and MDB_KEYEXIST are expected results, so are not
+ * logged.
+ *
+ * Return value: non 0 if the changes failed or were not committed
+ */
+static int
+librdf_hash_lmdb_end_write(librdf_hash_lmdb_context* lmdb_context,
+                           MDB_txn* txn, int ret)
+{
+  if(ret) {
+    mdb_txn_abort(txn);
+    if(ret != MDB_NOTFOUND && ret != MDB_KEYEXIST)
+      librdf_log(lmdb_context->hash->world, 0, LIBRDF_LOG_ERROR,
+                 LIBRDF_FROM_HASH, NULL,
+                 "LMDB change to '%s' failed - %s",
+                 lmdb_context->file_name, mdb_strerror(ret));
+    return 1;
+  }
+
+  ret = mdb_txn_commit(txn);
+  if(ret)
+    librdf_log(lmdb_context->hash->world, 0, LIBRDF_LOG_ERROR,
+               LIBRDF_FROM_HASH, NULL,
+               "LMDB commit to '%s' failed - %s",
+               lmdb_context->file_name, mdb_strerror(ret));
+
+  return (ret != 0);
+}
+
+
+/* out of line keys and values */
+
+/*
+ * librdf_hash_lmdb_is_ref:
+ * @val: key or value as stored in the values database
+ *
+ * INTERNAL - Test if a stored key or value is a reference to data
+ * stored out of line
+ *
+ * Return value: non 0 if it is
+ */
+static int
+librdf_hash_lmdb_is_ref(const MDB_val* val)
+{
+  return (val->mv_size == LIBRDF_HASH_LMDB_REF_SIZE &&
+          *(const unsigned char*)val->mv_data == LIBRDF_HASH_LMDB_REF_MARKER);
+}
+
+
+/*
+ * librdf_hash_lmdb_ref_find:
+ * @lmdb_context: LMDB hash context
+ * @txn: transaction
+ * @datum: key or value
+ * @ref: buffer of LIBRDF_HASH_LMDB_REF_SIZE bytes for the reference
+ *
+ * INTERNAL - Find the reference to data stored out of line
+ *
+ * If the data is not found, @ref is set to the first free reference
+ * for it.
+ *
+ * Return value: 0 if found, MDB_NOTFOUND if not or another LMDB error
+ */
+static int
+librdf_hash_lmdb_ref_find(librdf_hash_lmdb_context* lmdb_context,
+                          MDB_txn* txn, librdf_hash_datum* datum,
+                          unsigned char* ref)
+{
+  MDB_cursor* lmdb_cursor;
+  MDB_val lmdb_key;
+  MDB_val lmdb_value;
+  u32 hash;
+  u32 seq = 0;
+  int ret;
+
+  hash = (u32)librdf_hash_function_one_at_a_time(datum->data, datum->size, 0);
+  ref[0] = LIBRDF_HASH_LMDB_REF_MARKER;
+  ref[1] = (unsigned char)(hash >> 24);
+  ref[2] = (unsigned char)(hash >> 16);
+  ref[3] = (unsigned char)(hash >> 8);
+  ref[4] = (unsigned char)hash;
+  memset(ref + 5, 0, 4);
+
+  ret = mdb_cursor_open(txn, lmdb_context->long_dbi, &lmdb_cursor);
+  if(ret)
+    return ret;
+
+  /* data with the same hash sort together, in sequence number order */
+  lmdb_key.mv_data = ref;
+  lmdb_key.mv_size = LIBRDF_HASH_LMDB_REF_SIZE;
+  ret = mdb_cursor_get(lmdb_cursor, &lmdb_key, &lmdb_value, MDB_SET_RANGE);
+  while(!ret) {
+    const unsigned char* k = (const unsigned char*)lmdb_key.mv_data;
+
+    if(lmdb_key.mv_size != LIBRDF_HASH_LMDB_REF_SIZE || memcmp(k, ref, 5)) {
+      ret = MDB_NOTFOUND;
+      break;
+    }
+
+    if(lmdb_value.mv_size == LIBRDF_HASH_LMDB_COUNT_SIZE + datum->size &&
+       !memcmp((const unsigned char*)lmdb_value.mv_data + LIBRDF_HASH_LMDB_COUNT_SIZE,
+               datum->data, datum->size)) {
+      memcpy(ref, k, LIBRDF_HASH_LMDB_REF_SIZE);
+      break;
+    }
+
+    seq = ((u32)k[5] << 24) | ((u32)k[6] << 16) | ((u32)k[7] << 8) | k[8];
+    seq++;
+    ret = mdb_cursor_get(lmdb_cursor, &lmdb_key, &lmdb_value, MDB_NEXT);
+  }
+  mdb_cursor_close(lmdb_cursor);
+
+  if(ret == MDB_NOTFOUND) {
+    ref[5] = (unsigned char)(seq >> 24);
+    ref[6] = (unsigned char)(seq >> 16);
+    ref[7] = (unsigned char)(seq >> 8);
+    ref[8] = (unsigned char)seq;
+  }
+
+  return ret;
+}
+
+
+/*
+ * librdf_hash_lmdb_ref_update:
+ * @lmdb_context: LMDB hash context
+ * @txn: write transaction
+ * @ref: reference
+ * @delta: change to the use count, +1 or -1
+ *
+ * INTERNAL - Change the use count of data stored out of line,
+ * deleting it when no longer used.
+ *
+ * Return value: 0 or an LMDB error
+ */
+static int
+librdf_hash_lmdb_ref_update(librdf_hash_lmdb_context* lmdb_context,
+                            MDB_txn* txn, const unsigned char* ref,
+                            int delta)
+{
+  MDB_val lmdb_key;
+  MDB_val lmdb_value;
+  unsigned char* p;
+  u32 count;
+  int ret;
+
+  lmdb_key.mv_data = (void*)ref;
+  lmdb_key.mv_size = LIBRDF_HASH_LMDB_REF_SIZE;
+  ret = mdb_get(txn, lmdb_context->long_dbi, &lmdb_key, &lmdb_value);
+  if(ret)
+    return ret;
+
+  p = (unsigned char*)lmdb_value.mv_data;
+  count = ((u32)p[0] << 24) | ((u32)p[1] << 16) | ((u32)p[2] << 8) | p[3];
+  count += (u32)delta;
+  if(!count)
+    return mdb_del(txn, lmdb_context->long_dbi, &lmdb_key, NULL);
+
+  /* the returned data may not be written to; rewrite the record */
+  p = LIBRDF_MALLOC(unsigned char*, lmdb_value.mv_size);
+  if(!p)
+    return ENOMEM;
+  memcpy(p, lmdb_value.mv_data, lmdb_value.mv_size);
+  p[0] = (unsigned char)(count >> 24);
+  p[1] = (unsigned char)(count >> 16);
+  p[2] = (unsigned char)(count >> 8);
+  p[3] = (unsigned char)count;
+  lmdb_value.mv_data = p;
+  ret = mdb_put(txn, lmdb_context->long_dbi, &lmdb_key, &lmdb_value, 0);
+  LIBRDF_FREE(unsigned char*, p);
+
+  return ret;
+}
+
+
+/*
+ * librdf_hash_lmdb_encode:
+ * @lmdb_context: LMDB hash context
+ * @txn: transaction
+ * @datum: key or value
+ * @val: LMDB value to set
+ * @ref: buffer of LIBRDF_HASH_LMDB_REF_SIZE bytes for a reference
+ * @add: non 0 to store the data out of line or count another use
+ *
+ * INTERNAL - Get the form of a key or value stored in the values
+ * database: the datum itself or a reference to it in @ref.
+ *
+ * Return value: 0, MDB_NOTFOUND if !@add and the data is not stored
+ * or another LMDB error
+ */
+static int
+librdf_hash_lmdb_encode(librdf_hash_lmdb_context* lmdb_context,
+                        MDB_txn* txn, librdf_hash_datum* datum,
+                        MDB_val* val, unsigned char* ref, int add)
+{
+  int ret;
+
+  if(datum->size && datum->size <= lmdb_context->max_inline &&
+     *(unsigned char*)datum->data != LIBRDF_HASH_LMDB_REF_MARKER) {
+    val->mv_data = datum->data;
+    val->mv_size = datum->size;
+    return 0;
+  }
+
+  val->mv_data = ref;
+  val->mv_size = LIBRDF_HASH_LMDB_REF_SIZE;
+
+  ret = librdf_hash_lmdb_ref_find(lmdb_context, txn, datum, ref);
+  if(!add)
+    return ret;
+
+  if(!ret)
+    return librdf_hash_lmdb_ref_update(lmdb_context, txn, ref, 1);
+
+  if(ret == MDB_NOTFOUND) {
+    MDB_val lmdb_key;
+    MDB_val lmdb_value;
+    unsigned char* p;
+
+    lmdb_key.mv_data = ref;
+    lmdb_key.mv_size = LIBRDF_HASH_LMDB_REF_SIZE;
+    lmdb_value.mv_data = NULL;
+    lmdb_value.mv_size = LIBRDF_HASH_LMDB_COUNT_SIZE + datum->size;
+    ret = mdb_put(txn, lmdb_context->long_dbi, &lmdb_key, &lmdb_value,
+                  MDB_RESERVE);
+    if(!ret) {
+      p = (unsigned char*)lmdb_value.mv_data;
+      p[0] = p[1] = p[2] = 0;
+      p[3] = 1;
+      if(datum->size)
+        memcpy(p + LIBRDF_HASH_LMDB_COUNT_SIZE, datum->data, datum->size);
+    }
+  }
+
+  return ret;
+}
+
+
+/*
+ * librdf_hash_lmdb_release:
+ * @lmdb_context: LMDB hash context
+ * @txn: write transaction
+ * @val: key or value as stored in the values database
+ *
+ * INTERNAL - Give up one use of a stored key or value, if it is a
+ * reference to out of line data.
+ *
+ * Return value: 0 or an LMDB error
+ */
+static int
+librdf_hash_lmdb_release(librdf_hash_lmdb_context* lmdb_context,
+                         MDB_txn* txn, const MDB_val* val)
+{
+  unsigned char ref[LIBRDF_HASH_LMDB_REF_SIZE];
+
+  if(!librdf_hash_lmdb_is_ref(val))
+    return 0;
+
+  /* copied as val may point into a page the update changes */
+  memcpy(ref, val->mv_data, LIBRDF_HASH_LMDB_REF_SIZE);
+  return librdf_hash_lmdb_ref_update(lmdb_context, txn, ref, -1);
+}
+
+
+/*
+ * librdf_hash_lmdb_decode:
+ * @lmdb_context: LMDB hash context
+ * @txn: transaction
+ * @val: key or value as stored in the values database
+ *
+ * INTERNAL - Replace a reference to out of line data by the data
+ *
+ * Return value: 0 or an LMDB error
+ */
+static int
+librdf_hash_lmdb_decode(librdf_hash_lmdb_context* lmdb_context,
+                        MDB_txn* txn, MDB_val* val)
+{
+  MDB_val lmdb_value;
+  int ret;
+
+  if(!librdf_hash_lmdb_is_ref(val))
+    return 0;
+
+  ret = mdb_get(txn, lmdb_context->long_dbi, val, &lmdb_value);
+  if(ret)
+    return ret;
+
+  val->mv_data = (unsigned char*)lmdb_value.mv_data + LIBRDF_HASH_LMDB_COUNT_SIZE;
+  val->mv_size = lmdb_value.mv_size - LIBRDF_HASH_LMDB_COUNT_SIZE;
+  return 0;
+}
+
+
+/*
+ * librdf_hash_lmdb_put_pair:
+ * @lmdb_context: LMDB hash context
+ * @txn: write transaction
+ * @key: key
+ * @value: value
+ *
+ * INTERNAL - Store a key/value pair unless it is already present
+ *
+ * Return value: 0, MDB_KEYEXIST if already present or another LMDB error
+ */
+static int
+librdf_hash_lmdb_put_pair(librdf_hash_lmdb_context* lmdb_context,
+                          MDB_txn* txn,
+                          librdf_hash_datum* key, librdf_hash_datum* value)
+{
+  unsigned char key_ref[LIBRDF_HASH_LMDB_REF_SIZE];
+  unsigned char value_ref[LIBRDF_HASH_LMDB_REF_SIZE];
+  MDB_val lmdb_key;
+  MDB_val lmdb_value;
+  int ret;
+
+  ret = librdf_hash_lmdb_encode(lmdb_context, txn, key, &lmdb_key, key_ref, 1);
+  if(ret)
+    return ret;
+  ret = librdf_hash_lmdb_encode(lmdb_context, txn, value, &lmdb_value,
+                                value_ref, 1);
+  if(ret)
+    return ret;
+
+  /* the pair is looked up by the same B-tree descent that inserts it */
+  ret = mdb_put(txn, lmdb_context->dbi, &lmdb_key, &lmdb_value,
+                MDB_NODUPDATA);
+  if(ret == MDB_KEYEXIST) {
+    /* give back the uses counted above */
+    int ret2;
+
+    ret2 = librdf_hash_lmdb_release(lmdb_context, txn, &lmdb_key);
+    if(!ret2)
+      ret2 = librdf_hash_lmdb_release(lmdb_context, txn, &lmdb_value);
+    if(ret2)
+      ret = ret2;
+  }
+
+  return ret;
+}
+
+
+/*
+ * librdf_hash_lmdb_delete_pair:
+ * @lmdb_context: LMDB hash context
+ * @txn: write transaction
+ * @key: key
+ * @value: value
+ *
+ * INTERNAL - Delete a key/value pair
+ *
+ * Return value: 0, MDB_NOTFOUND if not present or another LMDB error
+ */
+static int
+librdf_hash_lmdb_delete_pair(librdf_hash_lmdb_context* lmdb_context,
+                             MDB_txn* txn,
+                             librdf_hash_datum* key, librdf_hash_datum* value)
+{
+  unsigned char key_ref[LIBRDF_HASH_LMDB_REF_SIZE];
+  unsigned char value_ref[LIBRDF_HASH_LMDB_REF_SIZE];
+  MDB_val lmdb_key;
+  MDB_val lmdb_value;
+  int ret;
+
+  ret = librdf_hash_lmdb_encode(lmdb_context, txn, key, &lmdb_key, key_ref, 0);
+  if(!ret)
+    ret = librdf_hash_lmdb_encode(lmdb_context, txn, value, &lmdb_value,
+                                  value_ref, 0);
+  if(!ret)
+    ret = mdb_del(txn, lmdb_context->dbi, &lmdb_key, &lmdb_value);
+  if(!ret)
+    ret = librdf_hash_lmdb_release(lmdb_context, txn, &lmdb_key);
+  if(!ret)
+    ret = librdf_hash_lmdb_release(lmdb_context, txn, &lmdb_value);
+
+  return ret;
+}
+
+
+/* functions implementing hash api */
+
+/**
+ * librdf_hash_lmdb_create:
+ * @hash: #librdf_hash hash that this implements
+ * @context: LMDB hash context
+ *
+ * Create a LMDB hash.
+ *
+ * Return value: non 0 on failure.
+ **/
+static int
+librdf_hash_lmdb_create(librdf_hash* hash, void* context)
+{
+  librdf_hash_lmdb_context* hcontext=(librdf_hash_lmdb_context*)context;
+
+  hcontext->hash=hash;
+  hcontext->map_size=LIBRDF_HASH_LMDB_DEFAULT_MAP_SIZE;
+  return 0;
+}
+
+
+/**
+ * librdf_hash_lmdb_destroy:
+ * @context: LMDB hash context
+ *
+ * Destroy a LMDB hash.
+ *
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_hash_lmdb_destroy(void* context)
+{
+  /* NOP */
+  return 0;
+}
+
+
+/**
+ * librdf_hash_lmdb_open:
+ * @context: LMDB hash context
+ * @identifier: filename to use for LMDB file
+ * @mode: file creation mode
+ * @is_writable: is hash writable?
+ * @is_new: is hash new?
+ * @options: hash options
+ *
+ * Open and maybe create a LMDB hash.
+ *
+ * Options used:
+ *   map-size - largest size in bytes the file can grow to
+ *              (default 16G, 256M on 32 bit systems)
+ *
+ * Return value: non 0 on failure.
+ **/
+static int
+librdf_hash_lmdb_open(void* context, const char *identifier,
+                      int mode, int is_writable, int is_new,
+                      librdf_hash* options)
+{
+  librdf_hash_lmdb_context* lmdb_context=(librdf_hash_lmdb_context*)context;
+  MDB_env* env;
+  MDB_txn* txn;
+  char *file;
+  long map_size;
+  int ret;
+
+  LIBRDF_ASSERT_OBJECT_POINTER_RETURN_VALUE(identifier, cstring, 1);
+
+  /* options are copied into the context so that the clone method
+   * can use them
+   */
+  lmdb_context->mode=mode;
+  lmdb_context->is_writable=is_writable;
+  lmdb_context->is_new=is_new;
+  if(options) {
+    map_size=librdf_hash_get_as_long(options, "map-size");
+    if(map_size > 0)
+      lmdb_context->map_size=(size_t)map_size;
+  }
+
+  /* the environment is one data file and a lock file beside it */
+  file = LIBRDF_MALLOC(char*, strlen(identifier) + 10);
+  if(!file)
+    return 1;
+
+  if(is_new) {
+    sprintf(file, "%s.mdb-lock", identifier);
+    remove(file);
+  }
+  sprintf(file, "%s.mdb", identifier);
+  if(is_new)
+    remove(file);
+
+  ret = mdb_env_create(&env);
+  if(ret) {
+    LIBRDF_DEBUG2("Failed to create LMDB environment - %d\n", ret);
+    LIBRDF_FREE(char*, file);
+    return 1;
+  }
+
+  ret = mdb_env_set_mapsize(env, lmdb_context->map_size);
+  if(!ret)
+    ret = mdb_env_set_maxdbs(env, 2);
+  if(!ret)
+    /* MDB_NOTLS lets read-only transactions and cursors stay open
+     * while changes are made.  MDB_NOSYNC leaves flushing to sync
+     * and close.
+     */
+    ret = mdb_env_open(env, file,
+                       MDB_NOSUBDIR | MDB_NOTLS |
+                       (is_writable ? MDB_NOSYNC : MDB_RDONLY),
+                       (mdb_mode_t)mode);
+  if(ret) {
+    librdf_log(lmdb_context->hash->world, 0, LIBRDF_LOG_ERROR,
+               LIBRDF_FROM_HASH, NULL,
+               "LMDB open of '%s' failed - %s", file, mdb_strerror(ret));
+    mdb_env_close(env);
+    LIBRDF_FREE(char*, file);
+    return 1;
+  }
+
+  ret = mdb_txn_begin(env, NULL, is_writable ? 0 : MDB_RDONLY, &txn);
+  if(!ret) {
+    ret = mdb_dbi_open(txn, "values",
+                       MDB_DUPSORT | (is_writable ? MDB_CREATE : 0),
+                       &lmdb_context->dbi);
+    if(!ret)
+      ret = mdb_dbi_open(txn, "long", (is_writable ? MDB_CREATE : 0),
+                         &lmdb_context->long_dbi);
+    if(ret)
+      mdb_txn_abort(txn);
+    else
+      ret = mdb_txn_commit(txn);
+  }
+  if(ret) {
+    librdf_log(lmdb_context->hash->world, 0, LIBRDF_LOG_ERROR,
+               LIBRDF_FROM_HASH, NULL,
+               "LMDB database open in '%s' failed - %s", file,
+               mdb_strerror(ret));
+    mdb_env_close(env);
+    LIBRDF_FREE(char*, file);
+    return 1;
+  }
+
+  lmdb_context->max_inline=(size_t)mdb_env_get_maxkeysize(env);
+  lmdb_context->env=env;
+  lmdb_context->file_name=file;
+  return 0;
+}
+
+
+/**
+ * librdf_hash_lmdb_close:
+ * @context: LMDB hash context
+ *
+ * Close the hash.
+ *
+ * Flushes the changes and finishes the association between the
+ * rdf hash and the LMDB file (does not delete the file)
+ *
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_hash_lmdb_close(void* context)
+{
+  librdf_hash_lmdb_context* lmdb_context=(librdf_hash_lmdb_context*)context;
+  int ret;
+
+  ret=librdf_hash_lmdb_sync(lmdb_context);
+
+  if(lmdb_context->read_txn) {
+    mdb_txn_abort(lmdb_context->read_txn);
+    lmdb_context->read_txn=NULL;
+    lmdb_context->read_txn_started=0;
+  }
+
+  mdb_env_close(lmdb_context->env);
+  lmdb_context->env=NULL;
+
+  LIBRDF_FREE(char*, lmdb_context->file_name);
+  lmdb_context->file_name=NULL;
+  return ret;
+}
+
+
+/**
+ * librdf_hash_lmdb_clone:
+ * @hash: new #librdf_hash that this implements
+ * @context: new LMDB hash context
+ * @new_identifier: new identifier for this hash
+ * @old_context: old LMDB hash context
+ *
+ * Clone the LMDB hash.
+ *
+ * Clones the existing LMDB hash into the new one with the
+ * new identifier.
+ *
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_hash_lmdb_clone(librdf_hash *hash, void* context, char *new_identifier,
+                       void *old_context)
+{
+  librdf_hash_lmdb_context* hcontext=(librdf_hash_lmdb_context*)context;
+  librdf_hash_lmdb_context* old_hcontext=(librdf_hash_lmdb_context*)old_context;
+  librdf_hash_datum *key, *value;
+  librdf_iterator *iterator;
+  int status=0;
+
+  /* copy data fields that might change */
+  hcontext->hash=hash;
+  hcontext->map_size=old_hcontext->map_size;
+
+  if(librdf_hash_lmdb_open(context, new_identifier,
+                           old_hcontext->mode, old_hcontext->is_writable,
+                           old_hcontext->is_new, NULL))
+    return 1;
+
+  key=librdf_new_hash_datum(hash->world, NULL, 0);
+  value=librdf_new_hash_datum(hash->world, NULL, 0);
+
+  iterator=librdf_hash_get_all(old_hcontext->hash, key, value);
+  while(!librdf_iterator_end(iterator)) {
+    librdf_hash_datum* k= (librdf_hash_datum*)librdf_iterator_get_key(iterator);
+    librdf_hash_datum* v= (librdf_hash_datum*)librdf_iterator_get_value(iterator);
+
+    if(librdf_hash_lmdb_put(hcontext, k, v)) {
+      status=1;
+      break;
+    }
+    librdf_iterator_next(iterator);
+  }
+  if(iterator)
+    librdf_free_iterator(iterator);
+
+  librdf_free_hash_datum(value);
+  librdf_free_hash_datum(key);
+
+  return status;
+}
+
+
+/**
+ * librdf_hash_lmdb_values_count:
+ * @context: LMDB hash context
+ *
+ * Get the number of values in the hash.
+ *
+ * Return value: number of values in the hash or <0 if not available
+ **/
+static int
+librdf_hash_lmdb_values_count(void *context)
+{
+  librdf_hash_lmdb_context* lmdb_context=(librdf_hash_lmdb_context*)context;
+  MDB_txn* txn;
+  MDB_stat stat;
+  int ret;
+
+  txn=librdf_hash_lmdb_read_txn(lmdb_context);
+  if(!txn)
+    return -1;
+
+  /* every duplicate of a key is counted as an entry */
+  ret=mdb_stat(txn, lmdb_context->dbi, &stat);
+  librdf_hash_lmdb_end_read(lmdb_context, txn);
+
+  if(ret)
+    return -1;
+  return (int)stat.ms_entries;
+}
+
+
+
+typedef struct {
+  librdf_hash_lmdb_context* hash;
+  /* read-only transaction owned by the cursor */
+  MDB_txn* txn;
+  MDB_cursor* cursor;
+} librdf_hash_lmdb_cursor_context;
+
+
+/**
+ * librdf_hash_lmdb_cursor_init:
+ * @cursor_context: hash cursor context
+ * @hash_context: hash to operate over
+ *
+ * Initialise a new LMDB cursor.
+ *
+ * The cursor reads a snapshot of the hash in its own read-only
+ * transaction, so changes made while it is open are not seen.
+ *
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_hash_lmdb_cursor_init(void *cursor_context, void *hash_context)
+{
+  librdf_hash_lmdb_cursor_context *cursor=(librdf_hash_lmdb_cursor_context*)cursor_context;
+  librdf_hash_lmdb_context* lmdb_context;
+  int ret;
+
+  cursor->hash=lmdb_context=(librdf_hash_lmdb_context*)hash_context;
+
+  ret=mdb_txn_begin(lmdb_context->env, NULL, MDB_RDONLY, &cursor->txn);
+  if(ret) {
+    LIBRDF_DEBUG2("LMDB cursor transaction failed - %d\n", ret);
+    cursor->txn=NULL;
+    cursor->cursor=NULL;
+    return 1;
+  }
+
+  ret=mdb_cursor_open(cursor->txn, lmdb_context->dbi, &cursor->cursor);
+  if(ret) {
+    LIBRDF_DEBUG2("LMDB cursor open failed - %d\n", ret);
+    mdb_txn_abort(cursor->txn);
+    cursor->txn=NULL;
+    cursor->cursor=NULL;
+    return 1;
+  }
+
+  return 0;
+}
+
+
+/**
+ * librdf_hash_lmdb_cursor_get:
+ * @context: LMDB hash cursor context
+ * @key: pointer to key to use
+ * @value: pointer to value to use
+ * @flags: flags
+ *
+ * Retrieve a hash value for the given key.
+ *
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_hash_lmdb_cursor_get(void* context,
+                            librdf_hash_datum *key, librdf_hash_datum *value,
+                            unsigned int flags)
+{
+  librdf_hash_lmdb_cursor_context *cursor=(librdf_hash_lmdb_cursor_context*)context;
+  unsigned char key_ref[LIBRDF_HASH_LMDB_REF_SIZE];
+  MDB_val lmdb_key;
+  MDB_val lmdb_value;
+  MDB_cursor_op op;
+  int ret=0;
+
+  lmdb_key.mv_data = NULL;
+  lmdb_key.mv_size = 0;
+  lmdb_value.mv_data = NULL;
+  lmdb_value.mv_size = 0;
+
+  switch(flags) {
+    case LIBRDF_HASH_CURSOR_SET:
+      op=MDB_SET_KEY;
+      ret=librdf_hash_lmdb_encode(cursor->hash, cursor->txn, key, &lmdb_key,
+                                  key_ref, 0);
+      break;
+
+    case LIBRDF_HASH_CURSOR_FIRST:
+      op=MDB_FIRST;
+      break;
+
+    case LIBRDF_HASH_CURSOR_NEXT_VALUE:
+      /* ends when the key changes */
+      op=MDB_NEXT_DUP;
+      break;
+
+    case LIBRDF_HASH_CURSOR_NEXT:
+      /* Get next key, or next key/value (when value defined) */
+      op=(value) ? MDB_NEXT : MDB_NEXT_NODUP;
+      break;
+
+    default:
+      librdf_log(cursor->hash->hash->world,
+                 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_HASH, NULL,
+                 "Unknown hash method flag %d", flags);
+      return 1;
+  }
+
+  if(!ret)
+    ret=mdb_cursor_get(cursor->cursor, &lmdb_key, &lmdb_value, op);
+  if(!ret)
+    ret=librdf_hash_lmdb_decode(cursor->hash, cursor->txn, &lmdb_key);
+  if(!ret && value)
+    ret=librdf_hash_lmdb_decode(cursor->hash, cursor->txn, &lmdb_value);
+  if(ret) {
+#ifdef LIBRDF_DEBUG
+    if(ret != MDB_NOTFOUND)
+      LIBRDF_DEBUG2("LMDB cursor error - %d\n", ret);
+#endif
+    key->data=NULL;
+    return ret;
+  }
+
+  /* no copies - the data stays in the map */
+  key->data = lmdb_key.mv_data;
+  key->size = lmdb_key.mv_size;
+
+  if(value) {
+    value->data = lmdb_value.mv_data;
+    value->size = lmdb_value.mv_size;
+  }
+
+  return 0;
+}
+
+
+/**
+ * librdf_hash_lmdb_cursor_finished:
+ * @context: LMDB hash cursor context
+ *
+ * Finish the serialisation of the hash LMDB get.
+ *
+ **/
+static void
+librdf_hash_lmdb_cursor_finish(void* context)
+{
+  librdf_hash_lmdb_cursor_context* cursor=(librdf_hash_lmdb_cursor_context*)context;
+
+  if(!cursor->cursor)
+    return;
+
+  mdb_cursor_close(cursor->cursor);
+  mdb_txn_abort(cursor->txn);
+}
+
+
+/**
+ * librdf_hash_lmdb_put:
+ * @context: LMDB hash context
+ * @key: pointer to key to store
+ * @value: pointer to value to store
+ *
+ * Store a key/value pair in the hash.
+ *
+ * A key/value pair that is already present is not stored again.
+ *
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_hash_lmdb_put(void* context, librdf_hash_datum *key,
+                     librdf_hash_datum *value)
+{
+  librdf_hash_lmdb_context* lmdb_context=(librdf_hash_lmdb_context*)context;
+  MDB_txn* txn;
+  int ret;
+
+  txn=librdf_hash_lmdb_begin_write(lmdb_context);
+  if(!txn)
+    return 1;
+
+  ret = librdf_hash_lmdb_put_pair(lmdb_context, txn, key, value);
+  if(ret == MDB_KEYEXIST) {
+    mdb_txn_abort(txn);
+    return 0;
+  }
+
+  return librdf_hash_lmdb_end_write(lmdb_context, txn, ret);
+}
+
+
+/**
+ * librdf_hash_lmdb_put_if_absent:
+ * @context: LMDB hash context
+ * @key: pointer to key to store
+ * @value: pointer to value to store
+ *
+ * Store a key/value pair in the hash unless it is already present.
+ *
+ * Return value: 0 if stored, >0 if already present, <0 on failure
+ **/
+static int
+librdf_hash_lmdb_put_if_absent(void* context, librdf_hash_datum *key,
+                               librdf_hash_datum *value)
+{
+  librdf_hash_lmdb_context* lmdb_context=(librdf_hash_lmdb_context*)context;
+  MDB_txn* txn;
+  int ret;
+
+  txn=librdf_hash_lmdb_begin_write(lmdb_context);
+  if(!txn)
+    return -1;
+
+  ret = librdf_hash_lmdb_put_pair(lmdb_context, txn, key, value);
+  if(ret == MDB_KEYEXIST) {
+    mdb_txn_abort(txn);
+    return 1;
+  }
+
+  return librdf_hash_lmdb_end_write(lmdb_context, txn, ret) ? -1 : 0;
+}
+
+
+/**
+ * librdf_hash_lmdb_put_many:
+ * @context: LMDB hash context
+ * @keys: array of keys
+ * @values: array of values
+ * @count: number of key/value pairs
+ *
+ * Store many key/value pairs in the hash in one transaction.
+ *
+ * If any pair cannot be stored, none are.
+ *
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_hash_lmdb_put_many(void* context, librdf_hash_datum *keys,
+                          librdf_hash_datum *values, int count)
+{
+  librdf_hash_lmdb_context* lmdb_context=(librdf_hash_lmdb_context*)context;
+  MDB_txn* txn;
+  int i;
+  int ret=0;
+
+  if(!count)
+    return 0;
+
+  txn=librdf_hash_lmdb_begin_write(lmdb_context);
+  if(!txn)
+    return 1;
+
+  for(i=0; i < count; i++) {
+    ret = librdf_hash_lmdb_put_pair(lmdb_context, txn, &keys[i], &values[i]);
+    if(ret == MDB_KEYEXIST)
+      ret = 0;
+    else if(ret)
+      break;
+  }
+
+  return librdf_hash_lmdb_end_write(lmdb_context, txn, ret);
+}
+
+
+/**
+ * librdf_hash_lmdb_key_values_count:
+ * @context: LMDB hash context
+ * @key: pointer to key
+ *
+ * Get the number of values of a key.
+ *
+ * Return value: the number of values or <0 on failure
+ **/
+static int
+librdf_hash_lmdb_key_values_count(void* context, librdf_hash_datum *key)
+{
+  librdf_hash_lmdb_context* lmdb_context=(librdf_hash_lmdb_context*)context;
+  unsigned char key_ref[LIBRDF_HASH_LMDB_REF_SIZE];
+  MDB_txn* txn;
+  MDB_cursor* lmdb_cursor;
+  MDB_val lmdb_key;
+  MDB_val lmdb_value;
+  size_t count=0;
+  int ret;
+
+  txn=librdf_hash_lmdb_read_txn(lmdb_context);
+  if(!txn)
+    return -1;
+
+  ret = librdf_hash_lmdb_encode(lmdb_context, txn, key, &lmdb_key, key_ref, 0);
+  if(!ret) {
+    ret = mdb_cursor_open(txn, lmdb_context->dbi, &lmdb_cursor);
+    if(!ret) {
+      ret = mdb_cursor_get(lmdb_cursor, &lmdb_key, &lmdb_value, MDB_SET);
+      if(!ret)
+        ret = mdb_cursor_count(lmdb_cursor, &count);
+      mdb_cursor_close(lmdb_cursor);
+    }
+  }
+
+  librdf_hash_lmdb_end_read(lmdb_context, txn);
+
+  if(ret == MDB_NOTFOUND)
+    return 0;
+
+  return ret ? -1 : (int)count;
+}
+
+
+/**
+ * librdf_hash_lmdb_exists:
+ * @context: LMDB hash context
+ * @key: pointer to key
+ * @value: pointer to value (optional)
+ *
+ * Test the existence of a key/value in the hash.
+ *
+ * The value can be NULL in which case the check will just be
+ * for the key.
+ *
+ * Return value: >0 if the key/value exists in the hash, 0 if not, <0 on failure
+ **/
+static int
+librdf_hash_lmdb_exists(void* context, librdf_hash_datum *key,
+                        librdf_hash_datum *value)
+{
+  librdf_hash_lmdb_context* lmdb_context=(librdf_hash_lmdb_context*)context;
+  unsigned char key_ref[LIBRDF_HASH_LMDB_REF_SIZE];
+  unsigned char value_ref[LIBRDF_HASH_LMDB_REF_SIZE];
+  MDB_txn* txn;
+  MDB_cursor* lmdb_cursor;
+  MDB_val lmdb_key;
+  MDB_val lmdb_value;
+  int ret;
+
+  txn=librdf_hash_lmdb_read_txn(lmdb_context);
+  if(!txn)
+    return -1;
+
+  ret = librdf_hash_lmdb_encode(lmdb_context, txn, key, &lmdb_key, key_ref, 0);
+
+  if(ret)
+    ;
+  else if(!value)
+    /* don't care about value, can use standard get */
+    ret = mdb_get(txn, lmdb_context->dbi, &lmdb_key, &lmdb_value);
+  else {
+    /* want the exact key/value */
+    ret = librdf_hash_lmdb_encode(lmdb_context, txn, value, &lmdb_value,
+                                  value_ref, 0);
+    if(!ret)
+      ret = mdb_cursor_open(txn, lmdb_context->dbi, &lmdb_cursor);
+    if(!ret) {
+      ret = mdb_cursor_get(lmdb_cursor, &lmdb_key, &lmdb_value, MDB_GET_BOTH);
+      mdb_cursor_close(lmdb_cursor);
+    }
+  }
+
+  librdf_hash_lmdb_end_read(lmdb_context, txn);
+
+  if(ret == MDB_NOTFOUND)
+    return 0;
+  else if(ret) /* failed */
+    return -1;
+  return 1;
+}
+
+
+/**
+ * librdf_hash_lmdb_delete_key:
+ * @context: LMDB hash context
+ * @key: key
+ *
+ * Delete all values for given key from the hash.
+ *
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_hash_lmdb_delete_key(void* context, librdf_hash_datum *key)
+{
+  librdf_hash_lmdb_context* lmdb_context=(librdf_hash_lmdb_context*)context;
+  unsigned char key_ref[LIBRDF_HASH_LMDB_REF_SIZE];
+  MDB_txn* txn;
+  MDB_cursor* lmdb_cursor;
+  MDB_val lmdb_key;
+  MDB_val lmdb_value;
+  int ret;
+
+  txn=librdf_hash_lmdb_begin_write(lmdb_context);
+  if(!txn)
+    return 1;
+
+  ret = librdf_hash_lmdb_encode(lmdb_context, txn, key, &lmdb_key, key_ref, 0);
+  if(!ret)
+    ret = mdb_cursor_open(txn, lmdb_context->dbi, &lmdb_cursor);
+  if(!ret) {
+    /* give up the uses of out of line data by each pair */
+    MDB_val stored_key = lmdb_key;
+
+    ret = mdb_cursor_get(lmdb_cursor, &lmdb_key, &lmdb_value, MDB_SET);
+    while(!ret) {
+      ret = librdf_hash_lmdb_release(lmdb_context, txn, &stored_key);
+      if(!ret)
+        ret = librdf_hash_lmdb_release(lmdb_context, txn, &lmdb_value);
+      if(!ret)
+        ret = mdb_cursor_get(lmdb_cursor, &lmdb_key, &lmdb_value,
+                             MDB_NEXT_DUP);
+    }
+    mdb_cursor_close(lmdb_cursor);
+
+    if(ret == MDB_NOTFOUND)
+      ret = mdb_del(txn, lmdb_context->dbi, &stored_key, NULL);
+  }
+
+  return librdf_hash_lmdb_end_write(lmdb_context, txn, ret);
+}
+
+
+/**
+ * librdf_hash_lmdb_delete_key_value:
+ * @context: LMDB hash context
+ * @key: key
+ * @value: value
+ *
+ * Delete given key/value from the hash.
+ *
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_hash_lmdb_delete_key_value(void* context,
+                                  librdf_hash_datum *key, librdf_hash_datum *value)
+{
+  librdf_hash_lmdb_context* lmdb_context=(librdf_hash_lmdb_context*)context;
+  MDB_txn* txn;
+  int ret;
+
+  txn=librdf_hash_lmdb_begin_write(lmdb_context);
+  if(!txn)
+    return 1;
+
+  ret = librdf_hash_lmdb_delete_pair(lmdb_context, txn, key, value);
+
+  return librdf_hash_lmdb_end_write(lmdb_context, txn, ret);
+}
+
+
+/**
+ * librdf_hash_lmdb_delete_many:
+ * @context: LMDB hash context
+ * @keys: array of keys
+ * @values: array of values
+ * @count: number of key/value pairs
+ *
+ * Delete many key/value pairs from the hash in one transaction.
+ *
+ * Every pair present is deleted even if some are not.
+ *
+ * Return value: non 0 on failure (including any pair not present)
+ **/
+static int
+librdf_hash_lmdb_delete_many(void* context, librdf_hash_datum *keys,
+                             librdf_hash_datum *values, int count)
+{
+  librdf_hash_lmdb_context* lmdb_context=(librdf_hash_lmdb_context*)context;
+  MDB_txn* txn;
+  int i;
+  int ret=0;
+  int status=0;
+
+  if(!count)
+    return 0;
+
+  txn=librdf_hash_lmdb_begin_write(lmdb_context);
+  if(!txn)
+    return 1;
+
+  for(i=0; i < count; i++) {
+    ret = librdf_hash_lmdb_delete_pair(lmdb_context, txn, &keys[i], &values[i]);
+    if(ret == MDB_NOTFOUND) {
+      status=1;
+      ret = 0;
+    } else if(ret)
+      break;
+  }
+
+  return librdf_hash_lmdb_end_write(lmdb_context, txn, ret) || status;
+}
+
+
+/**
+ * librdf_hash_lmdb_sync:
+ * @context: LMDB hash context
+ *
+ * Flush the hash to disk.
+ *
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_hash_lmdb_sync(void* context)
+{
+  librdf_hash_lmdb_context* lmdb_context = (librdf_hash_lmdb_context*)context;
+
+  if(!lmdb_context->is_writable)
+    return 0;
+
+  return (mdb_env_sync(lmdb_context->env, 1) != 0);
+}
+
+
+/**
+ * librdf_hash_lmdb_get_fd:
+ * @context: LMDB hash context
+ *
+ * Get the file description representing the hash.
+ *
+ * Return value: the file descriptor or < 0 on failure
+ **/
+static int
+librdf_hash_lmdb_get_fd(void* context)
+{
+  librdf_hash_lmdb_context* lmdb_context=(librdf_hash_lmdb_context*)context;
+  mdb_filehandle_t fd;
+
+  if(mdb_env_get_fd(lmdb_context->env, &fd))
+    return -1;
+  return (int)fd;
+}
+
+
+/* local function to register LMDB hash functions */
+
+/**
+ * librdf_hash_lmdb_register_factory:
+ * @factory: hash factory prototype
+ *
+ * Register the LMDB hash module with the hash factory.
+ *
+ **/
+static void
+librdf_hash_lmdb_register_factory(librdf_hash_factory *factory)
+{
+  factory->context_length = sizeof(librdf_hash_lmdb_context);
+  factory->cursor_context_length = sizeof(librdf_hash_lmdb_cursor_context);
+
+  factory->create  = librdf_hash_lmdb_create;
+  factory->destroy = librdf_hash_lmdb_destroy;
+
+  factory->open    = librdf_hash_lmdb_open;
+  factory->close   = librdf_hash_lmdb_close;
+  factory->clone   = librdf_hash_lmdb_clone;
+
+  factory->values_count = librdf_hash_lmdb_values_count;
+
+  factory->put     = librdf_hash_lmdb_put;
+  factory->exists  = librdf_hash_lmdb_exists;
+  factory->delete_key  = librdf_hash_lmdb_delete_key;
+  factory->delete_key_value  = librdf_hash_lmdb_delete_key_value;
+  factory->sync    = librdf_hash_lmdb_sync;
+  factory->get_fd  = librdf_hash_lmdb_get_fd;
+
+  factory->cursor_init   = librdf_hash_lmdb_cursor_init;
+  factory->cursor_get    = librdf_hash_lmdb_cursor_get;
+  factory->cursor_finish = librdf_hash_lmdb_cursor_finish;
+
+  factory->put_if_absent = librdf_hash_lmdb_put_if_absent;
+  factory->key_values_count = librdf_hash_lmdb_key_values_count;
+
+  factory->put_many    = librdf_hash_lmdb_put_many;
+  factory->delete_many = librdf_hash_lmdb_delete_many;
+}
+
+
+/**
+ * librdf_init_hash_lmdb:
+ * @world: redland world object
+ *
+ * Initialise the LMDB hash module.
+ *
+ **/
+void
+librdf_init_hash_lmdb(librdf_world *world)
+{
+  librdf_hash_register_factory(world,
+                               "lmdb", &librdf_hash_lmdb_register_factory);
+}
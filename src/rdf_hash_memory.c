@@ -1,7 +1,7 @@
 /* -*- Mode: c; c-basic-offset: 2 -*-
- *
+ * 
  * rdf_hash_memory.c - RDF Hash In Memory Implementation
- *
+ * 
  * Copyright (C) 2000-2008, David Beckett http://www.dajobe.org/
  * Copyright (C) 2000-2004, University of Bristol, UK http://www.bristol.ac.uk/
  * 
@@ -44,48 +44,171 @@
 #include <rdf_types.h>
 
 
+/*
+ * The memory hash is an open-addressing table.  Each slot has one
+ * control byte which is either EMPTY, DELETED (a tombstone) or, for
+ * a used slot, the low 7 bits of the key hash.  The control bytes
+ * are probed a group of 16 slots at a time using SSE2 or NEON
+ * comparisons where available, so a lookup normally touches one
+ * cache line of control bytes and then only the entries whose 7 bit
+ * hash matches.
+ * 
+ * Keys and values are stored inline in records allocated from a slab
+ * owned by the hash so a put does no per-record malloc().  Deleted
+ * records go on free lists by size for reuse and when more of the
+ * slab is wasted than used, the live records are compacted into a
+ * new slab.
+ * 
+ * Keys are hashed with the function chosen by the hash-function
+ * option (see librdf_get_hash_function()) and the low 32 bits of the
+ * result are kept in each entry for rehashing.
+ */
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LIBRDF_HASH_MEMORY_SSE2 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define LIBRDF_HASH_MEMORY_NEON 1
+#endif
+
+
+/* number of control bytes probed together */
+#define LIBRDF_HASH_MEMORY_GROUP_WIDTH 16
+
+/* control byte values.  Used slots hold a value 0x00-0x7F */
+#define LIBRDF_HASH_MEMORY_CTRL_EMPTY   ((byte)0x80)
+#define LIBRDF_HASH_MEMORY_CTRL_DELETED ((byte)0xFE)
+#define LIBRDF_HASH_MEMORY_CTRL_IS_FULL(c) (!((c) & 0x80))
+
+/* split of the hash into the group selector and the control byte */
+#define LIBRDF_HASH_MEMORY_H1(h) ((h) >> 7)
+#define LIBRDF_HASH_MEMORY_H2(h) ((byte)((h) & 0x7F))
+
+/* how many keys ahead put_many and delete_many prefetch the table */
+#define LIBRDF_HASH_MEMORY_PREFETCH_DISTANCE 8
+
+#ifdef __GNUC__
+#define LIBRDF_HASH_MEMORY_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define LIBRDF_HASH_MEMORY_PREFETCH(addr) do { } while(0)
+#endif
+
+/* alignment of records in the slab */
+#define LIBRDF_HASH_MEMORY_ALIGN(size) (((size) + 7) & ~((size_t)7))
+
+/* freed records up to this many 8 byte units are kept for reuse */
+#define LIBRDF_HASH_MEMORY_FREE_CLASSES 32
+#define LIBRDF_HASH_MEMORY_FREE_CLASS(size) (((size) >> 3) - 1)
+
+/* size of key and value records */
+#define LIBRDF_HASH_MEMORY_ENTRY_SIZE(key_len) \
+  LIBRDF_HASH_MEMORY_ALIGN(sizeof(librdf_hash_memory_entry) + (key_len))
+#define LIBRDF_HASH_MEMORY_VALUE_SIZE(value_len) \
+  LIBRDF_HASH_MEMORY_ALIGN(sizeof(librdf_hash_memory_value) + (value_len))
+
+
 /* private structures */
-struct librdf_hash_memory_node_value_s
+
+/* A value record; the value bytes follow the structure in the slab */
+struct librdf_hash_memory_value_s
 {
-  struct librdf_hash_memory_node_value_s* next;
-  void *value;
+  struct librdf_hash_memory_value_s* next;
   size_t value_len;
 };
-typedef struct librdf_hash_memory_node_value_s librdf_hash_memory_node_value;
+typedef struct librdf_hash_memory_value_s librdf_hash_memory_value;
+
+#define LIBRDF_HASH_MEMORY_VALUE_DATA(v) \
+  ((unsigned char*)(v) + sizeof(librdf_hash_memory_value))
 
 
-struct librdf_hash_memory_node_s
+/* A key record; the key bytes follow the structure in the slab */
+struct librdf_hash_memory_entry_s
 {
-  struct librdf_hash_memory_node_s* next;
-  void *key;
+  librdf_hash_memory_value *values;
   size_t key_len;
   u32 hash_key;
-  librdf_hash_memory_node_value *values;
   int values_count;
 };
-typedef struct librdf_hash_memory_node_s librdf_hash_memory_node;
+typedef struct librdf_hash_memory_entry_s librdf_hash_memory_entry;
+
+#define LIBRDF_HASH_MEMORY_ENTRY_KEY(e) \
+  ((unsigned char*)(e) + sizeof(librdf_hash_memory_entry))
+
+
+/* A slab chunk; records are bump allocated from the data after it */
+struct librdf_hash_memory_slab_s
+{
+  struct librdf_hash_memory_slab_s* next;
+  size_t size;
+  size_t used;
+};
+typedef struct librdf_hash_memory_slab_s librdf_hash_memory_slab;
+
+#define LIBRDF_HASH_MEMORY_SLAB_DATA(s) \
+  ((unsigned char*)(s) + LIBRDF_HASH_MEMORY_ALIGN(sizeof(librdf_hash_memory_slab)))
+
+
+/* A table of slots */
+typedef struct
+{
+  /* control bytes, one per slot; the entries array follows them */
+  byte* ctrl;
+  /* An array pointing to the entries */
+  librdf_hash_memory_entry** entries;
+  /* total array size */
+  int capacity;
+} librdf_hash_memory_table;
 
 
 typedef struct
 {
   /* the hash object */
   librdf_hash* hash;
-  /* An array pointing to a list of nodes (buckets) */
-  librdf_hash_memory_node** nodes;
-  /* this many buckets used */
-  int size;
-  /* this many keys */
+  /* the table new keys are added to */
+  librdf_hash_memory_table table;
+  /* this many keys, in both tables */
   int keys;
   /* this many values */
   int values;
-  /* total array size */
-  int capacity;
+  /* this many slots of table are DELETED tombstones */
+  int tombstones;
+
+  /* While the table is being resized, the previous table.  Its keys
+   * are moved to table a few groups at a time by each change to the
+   * hash so no single put pays for the whole resize.  Lookups check
+   * both tables.
+   */
+  librdf_hash_memory_table old_table;
+  /* this many keys are still in old_table */
+  int old_keys;
+  /* next slot of old_table to move */
+  int old_next_slot;
 
   /* array load factor expressed out of 1000.
-   * Always true: (size/capacity * 1000) < load_factor,
-   * or in the code: size * 1000 < load_factor * capacity
+   * Always true: ((keys+tombstones)/capacity * 1000) < load_factor,
+   * or in the code: (keys+tombstones) * 1000 < load_factor * capacity
+   * counting only the keys in table.
    */
   int load_factor;
+
+  /* slab chunks holding the key and value records, newest first */
+  librdf_hash_memory_slab* slabs;
+  /* size of the next slab chunk to allocate */
+  size_t slab_size;
+  /* number of slab chunks and their total size */
+  int slabs_count;
+  size_t slabs_bytes;
+  /* bytes in records in use */
+  size_t slabs_bytes_used;
+  /* freed records by size class, linked through their first word */
+  void* free_records[LIBRDF_HASH_MEMORY_FREE_CLASSES];
+  /* number of open cursors; the slab is not compacted while any are */
+  int cursors;
+
+  /* key hash function and its seed */
+  librdf_hash_function hash_function;
+  u64 hash_seed;
 } librdf_hash_memory_context;
 
 
@@ -93,13 +216,22 @@ typedef struct
 /* default load_factor out of 1000 */
 static const int librdf_hash_default_load_factor=750;
 
-/* starting capacity - MUST BE POWER OF 2 */
-static const int librdf_hash_initial_capacity=8;
+/* starting capacity - MUST BE POWER OF 2 and at least one group */
+static const int librdf_hash_initial_capacity=LIBRDF_HASH_MEMORY_GROUP_WIDTH;
+
+/* groups of old_table slots moved per change during a resize.  This
+ * must move all of old_table before table fills up: it takes at most
+ * capacity/(16*4) puts which is well inside the room left in table
+ */
+#define LIBRDF_HASH_MEMORY_MIGRATE_GROUPS 4
+
+/* first and largest slab chunk sizes */
+static const size_t librdf_hash_memory_initial_slab_size=256;
+static const size_t librdf_hash_memory_max_slab_size=65536;
 
 
 /* prototypes for local functions */
-static librdf_hash_memory_node* librdf_hash_memory_find_node(librdf_hash_memory_context* hash, void *key, size_t key_len, int *bucket, librdf_hash_memory_node** prev);
-static void librdf_free_hash_memory_node(librdf_hash_memory_node* node);
+static int librdf_hash_memory_find_slot(librdf_hash_memory_context* hash, const void *key, size_t key_len, u32 hash_key, librdf_hash_memory_table** table_p);
 static int librdf_hash_memory_expand_size(librdf_hash_memory_context* hash);
 
 /* Implementing the hash cursor */
@@ -124,336 +256,1125 @@ static int librdf_hash_memory_delete_key(void* context, librdf_hash_datum *key);
 static int librdf_hash_memory_delete_key_value(void* context, librdf_hash_datum *key, librdf_hash_datum *value);
 static int librdf_hash_memory_sync(void* context);
 static int librdf_hash_memory_get_fd(void* context);
+static int librdf_hash_memory_prepare_key(void* context, librdf_hash_datum *key);
+static int librdf_hash_memory_put_prepared(void* context, librdf_hash_datum *key, librdf_hash_datum *value);
+static int librdf_hash_memory_exists_prepared(void* context, librdf_hash_datum *key, librdf_hash_datum *value);
+static int librdf_hash_memory_delete_prepared(void* context, librdf_hash_datum *key, librdf_hash_datum *value);
+static char* librdf_hash_memory_get_option(void* context, const char *name);
+static int librdf_hash_memory_put_many(void* context, librdf_hash_datum *keys, librdf_hash_datum *values, int count);
+static int librdf_hash_memory_put_if_absent(void* context, librdf_hash_datum *key, librdf_hash_datum *value);
+static int librdf_hash_memory_key_values_count(void* context, librdf_hash_datum *key);
+static int librdf_hash_memory_delete_many(void* context, librdf_hash_datum *keys, librdf_hash_datum *values, int count);
 
 static void librdf_hash_memory_register_factory(librdf_hash_factory *factory);
 
 
 
 
+/* helper functions */
+
+
 /*
- * perldelta 5.8.0 says under *Performance Enhancements*
- *
- *   Hashes now use Bob Jenkins "One-at-a-Time" hashing key algorithm
- *   http://burtleburtle.net/bob/hash/doobs.html  This algorithm is
- *   reasonably fast while producing a much better spread of values
- *   than the old hashing algorithm ...
- *
- * Changed here to hash the string backwards to help do URIs better
- *
+ * librdf_hash_memory_key_hash:
+ * @hash: the memory hash context
+ * @key: key
+ * 
+ * INTERNAL - Get the hash of a key.
+ * 
+ * Return value: the hash
  */
-
-#define ONE_AT_A_TIME_HASH(hash,str,len) \
-     do { \
-        register const unsigned char *c_oneat = (unsigned char*)str+len-1; \
-        register size_t i_oneat = len; \
-        register u32 hash_oneat = 0; \
-        while (i_oneat--) { \
-            hash_oneat += *c_oneat--; \
-            hash_oneat += (hash_oneat << 10); \
-            hash_oneat ^= (hash_oneat >> 6); \
-        } \
-        hash_oneat += (hash_oneat << 3); \
-        hash_oneat ^= (hash_oneat >> 11); \
-        (hash) = (hash_oneat + (hash_oneat << 15)); \
-    } while(0)
+static REDLAND_INLINE u32
+librdf_hash_memory_key_hash(librdf_hash_memory_context* hash,
+                            librdf_hash_datum* key)
+{
+  return (u32)hash->hash_function(key->data, key->size, hash->hash_seed);
+}
 
 
+/*
+ * librdf_hash_memory_prepared_key_hash:
+ * @hash: the memory hash context
+ * @key: key prepared by librdf_hash_prepare_key()
+ * 
+ * INTERNAL - Get the hash of a prepared key, using the one saved in
+ * the key if it was made the same way.
+ * 
+ * Return value: the hash
+ */
+static REDLAND_INLINE u32
+librdf_hash_memory_prepared_key_hash(librdf_hash_memory_context* hash,
+                                     librdf_hash_datum* key)
+{
+  if(key->hash_function == hash->hash_function &&
+     key->hash_seed == hash->hash_seed)
+    return (u32)key->hash_value;
 
-/* helper functions */
+  return librdf_hash_memory_key_hash(hash, key);
+}
 
 
-/**
- * librdf_hash_memory_find_node:
- * @hash: the memory hash context
- * @key: key string
- * @key_len: key string length
- * @user_bucket: pointer to store bucket
- * @prev: pointer to store previous node
- *
- * Find the node for the given key or value.
- * 
- * If value is not NULL and value_len is non 0, the value will also be
- * compared in the search.
- *
- * If user_bucket is not NULL, the bucket used will be returned.  if
- * prev is no NULL, the previous node in the list will be returned.
- * 
- * Return value: #librdf_hash_memory_node of content or NULL on failure
- **/
-static librdf_hash_memory_node*
-librdf_hash_memory_find_node(librdf_hash_memory_context* hash, 
-			     void *key, size_t key_len,
-			     int *user_bucket,
-			     librdf_hash_memory_node** prev) 
+#ifdef LIBRDF_HASH_MEMORY_NEON
+static REDLAND_INLINE unsigned int
+librdf_hash_memory_neon_movemask(uint8x16_t cmp)
 {
-  librdf_hash_memory_node* node;
-  int bucket;
-  u32 hash_key;
+  static const byte bits[16] = { 1, 2, 4, 8, 16, 32, 64, 128,
+                                 1, 2, 4, 8, 16, 32, 64, 128 };
+  uint8x16_t masked = vandq_u8(cmp, vld1q_u8(bits));
 
-  /* empty hash */
-  if(!hash->capacity)
-    return NULL;
-  
-  ONE_AT_A_TIME_HASH(hash_key, key, key_len);
+  return (unsigned int)vaddv_u8(vget_low_u8(masked)) |
+         ((unsigned int)vaddv_u8(vget_high_u8(masked)) << 8);
+}
+#endif
 
-  if(prev)
-    *prev=NULL;
 
-  /* find slot in table */
-  bucket=hash_key & (hash->capacity - 1);
-  if(user_bucket)
-    *user_bucket=bucket;
+/*
+ * librdf_hash_memory_group_match:
+ * @ctrl: start of a group of control bytes
+ * @c: control byte to look for
+ * 
+ * INTERNAL - Find the slots in a group with the given control byte.
+ * 
+ * Return value: bit mask with bit i set if ctrl[i] == c
+ */
+static REDLAND_INLINE unsigned int
+librdf_hash_memory_group_match(const byte* ctrl, byte c)
+{
+#if defined(LIBRDF_HASH_MEMORY_SSE2)
+  __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+
+  return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(group,
+                                                        _mm_set1_epi8((char)c)));
+#elif defined(LIBRDF_HASH_MEMORY_NEON)
+  return librdf_hash_memory_neon_movemask(vceqq_u8(vld1q_u8(ctrl),
+                                                   vdupq_n_u8(c)));
+#else
+  unsigned int mask = 0;
+  int i;
 
-  /* check if there is a list present */ 
-  node=hash->nodes[bucket];
-  if(!node)
-    /* no list there */
-    return NULL;
-    
-  /* walk the list */
-  while(node) {
-    if(key_len == node->key_len && !memcmp(key, node->key, key_len))
-      break;
-    if(prev)
-      *prev=node;
-    node=node->next;
-  }
+  for(i = 0; i < LIBRDF_HASH_MEMORY_GROUP_WIDTH; i++)
+    if(ctrl[i] == c)
+      mask |= (1U << i);
+  return mask;
+#endif
+}
 
-  return node;
+
+/*
+ * librdf_hash_memory_group_match_free:
+ * @ctrl: start of a group of control bytes
+ * 
+ * INTERNAL - Find the EMPTY or DELETED slots in a group.
+ * 
+ * Return value: bit mask with bit i set if slot i can be inserted into
+ */
+static REDLAND_INLINE unsigned int
+librdf_hash_memory_group_match_free(const byte* ctrl)
+{
+#if defined(LIBRDF_HASH_MEMORY_SSE2)
+  return (unsigned int)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+#elif defined(LIBRDF_HASH_MEMORY_NEON)
+  return librdf_hash_memory_neon_movemask(vtstq_u8(vld1q_u8(ctrl),
+                                                   vdupq_n_u8(0x80)));
+#else
+  unsigned int mask = 0;
+  int i;
+
+  for(i = 0; i < LIBRDF_HASH_MEMORY_GROUP_WIDTH; i++)
+    if(!LIBRDF_HASH_MEMORY_CTRL_IS_FULL(ctrl[i]))
+      mask |= (1U << i);
+  return mask;
+#endif
 }
 
 
-static void
-librdf_free_hash_memory_node(librdf_hash_memory_node* node) 
+/* index of lowest set bit in a non-0 group mask */
+static REDLAND_INLINE int
+librdf_hash_memory_first_bit(unsigned int mask)
 {
-  if(node->key)
-    LIBRDF_FREE(char*, node->key);
-  if(node->values) {
-    librdf_hash_memory_node_value *vnode, *next;
-
-    /* Empty the list of values */
-    for(vnode=node->values; vnode; vnode=next) {
-      next=vnode->next;
-      if(vnode->value)
-        LIBRDF_FREE(char*, vnode->value);
-      LIBRDF_FREE(librdf_hash_memory_node_value, vnode);
-    }
+#if defined(__GNUC__)
+  return __builtin_ctz(mask);
+#else
+  int i = 0;
+
+  while(!(mask & 1)) {
+    mask >>= 1;
+    i++;
   }
-  LIBRDF_FREE(librdf_hash_memory_node, node);
+  return i;
+#endif
 }
 
 
-static int
-librdf_hash_memory_expand_size(librdf_hash_memory_context* hash) {
-  int required_capacity=0;
-  librdf_hash_memory_node **new_nodes;
-  int i;
-
-  if (hash->capacity) {
-    /* big enough */
-    if((1000 * hash->keys) < (hash->load_factor * hash->capacity))
-      return 0;
-    /* grow hash (keeping it a power of two) */
-    required_capacity=hash->capacity << 1;
-  } else {
-    required_capacity=librdf_hash_initial_capacity;
-  }
+/*
+ * librdf_hash_memory_slab_alloc:
+ * @hash: the memory hash context
+ * @size: bytes wanted
+ * 
+ * INTERNAL - Allocate a record from the hash slab, reusing a freed
+ * record of the same size if there is one.
+ * 
+ * Return value: pointer to the record or NULL on failure
+ */
+static void*
+librdf_hash_memory_slab_alloc(librdf_hash_memory_context* hash, size_t size)
+{
+  librdf_hash_memory_slab* slab = hash->slabs;
+  size_t header_size = LIBRDF_HASH_MEMORY_ALIGN(sizeof(*slab));
+  void *p;
 
-  /* allocate new table */
-  new_nodes = LIBRDF_CALLOC(librdf_hash_memory_node**, 
-                            required_capacity,
-                            sizeof(librdf_hash_memory_node*));
-  if(!new_nodes)
-    return 1;
+  size = LIBRDF_HASH_MEMORY_ALIGN(size);
 
+  if(LIBRDF_HASH_MEMORY_FREE_CLASS(size) < LIBRDF_HASH_MEMORY_FREE_CLASSES) {
+    void** free_list = &hash->free_records[LIBRDF_HASH_MEMORY_FREE_CLASS(size)];
 
-  /* it is a new hash empty hash - we are done */
-  if(!hash->size) {
-    hash->capacity=required_capacity;
-    hash->nodes=new_nodes;
-    return 0;
+    if(*free_list) {
+      p = *free_list;
+      *free_list = *(void**)p;
+      hash->slabs_bytes_used += size;
+      return p;
+    }
   }
-  
-
-  for(i=0; i<hash->capacity; i++) {
-    librdf_hash_memory_node *node=hash->nodes[i];
-      
-    /* walk all attached nodes */
-    while(node) {
-      librdf_hash_memory_node *next;
-      int bucket;
-
-      next=node->next;
-      /* find slot in new table */
-      bucket=node->hash_key & (required_capacity - 1);
-      node->next=new_nodes[bucket];
-      new_nodes[bucket]=node;
-
-      node=next;
+
+  if(!slab || slab->used + size > slab->size) {
+    size_t slab_size = hash->slab_size;
+
+    if(slab_size < size)
+      slab_size = size;
+
+    slab = LIBRDF_MALLOC(librdf_hash_memory_slab*, header_size + slab_size);
+    if(!slab)
+      return NULL;
+    slab->size = slab_size;
+    slab->used = 0;
+    hash->slabs_count++;
+    hash->slabs_bytes += slab_size;
+
+    if(hash->slabs && size > hash->slab_size) {
+      /* An oversized record gets a chunk of its own, kept behind the
+       * current chunk so that chunk can still be used for small records
+       */
+      slab->next = hash->slabs->next;
+      hash->slabs->next = slab;
+    } else {
+      slab->next = hash->slabs;
+      hash->slabs = slab;
+      if(hash->slab_size < librdf_hash_memory_max_slab_size)
+        hash->slab_size <<= 1;
     }
   }
 
-  /* now free old table */
-  LIBRDF_FREE(librdf_hash_memory_nodes, hash->nodes);
+  p = LIBRDF_HASH_MEMORY_SLAB_DATA(slab) + slab->used;
+  slab->used += size;
+  hash->slabs_bytes_used += size;
+  return p;
+}
+
 
-  /* attach new one */
-  hash->capacity=required_capacity;
-  hash->nodes=new_nodes;
+/*
+ * librdf_hash_memory_slab_free:
+ * @hash: the memory hash context
+ * @p: record
+ * @size: size of the record
+ * 
+ * INTERNAL - Return a record to the hash slab.
+ * 
+ * Small records are kept for reuse; the space of larger ones is only
+ * recovered by librdf_hash_memory_compact().
+ */
+static void
+librdf_hash_memory_slab_free(librdf_hash_memory_context* hash, void *p,
+                             size_t size)
+{
+  size = LIBRDF_HASH_MEMORY_ALIGN(size);
+  hash->slabs_bytes_used -= size;
 
-  return 0;
+  if(LIBRDF_HASH_MEMORY_FREE_CLASS(size) < LIBRDF_HASH_MEMORY_FREE_CLASSES) {
+    void** free_list = &hash->free_records[LIBRDF_HASH_MEMORY_FREE_CLASS(size)];
+
+    *(void**)p = *free_list;
+    *free_list = p;
+  }
 }
 
 
+/*
+ * librdf_hash_memory_slab_wasted:
+ * @hash: the memory hash context
+ * 
+ * INTERNAL - Get the number of slab bytes neither in use nor available
+ * at the end of the current chunk.  This includes the free lists.
+ * 
+ * Return value: number of bytes
+ */
+static size_t
+librdf_hash_memory_slab_wasted(librdf_hash_memory_context* hash)
+{
+  size_t available = 0;
+
+  if(hash->slabs)
+    available = hash->slabs->size - hash->slabs->used;
+
+  return hash->slabs_bytes - hash->slabs_bytes_used - available;
+}
 
-/* functions implementing hash api */
 
-/**
- * librdf_hash_memory_create:
- * @hash: #librdf_hash hash
- * @context: memory hash contxt
- *
- * Create a new memory hash.
+/*
+ * librdf_hash_memory_free_slabs:
+ * @hash: the memory hash context
  * 
- * Return value: non 0 on failure
- **/
-static int
-librdf_hash_memory_create(librdf_hash* hash, void* context) 
+ * INTERNAL - Free all the slab chunks and the records in them.
+ */
+static void
+librdf_hash_memory_free_slabs(librdf_hash_memory_context* hash)
 {
-  librdf_hash_memory_context* hcontext=(librdf_hash_memory_context*)context;
+  librdf_hash_memory_slab *slab, *next;
 
-  hcontext->hash=hash;
-  hcontext->load_factor=librdf_hash_default_load_factor;
-  return librdf_hash_memory_expand_size(hcontext);
+  for(slab = hash->slabs; slab; slab = next) {
+    next = slab->next;
+    LIBRDF_FREE(librdf_hash_memory_slab, slab);
+  }
+  hash->slabs = NULL;
+  hash->slab_size = librdf_hash_memory_initial_slab_size;
+  hash->slabs_count = 0;
+  hash->slabs_bytes = 0;
+  hash->slabs_bytes_used = 0;
+  memset(hash->free_records, 0, sizeof(hash->free_records));
 }
 
 
-/**
- * librdf_hash_memory_destroy:
- * @context: memory hash context
- *
- * Destroy a memory hash.
+/*
+ * librdf_hash_memory_compact_table:
+ * @table: table
+ * @p: where to copy the records to
  * 
- * Return value: non 0 on failure
- **/
-static int
-librdf_hash_memory_destroy(void* context) 
+ * INTERNAL - Copy the records of the keys in a table to @p onwards.
+ * 
+ * Return value: the end of the copied records
+ */
+static unsigned char*
+librdf_hash_memory_compact_table(librdf_hash_memory_table* table,
+                                 unsigned char *p)
 {
-  librdf_hash_memory_context* hcontext=(librdf_hash_memory_context*)context;
+  int i;
 
-  if(hcontext->nodes) {
-    int i;
-  
-    for(i=0; i<hcontext->capacity; i++) {
-      librdf_hash_memory_node *node=hcontext->nodes[i];
-      
-      /* this entry is used */
-      if(node) {
-        librdf_hash_memory_node *next;
-        /* free all attached nodes */
-        while(node) {
-          next=node->next;
-          librdf_free_hash_memory_node(node);
-          node=next;
-        }
-      }
+  for(i = 0; i < table->capacity; i++) {
+    librdf_hash_memory_entry *entry;
+    librdf_hash_memory_value *vnode, **vprev;
+    size_t record_size;
+
+    if(!LIBRDF_HASH_MEMORY_CTRL_IS_FULL(table->ctrl[i]))
+      continue;
+
+    record_size = LIBRDF_HASH_MEMORY_ENTRY_SIZE(table->entries[i]->key_len);
+    entry = (librdf_hash_memory_entry*)p;
+    memcpy(entry, table->entries[i], record_size);
+    p += record_size;
+    table->entries[i] = entry;
+
+    for(vprev = &entry->values; *vprev; vprev = &vnode->next) {
+      record_size = LIBRDF_HASH_MEMORY_VALUE_SIZE((*vprev)->value_len);
+      vnode = (librdf_hash_memory_value*)p;
+      memcpy(vnode, *vprev, record_size);
+      p += record_size;
+      *vprev = vnode;
     }
-    LIBRDF_FREE(librdf_hash_memory_nodes, hcontext->nodes);
   }
 
-  return 0;
+  return p;
 }
 
 
-/**
- * librdf_hash_memory_open:
- * @context: memory hash context
- * @identifier: identifier - not used
- * @mode: access mode - not used
- * @is_writable: is hash writable? - not used
- * @is_new: is hash new? - not used
- * @options: #librdf_hash of options - not used
- *
- * Open memory hash with given parameters.
+/*
+ * librdf_hash_memory_compact:
+ * @hash: the memory hash context
+ * 
+ * INTERNAL - Copy all the records in use into one new slab chunk and
+ * free the old chunks.
+ * 
+ * This moves every key and value so it must not be done while there
+ * are open cursors.
  * 
  * Return value: non 0 on failure
- **/
+ */
 static int
-librdf_hash_memory_open(void* context, const char *identifier,
-                        int mode, int is_writable, int is_new,
-                        librdf_hash* options) 
+librdf_hash_memory_compact(librdf_hash_memory_context* hash)
 {
-  /* NOP */
+  librdf_hash_memory_slab *old_slabs = hash->slabs;
+  librdf_hash_memory_slab *slab;
+  size_t header_size = LIBRDF_HASH_MEMORY_ALIGN(sizeof(*slab));
+  size_t size = hash->slabs_bytes_used;
+  size_t slab_size = hash->slab_size;
+  unsigned char *p;
+
+  if(!size || hash->cursors)
+    return 0;
+
+  slab = LIBRDF_MALLOC(librdf_hash_memory_slab*, header_size + size);
+  if(!slab)
+    return 1;
+  slab->next = NULL;
+  slab->size = size;
+  slab->used = size;
+
+  p = LIBRDF_HASH_MEMORY_SLAB_DATA(slab);
+  p = librdf_hash_memory_compact_table(&hash->table, p);
+  if(hash->old_table.ctrl)
+    librdf_hash_memory_compact_table(&hash->old_table, p);
+
+  hash->slabs = old_slabs;
+  librdf_hash_memory_free_slabs(hash);
+
+  hash->slabs = slab;
+  hash->slab_size = slab_size;
+  hash->slabs_count = 1;
+  hash->slabs_bytes = size;
+  hash->slabs_bytes_used = size;
+
   return 0;
 }
 
 
-/**
- * librdf_hash_memory_close:
- * @context: memory hash context
- *
- * Close the hash.
+/*
+ * librdf_hash_memory_new_value:
+ * @hash: the memory hash context
+ * @value: value to copy
  * 
- * Return value: non 0 on failure
- **/
-static int
-librdf_hash_memory_close(void* context) 
+ * INTERNAL - Allocate a value record holding a copy of @value
+ * 
+ * Return value: new record or NULL on failure
+ */
+static librdf_hash_memory_value*
+librdf_hash_memory_new_value(librdf_hash_memory_context* hash,
+                             librdf_hash_datum *value)
 {
-  /* NOP */
-  return 0;
+  librdf_hash_memory_value* vnode;
+
+  vnode = (librdf_hash_memory_value*)librdf_hash_memory_slab_alloc(hash,
+                                                                    sizeof(*vnode) + value->size);
+  if(!vnode)
+    return NULL;
+
+  vnode->next = NULL;
+  vnode->value_len = value->size;
+  if(value->size)
+    memcpy(LIBRDF_HASH_MEMORY_VALUE_DATA(vnode), value->data, value->size);
+  return vnode;
 }
 
 
+/*
+ * librdf_hash_memory_table_find_slot:
+ * @table: table to search
+ * @key: key string
+ * @key_len: key string length
+ * @hash_key: hash of the key
+ * 
+ * INTERNAL - Find the slot of a table holding the given key.
+ * 
+ * Return value: slot index or <0 if the key is not present
+ */
 static int
-librdf_hash_memory_clone(librdf_hash *hash, void* context, char *new_identifer,
-                         void *old_context) 
+librdf_hash_memory_table_find_slot(librdf_hash_memory_table* table,
+                                   const void *key, size_t key_len,
+                                   u32 hash_key)
 {
-  librdf_hash_memory_context* hcontext=(librdf_hash_memory_context*)context;
-  librdf_hash_memory_context* old_hcontext=(librdf_hash_memory_context*)old_context;
-  librdf_hash_datum *key, *value;
-  librdf_iterator *iterator;
-  int status=0;
-  
-  /* copy data fields that might change */
-  hcontext->hash=hash;
-  hcontext->load_factor=old_hcontext->load_factor;
+  int groups_mask;
+  int group;
+  int probe;
+  byte h2 = LIBRDF_HASH_MEMORY_H2(hash_key);
 
-  /* Don't need to deal with new_identifier - not used for memory hashes */
+  /* empty table */
+  if(!table->capacity)
+    return -1;
 
-  /* Use higher level functions to iterator this data
-   * on the other hand, maybe this is a good idea since that
-   * code is tested and works
-   */
+  groups_mask = (table->capacity / LIBRDF_HASH_MEMORY_GROUP_WIDTH) - 1;
+  group = (int)(LIBRDF_HASH_MEMORY_H1(hash_key) & (u32)groups_mask);
 
-  key=librdf_new_hash_datum(hash->world, NULL, 0);
-  value=librdf_new_hash_datum(hash->world, NULL, 0);
+  /* triangular probe over groups - visits every group once */
+  for(probe = 1; probe <= groups_mask + 1; probe++) {
+    const byte* ctrl = table->ctrl + group * LIBRDF_HASH_MEMORY_GROUP_WIDTH;
+    unsigned int match = librdf_hash_memory_group_match(ctrl, h2);
 
-  iterator=librdf_hash_get_all(old_hcontext->hash, key, value);
-  while(!librdf_iterator_end(iterator)) {
-    librdf_hash_datum* k= (librdf_hash_datum*)librdf_iterator_get_key(iterator);
-    librdf_hash_datum* v= (librdf_hash_datum*)librdf_iterator_get_value(iterator);
+    while(match) {
+      int slot = group * LIBRDF_HASH_MEMORY_GROUP_WIDTH +
+                 librdf_hash_memory_first_bit(match);
+      librdf_hash_memory_entry* entry = table->entries[slot];
 
-    if(librdf_hash_memory_put(hcontext, k, v)) {
-      status=1;
-      break;
+      if(entry->hash_key == hash_key && entry->key_len == key_len &&
+         !memcmp(key, LIBRDF_HASH_MEMORY_ENTRY_KEY(entry), key_len))
+        return slot;
+
+      match &= match - 1;
     }
-    librdf_iterator_next(iterator);
-  }
-  if(iterator)
-    librdf_free_iterator(iterator);
 
-  librdf_free_hash_datum(value);
-  librdf_free_hash_datum(key);
+    /* a group with an EMPTY slot ends every probe sequence through it */
+    if(librdf_hash_memory_group_match(ctrl, LIBRDF_HASH_MEMORY_CTRL_EMPTY))
+      break;
 
-  return status;
+    group = (group + probe) & groups_mask;
+  }
+
+  return -1;
 }
 
 
 /**
- * librdf_hash_memory_values_count:
- * @context: memory hash cursor context
- *
- * Get the number of values in the hash.
- * 
+ * librdf_hash_memory_find_slot:
+ * @hash: the memory hash context
+ * @key: key string
+ * @key_len: key string length
+ * @hash_key: hash of the key
+ * @table_p: pointer to store the table holding the key
+ * 
+ * Find the slot holding the given key in either table.
+ * 
+ * Return value: slot index or <0 if the key is not present
+ **/
+static int
+librdf_hash_memory_find_slot(librdf_hash_memory_context* hash,
+                             const void *key, size_t key_len, u32 hash_key,
+                             librdf_hash_memory_table** table_p)
+{
+  int slot;
+
+  slot = librdf_hash_memory_table_find_slot(&hash->table, key, key_len,
+                                            hash_key);
+  if(slot >= 0) {
+    *table_p = &hash->table;
+    return slot;
+  }
+
+  if(hash->old_table.ctrl) {
+    slot = librdf_hash_memory_table_find_slot(&hash->old_table, key, key_len,
+                                              hash_key);
+    if(slot >= 0) {
+      *table_p = &hash->old_table;
+      return slot;
+    }
+  }
+
+  return -1;
+}
+
+
+/*
+ * librdf_hash_memory_find_free_slot:
+ * @ctrl: control bytes of the table
+ * @capacity: number of slots in the table
+ * @hash_key: hash of the key to insert
+ * 
+ * INTERNAL - Find the first EMPTY or DELETED slot in a key's probe sequence
+ * 
+ * Return value: slot index (the table is never full)
+ */
+static int
+librdf_hash_memory_find_free_slot(const byte* ctrl, int capacity,
+                                  u32 hash_key)
+{
+  int groups_mask = (capacity / LIBRDF_HASH_MEMORY_GROUP_WIDTH) - 1;
+  int group = (int)(LIBRDF_HASH_MEMORY_H1(hash_key) & (u32)groups_mask);
+  int probe;
+
+  for(probe = 1; ; probe++) {
+    unsigned int match;
+
+    match = librdf_hash_memory_group_match_free(ctrl + group * LIBRDF_HASH_MEMORY_GROUP_WIDTH);
+    if(match)
+      return group * LIBRDF_HASH_MEMORY_GROUP_WIDTH +
+             librdf_hash_memory_first_bit(match);
+
+    group = (group + probe) & groups_mask;
+  }
+}
+
+
+/*
+ * librdf_hash_memory_table_insert:
+ * @table: table with a free slot
+ * @entry: entry
+ * 
+ * INTERNAL - Add an entry to a table
+ * 
+ * Return value: non 0 if the entry went into a DELETED slot
+ */
+static int
+librdf_hash_memory_table_insert(librdf_hash_memory_table* table,
+                                librdf_hash_memory_entry* entry)
+{
+  int slot;
+  int was_deleted;
+
+  slot = librdf_hash_memory_find_free_slot(table->ctrl, table->capacity,
+                                           entry->hash_key);
+  was_deleted = (table->ctrl[slot] == LIBRDF_HASH_MEMORY_CTRL_DELETED);
+  table->ctrl[slot] = LIBRDF_HASH_MEMORY_H2(entry->hash_key);
+  table->entries[slot] = entry;
+  return was_deleted;
+}
+
+
+/*
+ * librdf_hash_memory_insert_entry:
+ * @hash: the memory hash context
+ * @entry: entry
+ * 
+ * INTERNAL - Add an entry to the table new keys go into
+ */
+static void
+librdf_hash_memory_insert_entry(librdf_hash_memory_context* hash,
+                                librdf_hash_memory_entry* entry)
+{
+  if(librdf_hash_memory_table_insert(&hash->table, entry))
+    hash->tombstones--;
+}
+
+
+/*
+ * librdf_hash_memory_end_resize:
+ * @hash: the memory hash context
+ * 
+ * INTERNAL - Free the table being resized from once it has no keys
+ */
+static void
+librdf_hash_memory_end_resize(librdf_hash_memory_context* hash)
+{
+  if(hash->old_table.ctrl)
+    LIBRDF_FREE(byte*, hash->old_table.ctrl);
+  hash->old_table.ctrl = NULL;
+  hash->old_table.entries = NULL;
+  hash->old_table.capacity = 0;
+  hash->old_keys = 0;
+  hash->old_next_slot = 0;
+}
+
+
+/*
+ * librdf_hash_memory_migrate:
+ * @hash: the memory hash context
+ * @groups: number of groups of slots to move or <0 to move them all
+ * 
+ * INTERNAL - Move keys from the table being resized from to the new table
+ */
+static void
+librdf_hash_memory_migrate(librdf_hash_memory_context* hash, int groups)
+{
+  librdf_hash_memory_table* old_table = &hash->old_table;
+  int end;
+  int i;
+
+  if(!old_table->ctrl)
+    return;
+
+  end = old_table->capacity;
+  if(groups >= 0 &&
+     groups < (end - hash->old_next_slot) / LIBRDF_HASH_MEMORY_GROUP_WIDTH)
+    end = hash->old_next_slot + groups * LIBRDF_HASH_MEMORY_GROUP_WIDTH;
+
+  for(i = hash->old_next_slot; i < end && hash->old_keys; i++) {
+    if(!LIBRDF_HASH_MEMORY_CTRL_IS_FULL(old_table->ctrl[i]))
+      continue;
+
+    /* the table was filled past its load factor while there were
+     * cursors; the next resize takes the rest of the keys
+     */
+    if((hash->keys - hash->old_keys) + hash->tombstones + 1 >=
+       hash->table.capacity)
+      break;
+
+    librdf_hash_memory_insert_entry(hash, old_table->entries[i]);
+    /* the rest of the old table is still probed by lookups */
+    old_table->ctrl[i] = LIBRDF_HASH_MEMORY_CTRL_DELETED;
+    old_table->entries[i] = NULL;
+    hash->old_keys--;
+  }
+  hash->old_next_slot = i;
+
+  if(!hash->old_keys)
+    librdf_hash_memory_end_resize(hash);
+}
+
+
+/*
+ * librdf_hash_memory_migrate_step:
+ * @hash: the memory hash context
+ * 
+ * INTERNAL - Move a few keys on from the table being resized from.
+ * 
+ * Called on every change to the hash.  Nothing is moved while there
+ * are open cursors, so they see every key once.
+ */
+static REDLAND_INLINE void
+librdf_hash_memory_migrate_step(librdf_hash_memory_context* hash)
+{
+  if(hash->old_table.ctrl && !hash->cursors)
+    librdf_hash_memory_migrate(hash, LIBRDF_HASH_MEMORY_MIGRATE_GROUPS);
+}
+
+
+/*
+ * librdf_hash_memory_erase_slot:
+ * @hash: the memory hash context
+ * @table: table holding the slot
+ * @slot: slot to clear
+ * 
+ * INTERNAL - Remove the entry in a slot from the table and free it
+ * with any values it still has.
+ */
+static void
+librdf_hash_memory_erase_slot(librdf_hash_memory_context* hash,
+                              librdf_hash_memory_table* table, int slot)
+{
+  int group = slot / LIBRDF_HASH_MEMORY_GROUP_WIDTH;
+  const byte* ctrl = table->ctrl + group * LIBRDF_HASH_MEMORY_GROUP_WIDTH;
+  librdf_hash_memory_entry* entry = table->entries[slot];
+  librdf_hash_memory_value *vnode, *next;
+
+  /* If the group still has an EMPTY slot, no probe sequence ever
+   * continued past it so this slot can become EMPTY too; otherwise
+   * a tombstone is needed to keep later keys reachable.
+   */
+  if(librdf_hash_memory_group_match(ctrl, LIBRDF_HASH_MEMORY_CTRL_EMPTY))
+    table->ctrl[slot] = LIBRDF_HASH_MEMORY_CTRL_EMPTY;
+  else {
+    table->ctrl[slot] = LIBRDF_HASH_MEMORY_CTRL_DELETED;
+    if(table == &hash->table)
+      hash->tombstones++;
+  }
+  table->entries[slot] = NULL;
+  hash->keys--;
+
+  if(table == &hash->old_table && !--hash->old_keys)
+    librdf_hash_memory_end_resize(hash);
+
+  /* all records are unused, so the slab can be recycled */
+  if(!hash->keys) {
+    librdf_hash_memory_free_slabs(hash);
+    return;
+  }
+
+  for(vnode = entry->values; vnode; vnode = next) {
+    next = vnode->next;
+    librdf_hash_memory_slab_free(hash, vnode,
+                                 LIBRDF_HASH_MEMORY_VALUE_SIZE(vnode->value_len));
+  }
+  librdf_hash_memory_slab_free(hash, entry,
+                               LIBRDF_HASH_MEMORY_ENTRY_SIZE(entry->key_len));
+}
+
+
+/*
+ * librdf_hash_memory_check_waste:
+ * @hash: the memory hash context
+ * 
+ * INTERNAL - Compact the slab after deletes if more of it is wasted
+ * than used.
+ */
+static void
+librdf_hash_memory_check_waste(librdf_hash_memory_context* hash)
+{
+  size_t wasted;
+
+  if(hash->cursors)
+    return;
+
+  wasted = librdf_hash_memory_slab_wasted(hash);
+  if(wasted > hash->slabs_bytes_used &&
+     wasted > librdf_hash_memory_max_slab_size)
+    /* failure only means the space stays wasted */
+    librdf_hash_memory_compact(hash);
+}
+
+
+/*
+ * librdf_hash_memory_start_resize:
+ * @hash: the memory hash context
+ * @required_capacity: new number of slots
+ * 
+ * INTERNAL - Start moving all entries into a new table, dropping tombstones
+ * 
+ * The current table becomes the old table and its keys are moved
+ * over by librdf_hash_memory_migrate().  The keys of any resize
+ * already in progress go straight into the new table.
+ * 
+ * This moves keys between tables under any open cursors, so while
+ * there are some librdf_hash_memory_expand_size() only calls it once
+ * the table is full.
+ * 
+ * Return value: non 0 on failure
+ */
+static int
+librdf_hash_memory_start_resize(librdf_hash_memory_context* hash,
+                                int required_capacity)
+{
+  librdf_hash_memory_table* old_table = &hash->old_table;
+  librdf_hash_memory_table new_table;
+  byte *new_ctrl;
+  int moved = 0;
+  int i;
+
+  /* allocate new table: control bytes then the entries array */
+  new_ctrl = LIBRDF_MALLOC(byte*,
+                           LIBRDF_GOOD_CAST(size_t, required_capacity) *
+                           (1 + sizeof(librdf_hash_memory_entry*)));
+  if(!new_ctrl)
+    return 1;
+  memset(new_ctrl, LIBRDF_HASH_MEMORY_CTRL_EMPTY,
+         LIBRDF_GOOD_CAST(size_t, required_capacity));
+  new_table.ctrl = new_ctrl;
+  new_table.entries = (librdf_hash_memory_entry**)(new_ctrl + required_capacity);
+  new_table.capacity = required_capacity;
+
+  /* the new table can take every key, unlike the current one */
+  for(i = hash->old_next_slot; i < old_table->capacity && hash->old_keys; i++) {
+    if(!LIBRDF_HASH_MEMORY_CTRL_IS_FULL(old_table->ctrl[i]))
+      continue;
+
+    librdf_hash_memory_table_insert(&new_table, old_table->entries[i]);
+    hash->old_keys--;
+    moved++;
+  }
+  librdf_hash_memory_end_resize(hash);
+
+  hash->old_table = hash->table;
+  hash->old_keys = hash->keys - moved;
+  hash->old_next_slot = 0;
+
+  /* attach new one */
+  hash->table = new_table;
+  hash->tombstones = 0;
+
+  if(!hash->old_keys)
+    librdf_hash_memory_end_resize(hash);
+
+  return 0;
+}
+
+
+/*
+ * librdf_hash_memory_rehash:
+ * @hash: the memory hash context
+ * @required_capacity: new number of slots
+ * 
+ * INTERNAL - Move all entries into a new table now, dropping tombstones
+ * 
+ * Return value: non 0 on failure
+ */
+static int
+librdf_hash_memory_rehash(librdf_hash_memory_context* hash,
+                          int required_capacity)
+{
+  if(librdf_hash_memory_start_resize(hash, required_capacity))
+    return 1;
+
+  librdf_hash_memory_migrate(hash, -1);
+  return 0;
+}
+
+
+static int
+librdf_hash_memory_expand_size(librdf_hash_memory_context* hash) {
+  int required_capacity=0;
+
+  if (hash->table.capacity) {
+    /* big enough - keys and tombstones both lengthen probe sequences.
+     * Keys not yet moved from the old table are counted too so that
+     * the table can always take them.
+     */
+    if(1000 * (u64)(hash->keys + hash->tombstones + 1) <=
+       (u64)hash->load_factor * (u64)hash->table.capacity)
+      return 0;
+
+    /* Resizing moves keys to another table so open cursors would see
+     * some twice or miss them.  Until they are finished, go on filling
+     * the table past the load factor while it has free slots; there
+     * are always enough for the keys moved in later by the resize.
+     */
+    if(hash->cursors &&
+       (hash->keys - hash->old_keys) + hash->tombstones + 1 < hash->table.capacity)
+      return 0;
+
+    /* enough tombstones to free up the room by cleaning in place */
+    if(2000 * (u64)(hash->keys + 1) <=
+       (u64)hash->load_factor * (u64)hash->table.capacity)
+      required_capacity=hash->table.capacity;
+    else
+      /* grow hash (keeping it a power of two) */
+      required_capacity=hash->table.capacity << 1;
+  } else {
+    required_capacity=librdf_hash_initial_capacity;
+  }
+
+  if(librdf_hash_memory_start_resize(hash, required_capacity))
+    return 1;
+
+  librdf_hash_memory_migrate_step(hash);
+  return 0;
+}
+
+
+
+/* functions implementing hash api */
+
+/**
+ * librdf_hash_memory_create:
+ * @hash: #librdf_hash hash
+ * @context: memory hash contxt
+ * 
+ * Create a new memory hash.
+ * 
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_hash_memory_create(librdf_hash* hash, void* context) 
+{
+  librdf_hash_memory_context* hcontext=(librdf_hash_memory_context*)context;
+
+  hcontext->hash=hash;
+  hcontext->load_factor=librdf_hash_default_load_factor;
+  hcontext->slab_size=librdf_hash_memory_initial_slab_size;
+  hcontext->hash_function=librdf_get_hash_function(NULL);
+  hcontext->hash_seed=0;
+  return librdf_hash_memory_expand_size(hcontext);
+}
+
+
+/**
+ * librdf_hash_memory_destroy:
+ * @context: memory hash context
+ * 
+ * Destroy a memory hash.
+ * 
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_hash_memory_destroy(void* context) 
+{
+  librdf_hash_memory_context* hcontext=(librdf_hash_memory_context*)context;
+
+  /* all key and value records live in the slab */
+  librdf_hash_memory_free_slabs(hcontext);
+
+  if(hcontext->table.ctrl) {
+    LIBRDF_FREE(byte*, hcontext->table.ctrl);
+    hcontext->table.ctrl=NULL;
+    hcontext->table.entries=NULL;
+  }
+  librdf_hash_memory_end_resize(hcontext);
+
+  return 0;
+}
+
+
+/*
+ * librdf_hash_memory_set_hash_function:
+ * @hash: the memory hash context
+ * @hash_function: new key hash function
+ * @hash_seed: new seed
+ * 
+ * INTERNAL - Change the key hash function, rehashing any keys
+ * 
+ * Return value: non 0 on failure
+ */
+static int
+librdf_hash_memory_set_hash_function(librdf_hash_memory_context* hash,
+                                     librdf_hash_function hash_function,
+                                     u64 hash_seed)
+{
+  int i;
+
+  if(hash->hash_function == hash_function && hash->hash_seed == hash_seed)
+    return 0;
+
+  hash->hash_function = hash_function;
+  hash->hash_seed = hash_seed;
+
+  if(!hash->keys)
+    return 0;
+
+  /* get all the keys in one table */
+  librdf_hash_memory_migrate(hash, -1);
+
+  for(i = 0; i < hash->table.capacity; i++) {
+    librdf_hash_memory_entry* entry;
+
+    if(!LIBRDF_HASH_MEMORY_CTRL_IS_FULL(hash->table.ctrl[i]))
+      continue;
+
+    entry = hash->table.entries[i];
+    entry->hash_key = (u32)hash_function(LIBRDF_HASH_MEMORY_ENTRY_KEY(entry),
+                                         entry->key_len, hash_seed);
+  }
+
+  return librdf_hash_memory_rehash(hash, hash->table.capacity);
+}
+
+
+/*
+ * librdf_hash_memory_reserve:
+ * @hash: the memory hash context
+ * @expected_size: number of keys
+ * 
+ * INTERNAL - Grow the table so it can hold a number of keys without
+ * resizing.
+ * 
+ * Return value: non 0 on failure
+ */
+static int
+librdf_hash_memory_reserve(librdf_hash_memory_context* hash,
+                           long expected_size)
+{
+  int required_capacity=hash->table.capacity;
+
+  /* the table is never bigger than 2^30 slots */
+  while(required_capacity < (1 << 30) &&
+        1000 * (u64)expected_size >
+        (u64)hash->load_factor * (u64)required_capacity)
+    required_capacity <<= 1;
+
+  if(required_capacity == hash->table.capacity)
+    return 0;
+
+  return librdf_hash_memory_rehash(hash, required_capacity);
+}
+
+
+/**
+ * librdf_hash_memory_open:
+ * @context: memory hash context
+ * @identifier: identifier - not used
+ * @mode: access mode - not used
+ * @is_writable: is hash writable? - not used
+ * @is_new: is hash new? - not used
+ * @options: #librdf_hash of options
+ * 
+ * Open memory hash with given parameters.
+ * 
+ * Options used:
+ *   hash-function - key hash function: 'wyhash' (default) or
+ *                   'one-at-a-time'
+ *   hash-seed - seed for the key hash function; an integer or 'random'
+ *               for a seed chosen at open time so key hashes cannot be
+ *               predicted (default 0)
+ *   expected-size - number of keys to make room for now, so that
+ *                   adding up to that many needs no resizing
+ * 
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_hash_memory_open(void* context, const char *identifier,
+                        int mode, int is_writable, int is_new,
+                        librdf_hash* options) 
+{
+  librdf_hash_memory_context* hcontext=(librdf_hash_memory_context*)context;
+  librdf_hash_function hash_function=hcontext->hash_function;
+  u64 hash_seed=hcontext->hash_seed;
+  char *string;
+  long expected_size;
+
+  if(!options)
+    return 0;
+
+  expected_size=librdf_hash_get_as_long(options, "expected-size");
+  if(expected_size > 0 &&
+     librdf_hash_memory_reserve(hcontext, expected_size))
+    return 1;
+
+  string=librdf_hash_get(options, "hash-function");
+  if(string) {
+    hash_function=librdf_get_hash_function(string);
+    if(!hash_function)
+      librdf_log(hcontext->hash->world,
+                 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_HASH, NULL,
+                 "Unknown hash function '%s'", string);
+    LIBRDF_FREE(char*, string);
+    if(!hash_function)
+      return 1;
+  }
+
+  string=librdf_hash_get(options, "hash-seed");
+  if(string) {
+    if(!strcmp(string, "random"))
+      hash_seed=librdf_hash_random_seed();
+    else
+      hash_seed=(u64)strtoul(string, NULL, 0);
+    LIBRDF_FREE(char*, string);
+  }
+
+  return librdf_hash_memory_set_hash_function(hcontext, hash_function,
+                                              hash_seed);
+}
+
+
+/**
+ * librdf_hash_memory_close:
+ * @context: memory hash context
+ * 
+ * Close the hash.
+ * 
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_hash_memory_close(void* context) 
+{
+  /* NOP */
+  return 0;
+}
+
+
+static int
+librdf_hash_memory_clone(librdf_hash *hash, void* context, char *new_identifer,
+                         void *old_context) 
+{
+  librdf_hash_memory_context* hcontext=(librdf_hash_memory_context*)context;
+  librdf_hash_memory_context* old_hcontext=(librdf_hash_memory_context*)old_context;
+  librdf_hash_datum *key, *value;
+  librdf_iterator *iterator;
+  int status=0;
+
+  /* copy data fields that might change */
+  hcontext->hash=hash;
+  hcontext->load_factor=old_hcontext->load_factor;
+  hcontext->slab_size=librdf_hash_memory_initial_slab_size;
+  hcontext->hash_function=old_hcontext->hash_function;
+  hcontext->hash_seed=old_hcontext->hash_seed;
+
+  /* Don't need to deal with new_identifier - not used for memory hashes */
+
+  /* Use higher level functions to iterator this data
+   * on the other hand, maybe this is a good idea since that
+   * code is tested and works
+   */
+
+  key=librdf_new_hash_datum(hash->world, NULL, 0);
+  value=librdf_new_hash_datum(hash->world, NULL, 0);
+
+  iterator=librdf_hash_get_all(old_hcontext->hash, key, value);
+  while(!librdf_iterator_end(iterator)) {
+    librdf_hash_datum* k= (librdf_hash_datum*)librdf_iterator_get_key(iterator);
+    librdf_hash_datum* v= (librdf_hash_datum*)librdf_iterator_get_value(iterator);
+
+    if(librdf_hash_memory_put(hcontext, k, v)) {
+      status=1;
+      break;
+    }
+    librdf_iterator_next(iterator);
+  }
+  if(iterator)
+    librdf_free_iterator(iterator);
+
+  librdf_free_hash_datum(value);
+  librdf_free_hash_datum(key);
+
+  return status;
+}
+
+
+/**
+ * librdf_hash_memory_values_count:
+ * @context: memory hash cursor context
+ * 
+ * Get the number of values in the hash.
+ * 
  * Return value: number of values in the hash or <0 on failure
  **/
 static int
@@ -468,9 +1389,11 @@ librdf_hash_memory_values_count(void *context)
 
 typedef struct {
   librdf_hash_memory_context* hash;
-  int current_bucket;
-  librdf_hash_memory_node* current_node;
-  librdf_hash_memory_node_value *current_value;
+  /* table being walked; the old table comes first during a resize */
+  librdf_hash_memory_table* current_table;
+  int current_slot;
+  librdf_hash_memory_entry* current_entry;
+  librdf_hash_memory_value *current_value;
 } librdf_hash_memory_cursor_context;
 
 
@@ -479,7 +1402,7 @@ typedef struct {
  * librdf_hash_memory_cursor_init:
  * @cursor_context: hash cursor context
  * @hash_context: hash to operate over
- *
+ * 
  * Initialise a new hash cursor.
  * 
  * Return value: non 0 on failure
@@ -490,17 +1413,61 @@ librdf_hash_memory_cursor_init(void *cursor_context, void *hash_context)
   librdf_hash_memory_cursor_context *cursor=(librdf_hash_memory_cursor_context*)cursor_context;
 
   cursor->hash = (librdf_hash_memory_context*)hash_context;
+  cursor->current_table = &cursor->hash->table;
+  cursor->hash->cursors++;
   return 0;
 }
 
 
+/*
+ * librdf_hash_memory_cursor_next_slot:
+ * @cursor: memory hash cursor context
+ * @slot: slot to start looking at
+ * 
+ * INTERNAL - Move the cursor to the first used slot at or after @slot
+ */
+static void
+librdf_hash_memory_cursor_next_slot(librdf_hash_memory_cursor_context *cursor,
+                                    int slot)
+{
+  librdf_hash_memory_context* hash = cursor->hash;
+  librdf_hash_memory_table* table = cursor->current_table;
+
+  cursor->current_entry = NULL;
+  cursor->current_value = NULL;
+
+  while(1) {
+    /* if the resize has finished, the old table has no slots */
+    for(; slot < table->capacity; slot++) {
+      if(LIBRDF_HASH_MEMORY_CTRL_IS_FULL(table->ctrl[slot]))
+        break;
+    }
+
+    if(slot < table->capacity) {
+      cursor->current_table = table;
+      cursor->current_slot = slot;
+      cursor->current_entry = table->entries[slot];
+      cursor->current_value = cursor->current_entry->values;
+      break;
+    }
+
+    if(table == &hash->table)
+      break;
+
+    /* move on from the old table to the new one */
+    table = &hash->table;
+    slot = 0;
+  }
+}
+
+
 /**
  * librdf_hash_memory_cursor_get:
  * @context: memory hash cursor context
  * @key: pointer to key to use
  * @value: pointer to value to use
  * @flags: flags
- *
+ * 
  * Retrieve a hash value for the given key.
  * 
  * Return value: non 0 on failure
@@ -512,44 +1479,39 @@ librdf_hash_memory_cursor_get(void* context,
                               unsigned int flags)
 {
   librdf_hash_memory_cursor_context *cursor=(librdf_hash_memory_cursor_context*)context;
-  librdf_hash_memory_node_value *vnode=NULL;
-  librdf_hash_memory_node *node;
-  
+  librdf_hash_memory_value *vnode=NULL;
+  librdf_hash_memory_entry *entry;
 
-  /* First step, make sure cursor->current_node points to a valid node,
+
+  /* First step, make sure cursor->current_entry points to a valid entry,
      if possible */
 
   /* Move to start of hash if necessary  */
   if(flags == LIBRDF_HASH_CURSOR_FIRST) {
-    int i;
-    
-    cursor->current_node=NULL;
-    /* find first used bucket (with keys) */
-    cursor->current_bucket=0;
-
-    for(i=0; i< cursor->hash->capacity; i++)
-      if((cursor->current_node=cursor->hash->nodes[i])) {
-        cursor->current_bucket=i;
-        break;
-      }
-
-    if(cursor->current_node)
-      cursor->current_value=cursor->current_node->values;
+    cursor->current_table=&cursor->hash->old_table;
+    librdf_hash_memory_cursor_next_slot(cursor, 0);
   }
 
-  /* If still have no current node, try to find it from the key */
-  if(!cursor->current_node && key && key->data) {
-    cursor->current_node=librdf_hash_memory_find_node(cursor->hash,
-                                                      (char*)key->data,
-                                                      key->size,
-                                                      NULL, NULL);
-    if(cursor->current_node)
-      cursor->current_value=cursor->current_node->values;
+  /* If still have no current entry, try to find it from the key */
+  if(!cursor->current_entry && key && key->data) {
+    librdf_hash_memory_table* table;
+    u32 hash_key;
+    int slot;
+
+    hash_key=librdf_hash_memory_key_hash(cursor->hash, key);
+    slot=librdf_hash_memory_find_slot(cursor->hash, key->data, key->size,
+                                      hash_key, &table);
+    if(slot >= 0) {
+      cursor->current_table=table;
+      cursor->current_slot=slot;
+      cursor->current_entry=table->entries[slot];
+      cursor->current_value=cursor->current_entry->values;
+    }
   }
 
 
-  /* If still have no node, failed */
-  if(!cursor->current_node)
+  /* If still have no entry, failed */
+  if(!cursor->current_entry)
     return 1;
 
   /* Check for end of values */
@@ -564,13 +1526,13 @@ librdf_hash_memory_cursor_get(void* context,
       if(!cursor->current_value)
         return 1;
       break;
-      
+
     case LIBRDF_HASH_CURSOR_FIRST:
     case LIBRDF_HASH_CURSOR_NEXT:
-      /* If have reached last bucket, end */
-      if(cursor->current_bucket >= cursor->hash->capacity)
+      /* If have reached last slot, end */
+      if(!cursor->current_entry)
         return 1;
-      
+
       break;
     default:
       librdf_log(cursor->hash->hash->world,
@@ -578,7 +1540,7 @@ librdf_hash_memory_cursor_get(void* context,
                  "Unknown hash method flag %d", flags);
       return 1;
   }
-  
+
 
   /* Ok, there is data, retrieve it */
 
@@ -588,57 +1550,44 @@ librdf_hash_memory_cursor_get(void* context,
       /* FALLTHROUGH */
     case LIBRDF_HASH_CURSOR_NEXT_VALUE:
       vnode=cursor->current_value;
-      
+
       /* copy value */
-      value->data=vnode->value;
+      value->data=LIBRDF_HASH_MEMORY_VALUE_DATA(vnode);
       value->size=vnode->value_len;
-      
+
       /* move on */
       cursor->current_value=vnode->next;
       break;
-      
+
     case LIBRDF_HASH_CURSOR_FIRST:
     case LIBRDF_HASH_CURSOR_NEXT:
-      node=cursor->current_node;
+      entry=cursor->current_entry;
 
       /* get key */
-      key->data= node->key;
-      key->size= node->key_len;
+      key->data= LIBRDF_HASH_MEMORY_ENTRY_KEY(entry);
+      key->size= entry->key_len;
 
       /* if want values, walk through them */
       if(value) {
         vnode=cursor->current_value;
-        
+
         /* get value */
-        value->data=vnode->value;
+        value->data=LIBRDF_HASH_MEMORY_VALUE_DATA(vnode);
         value->size=vnode->value_len;
 
         /* move on */
         cursor->current_value=vnode->next;
-        
+
         /* stop here if there are more values, otherwise need next
-         * key & values so drop through and move to the next node
+         * key & values so drop through and move to the next entry
          */
         if(cursor->current_value)
           break;
       }
-      
-      /* move on to next node in current bucket */
-      if(!(node=cursor->current_node->next)) {
-        int i;
-        
-        /* end of list - move to next used bucket */
-        for(i=cursor->current_bucket+1; i< cursor->hash->capacity; i++)
-          if((node=cursor->hash->nodes[i])) {
-            cursor->current_bucket=i;
-            break;
-          }
-        
-      }
-      
-      if((cursor->current_node=node))
-        cursor->current_value=node->values;
-      
+
+      /* move on to next used slot */
+      librdf_hash_memory_cursor_next_slot(cursor, cursor->current_slot + 1);
+
       break;
     default:
       librdf_log(cursor->hash->hash->world,
@@ -646,141 +1595,248 @@ librdf_hash_memory_cursor_get(void* context,
                  "Unknown hash method flag %d", flags);
       return 1;
   }
-  
 
-  return 0;
+
+  return 0;
+}
+
+
+/**
+ * librdf_hash_memory_cursor_finished:
+ * @context: hash memory get iterator context
+ * 
+ * Finish the serialisation of the hash memory get.
+ * 
+ **/
+static void
+librdf_hash_memory_cursor_finish(void* context)
+{
+  librdf_hash_memory_cursor_context *cursor=(librdf_hash_memory_cursor_context*)context;
+
+  cursor->hash->cursors--;
+}
+
+
+/*
+ * librdf_hash_memory_put_value:
+ * @hash: memory hash context
+ * @key: pointer to key to store
+ * @value: pointer to value to store
+ * @if_absent: non 0 to not store a key/value pair already present
+ * @hash_key: hash of @key
+ * 
+ * INTERNAL - Store a key/value pair in the hash.
+ * 
+ * Return value: 0 if stored, >0 if @if_absent and the pair is
+ * present, <0 on failure
+ */
+static int
+librdf_hash_memory_put_value(librdf_hash_memory_context* hash,
+                             librdf_hash_datum *key, 
+                             librdf_hash_datum *value, int if_absent,
+                             u32 hash_key)
+{
+  librdf_hash_memory_entry *entry;
+  librdf_hash_memory_value *vnode;
+  librdf_hash_memory_table *table;
+  int slot;
+
+  librdf_hash_memory_migrate_step(hash);
+
+  /* find entry for key */
+  slot=librdf_hash_memory_find_slot(hash, key->data, key->size, hash_key,
+                                    &table);
+
+  if(slot >= 0) {
+    entry=table->entries[slot];
+
+    if(if_absent) {
+      for(vnode=entry->values; vnode; vnode=vnode->next) {
+        if(value->size == vnode->value_len && 
+           !memcmp(value->data, LIBRDF_HASH_MEMORY_VALUE_DATA(vnode),
+                   value->size))
+          return 1;
+      }
+    }
+
+    /* always allocate new value */
+    vnode=librdf_hash_memory_new_value(hash, value);
+    if(!vnode)
+      return -1;
+  } else {
+    /* not found - new key; ensure there is enough space in the hash */
+    if(librdf_hash_memory_expand_size(hash))
+      return -1;
+
+    /* allocate new entry with the key copied after it */
+    entry=(librdf_hash_memory_entry*)librdf_hash_memory_slab_alloc(hash,
+                                                                   sizeof(*entry) + key->size);
+    if(!entry)
+      return -1;
+
+    vnode=librdf_hash_memory_new_value(hash, value);
+    if(!vnode) {
+      librdf_hash_memory_slab_free(hash, entry,
+                                   LIBRDF_HASH_MEMORY_ENTRY_SIZE(key->size));
+      return -1;
+    }
+
+    /* if we get here, all allocations succeeded */
+
+    entry->values=NULL;
+    entry->values_count=0;
+    entry->hash_key=hash_key;
+    entry->key_len=key->size;
+    if(key->size)
+      memcpy(LIBRDF_HASH_MEMORY_ENTRY_KEY(entry), key->data, key->size);
+
+    librdf_hash_memory_insert_entry(hash, entry);
+
+    hash->keys++;
+  }
+
+
+  /* put new value node in list */
+  vnode->next=entry->values;
+  entry->values=vnode;
+
+  /* note that in counter */
+  entry->values_count++;
+
+  hash->values++;
+
+  return 0;
+}
+
+
+/**
+ * librdf_hash_memory_put:
+ * @context: memory hash context
+ * @key: pointer to key to store
+ * @value: pointer to value to store
+ * 
+ * - Store a key/value pair in the hash.
+ * 
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_hash_memory_put(void* context, librdf_hash_datum *key, 
+		       librdf_hash_datum *value) 
+{
+  librdf_hash_memory_context* hash=(librdf_hash_memory_context*)context;
+
+  return (librdf_hash_memory_put_value(hash, key, value, 0,
+                                       librdf_hash_memory_key_hash(hash, key)) != 0);
 }
 
 
 /**
- * librdf_hash_memory_cursor_finished:
- * @context: hash memory get iterator context
- *
- * Finish the serialisation of the hash memory get.
- *
+ * librdf_hash_memory_put_prepared:
+ * @context: memory hash context
+ * @key: pointer to prepared key to store
+ * @value: pointer to value to store
+ * 
+ * - Store a key/value pair in the hash using the hash saved in the key.
+ * 
+ * Return value: non 0 on failure
  **/
-static void
-librdf_hash_memory_cursor_finish(void* context)
+static int
+librdf_hash_memory_put_prepared(void* context, librdf_hash_datum *key, 
+                                librdf_hash_datum *value) 
 {
-/* librdf_hash_memory_cursor_context *cursor=(librdf_hash_memory_cursor_context*)context; */
+  librdf_hash_memory_context* hash=(librdf_hash_memory_context*)context;
 
+  return (librdf_hash_memory_put_value(hash, key, value, 0,
+                                       librdf_hash_memory_prepared_key_hash(hash, key)) != 0);
 }
 
 
 /**
- * librdf_hash_memory_put:
+ * librdf_hash_memory_put_if_absent:
  * @context: memory hash context
  * @key: pointer to key to store
  * @value: pointer to value to store
- *
- * - Store a key/value pair in the hash.
  * 
- * Return value: non 0 on failure
+ * - Store a key/value pair in the hash unless it is already present.
+ * 
+ * Return value: 0 if stored, >0 if already present, <0 on failure
  **/
 static int
-librdf_hash_memory_put(void* context, librdf_hash_datum *key, 
-		       librdf_hash_datum *value) 
+librdf_hash_memory_put_if_absent(void* context, librdf_hash_datum *key, 
+                                 librdf_hash_datum *value) 
 {
   librdf_hash_memory_context* hash=(librdf_hash_memory_context*)context;
-  librdf_hash_memory_node *node;
-  librdf_hash_memory_node_value *vnode;
-  u32 hash_key;
-  void *new_key=NULL;
-  void *new_value;
-  int bucket= (-1);
-  int is_new_node;
 
-  /* ensure there is enough space in the hash */
-  if (librdf_hash_memory_expand_size(hash))
-    return 1;
-  
-  /* find node for key */
-  node=librdf_hash_memory_find_node(hash,
-				    key->data, key->size,
-				    NULL, NULL);
-
-  is_new_node=(node == NULL);
-  
-  /* not found - new key */
-  if(is_new_node) {
-    ONE_AT_A_TIME_HASH(hash_key, key->data, key->size);
-
-    bucket=hash_key & (hash->capacity - 1);
-
-    /* allocate new node */
-    node = LIBRDF_CALLOC(librdf_hash_memory_node*, 1, sizeof(*node));
-    if(!node)
-      return 1;
+  return librdf_hash_memory_put_value(hash, key, value, 1,
+                                      librdf_hash_memory_key_hash(hash, key));
+}
 
-    node->hash_key=hash_key;
-    
-    /* allocate key for new node */
-    new_key = LIBRDF_MALLOC(void*, key->size);
-    if(!new_key) {
-      LIBRDF_FREE(librdf_hash_memory_node, node);
-      return 1;
-    }
 
-    /* copy new key */
-    memcpy(new_key, key->data, key->size);
-    node->key=new_key;
-    node->key_len=key->size;
-  }
-  
-  
-  /* always allocate new value */
-  new_value = LIBRDF_MALLOC(void*, value->size);
-  if(!new_value) {
-    if(is_new_node) {
-      LIBRDF_FREE(char*, new_key);
-      LIBRDF_FREE(librdf_hash_memory_node, node);
-    }
-    return 1;
-  }
+/**
+ * librdf_hash_memory_key_values_count:
+ * @context: memory hash context
+ * @key: key
+ * 
+ * Get the number of values of a key.
+ * 
+ * Return value: the number of values
+ **/
+static int
+librdf_hash_memory_key_values_count(void* context, librdf_hash_datum *key)
+{
+  librdf_hash_memory_context* hash=(librdf_hash_memory_context*)context;
+  librdf_hash_memory_table *table;
+  u32 hash_key;
+  int slot;
 
-  /* always allocate new librdf_hash_memory_node_value */
-  vnode = LIBRDF_CALLOC(librdf_hash_memory_node_value*, 1, sizeof(*vnode));
-  if(!vnode) {
-    LIBRDF_FREE(char*, new_value);
-    if(is_new_node) {
-      LIBRDF_FREE(char*, new_key);
-      LIBRDF_FREE(librdf_hash_memory_node, node);
-    }
-    return 1;
-  }
+  hash_key=librdf_hash_memory_key_hash(hash, key);
+  slot=librdf_hash_memory_find_slot(hash, key->data, key->size, hash_key,
+                                    &table);
+  if(slot < 0)
+    return 0;
 
-  /* if we get here, all allocations succeeded */
+  return table->entries[slot]->values_count;
+}
 
 
-  /* put new value node in list */
-  vnode->next=node->values;
-  node->values=vnode;
+/*
+ * librdf_hash_memory_exists_value:
+ * @hash: memory hash context
+ * @key: key
+ * @value: value
+ * @hash_key: hash of @key
+ * 
+ * INTERNAL - Test the existence of a key in the hash.
+ * 
+ * Return value: >0 if the key/value exists in the hash, 0 if not
+ */
+static int
+librdf_hash_memory_exists_value(librdf_hash_memory_context* hash,
+                                librdf_hash_datum *key,
+                                librdf_hash_datum *value, u32 hash_key)
+{
+  librdf_hash_memory_value *vnode;
+  librdf_hash_memory_table *table;
+  int slot;
 
-  /* note that in counter */
-  node->values_count++;
- 
-  /* copy new value */
-  memcpy(new_value, value->data, value->size);
-  vnode->value=new_value;
-  vnode->value_len=value->size;
-
-
-  /* now update buckets and hash counts */
-  if(is_new_node) {
-    node->next=hash->nodes[bucket];
-    hash->nodes[bucket]=node;
-  
-    hash->keys++;
-  }
-  
+  slot=librdf_hash_memory_find_slot(hash, key->data, key->size, hash_key,
+                                    &table);
+  /* key not found */
+  if(slot < 0)
+    return 0;
 
-  hash->values++;
+  /* no value wanted */
+  if(!value)
+    return 1;
 
-  /* Only increase bucket count use when previous value was NULL */
-  if(!node->next)
-    hash->size++;
+  /* search for value in list of values */
+  for(vnode=table->entries[slot]->values; vnode; vnode=vnode->next) {
+    if(value->size == vnode->value_len && 
+       !memcmp(value->data, LIBRDF_HASH_MEMORY_VALUE_DATA(vnode), value->size))
+      break;
+  }
 
-  return 0;
+  return (vnode != NULL);
 }
 
 
@@ -789,7 +1845,7 @@ librdf_hash_memory_put(void* context, librdf_hash_datum *key,
  * @context: memory hash context
  * @key: key
  * @value: value
- *
+ * 
  * Test the existence of a key in the hash.
  * 
  * Return value: >0 if the key/value exists in the hash, 0 if not, <0 on failure
@@ -799,64 +1855,72 @@ librdf_hash_memory_exists(void* context,
                           librdf_hash_datum *key, librdf_hash_datum *value)
 {
   librdf_hash_memory_context* hash=(librdf_hash_memory_context*)context;
-  librdf_hash_memory_node* node;
-  librdf_hash_memory_node_value *vnode;
-  
-  node=librdf_hash_memory_find_node(hash,
-				    (char*)key->data, key->size,
-				    NULL, NULL);
-  /* key not found */
-  if(!node)
-    return 0;
-  
-  /* no value wanted */
-  if(!value)
-    return 1;
-
-  /* search for value in list of values */
-  for(vnode=node->values; vnode; vnode=vnode->next) {
-    if(value->size == vnode->value_len && 
-       !memcmp(value->data, vnode->value, value->size))
-      break;
-  }
 
-  return (vnode != NULL);
+  return librdf_hash_memory_exists_value(hash, key, value,
+                                         librdf_hash_memory_key_hash(hash, key));
 }
 
 
-
 /**
- * librdf_hash_memory_delete_key_value:
+ * librdf_hash_memory_exists_prepared:
  * @context: memory hash context
+ * @key: prepared key
+ * @value: value
+ * 
+ * Test the existence of a key in the hash using the hash saved in the key.
+ * 
+ * Return value: >0 if the key/value exists in the hash, 0 if not, <0 on failure
+ **/
+static int
+librdf_hash_memory_exists_prepared(void* context, 
+                                   librdf_hash_datum *key,
+                                   librdf_hash_datum *value)
+{
+  librdf_hash_memory_context* hash=(librdf_hash_memory_context*)context;
+
+  return librdf_hash_memory_exists_value(hash, key, value,
+                                         librdf_hash_memory_prepared_key_hash(hash, key));
+}
+
+
+
+/*
+ * librdf_hash_memory_delete_value:
+ * @hash: memory hash context
  * @key: pointer to key to delete
  * @value: pointer to value to delete
- *
- * - Delete a key/value pair from the hash.
+ * @hash_key: hash of @key
+ * 
+ * INTERNAL - Delete a key/value pair from the hash.
  * 
  * Return value: non 0 on failure
- **/
+ */
 static int
-librdf_hash_memory_delete_key_value(void* context, librdf_hash_datum *key,
-                                    librdf_hash_datum *value)
+librdf_hash_memory_delete_value(librdf_hash_memory_context* hash,
+                                librdf_hash_datum *key,
+                                librdf_hash_datum *value, u32 hash_key)
 {
-  librdf_hash_memory_context* hash=(librdf_hash_memory_context*)context;
-  librdf_hash_memory_node *node, *prev, *next;
-  librdf_hash_memory_node_value *vnode, *vprev;
-  int bucket;
-  
-  node=librdf_hash_memory_find_node(hash, 
-				    (char*)key->data, key->size,
-				    &bucket, &prev);
+  librdf_hash_memory_entry *entry;
+  librdf_hash_memory_value *vnode, *vprev;
+  librdf_hash_memory_table *table;
+  int slot;
+
+  librdf_hash_memory_migrate_step(hash);
+
+  slot=librdf_hash_memory_find_slot(hash, key->data, key->size, hash_key,
+                                    &table);
   /* key not found anywhere */
-  if(!node)
+  if(slot < 0)
     return 1;
 
+  entry=table->entries[slot];
+
   /* search for value in list of values */
-  vnode=node->values;
+  vnode=entry->values;
   vprev=NULL;
   while(vnode) {
     if(value->size == vnode->value_len && 
-       !memcmp(value->data, vnode->value, value->size))
+       !memcmp(value->data, LIBRDF_HASH_MEMORY_VALUE_DATA(vnode), value->size))
       break;
     vprev=vnode;
     vnode=vnode->next;
@@ -869,68 +1933,75 @@ librdf_hash_memory_delete_key_value(void* context, librdf_hash_datum *key,
   /* found - delete it from list */
   if(!vprev) {
     /* at start of list so delete from there */
-    node->values=vnode->next;
+    entry->values=vnode->next;
   } else
     vprev->next=vnode->next;
 
-  /* free value and value node */
-  if(vnode->value)
-    LIBRDF_FREE(librdf_hash_memory_node_value, vnode->value);
-  LIBRDF_FREE(librdf_hash_memory_node_value, vnode);
+  librdf_hash_memory_slab_free(hash, vnode,
+                               LIBRDF_HASH_MEMORY_VALUE_SIZE(vnode->value_len));
 
   /* update hash counts */
+  entry->values_count--;
   hash->values--;
 
   /* check if last value was removed */
-  if(node->values)
-    /* no, so return success */
-    return 0;
-  
+  if(!entry->values)
+    /* yes - all values gone so need to delete the entire key */
+    librdf_hash_memory_erase_slot(hash, table, slot);
 
-  /* yes - all values gone so need to delete entire key node */
-
-  if(!prev) {
-    /* is at start of list, so delete from there */
-    if(!(hash->nodes[bucket]=node->next))
-      /* hash bucket occupancy is one less if bucket is now empty */
-      hash->size--;
-    next=NULL;
-  } else
-    next=prev->next=node->next;
-  
-  /* free node */
-  librdf_free_hash_memory_node(node);
-  
-  /* see if there are remaining values for this key */
-  if(!next) {
-    /* no - so was last value for that key, reduce key count */
-    hash->keys--;
-  } else {
-    int found=0;
-    
-    node=next;
-    while(node) {
-      if(key->size == node->key_len && !memcmp(key, node->key, key->size)){
-        found=1;
-        break;
-      }
-      node=node->next;
-    }
-    
-    /* no further key values found - so was last value for that key */
-    if(!found)
-      hash->keys--;
-  }
+  librdf_hash_memory_check_waste(hash);
 
   return 0;
 }
 
 
+/**
+ * librdf_hash_memory_delete_key_value:
+ * @context: memory hash context
+ * @key: pointer to key to delete
+ * @value: pointer to value to delete
+ * 
+ * - Delete a key/value pair from the hash.
+ * 
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_hash_memory_delete_key_value(void* context, librdf_hash_datum *key,
+                                    librdf_hash_datum *value)
+{
+  librdf_hash_memory_context* hash=(librdf_hash_memory_context*)context;
+
+  return librdf_hash_memory_delete_value(hash, key, value,
+                                         librdf_hash_memory_key_hash(hash, key));
+}
+
+
+/**
+ * librdf_hash_memory_delete_prepared:
+ * @context: memory hash context
+ * @key: pointer to prepared key to delete
+ * @value: pointer to value to delete
+ * 
+ * - Delete a key/value pair from the hash using the hash saved in the key.
+ * 
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_hash_memory_delete_prepared(void* context, librdf_hash_datum *key,
+                                   librdf_hash_datum *value)
+{
+  librdf_hash_memory_context* hash=(librdf_hash_memory_context*)context;
+
+  return librdf_hash_memory_delete_value(hash, key, value,
+                                         librdf_hash_memory_prepared_key_hash(hash, key));
+}
+
+
 /**
  * librdf_hash_memory_delete_key:
  * @context: memory hash context
  * @key: pointer to key to delete
- *
+ * 
  * - Delete a key and all its values from the hash.
  * 
  * Return value: non 0 on failure
@@ -939,57 +2010,233 @@ static int
 librdf_hash_memory_delete_key(void* context, librdf_hash_datum *key) 
 {
   librdf_hash_memory_context* hash=(librdf_hash_memory_context*)context;
-  librdf_hash_memory_node *node, *prev;
-  int bucket;
-  
-  node=librdf_hash_memory_find_node(hash, 
-				    (char*)key->data, key->size,
-				    &bucket, &prev);
+  librdf_hash_memory_table *table;
+  u32 hash_key;
+  int slot;
+
+  librdf_hash_memory_migrate_step(hash);
+
+  hash_key=librdf_hash_memory_key_hash(hash, key);
+  slot=librdf_hash_memory_find_slot(hash, key->data, key->size, hash_key,
+                                    &table);
   /* not found anywhere */
-  if(!node)
+  if(slot < 0)
     return 1;
 
-  /* search list from here */
-  if(!prev) {
-    /* is at start of list, so delete from there */
-    if(!(hash->nodes[bucket]=node->next))
-      /* hash bucket occupancy is one less if bucket is now empty */
-      hash->size--;
-  } else
-    prev->next=node->next;
-
   /* update hash counts */
-  hash->keys--;
-  hash->values-= node->values_count;
-  
-  /* free node */
-  librdf_free_hash_memory_node(node);
+  hash->values-= table->entries[slot]->values_count;
+
+  librdf_hash_memory_erase_slot(hash, table, slot);
+  librdf_hash_memory_check_waste(hash);
+  return 0;
+}
+
+
+/**
+ * librdf_hash_memory_prepare_key:
+ * @context: memory hash context
+ * @key: key
+ * 
+ * Save the hash of a key in it for use by later operations.
+ * 
+ * Return value: 0
+ **/
+static int
+librdf_hash_memory_prepare_key(void* context, librdf_hash_datum *key)
+{
+  librdf_hash_memory_context* hash=(librdf_hash_memory_context*)context;
+
+  key->hash_value=hash->hash_function(key->data, key->size, hash->hash_seed);
+  key->hash_seed=hash->hash_seed;
+  key->hash_function=hash->hash_function;
+  return 0;
+}
+
+
+/*
+ * librdf_hash_memory_prefetch_key:
+ * @hash: memory hash context
+ * @key: key
+ * 
+ * INTERNAL - Hash a key that will be used soon and start loading the
+ * first group of slots it probes into the cache.
+ * 
+ * Return value: the hash of @key
+ */
+static u32
+librdf_hash_memory_prefetch_key(librdf_hash_memory_context* hash,
+                                librdf_hash_datum *key)
+{
+  int groups_mask = (hash->table.capacity / LIBRDF_HASH_MEMORY_GROUP_WIDTH) - 1;
+  u32 hash_key;
+  int slot;
+
+  hash_key=librdf_hash_memory_key_hash(hash, key);
+
+  slot = (int)(LIBRDF_HASH_MEMORY_H1(hash_key) & (u32)groups_mask) *
+         LIBRDF_HASH_MEMORY_GROUP_WIDTH;
+  LIBRDF_HASH_MEMORY_PREFETCH(hash->table.ctrl + slot);
+  LIBRDF_HASH_MEMORY_PREFETCH(hash->table.entries + slot);
+
+  return hash_key;
+}
+
+
+/**
+ * librdf_hash_memory_put_many:
+ * @context: memory hash context
+ * @keys: array of keys
+ * @values: array of values
+ * @count: number of key/value pairs
+ * 
+ * Store many key/value pairs in the hash.
+ * 
+ * The table slots of later keys are prefetched while earlier ones
+ * are stored, so the cache misses overlap.
+ * 
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_hash_memory_put_many(void* context, librdf_hash_datum *keys,
+                            librdf_hash_datum *values, int count)
+{
+  librdf_hash_memory_context* hash=(librdf_hash_memory_context*)context;
+  /* hashes of the next keys, by index modulo the prefetch distance */
+  u32 hash_keys[LIBRDF_HASH_MEMORY_PREFETCH_DISTANCE];
+  u32 hash_key;
+  int i;
+
+  for(i=0; i < count && i < LIBRDF_HASH_MEMORY_PREFETCH_DISTANCE; i++)
+    hash_keys[i]=librdf_hash_memory_prefetch_key(hash, &keys[i]);
+
+  for(i=0; i < count; i++) {
+    hash_key=hash_keys[i % LIBRDF_HASH_MEMORY_PREFETCH_DISTANCE];
+    if(i + LIBRDF_HASH_MEMORY_PREFETCH_DISTANCE < count)
+      hash_keys[i % LIBRDF_HASH_MEMORY_PREFETCH_DISTANCE]=
+        librdf_hash_memory_prefetch_key(hash,
+                                        &keys[i + LIBRDF_HASH_MEMORY_PREFETCH_DISTANCE]);
+
+    if(librdf_hash_memory_put_value(hash, &keys[i], &values[i], 0, hash_key))
+      return 1;
+  }
+
   return 0;
 }
 
 
+/**
+ * librdf_hash_memory_delete_many:
+ * @context: memory hash context
+ * @keys: array of keys
+ * @values: array of values
+ * @count: number of key/value pairs
+ * 
+ * Delete many key/value pairs from the hash, prefetching as
+ * librdf_hash_memory_put_many() does.
+ * 
+ * Return value: non 0 on failure (including any pair not present)
+ **/
+static int
+librdf_hash_memory_delete_many(void* context, librdf_hash_datum *keys,
+                               librdf_hash_datum *values, int count)
+{
+  librdf_hash_memory_context* hash=(librdf_hash_memory_context*)context;
+  u32 hash_keys[LIBRDF_HASH_MEMORY_PREFETCH_DISTANCE];
+  u32 hash_key;
+  int status=0;
+  int i;
+
+  for(i=0; i < count && i < LIBRDF_HASH_MEMORY_PREFETCH_DISTANCE; i++)
+    hash_keys[i]=librdf_hash_memory_prefetch_key(hash, &keys[i]);
+
+  for(i=0; i < count; i++) {
+    hash_key=hash_keys[i % LIBRDF_HASH_MEMORY_PREFETCH_DISTANCE];
+    if(i + LIBRDF_HASH_MEMORY_PREFETCH_DISTANCE < count)
+      hash_keys[i % LIBRDF_HASH_MEMORY_PREFETCH_DISTANCE]=
+        librdf_hash_memory_prefetch_key(hash,
+                                        &keys[i + LIBRDF_HASH_MEMORY_PREFETCH_DISTANCE]);
+
+    if(librdf_hash_memory_delete_value(hash, &keys[i], &values[i], hash_key))
+      status=1;
+  }
+
+  return status;
+}
+
+
 /**
  * librdf_hash_memory_sync:
  * @context: memory hash context
- *
+ * 
  * Flush the hash to disk.
  * 
- * Not used
+ * There is no disk so this compacts the slab holding the keys and
+ * values instead, if there are no open cursors.
  * 
- * Return value: 0
+ * Return value: non 0 on failure
  **/
 static int
 librdf_hash_memory_sync(void* context) 
 {
-  /* Not applicable */
-  return 0;
+  librdf_hash_memory_context* hash=(librdf_hash_memory_context*)context;
+
+  if(!librdf_hash_memory_slab_wasted(hash))
+    return 0;
+
+  return librdf_hash_memory_compact(hash);
+}
+
+
+/**
+ * librdf_hash_memory_get_option:
+ * @context: memory hash context
+ * @name: option name
+ * 
+ * Get the value of a memory hash option.
+ * 
+ * Options available are the statistics of the slab holding the keys
+ * and values, as decimal numbers:
+ *   arena-count - number of slab chunks
+ *   arena-bytes - total size of the slab chunks
+ *   arena-bytes-used - bytes in keys and values in use
+ *   arena-bytes-wasted - bytes in freed keys and values, including
+ *                        ones kept for reuse, and unused chunk ends
+ * and of the table:
+ *   table-capacity - number of slots in the table new keys go into
+ * 
+ * Return value: new string or NULL if @name is not known
+ **/
+static char*
+librdf_hash_memory_get_option(void* context, const char *name)
+{
+  librdf_hash_memory_context* hash=(librdf_hash_memory_context*)context;
+  unsigned long value;
+  char *result;
+
+  if(!strcmp(name, "arena-count"))
+    value=(unsigned long)hash->slabs_count;
+  else if(!strcmp(name, "arena-bytes"))
+    value=(unsigned long)hash->slabs_bytes;
+  else if(!strcmp(name, "arena-bytes-used"))
+    value=(unsigned long)hash->slabs_bytes_used;
+  else if(!strcmp(name, "arena-bytes-wasted"))
+    value=(unsigned long)librdf_hash_memory_slab_wasted(hash);
+  else if(!strcmp(name, "table-capacity"))
+    value=(unsigned long)hash->table.capacity;
+  else
+    return NULL;
+
+  result=LIBRDF_MALLOC(char*, 24);
+  if(result)
+    sprintf(result, "%lu", value);
+  return result;
 }
 
 
 /**
  * librdf_hash_memory_get_fd:
  * @context: memory hash context
- *
+ * 
  * Get the file descriptor representing the hash.
  * 
  * Not used
@@ -1009,7 +2256,7 @@ librdf_hash_memory_get_fd(void* context)
 /**
  * librdf_hash_memory_register_factory:
  * @factory: hash factory prototype
- *
+ * 
  * Register the memory hash module with the hash factory.
  * 
  **/
@@ -1018,7 +2265,7 @@ librdf_hash_memory_register_factory(librdf_hash_factory *factory)
 {
   factory->context_length = sizeof(librdf_hash_memory_context);
   factory->cursor_context_length = sizeof(librdf_hash_memory_cursor_context);
-  
+
   factory->create  = librdf_hash_memory_create;
   factory->destroy = librdf_hash_memory_destroy;
 
@@ -1038,16 +2285,26 @@ librdf_hash_memory_register_factory(librdf_hash_factory *factory)
   factory->cursor_init   = librdf_hash_memory_cursor_init;
   factory->cursor_get    = librdf_hash_memory_cursor_get;
   factory->cursor_finish = librdf_hash_memory_cursor_finish;
+
+  factory->prepare_key = librdf_hash_memory_prepare_key;
+  factory->put_prepared    = librdf_hash_memory_put_prepared;
+  factory->exists_prepared = librdf_hash_memory_exists_prepared;
+  factory->delete_prepared = librdf_hash_memory_delete_prepared;
+  factory->get_option  = librdf_hash_memory_get_option;
+  factory->put_many    = librdf_hash_memory_put_many;
+  factory->delete_many = librdf_hash_memory_delete_many;
+  factory->put_if_absent = librdf_hash_memory_put_if_absent;
+  factory->key_values_count = librdf_hash_memory_key_values_count;
 }
 
 /**
  * librdf_init_hash_memory:
  * @world: redland world object
- *
+ * 
  * Initialise the memory hash module.
  * 
  * Initialises the memory hash module and sets the default hash load factor.
- *
+ * 
  * The recommended and current default value is 0.75, i.e. 750/1000.  
  * To use the default value (whatever it is) use a value less than 0.
  **/
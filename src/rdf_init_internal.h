@@ -92,6 +92,9 @@ struct librdf_world_s
   /* list of free librdf_hash_datums is kept */
   librdf_hash_datum* hash_datums_list;
 
+  /* list of Berkeley DB environments shared by bdb hashes */
+  void* hash_bdb_envs;
+
    /* hash load_factor out of 1000 */
   int hash_load_factor;
 
@@ -89,6 +89,44 @@ librdf_new_iterator(librdf_world *world,
 }
 
 
+/*
+ * librdf_iterator_set_lazy - INTERNAL - Only get iterator objects when asked for
+ * @iterator: the #librdf_iterator object
+ *
+ * Normally the end and next methods fetch the current object to decide
+ * if the iterator has finished.  A lazy iterator relies on its
+ * is_end_method alone for that (while no maps are added), so an
+ * iterator with an expensive object get, such as decoding a node, only
+ * pays for it in librdf_iterator_get_object().  The get_method must
+ * then return a non-NULL object whenever is_end_method returns 0.
+ */
+void
+librdf_iterator_set_lazy(librdf_iterator* iterator)
+{
+  iterator->is_lazy=1;
+}
+
+
+/* non 0 if the current element does not need getting to move on */
+static int
+librdf_iterator_is_lazy(librdf_iterator* iterator)
+{
+  return iterator->is_lazy &&
+         (!iterator->map_list || !librdf_list_size(iterator->map_list));
+}
+
+
+/* lazy iterator form of librdf_iterator_update_current_element */
+static int
+librdf_iterator_update_is_finished(librdf_iterator* iterator)
+{
+  if(!iterator->is_finished && iterator->is_end_method(iterator->context))
+    iterator->is_finished=1;
+
+  return iterator->is_finished;
+}
+
+
 /* helper function for deleting list map */
 static void
 librdf_iterator_free_iterator_map(void *list_data, void *user_data) 
@@ -229,6 +267,9 @@ librdf_iterator_end(librdf_iterator* iterator)
   if(!iterator || iterator->is_finished)
     return 1;
 
+  if(librdf_iterator_is_lazy(iterator))
+    return librdf_iterator_update_is_finished(iterator);
+
   librdf_iterator_update_current_element(iterator);
 
   return iterator->is_finished;
@@ -255,6 +296,9 @@ librdf_iterator_next(librdf_iterator* iterator)
   }
 
   iterator->is_updated=0;
+  if(librdf_iterator_is_lazy(iterator))
+    return librdf_iterator_update_is_finished(iterator);
+
   librdf_iterator_update_current_element(iterator);
   
   return iterator->is_finished;
@@ -329,7 +373,10 @@ librdf_iterator_get_key(librdf_iterator* iterator)
   if(iterator->is_finished)
     return NULL;
 
-  if(!librdf_iterator_update_current_element(iterator))
+  if(librdf_iterator_is_lazy(iterator)) {
+    if(librdf_iterator_update_is_finished(iterator))
+      return NULL;
+  } else if(!librdf_iterator_update_current_element(iterator))
     return NULL;
 
   return iterator->get_method(iterator->context, 
@@ -352,7 +399,10 @@ librdf_iterator_get_value(librdf_iterator* iterator)
   if(iterator->is_finished)
     return NULL;
 
-  if(!librdf_iterator_update_current_element(iterator))
+  if(librdf_iterator_is_lazy(iterator)) {
+    if(librdf_iterator_update_is_finished(iterator))
+      return NULL;
+  } else if(!librdf_iterator_update_current_element(iterator))
     return NULL;
 
   return iterator->get_method(iterator->context, 
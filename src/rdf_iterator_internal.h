@@ -44,6 +44,7 @@ struct librdf_iterator_s {
   int is_finished; /* 1 when have no more elements */
   int is_updated; /* 1 when we know there is a current item */
   int is_updating; /* 1 when are in the middle of update process */ 
+  int is_lazy; /* 1 when the object is only got when asked for */
 
   /* Used when mapping */
   void *current;            /* stores current element */
@@ -55,6 +56,8 @@ struct librdf_iterator_s {
   void (*finished_method)(void*);
 };
 
+void librdf_iterator_set_lazy(librdf_iterator* iterator);
+
 
 #ifdef __cplusplus
 }
@@ -247,6 +247,27 @@ librdf_list_remove(librdf_list* list, void *data)
     /* not found */
     return NULL;
 
+  return librdf_list_remove_node(list, node);
+}
+
+
+/**
+ * librdf_list_remove_node:
+ * @list: #librdf_list object
+ * @node: node of @list
+ *
+ * INTERNAL - Remove a node from an librdf_list without searching for it.
+ * 
+ * For callers that kept the node, such as the last node after
+ * librdf_list_add().
+ * 
+ * Return value: the data stored in the node
+ **/
+void *
+librdf_list_remove_node(librdf_list* list, librdf_list_node* node) 
+{
+  void *data;
+
   librdf_list_iterators_replace_node(list, node, node->next);
   
   if(node == list->first)
@@ -57,9 +57,6 @@ static int librdf_storage_stream_to_node_iterator_next_method(void* iterator);
 static void* librdf_storage_stream_to_node_iterator_get_method(void* iterator, int flags);
 static void librdf_storage_stream_to_node_iterator_finished(void* iterator);
 
-/* helper function for creating iterators for get sources, targets, arcs */
-static librdf_iterator* librdf_storage_node_stream_to_node_create(librdf_storage* storage, librdf_node* node1, librdf_node *node2, librdf_statement_part want);
-
 /* helper functions for dynamically loading storage modules */
 #ifdef MODULAR_LIBRDF
 void
@@ -93,6 +90,9 @@ librdf_init_storage(librdf_world *world)
   #ifdef STORAGE_TREES
     librdf_init_storage_trees(world);
   #endif
+  #ifdef STORAGE_FROZEN
+    librdf_init_storage_frozen(world);
+  #endif
   #ifdef STORAGE_MEMORY
     librdf_init_storage_list(world);
   #endif
@@ -1206,7 +1206,7 @@ librdf_storage_stream_to_node_iterator_finished(void* iterator)
  * 
  * Return value: a new #librdf_iterator or NULL on failure
  **/
-static librdf_iterator*
+librdf_iterator*
 librdf_storage_node_stream_to_node_create(librdf_storage* storage,
                                           librdf_node *node1,
                                           librdf_node *node2,
@@ -1652,6 +1652,44 @@ librdf_storage_context_as_stream(librdf_storage* storage, librdf_node* context)
 }
 
 
+/**
+ * librdf_storage_context_size:
+ * @storage: #librdf_storage object
+ * @context: #librdf_node context node
+ *
+ * Get the number of statements in a storage context.
+ * 
+ * Return value: The number of statements or < 0 if cannot be determined
+ **/
+int
+librdf_storage_context_size(librdf_storage* storage, librdf_node* context)
+{
+  librdf_stream *stream;
+  int count=0;
+
+  LIBRDF_ASSERT_OBJECT_POINTER_RETURN_VALUE(storage, librdf_storage, -1);
+  LIBRDF_ASSERT_OBJECT_POINTER_RETURN_VALUE(context, librdf_node, -1);
+
+  if(storage->factory->context_size)
+    return storage->factory->context_size(storage, context);
+
+  if(!storage->factory->context_serialise)
+    return -1;
+
+  stream=librdf_storage_context_as_stream(storage, context);
+  if(!stream)
+    return -1;
+
+  while(!librdf_stream_end(stream)) {
+    count++;
+    librdf_stream_next(stream);
+  }
+  librdf_free_stream(stream);
+
+  return count;
+}
+
+
 #ifndef REDLAND_DISABLE_DEPRECATED
 /**
  * librdf_storage_context_serialise:
@@ -2007,6 +2045,9 @@ main(int argc, char *argv[])
     #ifdef STORAGE_TREES
 	    "trees", "test", "contexts='yes'",
     #endif
+    #ifdef STORAGE_FROZEN
+	    "frozen", NULL, NULL,
+    #endif
     #ifdef STORAGE_FILE
       "file", "file://../redland.rdf", NULL,
 	    "uri", "http://librdf.org/redland.rdf", NULL,
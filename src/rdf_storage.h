@@ -127,6 +127,8 @@ REDLAND_API
 int librdf_storage_context_remove_statements(librdf_storage* storage, librdf_node* context);
 REDLAND_API
 librdf_stream* librdf_storage_context_as_stream(librdf_storage* storage, librdf_node* context);
+REDLAND_API
+int librdf_storage_context_size(librdf_storage* storage, librdf_node* context);
 REDLAND_API REDLAND_DEPRECATED
 librdf_stream* librdf_storage_context_serialise(librdf_storage* storage, librdf_node* context);
   
@@ -147,6 +149,110 @@ librdf_stream* librdf_storage_find_statements_in_context(librdf_storage* storage
 REDLAND_API
 librdf_iterator* librdf_storage_get_contexts(librdf_storage* storage);
 
+/**
+ * LIBRDF_STORAGE_FEATURE_STATISTICS_STATEMENTS:
+ *
+ * Storage feature statistics statements.
+ *
+ * The number of statements in a storage keeping statistics.
+ */
+#define LIBRDF_STORAGE_FEATURE_STATISTICS_STATEMENTS "http://feature.librdf.org/storage-statistics-statements"
+
+/**
+ * LIBRDF_STORAGE_FEATURE_STATISTICS_SUBJECTS:
+ *
+ * Storage feature statistics subjects.
+ *
+ * An estimate of the number of different subjects in a storage
+ * keeping statistics, not lowered when statements are removed.
+ */
+#define LIBRDF_STORAGE_FEATURE_STATISTICS_SUBJECTS "http://feature.librdf.org/storage-statistics-subjects"
+
+/**
+ * LIBRDF_STORAGE_FEATURE_STATISTICS_PREDICATES:
+ *
+ * Storage feature statistics predicates.
+ *
+ * The number of different predicates in a storage keeping statistics.
+ */
+#define LIBRDF_STORAGE_FEATURE_STATISTICS_PREDICATES "http://feature.librdf.org/storage-statistics-predicates"
+
+/**
+ * LIBRDF_STORAGE_FEATURE_STATISTICS_OBJECTS:
+ *
+ * Storage feature statistics objects.
+ *
+ * An estimate of the number of different objects in a storage
+ * keeping statistics, not lowered when statements are removed.
+ */
+#define LIBRDF_STORAGE_FEATURE_STATISTICS_OBJECTS "http://feature.librdf.org/storage-statistics-objects"
+
+/**
+ * LIBRDF_STORAGE_FEATURE_STATISTICS_SUBJECT:
+ *
+ * Storage feature statistics subject prefix.
+ *
+ * Followed by a node URI, by _: and a blank node identifier, or by
+ * a literal as "string", "string"@language or "string"^^datatype-URI,
+ * an estimate of the number of statements with that subject in a
+ * storage keeping statistics, never below the true number.
+ */
+#define LIBRDF_STORAGE_FEATURE_STATISTICS_SUBJECT "http://feature.librdf.org/storage-statistics-subject/"
+
+/**
+ * LIBRDF_STORAGE_FEATURE_STATISTICS_PREDICATE:
+ *
+ * Storage feature statistics predicate prefix.
+ *
+ * Followed by a predicate URI, the number of statements with that
+ * predicate in a storage keeping statistics.
+ */
+#define LIBRDF_STORAGE_FEATURE_STATISTICS_PREDICATE "http://feature.librdf.org/storage-statistics-predicate/"
+
+/**
+ * LIBRDF_STORAGE_FEATURE_STATISTICS_OBJECT:
+ *
+ * Storage feature statistics object prefix.
+ *
+ * Followed by a node URI, by _: and a blank node identifier, or by
+ * a literal as "string", "string"@language or "string"^^datatype-URI,
+ * an estimate of the number of statements with that object in a
+ * storage keeping statistics, never below the true number.
+ */
+#define LIBRDF_STORAGE_FEATURE_STATISTICS_OBJECT "http://feature.librdf.org/storage-statistics-object/"
+
+/**
+ * LIBRDF_STORAGE_FEATURE_NODE_CACHE_HITS:
+ *
+ * Storage feature node cache hits.
+ *
+ * The number of node lookups answered from the node cache of a
+ * storage keeping one.
+ */
+#define LIBRDF_STORAGE_FEATURE_NODE_CACHE_HITS "http://feature.librdf.org/storage-node-cache-hits"
+
+/**
+ * LIBRDF_STORAGE_FEATURE_NODE_CACHE_MISSES:
+ *
+ * Storage feature node cache misses.
+ *
+ * The number of node lookups not found in the node cache of a
+ * storage keeping one.
+ */
+#define LIBRDF_STORAGE_FEATURE_NODE_CACHE_MISSES "http://feature.librdf.org/storage-node-cache-misses"
+
+/**
+ * LIBRDF_STORAGE_FEATURE_BUILD_INDEXES:
+ *
+ * Storage feature build indexes.
+ *
+ * The number of index hashes of a hashes storage that are empty
+ * while another holds statements, such as one newly added to its
+ * indexes option.  Setting it to any value builds them from the
+ * statements in the others.
+ */
+#define LIBRDF_STORAGE_FEATURE_BUILD_INDEXES "http://feature.librdf.org/storage-build-indexes"
+
 /* features */
 REDLAND_API
 librdf_node* librdf_storage_get_feature(librdf_storage* storage, librdf_uri* feature);
@@ -0,0 +1,2629 @@
+/* -*- Mode: c; c-basic-offset: 2 -*-
+ *
+ * rdf_storage_frozen.c - RDF Storage as an immutable columnar image
+ *
+ * Copyright (C) 2000-2008, David Beckett http://www.dajobe.org/
+ * Copyright (C) 2000-2004, University of Bristol, UK http://www.bristol.ac.uk/
+ *
+ * This package is Free Software and part of Redland http://librdf.org/
+ *
+ * It is licensed under the following three licenses as alternatives:
+ *   1. GNU Lesser General Public License (LGPL) V2.1 or any newer version
+ *   2. GNU General Public License (GPL) V2 or any newer version
+ *   3. Apache License, V2.0 or any newer version
+ *
+ * You may not use this file except in compliance with at least one of
+ * the above three licenses.
+ *
+ * See LICENSE.html or LICENSE.txt at the top of this package for the
+ * complete terms and further detail along with the license texts for
+ * the licenses in COPYING.LIB, COPYING and LICENSE-2.0.txt respectively.
+ *
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <rdf_config.h>
+#endif
+
+#ifdef WIN32
+#include <win32_rdf_config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#include <sys/types.h>
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+#include <sys/mman.h>
+#define LIBRDF_STORAGE_FROZEN_MMAP 1
+#endif
+#if defined(HAVE_FLOCK) && defined(HAVE_SYS_FILE_H)
+#include <sys/file.h>
+#define LIBRDF_STORAGE_FROZEN_LOCK 1
+#endif
+
+#include <redland.h>
+
+
+/*
+ * The store is loaded once, then frozen into an image that is never
+ * changed:
+ *
+ *   header
+ *   u64 offsets[nodes_count + 1]   node i (1-based id) is encoded at
+ *                                  strings[offsets[i-1]..offsets[i]]
+ *   strings                        librdf_node_encode() of every node,
+ *                                  sorted by the encoded bytes
+ *   u32 rows[statements_count][3]  one array per index, rows of node
+ *                                  ids in the index order, sorted
+ *   predicates[predicates_count]   each predicate id and its first row
+ *                                  in the pos index, by id
+ *
+ * Every section starts on an 8 byte boundary so the same bytes can be
+ * used from memory, written out and mapped back in.
+ *
+ * With write='yes' statements added or removed after freezing are
+ * kept in a delta of two memory storages, written to the file
+ * <name>.delta on close and read back on open.  Syncing the storage
+ * merges the delta into a new image.  While open with write='yes' the
+ * file <name>.lock is locked so a second writer cannot overwrite the
+ * delta of the first.
+ */
+#define LIBRDF_STORAGE_FROZEN_MAGIC "LRDFFRZ1"
+#define LIBRDF_STORAGE_FROZEN_VERSION 2
+#define LIBRDF_STORAGE_FROZEN_DELTA_MAGIC "LRDFDLT1"
+#define LIBRDF_STORAGE_FROZEN_BYTE_ORDER 0x01020304
+
+#define LIBRDF_STORAGE_FROZEN_INDEX_SPO 0
+#define LIBRDF_STORAGE_FROZEN_INDEX_POS 1
+#define LIBRDF_STORAGE_FROZEN_INDEX_OSP 2
+#define LIBRDF_STORAGE_FROZEN_INDEX_COUNT 3
+
+#define LIBRDF_STORAGE_FROZEN_ALIGN(size) (((size) + 7) & ~((u64)7))
+
+/* Node ids are 32 bit; 0 is never a node */
+#define LIBRDF_STORAGE_FROZEN_MAX_NODES 0xFFFFFFFFUL
+
+/* Decoded nodes are cached in pages allocated on first use, so
+ * opening an image does not allocate in proportion to its size */
+#define LIBRDF_STORAGE_FROZEN_NODE_PAGE_BITS 12
+#define LIBRDF_STORAGE_FROZEN_NODE_PAGE_SIZE (1 << LIBRDF_STORAGE_FROZEN_NODE_PAGE_BITS)
+
+typedef struct
+{
+  char magic[8];
+  u32 byte_order;
+  u32 version;
+  u64 size;
+  u64 nodes_count;
+  u64 statements_count;
+  u64 offsets_offset;
+  u64 strings_offset;
+  u64 strings_size;
+  u64 index_offsets[LIBRDF_STORAGE_FROZEN_INDEX_COUNT];
+  u64 predicates_count;
+  u64 predicates_offset;
+} librdf_storage_frozen_header;
+
+typedef struct
+{
+  u32 id;
+  u32 pad;
+  u64 start;
+} librdf_storage_frozen_predicate;
+
+typedef struct
+{
+  /* image file name or NULL to keep the image in memory only */
+  char* name;
+  /* non 0 to rebuild the image file even if it exists */
+  int is_new;
+
+  /* The frozen image or NULL while loading */
+  unsigned char* image;
+  size_t image_size;
+  int image_mapped;
+  const librdf_storage_frozen_header* header;
+  const u64* offsets;
+  const unsigned char* strings;
+  const u32* indexes[LIBRDF_STORAGE_FROZEN_INDEX_COUNT];
+  const librdf_storage_frozen_predicate* predicates;
+  /* non 0 once the image file was read or written */
+  int image_saved;
+  /* non 0 to check every node id and offset of an image on opening */
+  int verify;
+
+  /* non 0 to allow changes after freezing */
+  int is_writable;
+  /* locked <name>.lock file while open for changes or -1 */
+  int lock_fd;
+  /* Changes since freezing: statements added and image statements
+   * removed, or NULL before the first change */
+  librdf_storage* added;
+  librdf_storage* removed;
+  /* non 0 if the delta file needs writing */
+  int delta_changed;
+
+  /* Pages of decoded nodes by id - 1, filled as they are returned */
+  librdf_node*** node_pages;
+  size_t node_pages_count;
+
+  /* While loading: encoded nodes and statements of their ids */
+  unsigned char* load_strings;
+  size_t load_strings_size;
+  size_t load_strings_capacity;
+  u64* load_offsets; /* start of each node; count is load_nodes_count */
+  size_t load_nodes_count;
+  size_t load_offsets_capacity;
+  u32* load_slots; /* open addressing table of node ids, 0 is empty */
+  size_t load_slots_size;
+  u32* load_rows;
+  size_t load_statements_count;
+  size_t load_rows_capacity;
+} librdf_storage_frozen_instance;
+
+
+/* Statement part (0 s, 1 p, 2 o) held in each column of an index */
+static const int librdf_storage_frozen_index_parts[LIBRDF_STORAGE_FROZEN_INDEX_COUNT][3]={
+  { 0, 1, 2 },
+  { 1, 2, 0 },
+  { 2, 0, 1 }
+};
+
+/* Column of an index holding each statement part (0 s, 1 p, 2 o) */
+static const int librdf_storage_frozen_index_columns[LIBRDF_STORAGE_FROZEN_INDEX_COUNT][3]={
+  { 0, 1, 2 },
+  { 2, 0, 1 },
+  { 1, 2, 0 }
+};
+
+
+/* prototypes for local functions */
+static int librdf_storage_frozen_init(librdf_storage* storage, const char *name, librdf_hash* options);
+static void librdf_storage_frozen_terminate(librdf_storage* storage);
+static int librdf_storage_frozen_open(librdf_storage* storage, librdf_model* model);
+static int librdf_storage_frozen_close(librdf_storage* storage);
+static int librdf_storage_frozen_size(librdf_storage* storage);
+static int librdf_storage_frozen_add_statement(librdf_storage* storage, librdf_statement* statement);
+static int librdf_storage_frozen_add_statements(librdf_storage* storage, librdf_stream* statement_stream);
+static int librdf_storage_frozen_remove_statement(librdf_storage* storage, librdf_statement* statement);
+static int librdf_storage_frozen_contains_statement(librdf_storage* storage, librdf_statement* statement);
+static librdf_stream* librdf_storage_frozen_serialise(librdf_storage* storage);
+static librdf_stream* librdf_storage_frozen_find_statements(librdf_storage* storage, librdf_statement* statement);
+static librdf_iterator* librdf_storage_frozen_find_sources(librdf_storage* storage, librdf_node* arc, librdf_node* target);
+static librdf_iterator* librdf_storage_frozen_find_arcs(librdf_storage* storage, librdf_node* source, librdf_node* target);
+static librdf_iterator* librdf_storage_frozen_find_targets(librdf_storage* storage, librdf_node* source, librdf_node* arc);
+static int librdf_storage_frozen_sync(librdf_storage* storage);
+static librdf_node* librdf_storage_frozen_get_feature(librdf_storage* storage, librdf_uri* feature);
+
+/* image functions */
+static int librdf_storage_frozen_attach(librdf_storage* storage, unsigned char* image, size_t size, int mapped);
+static int librdf_storage_frozen_read_image(librdf_storage* storage);
+static int librdf_storage_frozen_write_image(librdf_storage* storage);
+static char* librdf_storage_frozen_file_name(librdf_storage_frozen_instance* context, const char* suffix);
+static int librdf_storage_frozen_lock(librdf_storage* storage);
+static void librdf_storage_frozen_unlock(librdf_storage_frozen_instance* context);
+static int librdf_storage_frozen_freeze(librdf_storage* storage);
+static int librdf_storage_frozen_compact(librdf_storage* storage);
+static void librdf_storage_frozen_detach(librdf_storage_frozen_instance* context);
+static void librdf_storage_frozen_free_load(librdf_storage_frozen_instance* context);
+static int librdf_storage_frozen_load_statement(librdf_storage_frozen_instance* context, librdf_statement* statement);
+static int librdf_storage_frozen_image_contains(librdf_storage* storage, librdf_statement* statement);
+
+/* delta functions */
+static int librdf_storage_frozen_delta_add(librdf_storage* storage, librdf_statement* statement);
+static int librdf_storage_frozen_delta_remove(librdf_storage* storage, librdf_statement* statement);
+static int librdf_storage_frozen_delta_size(librdf_storage_frozen_instance* context);
+static void librdf_storage_frozen_delta_free(librdf_storage_frozen_instance* context);
+static int librdf_storage_frozen_read_delta(librdf_storage* storage);
+static int librdf_storage_frozen_write_delta(librdf_storage* storage);
+
+/* find stream methods */
+static int librdf_storage_frozen_find_end_of_stream(void* context);
+static int librdf_storage_frozen_find_next_statement(void* context);
+static void* librdf_storage_frozen_find_get_statement(void* context, int flags);
+static void librdf_storage_frozen_find_finished(void* context);
+
+/* node iterator methods */
+static int librdf_storage_frozen_nodes_is_end(void* iterator);
+static int librdf_storage_frozen_nodes_next_method(void* iterator);
+static void* librdf_storage_frozen_nodes_get_method(void* iterator, int flags);
+static void librdf_storage_frozen_nodes_finished(void* iterator);
+
+static void librdf_storage_frozen_register_factory(librdf_storage_factory *factory);
+
+
+/* functions implementing storage api */
+static int
+librdf_storage_frozen_init(librdf_storage* storage, const char *name,
+                           librdf_hash* options)
+{
+  librdf_storage_frozen_instance* context;
+
+  context = LIBRDF_CALLOC(librdf_storage_frozen_instance*, 1, sizeof(*context));
+  if(!context) {
+    if(options)
+      librdf_free_hash(options);
+    return 1;
+  }
+
+  librdf_storage_set_instance(storage, context);
+  context->lock_fd=-1;
+
+  if(name) {
+    size_t name_len=strlen(name);
+
+    context->name = LIBRDF_MALLOC(char*, name_len + 1);
+    if(!context->name) {
+      if(options)
+        librdf_free_hash(options);
+      return 1;
+    }
+    memcpy(context->name, name, name_len + 1);
+  }
+
+  if((context->is_new=librdf_hash_get_as_boolean(options, "new"))<0)
+    context->is_new=0; /* default is to use an existing image */
+
+  if((context->is_writable=librdf_hash_get_as_boolean(options, "write"))<0)
+    context->is_writable=0; /* default is no changes once frozen */
+
+  if((context->verify=librdf_hash_get_as_boolean(options, "verify"))<0)
+    context->verify=0; /* default is to check nodes as they are used */
+
+  /* no more options, might as well free them now */
+  if(options)
+    librdf_free_hash(options);
+
+  return 0;
+}
+
+
+static void
+librdf_storage_frozen_terminate(librdf_storage* storage)
+{
+  librdf_storage_frozen_instance* context=(librdf_storage_frozen_instance*)storage->instance;
+
+  if(!context)
+    return;
+
+  if(context->name)
+    LIBRDF_FREE(char*, context->name);
+
+  LIBRDF_FREE(librdf_storage_frozen_instance, context);
+}
+
+
+static int
+librdf_storage_frozen_open(librdf_storage* storage, librdf_model* model)
+{
+  librdf_storage_frozen_instance* context=(librdf_storage_frozen_instance*)storage->instance;
+  int rc=0;
+
+  /* one writer at a time, before the delta is read */
+  if(context->name && context->is_writable &&
+     librdf_storage_frozen_lock(storage))
+    return 1;
+
+  if(context->name && !context->is_new) {
+    rc=librdf_storage_frozen_read_image(storage);
+
+    /* < 0 is no image yet, so load one */
+    if(rc < 0)
+      rc=0;
+    else if(!rc) {
+      context->image_saved=1;
+      rc=librdf_storage_frozen_read_delta(storage);
+    }
+  }
+
+  if(rc) {
+    librdf_storage_frozen_detach(context);
+    librdf_storage_frozen_delta_free(context);
+    librdf_storage_frozen_unlock(context);
+  }
+
+  return rc;
+}
+
+
+/* Lock the <name>.lock file of the image, failing if another storage
+ * has it locked for changes */
+static int
+librdf_storage_frozen_lock(librdf_storage* storage)
+{
+#ifdef LIBRDF_STORAGE_FROZEN_LOCK
+  librdf_storage_frozen_instance* context=(librdf_storage_frozen_instance*)storage->instance;
+  char* lock_name;
+
+  lock_name=librdf_storage_frozen_file_name(context, ".lock");
+  if(!lock_name)
+    return 1;
+
+  context->lock_fd=open(lock_name, O_RDWR | O_CREAT, 0644);
+  if(context->lock_fd < 0) {
+    librdf_log(storage->world, 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+               "Failed to open frozen storage lock file %s", lock_name);
+    LIBRDF_FREE(char*, lock_name);
+    return 1;
+  }
+  LIBRDF_FREE(char*, lock_name);
+
+  if(flock(context->lock_fd, LOCK_EX | LOCK_NB)) {
+    librdf_log(storage->world, 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+               "Frozen storage %s is already open for changes",
+               context->name);
+    librdf_storage_frozen_unlock(context);
+    return 1;
+  }
+#endif
+
+  return 0;
+}
+
+
+static void
+librdf_storage_frozen_unlock(librdf_storage_frozen_instance* context)
+{
+#ifdef LIBRDF_STORAGE_FROZEN_LOCK
+  if(context->lock_fd >= 0) {
+    /* closing releases the lock; the file stays for the next writer */
+    close(context->lock_fd);
+    context->lock_fd=-1;
+  }
+#endif
+}
+
+
+/**
+ * librdf_storage_frozen_close:
+ * @storage: the storage
+ *
+ * .
+ *
+ * Close the storage, freezing and writing the image first if
+ * statements were loaded into a named store, or writing the delta
+ * file if the frozen image was changed.
+ *
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_storage_frozen_close(librdf_storage* storage)
+{
+  librdf_storage_frozen_instance* context=(librdf_storage_frozen_instance*)storage->instance;
+  int status=0;
+
+  if(!context->image && context->name && context->load_statements_count)
+    status=librdf_storage_frozen_freeze(storage);
+  else if(context->image && context->name && context->delta_changed) {
+    /* a delta is only read back with an image file */
+    if(context->image_saved)
+      status=librdf_storage_frozen_write_delta(storage);
+    else
+      status=librdf_storage_frozen_compact(storage);
+  }
+
+  librdf_storage_frozen_free_load(context);
+  librdf_storage_frozen_detach(context);
+  librdf_storage_frozen_delta_free(context);
+  librdf_storage_frozen_unlock(context);
+
+  return status;
+}
+
+
+/* Forget the image and the nodes decoded from it */
+static void
+librdf_storage_frozen_detach(librdf_storage_frozen_instance* context)
+{
+  if(context->node_pages) {
+    size_t page;
+    int i;
+
+    for(page=0; page < context->node_pages_count; page++) {
+      if(!context->node_pages[page])
+        continue;
+      for(i=0; i < LIBRDF_STORAGE_FROZEN_NODE_PAGE_SIZE; i++) {
+        if(context->node_pages[page][i])
+          librdf_free_node(context->node_pages[page][i]);
+      }
+      LIBRDF_FREE(librdf_node**, context->node_pages[page]);
+    }
+    LIBRDF_FREE(librdf_node***, context->node_pages);
+    context->node_pages=NULL;
+    context->node_pages_count=0;
+  }
+
+  if(context->image) {
+#ifdef LIBRDF_STORAGE_FROZEN_MMAP
+    if(context->image_mapped)
+      munmap(context->image, context->image_size);
+    else
+#endif
+      LIBRDF_FREE(unsigned char*, context->image);
+    context->image=NULL;
+    context->header=NULL;
+  }
+}
+
+
+/* Grow @buffer of @item_size items to hold at least @needed of them */
+static int
+librdf_storage_frozen_grow(void** buffer, size_t* capacity, size_t needed,
+                           size_t item_size)
+{
+  size_t new_capacity;
+  void* new_buffer;
+
+  if(needed <= *capacity)
+    return 0;
+
+  new_capacity=*capacity ? *capacity * 2 : 1024;
+  while(new_capacity < needed)
+    new_capacity *= 2;
+
+  new_buffer=LIBRDF_MALLOC(void*, new_capacity * item_size);
+  if(!new_buffer)
+    return 1;
+  if(*buffer) {
+    memcpy(new_buffer, *buffer, *capacity * item_size);
+    LIBRDF_FREE(void*, *buffer);
+  }
+  *buffer=new_buffer;
+  *capacity=new_capacity;
+
+  return 0;
+}
+
+
+static void
+librdf_storage_frozen_free_load(librdf_storage_frozen_instance* context)
+{
+  if(context->load_strings)
+    LIBRDF_FREE(unsigned char*, context->load_strings);
+  if(context->load_offsets)
+    LIBRDF_FREE(u64*, context->load_offsets);
+  if(context->load_slots)
+    LIBRDF_FREE(u32*, context->load_slots);
+  if(context->load_rows)
+    LIBRDF_FREE(u32*, context->load_rows);
+
+  context->load_strings=NULL;
+  context->load_strings_size=0;
+  context->load_strings_capacity=0;
+  context->load_offsets=NULL;
+  context->load_nodes_count=0;
+  context->load_offsets_capacity=0;
+  context->load_slots=NULL;
+  context->load_slots_size=0;
+  context->load_rows=NULL;
+  context->load_statements_count=0;
+  context->load_rows_capacity=0;
+}
+
+
+/* Encoded bytes of a node loaded with 1-based @id */
+static const unsigned char*
+librdf_storage_frozen_load_string(librdf_storage_frozen_instance* context,
+                                  u32 id, size_t* len_p)
+{
+  size_t start=(size_t)context->load_offsets[id - 1];
+  size_t end=(id < context->load_nodes_count) ?
+    (size_t)context->load_offsets[id] : context->load_strings_size;
+
+  *len_p=end - start;
+  return context->load_strings + start;
+}
+
+
+/* Double the table of loaded node ids, rehashing them */
+static int
+librdf_storage_frozen_load_rehash(librdf_storage_frozen_instance* context)
+{
+  size_t size=context->load_slots_size ? context->load_slots_size * 2 : 1024;
+  u32* slots;
+  u32 id;
+
+  slots=LIBRDF_CALLOC(u32*, size, sizeof(u32));
+  if(!slots)
+    return 1;
+
+  for(id=1; id <= context->load_nodes_count; id++) {
+    const unsigned char* string;
+    size_t len;
+    size_t slot;
+
+    string=librdf_storage_frozen_load_string(context, id, &len);
+    slot=(size_t)librdf_hash_function_wyhash(string, len, 0) & (size - 1);
+    while(slots[slot])
+      slot=(slot + 1) & (size - 1);
+    slots[slot]=id;
+  }
+
+  if(context->load_slots)
+    LIBRDF_FREE(u32*, context->load_slots);
+  context->load_slots=slots;
+  context->load_slots_size=size;
+
+  return 0;
+}
+
+
+/* Get the load id of a node, adding it if it is new.  0 on failure */
+static u32
+librdf_storage_frozen_load_node(librdf_storage_frozen_instance* context,
+                                librdf_node* node)
+{
+  size_t len;
+  unsigned char* string;
+  size_t slot;
+  u32 id;
+
+  if(context->load_nodes_count * 2 >= context->load_slots_size &&
+     librdf_storage_frozen_load_rehash(context))
+    return 0;
+
+  len=librdf_node_encode(node, NULL, 0);
+  if(!len)
+    return 0;
+  if(librdf_storage_frozen_grow((void**)&context->load_strings,
+                                &context->load_strings_capacity,
+                                context->load_strings_size + len, 1))
+    return 0;
+
+  /* encode at the end of the strings; only kept if the node is new */
+  string=context->load_strings + context->load_strings_size;
+  librdf_node_encode(node, string, len);
+
+  slot=(size_t)librdf_hash_function_wyhash(string, len, 0) & (context->load_slots_size - 1);
+  while((id=context->load_slots[slot])) {
+    const unsigned char* other;
+    size_t other_len;
+
+    other=librdf_storage_frozen_load_string(context, id, &other_len);
+    if(other_len == len && !memcmp(other, string, len))
+      return id;
+    slot=(slot + 1) & (context->load_slots_size - 1);
+  }
+
+  if(context->load_nodes_count >= LIBRDF_STORAGE_FROZEN_MAX_NODES ||
+     librdf_storage_frozen_grow((void**)&context->load_offsets,
+                                &context->load_offsets_capacity,
+                                context->load_nodes_count + 1, sizeof(u64)))
+    return 0;
+
+  context->load_offsets[context->load_nodes_count++]=context->load_strings_size;
+  context->load_strings_size += len;
+  id=(u32)context->load_nodes_count;
+  context->load_slots[slot]=id;
+
+  return id;
+}
+
+
+static int
+librdf_storage_frozen_size(librdf_storage* storage)
+{
+  librdf_storage_frozen_instance* context=(librdf_storage_frozen_instance*)storage->instance;
+  int count;
+
+  if(librdf_storage_frozen_freeze(storage))
+    return -1;
+
+  count=(int)context->header->statements_count;
+  if(context->added)
+    count += librdf_storage_size(context->added) -
+             librdf_storage_size(context->removed);
+
+  return count;
+}
+
+
+static int
+librdf_storage_frozen_add_statement(librdf_storage* storage,
+                                    librdf_statement* statement)
+{
+  librdf_storage_frozen_instance* context=(librdf_storage_frozen_instance*)storage->instance;
+
+  if(!context->image)
+    return librdf_storage_frozen_load_statement(context, statement);
+
+  if(!context->is_writable) {
+    librdf_log(storage->world, 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+               "Cannot add statements to a frozen storage");
+    return 1;
+  }
+
+  return librdf_storage_frozen_delta_add(storage, statement);
+}
+
+
+/* Add a statement to the statements being loaded */
+static int
+librdf_storage_frozen_load_statement(librdf_storage_frozen_instance* context,
+                                     librdf_statement* statement)
+{
+  u32* row;
+
+  if(!librdf_statement_is_complete(statement))
+    return 1;
+
+  if(librdf_storage_frozen_grow((void**)&context->load_rows,
+                                &context->load_rows_capacity,
+                                (context->load_statements_count + 1) * 3,
+                                sizeof(u32)))
+    return 1;
+
+  row=context->load_rows + context->load_statements_count * 3;
+  row[0]=librdf_storage_frozen_load_node(context, librdf_statement_get_subject(statement));
+  row[1]=librdf_storage_frozen_load_node(context, librdf_statement_get_predicate(statement));
+  row[2]=librdf_storage_frozen_load_node(context, librdf_statement_get_object(statement));
+  if(!row[0] || !row[1] || !row[2])
+    return 1;
+
+  /* duplicates are removed when frozen */
+  context->load_statements_count++;
+
+  return 0;
+}
+
+
+static int
+librdf_storage_frozen_add_statements(librdf_storage* storage,
+                                     librdf_stream* statement_stream)
+{
+  int status=0;
+
+  for(; !librdf_stream_end(statement_stream);
+      librdf_stream_next(statement_stream)) {
+    librdf_statement* statement=librdf_stream_get_object(statement_stream);
+
+    if(!statement) {
+      status=1;
+      break;
+    }
+
+    status=librdf_storage_frozen_add_statement(storage, statement);
+    if(status)
+      break;
+  }
+
+  return status;
+}
+
+
+static int
+librdf_storage_frozen_remove_statement(librdf_storage* storage,
+                                       librdf_statement* statement)
+{
+  librdf_storage_frozen_instance* context=(librdf_storage_frozen_instance*)storage->instance;
+
+  if(!context->is_writable) {
+    librdf_log(storage->world, 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+               "Cannot remove statements from a frozen storage");
+    return 1;
+  }
+
+  if(librdf_storage_frozen_freeze(storage))
+    return 1;
+
+  return librdf_storage_frozen_delta_remove(storage, statement);
+}
+
+
+/* Create the delta storages on the first change */
+static int
+librdf_storage_frozen_delta_init(librdf_storage* storage)
+{
+  librdf_storage_frozen_instance* context=(librdf_storage_frozen_instance*)storage->instance;
+
+  if(context->added)
+    return 0;
+
+  context->added=librdf_new_storage(storage->world, "memory", NULL,
+                                    "index='yes'");
+  context->removed=librdf_new_storage(storage->world, "memory", NULL,
+                                      "index='yes'");
+  if(!context->added || !context->removed) {
+    librdf_storage_frozen_delta_free(context);
+    return 1;
+  }
+
+  return 0;
+}
+
+
+static void
+librdf_storage_frozen_delta_free(librdf_storage_frozen_instance* context)
+{
+  if(context->added)
+    librdf_free_storage(context->added);
+  if(context->removed)
+    librdf_free_storage(context->removed);
+
+  context->added=NULL;
+  context->removed=NULL;
+  context->delta_changed=0;
+}
+
+
+/* Number of statements added and removed since freezing */
+static int
+librdf_storage_frozen_delta_size(librdf_storage_frozen_instance* context)
+{
+  if(!context->added)
+    return 0;
+
+  return librdf_storage_size(context->added) +
+         librdf_storage_size(context->removed);
+}
+
+
+/**
+ * librdf_storage_frozen_delta_add:
+ * @storage: the storage
+ * @statement: the statement
+ *
+ * INTERNAL - Add a statement to the delta of a frozen image
+ *
+ * A statement already in the image is only taken back out of the
+ * removed statements, so applying the same change twice has no
+ * further effect.
+ *
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_storage_frozen_delta_add(librdf_storage* storage,
+                                librdf_statement* statement)
+{
+  librdf_storage_frozen_instance* context=(librdf_storage_frozen_instance*)storage->instance;
+
+  if(!librdf_statement_is_complete(statement) ||
+     librdf_storage_frozen_delta_init(storage))
+    return 1;
+
+  if(librdf_storage_frozen_image_contains(storage, statement)) {
+    if(!librdf_storage_contains_statement(context->removed, statement))
+      return 0;
+    context->delta_changed=1;
+    return librdf_storage_remove_statement(context->removed, statement);
+  }
+
+  if(librdf_storage_contains_statement(context->added, statement))
+    return 0;
+  context->delta_changed=1;
+  return librdf_storage_add_statement(context->added, statement);
+}
+
+
+/**
+ * librdf_storage_frozen_delta_remove:
+ * @storage: the storage
+ * @statement: the statement
+ *
+ * INTERNAL - Remove a statement through the delta of a frozen image
+ *
+ * Return value: non 0 on failure or if the statement is not present
+ **/
+static int
+librdf_storage_frozen_delta_remove(librdf_storage* storage,
+                                   librdf_statement* statement)
+{
+  librdf_storage_frozen_instance* context=(librdf_storage_frozen_instance*)storage->instance;
+
+  if(!librdf_statement_is_complete(statement) ||
+     librdf_storage_frozen_delta_init(storage))
+    return 1;
+
+  if(librdf_storage_contains_statement(context->added, statement)) {
+    context->delta_changed=1;
+    return librdf_storage_remove_statement(context->added, statement);
+  }
+
+  if(!librdf_storage_frozen_image_contains(storage, statement) ||
+     librdf_storage_contains_statement(context->removed, statement))
+    return 1;
+  context->delta_changed=1;
+  return librdf_storage_add_statement(context->removed, statement);
+}
+
+
+/* Compare rows of node ids for qsort() */
+static int
+librdf_storage_frozen_compare_rows(const void* a, const void* b)
+{
+  const u32* row_a=(const u32*)a;
+  const u32* row_b=(const u32*)b;
+  int i;
+
+  for(i=0; i < 3; i++) {
+    if(row_a[i] != row_b[i])
+      return (row_a[i] < row_b[i]) ? -1 : 1;
+  }
+  return 0;
+}
+
+
+typedef struct
+{
+  const unsigned char* string;
+  size_t len;
+  u32 id;
+} librdf_storage_frozen_load_entry;
+
+
+/* Compare encoded nodes for qsort(): by bytes, then shorter first */
+static int
+librdf_storage_frozen_compare_strings(const unsigned char* a, size_t a_len,
+                                      const unsigned char* b, size_t b_len)
+{
+  int rc=memcmp(a, b, (a_len < b_len) ? a_len : b_len);
+
+  if(rc)
+    return rc;
+  return (a_len < b_len) ? -1 : (a_len > b_len);
+}
+
+
+static int
+librdf_storage_frozen_compare_entries(const void* a, const void* b)
+{
+  const librdf_storage_frozen_load_entry* entry_a=(const librdf_storage_frozen_load_entry*)a;
+  const librdf_storage_frozen_load_entry* entry_b=(const librdf_storage_frozen_load_entry*)b;
+
+  return librdf_storage_frozen_compare_strings(entry_a->string, entry_a->len,
+                                               entry_b->string, entry_b->len);
+}
+
+
+/**
+ * librdf_storage_frozen_freeze:
+ * @storage: the storage
+ *
+ * INTERNAL - Build the image from the loaded statements
+ *
+ * Sorts the nodes into the dictionary, renumbers the statements,
+ * removes duplicates and sorts each index.  Writes the image file
+ * if the storage has a name.  Does nothing if already frozen.
+ *
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_storage_frozen_freeze(librdf_storage* storage)
+{
+  librdf_storage_frozen_instance* context=(librdf_storage_frozen_instance*)storage->instance;
+  size_t nodes_count=context->load_nodes_count;
+  size_t count=context->load_statements_count;
+  librdf_storage_frozen_load_entry* entries=NULL;
+  u32* ids=NULL;
+  u32* rows=context->load_rows;
+  librdf_storage_frozen_header* header;
+  unsigned char* image;
+  u64 offsets_offset, strings_offset, strings_size, index_offset, size;
+  u64 predicates_offset;
+  size_t predicates_count=0;
+  u64* offsets;
+  librdf_storage_frozen_predicate* predicates;
+  const u32* pos_rows;
+  size_t i, j;
+  int index;
+
+  if(context->image)
+    return 0;
+
+  if(nodes_count) {
+    entries=LIBRDF_MALLOC(librdf_storage_frozen_load_entry*,
+                          nodes_count * sizeof(*entries));
+    ids=LIBRDF_MALLOC(u32*, nodes_count * sizeof(u32));
+    if(!entries || !ids)
+      goto failed;
+  }
+
+  /* dictionary in encoded node order; ids[old id - 1] is the new id */
+  for(i=0; i < nodes_count; i++) {
+    entries[i].string=librdf_storage_frozen_load_string(context, (u32)(i + 1),
+                                                        &entries[i].len);
+    entries[i].id=(u32)(i + 1);
+  }
+  if(nodes_count)
+    qsort(entries, nodes_count, sizeof(*entries),
+          librdf_storage_frozen_compare_entries);
+  for(i=0; i < nodes_count; i++)
+    ids[entries[i].id - 1]=(u32)(i + 1);
+
+  for(i=0; i < count * 3; i++)
+    rows[i]=ids[rows[i] - 1];
+
+  if(count) {
+    qsort(rows, count, 3 * sizeof(u32), librdf_storage_frozen_compare_rows);
+
+    for(i=1, j=1; i < count; i++) {
+      if(librdf_storage_frozen_compare_rows(rows + (i - 1) * 3, rows + i * 3))
+        memcpy(rows + (j++) * 3, rows + i * 3, 3 * sizeof(u32));
+    }
+    count=j;
+
+    /* count the distinct predicates, reusing ids to mark them */
+    memset(ids, 0, nodes_count * sizeof(u32));
+    for(i=0; i < count; i++) {
+      u32 predicate=rows[i * 3 + 1];
+
+      if(!ids[predicate - 1]) {
+        ids[predicate - 1]=1;
+        predicates_count++;
+      }
+    }
+  }
+
+  offsets_offset=LIBRDF_STORAGE_FROZEN_ALIGN(sizeof(librdf_storage_frozen_header));
+  strings_offset=offsets_offset + (nodes_count + 1) * sizeof(u64);
+  strings_size=context->load_strings_size;
+  index_offset=LIBRDF_STORAGE_FROZEN_ALIGN(strings_offset + strings_size);
+  predicates_offset=index_offset + LIBRDF_STORAGE_FROZEN_INDEX_COUNT *
+    LIBRDF_STORAGE_FROZEN_ALIGN(count * 3 * sizeof(u32));
+  size=predicates_offset +
+    predicates_count * sizeof(librdf_storage_frozen_predicate);
+
+  image=LIBRDF_CALLOC(unsigned char*, 1, (size_t)size);
+  if(!image)
+    goto failed;
+
+  header=(librdf_storage_frozen_header*)image;
+  memcpy(header->magic, LIBRDF_STORAGE_FROZEN_MAGIC, sizeof(header->magic));
+  header->byte_order=LIBRDF_STORAGE_FROZEN_BYTE_ORDER;
+  header->version=LIBRDF_STORAGE_FROZEN_VERSION;
+  header->size=size;
+  header->nodes_count=nodes_count;
+  header->statements_count=count;
+  header->offsets_offset=offsets_offset;
+  header->strings_offset=strings_offset;
+  header->strings_size=strings_size;
+  header->predicates_count=predicates_count;
+  header->predicates_offset=predicates_offset;
+
+  offsets=(u64*)(image + offsets_offset);
+  offsets[0]=0;
+  for(i=0; i < nodes_count; i++) {
+    memcpy(image + strings_offset + offsets[i], entries[i].string,
+           entries[i].len);
+    offsets[i + 1]=offsets[i] + entries[i].len;
+  }
+
+  for(index=0; index < LIBRDF_STORAGE_FROZEN_INDEX_COUNT; index++) {
+    const int* parts=librdf_storage_frozen_index_parts[index];
+    u32* index_rows=(u32*)(image + index_offset);
+
+    header->index_offsets[index]=index_offset;
+    for(i=0; i < count; i++) {
+      index_rows[i * 3]=rows[i * 3 + parts[0]];
+      index_rows[i * 3 + 1]=rows[i * 3 + parts[1]];
+      index_rows[i * 3 + 2]=rows[i * 3 + parts[2]];
+    }
+    /* spo rows are already in order */
+    if(index != LIBRDF_STORAGE_FROZEN_INDEX_SPO && count)
+      qsort(index_rows, count, 3 * sizeof(u32),
+            librdf_storage_frozen_compare_rows);
+    index_offset += LIBRDF_STORAGE_FROZEN_ALIGN(count * 3 * sizeof(u32));
+  }
+
+  /* where each predicate starts in pos */
+  predicates=(librdf_storage_frozen_predicate*)(image + predicates_offset);
+  pos_rows=(const u32*)(image + header->index_offsets[LIBRDF_STORAGE_FROZEN_INDEX_POS]);
+  for(i=0, j=0; i < count; i++) {
+    if(!i || pos_rows[i * 3] != pos_rows[(i - 1) * 3]) {
+      predicates[j].id=pos_rows[i * 3];
+      predicates[j].start=i;
+      j++;
+    }
+  }
+
+  if(entries)
+    LIBRDF_FREE(librdf_storage_frozen_load_entry*, entries);
+  if(ids)
+    LIBRDF_FREE(u32*, ids);
+  librdf_storage_frozen_free_load(context);
+
+  if(librdf_storage_frozen_attach(storage, image, (size_t)size, 0)) {
+    LIBRDF_FREE(unsigned char*, image);
+    return 1;
+  }
+
+  /* a store queried before anything was loaded writes no image file,
+   * unless asked for a new one or replacing one */
+  if(context->name && (count || context->is_new || context->image_saved)) {
+    char* delta_name;
+
+    if(librdf_storage_frozen_write_image(storage))
+      return 1;
+    context->image_saved=1;
+
+    /* any delta is for the image just replaced */
+    delta_name=librdf_storage_frozen_file_name(context, ".delta");
+    if(!delta_name)
+      return 1;
+    remove(delta_name);
+    LIBRDF_FREE(char*, delta_name);
+  }
+
+  return 0;
+
+  failed:
+  if(entries)
+    LIBRDF_FREE(librdf_storage_frozen_load_entry*, entries);
+  if(ids)
+    LIBRDF_FREE(u32*, ids);
+  librdf_log(storage->world, 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+             "Out of memory freezing storage");
+  return 1;
+}
+
+
+/* Check every node offset and node id of an image whose header was
+ * checked, for option verify; non 0 if not valid */
+static int
+librdf_storage_frozen_check_image(const librdf_storage_frozen_header* header,
+                                  const unsigned char* image)
+{
+  const u64* offsets=(const u64*)(image + header->offsets_offset);
+  const librdf_storage_frozen_predicate* predicates;
+  u64 nodes_count=header->nodes_count;
+  u64 i;
+  int index;
+
+  /* every node is at least one byte, in order, inside the strings */
+  if(offsets[0])
+    return 1;
+  for(i=0; i < nodes_count; i++) {
+    if(offsets[i + 1] <= offsets[i])
+      return 1;
+  }
+  if(offsets[nodes_count] > header->strings_size)
+    return 1;
+
+  for(index=0; index < LIBRDF_STORAGE_FROZEN_INDEX_COUNT; index++) {
+    const u32* rows=(const u32*)(image + header->index_offsets[index]);
+
+    for(i=0; i < header->statements_count * 3; i++) {
+      if(!rows[i] || rows[i] > nodes_count)
+        return 1;
+    }
+  }
+
+  predicates=(const librdf_storage_frozen_predicate*)(image + header->predicates_offset);
+  for(i=0; i < header->predicates_count; i++) {
+    if(!predicates[i].id || predicates[i].id > nodes_count ||
+       predicates[i].start >= header->statements_count)
+      return 1;
+  }
+
+  return 0;
+}
+
+
+/* Check an image and point the instance at its sections */
+static int
+librdf_storage_frozen_attach(librdf_storage* storage, unsigned char* image,
+                             size_t size, int mapped)
+{
+  librdf_storage_frozen_instance* context=(librdf_storage_frozen_instance*)storage->instance;
+  const librdf_storage_frozen_header* header=(const librdf_storage_frozen_header*)image;
+  u64 rows_size;
+  int index;
+
+  if(size < sizeof(*header) ||
+     memcmp(header->magic, LIBRDF_STORAGE_FROZEN_MAGIC, sizeof(header->magic)) ||
+     header->byte_order != LIBRDF_STORAGE_FROZEN_BYTE_ORDER ||
+     header->version != LIBRDF_STORAGE_FROZEN_VERSION ||
+     header->size != size ||
+     header->nodes_count > LIBRDF_STORAGE_FROZEN_MAX_NODES ||
+     header->statements_count > size / (3 * sizeof(u32)) ||
+     header->offsets_offset & 7 ||
+     header->strings_offset > size ||
+     header->offsets_offset > header->strings_offset ||
+     (header->nodes_count + 1) * sizeof(u64) > header->strings_offset - header->offsets_offset ||
+     header->strings_size > size - header->strings_offset ||
+     header->predicates_count > header->statements_count ||
+     header->predicates_offset & 7 ||
+     header->predicates_offset > size ||
+     header->predicates_count > (size - header->predicates_offset) / sizeof(librdf_storage_frozen_predicate))
+    goto bad;
+
+  rows_size=header->statements_count * 3 * sizeof(u32);
+  for(index=0; index < LIBRDF_STORAGE_FROZEN_INDEX_COUNT; index++) {
+    if(header->index_offsets[index] & 7 ||
+       header->index_offsets[index] < header->strings_offset + header->strings_size ||
+       header->index_offsets[index] > size ||
+       rows_size > size - header->index_offsets[index])
+      goto bad;
+  }
+
+  if(context->verify && librdf_storage_frozen_check_image(header, image))
+    goto bad;
+
+  context->image=image;
+  context->image_size=size;
+  context->image_mapped=mapped;
+  context->header=header;
+  context->offsets=(const u64*)(image + header->offsets_offset);
+  context->strings=image + header->strings_offset;
+  for(index=0; index < LIBRDF_STORAGE_FROZEN_INDEX_COUNT; index++)
+    context->indexes[index]=(const u32*)(image + header->index_offsets[index]);
+  context->predicates=(const librdf_storage_frozen_predicate*)(image + header->predicates_offset);
+
+  if(header->nodes_count) {
+    context->node_pages_count=(size_t)((header->nodes_count - 1) >> LIBRDF_STORAGE_FROZEN_NODE_PAGE_BITS) + 1;
+    context->node_pages=LIBRDF_CALLOC(librdf_node***, context->node_pages_count,
+                                      sizeof(librdf_node**));
+    if(!context->node_pages) {
+      context->node_pages_count=0;
+      context->image=NULL;
+      context->header=NULL;
+      return 1;
+    }
+  }
+
+  return 0;
+
+  bad:
+  librdf_log(storage->world, 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+             "Frozen storage image %s is not valid",
+             context->name ? context->name : "(memory)");
+  return 1;
+}
+
+
+/**
+ * librdf_storage_frozen_read_image:
+ * @storage: the storage
+ *
+ * INTERNAL - Map the image file named by the storage
+ *
+ * Only the header and section bounds are checked here, so opening
+ * takes the same time for any size of image; node ids and offsets are
+ * checked as they are used, or all at once with option verify.  The
+ * mapping is read only and shared, so processes using the same image
+ * share the page cache.
+ *
+ * Return value: < 0 if there is no image file, > 0 on failure
+ **/
+static int
+librdf_storage_frozen_read_image(librdf_storage* storage)
+{
+  librdf_storage_frozen_instance* context=(librdf_storage_frozen_instance*)storage->instance;
+  unsigned char* image;
+  size_t size;
+#ifdef LIBRDF_STORAGE_FROZEN_MMAP
+  struct stat st;
+  int fd;
+
+  fd=open(context->name, O_RDONLY);
+  if(fd < 0)
+    return -1;
+
+  if(fstat(fd, &st) || !st.st_size) {
+    close(fd);
+    return -1;
+  }
+  size=(size_t)st.st_size;
+
+  image=(unsigned char*)mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(image == (unsigned char*)MAP_FAILED) {
+    librdf_log(storage->world, 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+               "Failed to map frozen storage image %s", context->name);
+    return 1;
+  }
+
+  if(librdf_storage_frozen_attach(storage, image, size, 1)) {
+    munmap(image, size);
+    return 1;
+  }
+#else
+  FILE* fh;
+  long length;
+
+  fh=fopen(context->name, "rb");
+  if(!fh)
+    return -1;
+
+  if(fseek(fh, 0, SEEK_END) || (length=ftell(fh)) <= 0) {
+    fclose(fh);
+    return -1;
+  }
+  size=(size_t)length;
+  rewind(fh);
+
+  image=LIBRDF_MALLOC(unsigned char*, size);
+  if(!image || fread(image, 1, size, fh) != size) {
+    if(image)
+      LIBRDF_FREE(unsigned char*, image);
+    fclose(fh);
+    librdf_log(storage->world, 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+               "Failed to read frozen storage image %s", context->name);
+    return 1;
+  }
+  fclose(fh);
+
+  if(librdf_storage_frozen_attach(storage, image, size, 0)) {
+    LIBRDF_FREE(unsigned char*, image);
+    return 1;
+  }
+#endif
+
+  return 0;
+}
+
+
+/* Allocate the image file name followed by @suffix */
+static char*
+librdf_storage_frozen_file_name(librdf_storage_frozen_instance* context,
+                                const char* suffix)
+{
+  size_t name_len=strlen(context->name);
+  size_t suffix_len=strlen(suffix);
+  char* file_name;
+
+  file_name=LIBRDF_MALLOC(char*, name_len + suffix_len + 1);
+  if(!file_name)
+    return NULL;
+  memcpy(file_name, context->name, name_len);
+  memcpy(file_name + name_len, suffix, suffix_len + 1);
+
+  return file_name;
+}
+
+
+/* Write the image to a temporary file renamed over the image file so
+ * readers never see a partial image */
+static int
+librdf_storage_frozen_write_image(librdf_storage* storage)
+{
+  librdf_storage_frozen_instance* context=(librdf_storage_frozen_instance*)storage->instance;
+  char* new_name;
+  FILE* fh;
+  int status=0;
+
+  new_name=librdf_storage_frozen_file_name(context, ".new");
+  if(!new_name)
+    return 1;
+
+  fh=fopen(new_name, "wb");
+  if(!fh)
+    status=1;
+  else {
+    if(fwrite(context->image, 1, context->image_size, fh) != context->image_size)
+      status=1;
+    if(fclose(fh))
+      status=1;
+    if(!status && rename(new_name, context->name))
+      status=1;
+    if(status)
+      remove(new_name);
+  }
+
+  if(status)
+    librdf_log(storage->world, 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+               "Failed to write frozen storage image %s", context->name);
+
+  LIBRDF_FREE(char*, new_name);
+  return status;
+}
+
+
+/**
+ * librdf_storage_frozen_read_delta:
+ * @storage: the storage
+ *
+ * INTERNAL - Apply the delta file of the image, if there is one
+ *
+ * The changes are made again, so a delta that was already merged
+ * into the image has no further effect.
+ *
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_storage_frozen_read_delta(librdf_storage* storage)
+{
+  librdf_storage_frozen_instance* context=(librdf_storage_frozen_instance*)storage->instance;
+  char* delta_name;
+  char magic[8];
+  unsigned char* buffer=NULL;
+  size_t buffer_size=0;
+  FILE* fh;
+  int status=0;
+
+  delta_name=librdf_storage_frozen_file_name(context, ".delta");
+  if(!delta_name)
+    return 1;
+
+  fh=fopen(delta_name, "rb");
+  if(!fh) {
+    LIBRDF_FREE(char*, delta_name);
+    return 0;
+  }
+
+  if(fread(magic, 1, sizeof(magic), fh) != sizeof(magic) ||
+     memcmp(magic, LIBRDF_STORAGE_FROZEN_DELTA_MAGIC, sizeof(magic)))
+    status=1;
+
+  while(!status) {
+    int op=fgetc(fh);
+    u32 len;
+    librdf_statement statement;
+
+    if(op == EOF)
+      break;
+
+    if((op != '+' && op != '-') ||
+       fread(&len, sizeof(len), 1, fh) != 1 ||
+       librdf_storage_frozen_grow((void**)&buffer, &buffer_size, len, 1) ||
+       fread(buffer, 1, len, fh) != len) {
+      status=1;
+      break;
+    }
+
+    librdf_statement_init(storage->world, &statement);
+    if(!librdf_statement_decode2(storage->world, &statement, NULL, buffer, len))
+      status=1;
+    else if(op == '+')
+      status=librdf_storage_frozen_delta_add(storage, &statement);
+    else
+      librdf_storage_frozen_delta_remove(storage, &statement);
+    librdf_statement_clear(&statement);
+  }
+  fclose(fh);
+
+  if(status)
+    librdf_log(storage->world, 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+               "Frozen storage delta %s is not valid", delta_name);
+
+  /* the file holds these changes already */
+  context->delta_changed=0;
+
+  if(buffer)
+    LIBRDF_FREE(unsigned char*, buffer);
+  LIBRDF_FREE(char*, delta_name);
+
+  return status;
+}
+
+
+/**
+ * librdf_storage_frozen_write_delta:
+ * @storage: the storage
+ *
+ * INTERNAL - Write the delta file of the image
+ *
+ * Each change is '+' (added) or '-' (removed), the u32 length and
+ * the librdf_statement_encode2() bytes of the statement.  The file
+ * is written to a temporary file renamed over the delta file, or
+ * removed if there are no changes.
+ *
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_storage_frozen_write_delta(librdf_storage* storage)
+{
+  librdf_storage_frozen_instance* context=(librdf_storage_frozen_instance*)storage->instance;
+  char* delta_name;
+  char* new_name;
+  unsigned char* buffer=NULL;
+  size_t buffer_size=0;
+  FILE* fh;
+  int status=0;
+  int i;
+
+  delta_name=librdf_storage_frozen_file_name(context, ".delta");
+  new_name=librdf_storage_frozen_file_name(context, ".delta.new");
+  if(!delta_name || !new_name) {
+    status=1;
+    goto tidy;
+  }
+
+  if(!librdf_storage_frozen_delta_size(context)) {
+    remove(delta_name);
+    context->delta_changed=0;
+    goto tidy;
+  }
+
+  fh=fopen(new_name, "wb");
+  if(!fh) {
+    status=1;
+    goto tidy;
+  }
+
+  if(fwrite(LIBRDF_STORAGE_FROZEN_DELTA_MAGIC, 1, 8, fh) != 8)
+    status=1;
+
+  for(i=0; i < 2 && !status; i++) {
+    librdf_stream* stream;
+    int op=i ? '-' : '+';
+
+    stream=librdf_storage_serialise(i ? context->removed : context->added);
+    if(!stream) {
+      status=1;
+      break;
+    }
+
+    for(; !librdf_stream_end(stream); librdf_stream_next(stream)) {
+      librdf_statement* statement=librdf_stream_get_object(stream);
+      size_t len;
+      u32 len32;
+
+      len=statement ? librdf_statement_encode2(storage->world, statement, NULL, 0) : 0;
+      if(!len ||
+         librdf_storage_frozen_grow((void**)&buffer, &buffer_size, len, 1)) {
+        status=1;
+        break;
+      }
+      librdf_statement_encode2(storage->world, statement, buffer, len);
+
+      len32=(u32)len;
+      if(fputc(op, fh) == EOF ||
+         fwrite(&len32, sizeof(len32), 1, fh) != 1 ||
+         fwrite(buffer, 1, len, fh) != len) {
+        status=1;
+        break;
+      }
+    }
+    librdf_free_stream(stream);
+  }
+
+  if(fclose(fh))
+    status=1;
+  if(!status && rename(new_name, delta_name))
+    status=1;
+  if(status)
+    remove(new_name);
+  else
+    context->delta_changed=0;
+
+  tidy:
+  if(status)
+    librdf_log(storage->world, 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+               "Failed to write frozen storage delta for %s", context->name);
+
+  if(buffer)
+    LIBRDF_FREE(unsigned char*, buffer);
+  if(new_name)
+    LIBRDF_FREE(char*, new_name);
+  if(delta_name)
+    LIBRDF_FREE(char*, delta_name);
+
+  return status;
+}
+
+
+/* Get the node with 1-based @id, decoding it on first use; NULL if
+ * the id or its offsets are not in the image */
+static librdf_node*
+librdf_storage_frozen_get_node(librdf_storage* storage, u32 id)
+{
+  librdf_storage_frozen_instance* context=(librdf_storage_frozen_instance*)storage->instance;
+  size_t page;
+  librdf_node** nodes;
+
+  if(!id || id > context->header->nodes_count)
+    return NULL;
+
+  page=(size_t)((id - 1) >> LIBRDF_STORAGE_FROZEN_NODE_PAGE_BITS);
+  nodes=context->node_pages[page];
+  if(!nodes) {
+    nodes=LIBRDF_CALLOC(librdf_node**, LIBRDF_STORAGE_FROZEN_NODE_PAGE_SIZE,
+                        sizeof(librdf_node*));
+    if(!nodes)
+      return NULL;
+    context->node_pages[page]=nodes;
+  }
+
+  nodes += (id - 1) & (LIBRDF_STORAGE_FROZEN_NODE_PAGE_SIZE - 1);
+  if(!*nodes) {
+    u64 start=context->offsets[id - 1];
+    u64 end=context->offsets[id];
+
+    if(start >= end || end > context->header->strings_size)
+      return NULL;
+
+    *nodes=librdf_node_decode(storage->world, NULL,
+                              (unsigned char*)context->strings + start,
+                              (size_t)(end - start));
+  }
+
+  return *nodes;
+}
+
+
+/* Find the id of a node by binary search of the dictionary, 0 if absent */
+static u32
+librdf_storage_frozen_find_node(librdf_storage_frozen_instance* context,
+                                librdf_node* node)
+{
+  unsigned char buffer[256];
+  unsigned char* string=buffer;
+  size_t len;
+  u64 low=0, high=context->header->nodes_count;
+  u32 id=0;
+
+  len=librdf_node_encode(node, NULL, 0);
+  if(!len)
+    return 0;
+  if(len > sizeof(buffer)) {
+    string=LIBRDF_MALLOC(unsigned char*, len);
+    if(!string)
+      return 0;
+  }
+  librdf_node_encode(node, string, len);
+
+  while(low < high) {
+    u64 middle=low + (high - low) / 2;
+    u64 start=context->offsets[middle];
+    u64 end=context->offsets[middle + 1];
+    int rc;
+
+    /* a damaged dictionary finds nothing */
+    if(start >= end || end > context->header->strings_size)
+      break;
+
+    rc=librdf_storage_frozen_compare_strings(context->strings + start,
+                                             (size_t)(end - start),
+                                             string, len);
+    if(!rc) {
+      id=(u32)(middle + 1);
+      break;
+    }
+    if(rc < 0)
+      low=middle + 1;
+    else
+      high=middle;
+  }
+
+  if(string != buffer)
+    LIBRDF_FREE(unsigned char*, string);
+
+  return id;
+}
+
+
+/* Rows @low_p to @high_p of pos with predicate @id, non 0 if none */
+static int
+librdf_storage_frozen_predicate_rows(librdf_storage_frozen_instance* context,
+                                     u32 id, u64* low_p, u64* high_p)
+{
+  const librdf_storage_frozen_predicate* predicates=context->predicates;
+  u64 count=context->header->predicates_count;
+  u64 statements_count=context->header->statements_count;
+  u64 low=0, high=count;
+
+  while(low < high) {
+    u64 middle=low + (high - low) / 2;
+
+    if(predicates[middle].id < id)
+      low=middle + 1;
+    else
+      high=middle;
+  }
+  if(low == count || predicates[low].id != id)
+    return 1;
+
+  *low_p=predicates[low].start;
+  *high_p=(low + 1 < count) ? predicates[low + 1].start : statements_count;
+
+  /* never search outside the rows, even in a damaged image */
+  if(*high_p > statements_count)
+    *high_p=statements_count;
+  if(*low_p > *high_p)
+    *low_p=*high_p;
+
+  return 0;
+}
+
+
+/* First row of @index from @low to @high at or after (@upper: after)
+ * the @key_len ids of @key */
+static const u32*
+librdf_storage_frozen_bound(librdf_storage_frozen_instance* context,
+                            int index, u64 low, u64 high,
+                            const u32* key, int key_len, int upper)
+{
+  const u32* rows=context->indexes[index];
+
+  while(low < high) {
+    u64 middle=low + (high - low) / 2;
+    const u32* row=rows + middle * 3;
+    int rc=0;
+    int i;
+
+    for(i=0; i < key_len && !rc; i++) {
+      if(row[i] != key[i])
+        rc=(row[i] < key[i]) ? -1 : 1;
+    }
+
+    if(rc < 0 || (upper && !rc))
+      low=middle + 1;
+    else
+      high=middle;
+  }
+
+  return rows + low * 3;
+}
+
+
+/**
+ * librdf_storage_frozen_range:
+ * @storage: the storage
+ * @parts: subject, predicate and object nodes or NULL for any
+ * @start_p: pointer to store the first row
+ * @end_p: pointer to store the row after the last
+ *
+ * INTERNAL - Find the rows of the index whose prefix is the bound parts
+ *
+ * Each of the eight patterns of bound parts is a prefix of one of
+ * spo, pos or osp so the range holds exactly the matching statements.
+ * A bound predicate starts from its rows in the predicate offsets.
+ *
+ * Return value: the index or < 0 if a bound node is not in the store
+ **/
+static int
+librdf_storage_frozen_range(librdf_storage* storage, librdf_node** parts,
+                            const u32** start_p, const u32** end_p)
+{
+  librdf_storage_frozen_instance* context=(librdf_storage_frozen_instance*)storage->instance;
+  u32 key[3];
+  u64 low=0, high=context->header->statements_count;
+  int bound=0;
+  int key_len=0;
+  int index;
+  int i;
+
+  for(i=0; i < 3; i++) {
+    if(parts[i])
+      bound++;
+  }
+
+  for(index=0; index < LIBRDF_STORAGE_FROZEN_INDEX_COUNT; index++) {
+    for(key_len=0; key_len < 3; key_len++) {
+      if(!parts[librdf_storage_frozen_index_parts[index][key_len]])
+        break;
+    }
+    if(key_len == bound)
+      break;
+  }
+
+  for(i=0; i < key_len; i++) {
+    key[i]=librdf_storage_frozen_find_node(context,
+                                           parts[librdf_storage_frozen_index_parts[index][i]]);
+    if(!key[i])
+      return -1;
+  }
+
+  if(index == LIBRDF_STORAGE_FROZEN_INDEX_POS && key_len &&
+     librdf_storage_frozen_predicate_rows(context, key[0], &low, &high)) {
+    *start_p=*end_p=context->indexes[index];
+    return index;
+  }
+
+  *start_p=librdf_storage_frozen_bound(context, index, low, high,
+                                       key, key_len, 0);
+  *end_p=librdf_storage_frozen_bound(context, index, low, high,
+                                     key, key_len, 1);
+
+  return index;
+}
+
+
+static int
+librdf_storage_frozen_contains_statement(librdf_storage* storage,
+                                         librdf_statement* statement)
+{
+  librdf_storage_frozen_instance* context=(librdf_storage_frozen_instance*)storage->instance;
+
+  if(librdf_storage_frozen_freeze(storage))
+    return 0;
+
+  if(librdf_storage_frozen_image_contains(storage, statement))
+    return !(context->removed &&
+             librdf_storage_contains_statement(context->removed, statement));
+
+  return context->added &&
+    librdf_storage_contains_statement(context->added, statement);
+}
+
+
+/* Check the frozen image alone for a statement */
+static int
+librdf_storage_frozen_image_contains(librdf_storage* storage,
+                                     librdf_statement* statement)
+{
+  librdf_node* parts[3];
+  const u32* start;
+  const u32* end;
+
+  parts[0]=librdf_statement_get_subject(statement);
+  parts[1]=librdf_statement_get_predicate(statement);
+  parts[2]=librdf_statement_get_object(statement);
+
+  if(librdf_storage_frozen_range(storage, parts, &start, &end) < 0)
+    return 0;
+
+  return (start != end);
+}
+
+
+typedef struct {
+  librdf_storage *storage;
+  int index;
+  const u32* row;
+  const u32* end;
+  librdf_statement current; /* static, shared statement */
+  /* matching statements added since freezing, after the rows */
+  librdf_stream* added_stream;
+} librdf_storage_frozen_find_stream_context;
+
+
+/* Move past image rows removed since freezing */
+static void
+librdf_storage_frozen_find_skip_removed(librdf_storage_frozen_find_stream_context* scontext)
+{
+  librdf_storage_frozen_instance* context=(librdf_storage_frozen_instance*)scontext->storage->instance;
+
+  if(!context->removed || !librdf_storage_size(context->removed))
+    return;
+
+  while(scontext->row != scontext->end) {
+    librdf_statement* statement;
+
+    statement=(librdf_statement*)librdf_storage_frozen_find_get_statement(scontext, LIBRDF_ITERATOR_GET_METHOD_GET_OBJECT);
+    if(!statement ||
+       !librdf_storage_contains_statement(context->removed, statement))
+      break;
+    scontext->row += 3;
+  }
+}
+
+
+static librdf_stream*
+librdf_storage_frozen_serialise(librdf_storage* storage)
+{
+  return librdf_storage_frozen_find_statements(storage, NULL);
+}
+
+
+/**
+ * librdf_storage_frozen_find_statements:
+ * @storage: the storage
+ * @statement: the statement to match
+ *
+ * .
+ *
+ * Return a stream of statements matching the given statement (or
+ * all statements if NULL) from the range of one index, less those
+ * removed since freezing, then those added since.
+ *
+ * Return value: a #librdf_stream or NULL on failure
+ **/
+static librdf_stream*
+librdf_storage_frozen_find_statements(librdf_storage* storage,
+                                      librdf_statement* statement)
+{
+  librdf_storage_frozen_instance* context=(librdf_storage_frozen_instance*)storage->instance;
+  librdf_storage_frozen_find_stream_context* scontext;
+  librdf_node* parts[3]={ NULL, NULL, NULL };
+  librdf_stream* stream;
+
+  if(librdf_storage_frozen_freeze(storage))
+    return NULL;
+
+  if(statement) {
+    parts[0]=librdf_statement_get_subject(statement);
+    parts[1]=librdf_statement_get_predicate(statement);
+    parts[2]=librdf_statement_get_object(statement);
+  }
+
+  scontext = LIBRDF_CALLOC(librdf_storage_frozen_find_stream_context*, 1,
+                           sizeof(*scontext));
+  if(!scontext)
+    return NULL;
+
+  scontext->index=librdf_storage_frozen_range(storage, parts,
+                                              &scontext->row, &scontext->end);
+  if(scontext->index < 0) {
+    if(!context->added) {
+      LIBRDF_FREE(librdf_storage_frozen_find_stream_context, scontext);
+      return librdf_new_empty_stream(storage->world);
+    }
+    /* no rows, but the statements added may match */
+    scontext->row=scontext->end=NULL;
+  }
+
+  librdf_statement_init(storage->world, &scontext->current);
+
+  scontext->storage=storage;
+  librdf_storage_add_reference(scontext->storage);
+
+  if(context->added) {
+    scontext->added_stream=statement ?
+      librdf_storage_find_statements(context->added, statement) :
+      librdf_storage_serialise(context->added);
+    if(!scontext->added_stream) {
+      librdf_storage_frozen_find_finished((void*)scontext);
+      return NULL;
+    }
+  }
+
+  librdf_storage_frozen_find_skip_removed(scontext);
+
+  stream=librdf_new_stream(storage->world,
+                           (void*)scontext,
+                           &librdf_storage_frozen_find_end_of_stream,
+                           &librdf_storage_frozen_find_next_statement,
+                           &librdf_storage_frozen_find_get_statement,
+                           &librdf_storage_frozen_find_finished);
+  if(!stream) {
+    librdf_storage_frozen_find_finished((void*)scontext);
+    return NULL;
+  }
+
+  return stream;
+}
+
+
+static int
+librdf_storage_frozen_find_end_of_stream(void* context)
+{
+  librdf_storage_frozen_find_stream_context* scontext=(librdf_storage_frozen_find_stream_context*)context;
+
+  if(scontext->row != scontext->end)
+    return 0;
+
+  return (!scontext->added_stream || librdf_stream_end(scontext->added_stream));
+}
+
+
+static int
+librdf_storage_frozen_find_next_statement(void* context)
+{
+  librdf_storage_frozen_find_stream_context* scontext=(librdf_storage_frozen_find_stream_context*)context;
+
+  if(scontext->row != scontext->end) {
+    scontext->row += 3;
+    librdf_storage_frozen_find_skip_removed(scontext);
+  } else if(scontext->added_stream)
+    librdf_stream_next(scontext->added_stream);
+
+  return librdf_storage_frozen_find_end_of_stream(context);
+}
+
+
+static void*
+librdf_storage_frozen_find_get_statement(void* context, int flags)
+{
+  librdf_storage_frozen_find_stream_context* scontext=(librdf_storage_frozen_find_stream_context*)context;
+  const int* columns;
+  librdf_node* nodes[3];
+  int i;
+
+  switch(flags) {
+    case LIBRDF_ITERATOR_GET_METHOD_GET_OBJECT:
+      if(scontext->row == scontext->end)
+        return scontext->added_stream ?
+          librdf_stream_get_object(scontext->added_stream) : NULL;
+
+      /* rows only when a range was found, so index is >= 0 here */
+      columns=librdf_storage_frozen_index_columns[scontext->index];
+      for(i=0; i < 3; i++) {
+        nodes[i]=librdf_storage_frozen_get_node(scontext->storage,
+                                                scontext->row[columns[i]]);
+        if(!nodes[i])
+          return NULL;
+      }
+
+      librdf_statement_clear(&scontext->current);
+      librdf_statement_set_subject(&scontext->current,
+                                   librdf_new_node_from_node(nodes[0]));
+      librdf_statement_set_predicate(&scontext->current,
+                                     librdf_new_node_from_node(nodes[1]));
+      librdf_statement_set_object(&scontext->current,
+                                  librdf_new_node_from_node(nodes[2]));
+
+      return &scontext->current;
+
+    case LIBRDF_ITERATOR_GET_METHOD_GET_CONTEXT:
+      return NULL;
+
+    default:
+      librdf_log(scontext->storage->world,
+                 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+                 "Unknown iterator method flag %d", flags);
+      return NULL;
+  }
+}
+
+
+static void
+librdf_storage_frozen_find_finished(void* context)
+{
+  librdf_storage_frozen_find_stream_context* scontext=(librdf_storage_frozen_find_stream_context*)context;
+
+  if(scontext->added_stream)
+    librdf_free_stream(scontext->added_stream);
+
+  if(scontext->storage) {
+    librdf_statement_clear(&scontext->current);
+    librdf_storage_remove_reference(scontext->storage);
+  }
+
+  LIBRDF_FREE(librdf_storage_frozen_find_stream_context, scontext);
+}
+
+
+/* Iterator over the last column of a range with two bound parts */
+typedef struct {
+  librdf_storage *storage;
+  const u32* row;
+  const u32* end;
+} librdf_storage_frozen_nodes_iterator_context;
+
+
+static librdf_iterator*
+librdf_storage_frozen_find_nodes(librdf_storage* storage, librdf_node* subject,
+                                 librdf_node* predicate, librdf_node* object)
+{
+  librdf_storage_frozen_nodes_iterator_context* icontext;
+  librdf_node* parts[3];
+  librdf_iterator* iterator;
+
+  if(librdf_storage_frozen_freeze(storage))
+    return NULL;
+
+  parts[0]=subject;
+  parts[1]=predicate;
+  parts[2]=object;
+
+  icontext = LIBRDF_CALLOC(librdf_storage_frozen_nodes_iterator_context*, 1,
+                           sizeof(*icontext));
+  if(!icontext)
+    return NULL;
+
+  if(librdf_storage_frozen_range(storage, parts, &icontext->row,
+                                 &icontext->end) < 0) {
+    LIBRDF_FREE(librdf_storage_frozen_nodes_iterator_context, icontext);
+    return librdf_new_empty_iterator(storage->world);
+  }
+
+  icontext->storage=storage;
+  librdf_storage_add_reference(icontext->storage);
+
+  iterator=librdf_new_iterator(storage->world,
+                               (void*)icontext,
+                               &librdf_storage_frozen_nodes_is_end,
+                               &librdf_storage_frozen_nodes_next_method,
+                               &librdf_storage_frozen_nodes_get_method,
+                               &librdf_storage_frozen_nodes_finished);
+  if(!iterator)
+    librdf_storage_frozen_nodes_finished(icontext);
+  return iterator;
+}
+
+
+static librdf_iterator*
+librdf_storage_frozen_find_sources(librdf_storage* storage, librdf_node* arc,
+                                   librdf_node* target)
+{
+  librdf_storage_frozen_instance* context=(librdf_storage_frozen_instance*)storage->instance;
+
+  /* with changes since freezing, search the statements */
+  if(librdf_storage_frozen_delta_size(context))
+    return librdf_storage_node_stream_to_node_create(storage, arc, target,
+                                                     LIBRDF_STATEMENT_SUBJECT);
+
+  /* pos range, subjects last */
+  return librdf_storage_frozen_find_nodes(storage, NULL, arc, target);
+}
+
+
+static librdf_iterator*
+librdf_storage_frozen_find_arcs(librdf_storage* storage, librdf_node* source,
+                                librdf_node* target)
+{
+  librdf_storage_frozen_instance* context=(librdf_storage_frozen_instance*)storage->instance;
+
+  /* with changes since freezing, search the statements */
+  if(librdf_storage_frozen_delta_size(context))
+    return librdf_storage_node_stream_to_node_create(storage, source, target,
+                                                     LIBRDF_STATEMENT_PREDICATE);
+
+  /* osp range, predicates last */
+  return librdf_storage_frozen_find_nodes(storage, source, NULL, target);
+}
+
+
+static librdf_iterator*
+librdf_storage_frozen_find_targets(librdf_storage* storage, librdf_node* source,
+                                   librdf_node* arc)
+{
+  librdf_storage_frozen_instance* context=(librdf_storage_frozen_instance*)storage->instance;
+
+  /* with changes since freezing, search the statements */
+  if(librdf_storage_frozen_delta_size(context))
+    return librdf_storage_node_stream_to_node_create(storage, source, arc,
+                                                     LIBRDF_STATEMENT_OBJECT);
+
+  /* spo range, objects last */
+  return librdf_storage_frozen_find_nodes(storage, source, arc, NULL);
+}
+
+
+static int
+librdf_storage_frozen_nodes_is_end(void* iterator)
+{
+  librdf_storage_frozen_nodes_iterator_context* icontext=(librdf_storage_frozen_nodes_iterator_context*)iterator;
+
+  return (icontext->row == icontext->end);
+}
+
+
+static int
+librdf_storage_frozen_nodes_next_method(void* iterator)
+{
+  librdf_storage_frozen_nodes_iterator_context* icontext=(librdf_storage_frozen_nodes_iterator_context*)iterator;
+
+  if(icontext->row == icontext->end)
+    return 1;
+
+  icontext->row += 3;
+
+  return (icontext->row == icontext->end);
+}
+
+
+static void*
+librdf_storage_frozen_nodes_get_method(void* iterator, int flags)
+{
+  librdf_storage_frozen_nodes_iterator_context* icontext=(librdf_storage_frozen_nodes_iterator_context*)iterator;
+
+  switch(flags) {
+    case LIBRDF_ITERATOR_GET_METHOD_GET_OBJECT:
+      return librdf_storage_frozen_get_node(icontext->storage, icontext->row[2]);
+
+    case LIBRDF_ITERATOR_GET_METHOD_GET_CONTEXT:
+      return NULL;
+
+    default:
+      librdf_log(icontext->storage->world,
+                 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+                 "Unknown iterator method flag %d", flags);
+      return NULL;
+  }
+}
+
+
+static void
+librdf_storage_frozen_nodes_finished(void* iterator)
+{
+  librdf_storage_frozen_nodes_iterator_context* icontext=(librdf_storage_frozen_nodes_iterator_context*)iterator;
+
+  if(icontext->storage)
+    librdf_storage_remove_reference(icontext->storage);
+
+  LIBRDF_FREE(librdf_storage_frozen_nodes_iterator_context, icontext);
+}
+
+
+/**
+ * librdf_storage_frozen_sync:
+ * @storage: the storage
+ *
+ * .
+ *
+ * Freeze the loaded statements or merge the changes made since
+ * freezing into a new image.
+ *
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_storage_frozen_sync(librdf_storage* storage)
+{
+  if(librdf_storage_frozen_freeze(storage))
+    return 1;
+
+  return librdf_storage_frozen_compact(storage);
+}
+
+
+/**
+ * librdf_storage_frozen_compact:
+ * @storage: the storage
+ *
+ * INTERNAL - Merge the delta into a new image
+ *
+ * Loads every statement of the image and delta as if into a new
+ * store and freezes that, replacing the image file and removing the
+ * delta file.  Processes with the old image mapped keep using it
+ * until they open the storage again.
+ *
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_storage_frozen_compact(librdf_storage* storage)
+{
+  librdf_storage_frozen_instance* context=(librdf_storage_frozen_instance*)storage->instance;
+  librdf_stream* stream;
+  int status=0;
+
+  if(!librdf_storage_frozen_delta_size(context))
+    return 0;
+
+  stream=librdf_storage_frozen_find_statements(storage, NULL);
+  if(!stream)
+    return 1;
+
+  for(; !librdf_stream_end(stream); librdf_stream_next(stream)) {
+    librdf_statement* statement=librdf_stream_get_object(stream);
+
+    if(!statement ||
+       librdf_storage_frozen_load_statement(context, statement)) {
+      status=1;
+      break;
+    }
+  }
+  librdf_free_stream(stream);
+
+  if(status) {
+    librdf_storage_frozen_free_load(context);
+    return 1;
+  }
+
+  librdf_storage_frozen_detach(context);
+  librdf_storage_frozen_delta_free(context);
+
+  return librdf_storage_frozen_freeze(storage);
+}
+
+
+/**
+ * librdf_storage_frozen_get_feature:
+ * @storage: #librdf_storage object
+ * @feature: #librdf_uri feature property
+ *
+ * Get the value of a storage feature.
+ *
+ * Return value: #librdf_node feature value or NULL if no such feature
+ * exists or the value is empty.
+ **/
+static librdf_node*
+librdf_storage_frozen_get_feature(librdf_storage* storage, librdf_uri* feature)
+{
+  unsigned char *uri_string;
+
+  if(!feature)
+    return NULL;
+
+  uri_string=librdf_uri_as_string(feature);
+  if(!uri_string)
+    return NULL;
+
+  if(!strcmp((const char*)uri_string, LIBRDF_MODEL_FEATURE_CONTEXTS))
+    return librdf_new_node_from_typed_literal(storage->world,
+                                              (const unsigned char*)"0",
+                                              NULL, NULL);
+
+  return NULL;
+}
+
+
+/** Local entry point for dynamically loaded storage module */
+static void
+librdf_storage_frozen_register_factory(librdf_storage_factory *factory)
+{
+  LIBRDF_ASSERT_CONDITION(!strncmp(factory->name, "frozen", 6));
+
+  factory->version            = LIBRDF_STORAGE_INTERFACE_VERSION;
+  factory->init               = librdf_storage_frozen_init;
+  factory->terminate          = librdf_storage_frozen_terminate;
+  factory->open               = librdf_storage_frozen_open;
+  factory->close              = librdf_storage_frozen_close;
+  factory->size               = librdf_storage_frozen_size;
+  factory->add_statement      = librdf_storage_frozen_add_statement;
+  factory->add_statements     = librdf_storage_frozen_add_statements;
+  factory->remove_statement   = librdf_storage_frozen_remove_statement;
+  factory->contains_statement = librdf_storage_frozen_contains_statement;
+  factory->serialise          = librdf_storage_frozen_serialise;
+  factory->find_statements    = librdf_storage_frozen_find_statements;
+  factory->find_sources       = librdf_storage_frozen_find_sources;
+  factory->find_arcs          = librdf_storage_frozen_find_arcs;
+  factory->find_targets       = librdf_storage_frozen_find_targets;
+  factory->sync               = librdf_storage_frozen_sync;
+  factory->get_feature        = librdf_storage_frozen_get_feature;
+}
+
+
+#ifndef STANDALONE
+/*
+ * librdf_init_storage_frozen:
+ * @world: world object
+ *
+ * INTERNAL - Initialise the built-in storage_frozen module.
+ */
+void
+librdf_init_storage_frozen(librdf_world *world)
+{
+  librdf_storage_register_factory(world, "frozen", "Frozen image",
+                                  &librdf_storage_frozen_register_factory);
+}
+#endif
+
+
+/* TEST CODE */
+
+
+#ifdef STANDALONE
+
+/* one more prototype */
+int main(int argc, char *argv[]);
+
+#define FROZEN_TEST_SUBJECTS 20
+#define FROZEN_TEST_PREDICATES 10
+#define FROZEN_TEST_OBJECTS 10
+#define FROZEN_TEST_IMAGE "rdf_storage_frozen_test.img"
+
+
+static librdf_node*
+librdf_storage_frozen_test_node(librdf_world* world, const char* prefix, int i)
+{
+  char uri[64];
+
+  sprintf(uri, "http://example.org/%s%d", prefix, i);
+  return librdf_new_node_from_uri_string(world, (const unsigned char*)uri);
+}
+
+
+/* Check every pattern of bound parts and the node iterators */
+static int
+librdf_storage_frozen_test_patterns(const char* program, librdf_world* world,
+                                    librdf_storage* storage)
+{
+  int pattern;
+  int ret = 0;
+
+  for (pattern = 0; pattern < 8; pattern++) {
+    const int has_s = (pattern & 4), has_p = (pattern & 2), has_o = (pattern & 1);
+    int expected = 1;
+    librdf_statement* statement;
+    librdf_stream* stream;
+    int count = 0;
+
+    if(!has_s)
+      expected *= FROZEN_TEST_SUBJECTS;
+    if(!has_p)
+      expected *= FROZEN_TEST_PREDICATES;
+    if(!has_o)
+      expected *= FROZEN_TEST_OBJECTS;
+
+    statement=librdf_new_statement_from_nodes(world,
+                                              has_s ? librdf_storage_frozen_test_node(world, "s", 3) : NULL,
+                                              has_p ? librdf_storage_frozen_test_node(world, "p", 4) : NULL,
+                                              has_o ? librdf_storage_frozen_test_node(world, "o", 5) : NULL);
+    stream=librdf_storage_find_statements(storage, statement);
+    if(!stream) {
+      fprintf(stderr, "%s: Failed to find statements\n", program);
+      return 1;
+    }
+    while(!librdf_stream_end(stream)) {
+      librdf_statement* found=librdf_stream_get_object(stream);
+
+      if(!found || !librdf_statement_match(found, statement)) {
+        fprintf(stderr, "%s: Found a statement not matching the pattern\n",
+                program);
+        ret = 1;
+        break;
+      }
+      count++;
+      librdf_stream_next(stream);
+    }
+    librdf_free_stream(stream);
+    librdf_free_statement(statement);
+
+    if(count != expected) {
+      fprintf(stderr, "%s: Pattern (%s %s %s) matched %d statements, expected %d\n",
+              program, has_s ? "s" : "?", has_p ? "p" : "?", has_o ? "o" : "?",
+              count, expected);
+      ret = 1;
+    }
+  }
+
+  {
+    librdf_node* source=librdf_storage_frozen_test_node(world, "s", 3);
+    librdf_node* arc=librdf_storage_frozen_test_node(world, "p", 4);
+    librdf_iterator* iterator;
+    int count = 0;
+
+    iterator=librdf_storage_get_targets(storage, source, arc);
+    while(iterator && !librdf_iterator_end(iterator)) {
+      count++;
+      librdf_iterator_next(iterator);
+    }
+    if(iterator)
+      librdf_free_iterator(iterator);
+    librdf_free_node(source);
+    librdf_free_node(arc);
+
+    if(count != FROZEN_TEST_OBJECTS) {
+      fprintf(stderr, "%s: Found %d targets, expected %d\n", program, count,
+              FROZEN_TEST_OBJECTS);
+      ret = 1;
+    }
+  }
+
+  return ret;
+}
+
+
+/* Create and open the test image storage, NULL on failure */
+static librdf_storage*
+librdf_storage_frozen_test_open(const char* program, librdf_world* world,
+                                const char* options)
+{
+  librdf_storage* storage;
+
+  storage=librdf_new_storage(world, "frozen-test", FROZEN_TEST_IMAGE,
+                             options);
+  if(!storage) {
+    fprintf(stderr, "%s: Failed to create frozen storage\n", program);
+    return NULL;
+  }
+  if(librdf_storage_open(storage, NULL)) {
+    fprintf(stderr, "%s: Failed to open frozen storage\n", program);
+    librdf_free_storage(storage);
+    return NULL;
+  }
+
+  return storage;
+}
+
+
+static void
+librdf_storage_frozen_test_close(librdf_storage* storage)
+{
+  librdf_storage_close(storage);
+  librdf_free_storage(storage);
+}
+
+
+int
+main(int argc, char *argv[]) 
+{
+  const char *program=librdf_basename((const char*)argv[0]);
+  librdf_world *world;
+  librdf_storage* storage;
+  librdf_statement* statement;
+  librdf_statement* added;
+  librdf_statement* removed;
+  int s, p, o;
+  int i;
+  int ret = 0;
+
+  world=librdf_new_world();
+  librdf_world_open(world);
+
+  librdf_storage_register_factory(world, "frozen-test", "Frozen image test",
+                                  &librdf_storage_frozen_register_factory);
+
+  fprintf(stdout, "%s: Loading storage\n", program);
+  storage=librdf_storage_frozen_test_open(program, world, "new='yes'");
+  if(!storage)
+    return 1;
+
+  /* every statement twice; duplicates go when frozen */
+  for (s = 0; s < FROZEN_TEST_SUBJECTS * 2; s++) {
+    for (p = 0; p < FROZEN_TEST_PREDICATES; p++) {
+      for (o = 0; o < FROZEN_TEST_OBJECTS; o++) {
+        statement=librdf_new_statement_from_nodes(world,
+                                                  librdf_storage_frozen_test_node(world, "s", s % FROZEN_TEST_SUBJECTS),
+                                                  librdf_storage_frozen_test_node(world, "p", p),
+                                                  librdf_storage_frozen_test_node(world, "o", o));
+        if(!statement || librdf_storage_add_statement(storage, statement)) {
+          fprintf(stderr, "%s: Failed to add statement\n", program);
+          return 1;
+        }
+        librdf_free_statement(statement);
+      }
+    }
+  }
+
+  if(librdf_storage_size(storage) != FROZEN_TEST_SUBJECTS * FROZEN_TEST_PREDICATES * FROZEN_TEST_OBJECTS) {
+    fprintf(stderr, "%s: Frozen storage has %d statements\n", program,
+            librdf_storage_size(storage));
+    ret = 1;
+  }
+  ret |= librdf_storage_frozen_test_patterns(program, world, storage);
+
+  /* frozen now */
+  statement=librdf_new_statement_from_nodes(world,
+                                            librdf_storage_frozen_test_node(world, "s", 100),
+                                            librdf_storage_frozen_test_node(world, "p", 0),
+                                            librdf_storage_frozen_test_node(world, "o", 0));
+  if(!librdf_storage_add_statement(storage, statement)) {
+    fprintf(stderr, "%s: Added a statement to a frozen storage\n", program);
+    ret = 1;
+  }
+  if(librdf_storage_contains_statement(storage, statement)) {
+    fprintf(stderr, "%s: Frozen storage contains a statement never added\n",
+            program);
+    ret = 1;
+  }
+  librdf_free_statement(statement);
+
+  librdf_storage_frozen_test_close(storage);
+
+  fprintf(stdout, "%s: Opening storage image\n", program);
+  storage=librdf_storage_frozen_test_open(program, world, NULL);
+  if(!storage)
+    return 1;
+  if(librdf_storage_size(storage) != FROZEN_TEST_SUBJECTS * FROZEN_TEST_PREDICATES * FROZEN_TEST_OBJECTS) {
+    fprintf(stderr, "%s: Frozen storage image has %d statements\n", program,
+            librdf_storage_size(storage));
+    ret = 1;
+  }
+  ret |= librdf_storage_frozen_test_patterns(program, world, storage);
+  librdf_storage_frozen_test_close(storage);
+
+  fprintf(stdout, "%s: Changing storage image\n", program);
+  storage=librdf_storage_frozen_test_open(program, world, "write='yes'");
+  if(!storage)
+    return 1;
+  added=librdf_new_statement_from_nodes(world,
+                                        librdf_storage_frozen_test_node(world, "s", 100),
+                                        librdf_storage_frozen_test_node(world, "p", 0),
+                                        librdf_storage_frozen_test_node(world, "o", 0));
+  removed=librdf_new_statement_from_nodes(world,
+                                          librdf_storage_frozen_test_node(world, "s", 0),
+                                          librdf_storage_frozen_test_node(world, "p", 0),
+                                          librdf_storage_frozen_test_node(world, "o", 0));
+  if(librdf_storage_add_statement(storage, added) ||
+     librdf_storage_remove_statement(storage, removed)) {
+    fprintf(stderr, "%s: Failed to change frozen storage\n", program);
+    ret = 1;
+  }
+
+#ifdef LIBRDF_STORAGE_FROZEN_LOCK
+  /* a second writer would overwrite the delta of the first */
+  {
+    librdf_storage* writer;
+
+    writer=librdf_new_storage(world, "frozen-test", FROZEN_TEST_IMAGE,
+                              "write='yes'");
+    if(writer) {
+      if(!librdf_storage_open(writer, NULL)) {
+        fprintf(stderr, "%s: Opened frozen storage for changes twice\n",
+                program);
+        ret = 1;
+        librdf_storage_close(writer);
+      }
+      librdf_free_storage(writer);
+    }
+  }
+#endif
+  librdf_storage_frozen_test_close(storage);
+
+  /* the changes are in the delta file, then merged into a new image */
+  for (i = 0; i < 2; i++) {
+    storage=librdf_storage_frozen_test_open(program, world, NULL);
+    if(!storage)
+      return 1;
+    if(librdf_storage_size(storage) != FROZEN_TEST_SUBJECTS * FROZEN_TEST_PREDICATES * FROZEN_TEST_OBJECTS ||
+       !librdf_storage_contains_statement(storage, added) ||
+       librdf_storage_contains_statement(storage, removed)) {
+      fprintf(stderr, "%s: Frozen storage image is missing changes\n", program);
+      ret = 1;
+    }
+    if(!i && librdf_storage_sync(storage)) {
+      fprintf(stderr, "%s: Failed to merge changes into frozen storage image\n",
+              program);
+      ret = 1;
+    }
+    librdf_storage_frozen_test_close(storage);
+  }
+  librdf_free_statement(removed);
+
+  /* a node id past the dictionary ends a stream at its row instead of
+   * being read, and with verify the image is refused */
+  fprintf(stdout, "%s: Opening damaged storage image\n", program);
+  {
+    librdf_storage_frozen_header header;
+    u32 id;
+    FILE* fh;
+
+    fh=fopen(FROZEN_TEST_IMAGE, "r+b");
+    if(!fh || fread(&header, sizeof(header), 1, fh) != 1) {
+      fprintf(stderr, "%s: Failed to read frozen storage image\n", program);
+      return 1;
+    }
+    id=(u32)header.nodes_count + 1;
+    fseek(fh, (long)header.index_offsets[LIBRDF_STORAGE_FROZEN_INDEX_SPO], SEEK_SET);
+    fwrite(&id, sizeof(id), 1, fh);
+    fclose(fh);
+  }
+  storage=librdf_storage_frozen_test_open(program, world, NULL);
+  if(!storage)
+    return 1;
+  {
+    librdf_stream* stream=librdf_storage_serialise(storage);
+
+    if(!stream || !librdf_stream_end(stream)) {
+      fprintf(stderr, "%s: Damaged frozen storage image returned a statement\n",
+              program);
+      ret = 1;
+    }
+    if(stream)
+      librdf_free_stream(stream);
+  }
+  librdf_storage_frozen_test_close(storage);
+  storage=librdf_new_storage(world, "frozen-test", FROZEN_TEST_IMAGE,
+                             "verify='yes'");
+  if(storage) {
+    if(!librdf_storage_open(storage, NULL)) {
+      fprintf(stderr, "%s: Verified a damaged frozen storage image\n", program);
+      ret = 1;
+      librdf_storage_close(storage);
+    }
+    librdf_free_storage(storage);
+  }
+  remove(FROZEN_TEST_IMAGE);
+
+  /* querying before loading writes no image, changes write one */
+  fprintf(stdout, "%s: Opening empty storage\n", program);
+  storage=librdf_storage_frozen_test_open(program, world, "write='yes'");
+  if(!storage)
+    return 1;
+  if(librdf_storage_size(storage)) {
+    fprintf(stderr, "%s: Empty frozen storage has %d statements\n", program,
+            librdf_storage_size(storage));
+    ret = 1;
+  }
+  librdf_storage_frozen_test_close(storage);
+  if(!access(FROZEN_TEST_IMAGE, F_OK)) {
+    fprintf(stderr, "%s: Empty frozen storage wrote an image\n", program);
+    ret = 1;
+  }
+
+  for (i = 0; i < 2; i++) {
+    storage=librdf_storage_frozen_test_open(program, world, "write='yes'");
+    if(!storage)
+      return 1;
+    if(librdf_storage_size(storage) != i ||
+       (i && !librdf_storage_contains_statement(storage, added))) {
+      fprintf(stderr, "%s: Frozen storage lost a change to an empty store\n",
+              program);
+      ret = 1;
+    }
+    if(!i && librdf_storage_add_statement(storage, added)) {
+      fprintf(stderr, "%s: Failed to change empty frozen storage\n", program);
+      ret = 1;
+    }
+    librdf_storage_frozen_test_close(storage);
+  }
+  librdf_free_statement(added);
+
+  remove(FROZEN_TEST_IMAGE);
+  remove(FROZEN_TEST_IMAGE ".delta");
+  remove(FROZEN_TEST_IMAGE ".lock");
+
+  librdf_free_world(world);
+
+  return ret;
+}
+
+#endif
@@ -35,6 +35,8 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
+#include <math.h>
 #ifdef HAVE_STDLIB_H
 #include <stdlib.h>
 #endif
@@ -52,6 +54,26 @@ typedef struct
 } librdf_hash_descriptor;
 
 
+/* Subjects and objects are counted in fixed size sketches so the
+ * stats hash does not grow with the nodes: a count-min sketch of the
+ * statements with each node, which removals decrement, and a
+ * HyperLogLog of the different nodes, which only grows.
+ */
+#define LIBRDF_STORAGE_HASHES_SKETCH_DEPTH 4
+#define LIBRDF_STORAGE_HASHES_SKETCH_WIDTH 1024
+#define LIBRDF_STORAGE_HASHES_SKETCH_REGISTER_BITS 12
+#define LIBRDF_STORAGE_HASHES_SKETCH_REGISTERS (1 << LIBRDF_STORAGE_HASHES_SKETCH_REGISTER_BITS)
+
+typedef struct
+{
+  u32 counters[LIBRDF_STORAGE_HASHES_SKETCH_DEPTH][LIBRDF_STORAGE_HASHES_SKETCH_WIDTH];
+  unsigned char registers[LIBRDF_STORAGE_HASHES_SKETCH_REGISTERS];
+} librdf_storage_hashes_sketch;
+
+/* size of a sketch saved in the stats hash, counters big endian */
+#define LIBRDF_STORAGE_HASHES_SKETCH_SIZE (LIBRDF_STORAGE_HASHES_SKETCH_DEPTH * LIBRDF_STORAGE_HASHES_SKETCH_WIDTH * 4 + LIBRDF_STORAGE_HASHES_SKETCH_REGISTERS)
+
+
 static const librdf_hash_descriptor librdf_storage_hashes_descriptions[]= {
   {"sp2o",
    LIBRDF_STATEMENT_SUBJECT|LIBRDF_STATEMENT_PREDICATE,
@@ -65,9 +87,24 @@ static const librdf_hash_descriptor librdf_storage_hashes_descriptions[]= {
   {"p2so", 
    LIBRDF_STATEMENT_PREDICATE,
    LIBRDF_STATEMENT_SUBJECT|LIBRDF_STATEMENT_OBJECT},  /* For '(?, p, ?)' */
+  {"s2po", 
+   LIBRDF_STATEMENT_SUBJECT,
+   LIBRDF_STATEMENT_PREDICATE|LIBRDF_STATEMENT_OBJECT},  /* For '(s, ?, ?)' */
+  {"o2sp", 
+   LIBRDF_STATEMENT_OBJECT,
+   LIBRDF_STATEMENT_SUBJECT|LIBRDF_STATEMENT_PREDICATE},  /* For '(?, ?, o)' */
   {"contexts",
    0L, /* for contexts - do not touch when storing statements! */
    0L},
+  {"n2i",
+   0L, /* for node IDs - node to ID */
+   0L},
+  {"i2n",
+   0L, /* for node IDs - ID to node */
+   0L},
+  {"stats",
+   0L, /* for statistics - counts of statements and sketches of nodes */
+   0L},
   {NULL,0L,0L}
 };
 
@@ -126,9 +163,139 @@ typedef struct
   size_t key_buffer_len;
   unsigned char *value_buffer;
   size_t value_buffer_len;
+
+  /* number of statements add_statements adds to the hashes together */
+  int batch_size;
+
+  /* If this is non-0, add_statements loads via sorted runs on disk */
+  int bulk;
+  /* number of statements in each sorted run */
+  int bulk_run_size;
+
+  /* If this is non-0, index hashes store node IDs from a dictionary */
+  int dictionary;
+  int n2i_index;
+  int i2n_index;
+  /* last node ID given out */
+  u64 last_node_id;
+  /* growing buffer used to encode dictionary nodes */
+  unsigned char *node_buffer;
+  size_t node_buffer_len;
+
+  /* If this is non-0, statement counts are kept in the stats hash */
+  int statistics;
+  int stats_index;
+  /* number of statements and of different predicates, saved in the
+   * stats hash on sync and close */
+  u64 stats_counts[4];
+  int stats_dirty;
+  /* per predicate counts changed since they were last saved, as a
+   * memory hash from stats hash key to the new count and the saved
+   * count */
+  librdf_hash* stats_nodes;
+  int stats_nodes_count;
+  /* subject and object sketches, saved with the counts; NULL for
+   * statements and predicates */
+  librdf_storage_hashes_sketch* stats_sketches[4];
 } librdf_storage_hashes_instance;
 
 
+/* size of a dictionary node ID */
+#define LIBRDF_STORAGE_HASHES_NODE_ID_SIZE 8
+
+
+/* stats_counts entries and sketches, saved in the stats hash under
+ * one byte keys while per predicate counts use the same byte followed
+ * by the predicate */
+#define LIBRDF_STORAGE_HASHES_STATS_STATEMENTS 0
+#define LIBRDF_STORAGE_HASHES_STATS_SUBJECTS 1
+#define LIBRDF_STORAGE_HASHES_STATS_PREDICATES 2
+#define LIBRDF_STORAGE_HASHES_STATS_OBJECTS 3
+#define LIBRDF_STORAGE_HASHES_STATS_COUNT 4
+
+static const unsigned char librdf_storage_hashes_stats_keys[LIBRDF_STORAGE_HASHES_STATS_COUNT]={'n', 's', 'p', 'o'};
+
+/* most per predicate counts kept changed in memory before they are saved */
+#define LIBRDF_STORAGE_HASHES_STATS_NODES_MAX 10000
+
+
+/* default for the batch-size option */
+#define LIBRDF_STORAGE_HASHES_DEFAULT_BATCH_SIZE 1000
+
+/* default for the bulk-run-size option */
+#define LIBRDF_STORAGE_HASHES_DEFAULT_BULK_RUN_SIZE 100000
+
+/* initial size of the read buffer of each run while merging */
+#define LIBRDF_STORAGE_HASHES_RUN_BUFFER_SIZE 65536
+
+#ifdef HAVE_FSEEKO
+typedef off_t librdf_storage_hashes_offset;
+#define LIBRDF_STORAGE_HASHES_FSEEK(f, o) fseeko(f, o, SEEK_SET)
+#else
+typedef long librdf_storage_hashes_offset;
+#define LIBRDF_STORAGE_HASHES_FSEEK(f, o) fseek(f, o, SEEK_SET)
+#endif
+
+/* encoded key/value of one statement of a batch for one hash */
+typedef struct
+{
+  size_t key_offset;
+  size_t key_len;
+  size_t value_offset;
+  size_t value_len;
+} librdf_storage_hashes_batch_entry;
+
+/* a key/value of a batch being sorted */
+typedef struct
+{
+  const unsigned char *key;
+  size_t key_len;
+  const unsigned char *value;
+  size_t value_len;
+  int statement;
+} librdf_storage_hashes_batch_pair;
+
+/* statements encoded by add_statements before they are stored */
+typedef struct
+{
+  /* keys and values of all statements */
+  unsigned char *data;
+  size_t data_len;
+  size_t data_size;
+  /* size entries for each hash */
+  librdf_storage_hashes_batch_entry *entries;
+  librdf_storage_hashes_batch_pair *pairs;
+  /* set for statements already stored or earlier in the batch */
+  char *skip;
+  librdf_hash_datum *keys;
+  librdf_hash_datum *values;
+  int count;
+  int size;
+} librdf_storage_hashes_batch;
+
+/* the sorted runs of one hash spilled to disk by a bulk load */
+typedef struct
+{
+  FILE *file;
+  /* run_count+1 offsets of the start of each run and the end */
+  librdf_storage_hashes_offset *starts;
+  librdf_storage_hashes_offset length;
+} librdf_storage_hashes_run_file;
+
+/* reader of one sorted run while merging */
+typedef struct
+{
+  librdf_storage_hashes_offset offset;
+  librdf_storage_hashes_offset end;
+  unsigned char *buffer;
+  size_t buffer_size;
+  size_t buffer_len;
+  size_t buffer_pos;
+  /* current key/value */
+  librdf_storage_hashes_batch_pair pair;
+} librdf_storage_hashes_run;
+
+
 
 /* helper function for implementing init and clone methods */
 static int librdf_storage_hashes_register(librdf_storage *storage, const char *name, const librdf_hash_descriptor *source_desc);
@@ -144,10 +311,17 @@ static int librdf_storage_hashes_close(librdf_storage* storage);
 static int librdf_storage_hashes_size(librdf_storage* storage);
 static int librdf_storage_hashes_add_statement(librdf_storage* storage, librdf_statement* statement);
 static int librdf_storage_hashes_add_statements(librdf_storage* storage, librdf_stream* statement_stream);
+static int librdf_storage_hashes_add_remove_statement_index(librdf_storage* storage, librdf_statement* statement, librdf_node* context_node, int i, int is_addition, int if_absent);
+static size_t librdf_storage_hashes_encode_parts(librdf_storage* storage, librdf_statement* statement, librdf_node* context_node, unsigned char *buffer, size_t length, librdf_statement_part fields, int add);
+static size_t librdf_storage_hashes_decode_parts(librdf_storage* storage, librdf_statement* statement, librdf_node** context_node, unsigned char *buffer, size_t length, librdf_statement_part fields);
+static u64 librdf_storage_hashes_decode_node_id(const unsigned char *buffer);
+static int librdf_storage_hashes_stats_open(librdf_storage* storage);
+static int librdf_storage_hashes_stats_save(librdf_storage* storage);
 static int librdf_storage_hashes_remove_statement(librdf_storage* storage, librdf_statement* statement);
 static int librdf_storage_hashes_contains_statement(librdf_storage* storage, librdf_statement* statement);
 static librdf_stream* librdf_storage_hashes_serialise(librdf_storage* storage);
 static librdf_stream* librdf_storage_hashes_find_statements(librdf_storage* storage, librdf_statement* statement);
+static int librdf_storage_hashes_find_index(librdf_storage* storage, int fields);
 static librdf_iterator* librdf_storage_hashes_find_sources(librdf_storage* storage, librdf_node* arc, librdf_node *target);
 static librdf_iterator* librdf_storage_hashes_find_arcs(librdf_storage* storage, librdf_node* source, librdf_node *target);
 static librdf_iterator* librdf_storage_hashes_find_targets(librdf_storage* storage, librdf_node* source, librdf_node *arc);
@@ -161,6 +335,8 @@ static void librdf_storage_hashes_serialise_finished(void* context);
 /* context functions */
 static int librdf_storage_hashes_context_add_statement(librdf_storage* storage, librdf_node* context_node, librdf_statement* statement);
 static int librdf_storage_hashes_context_remove_statement(librdf_storage* storage, librdf_node* context_node, librdf_statement* statement);
+static int librdf_storage_hashes_context_remove_statements(librdf_storage* storage, librdf_node* context_node);
+static int librdf_storage_hashes_context_size(librdf_storage* storage, librdf_node* context_node);
 static librdf_stream* librdf_storage_hashes_context_serialise(librdf_storage* storage, librdf_node* context_node);
 
 /* context list statement stream methods */
@@ -229,6 +405,70 @@ librdf_storage_hashes_register(librdf_storage *storage,
   return (context->hashes[hash_index] == NULL);
 }
 
+/*
+ * librdf_storage_hashes_register_indexes:
+ * @storage: the storage
+ * @name: storage name
+ * @indexes: comma or space separated hash names
+ * @do_register: non 0 to register the hashes, 0 to only count them
+ * 
+ * INTERNAL - Count or register the index hashes named in the indexes option.
+ * 
+ * Return value: number of hashes or <0 on failure
+ */
+static int
+librdf_storage_hashes_register_indexes(librdf_storage *storage,
+                                       const char *name, const char *indexes,
+                                       int do_register)
+{
+  const librdf_hash_descriptor *desc;
+  const char *p=indexes;
+  int count=0;
+  int used=0;
+
+  while(1) {
+    char index_name[16];
+    size_t len;
+    int i;
+
+    while(*p == ',' || *p == ' ')
+      p++;
+    if(!*p)
+      break;
+
+    for(len=0; p[len] && p[len] != ',' && p[len] != ' '; len++)
+      ;
+    if(len >= sizeof(index_name))
+      len=sizeof(index_name) - 1;
+    memcpy(index_name, p, len);
+    index_name[len]='\0';
+    p += len;
+
+    desc=librdf_storage_get_hash_description_by_name(index_name);
+    i=desc ? (int)(desc - librdf_storage_hashes_descriptions) : 0;
+    if(!desc || !desc->key_fields || (used & (1 << i))) {
+      librdf_log(storage->world, 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE,
+                 NULL, "Unknown or repeated hashes storage index '%s'",
+                 index_name);
+      return -1;
+    }
+    used |= (1 << i);
+
+    if(do_register && librdf_storage_hashes_register(storage, name, desc))
+      return -1;
+    count++;
+  }
+
+  if(!count) {
+    librdf_log(storage->world, 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE,
+               NULL, "No hashes storage indexes in '%s'", indexes);
+    return -1;
+  }
+
+  return count;
+}
+
+
 /* helper function for implementing init and clone methods */
 
 static int
@@ -263,7 +503,17 @@ librdf_storage_hashes_init_common(librdf_storage* storage, const char *name,
   context->options=options;
 
   /* Work out the number of hashes for allocating stuff below */
-  hash_count=3;
+  if(indexes) {
+    /* exactly the named index hashes */
+    hash_count=librdf_storage_hashes_register_indexes(storage, name, indexes,
+                                                      0);
+    if(hash_count < 0) {
+      if(context->name)
+        LIBRDF_FREE(char*, context->name);
+      return 1;
+    }
+  } else
+    hash_count=3;
 
   if((index_contexts=librdf_hash_get_as_boolean(options, "contexts"))<0)
     index_contexts=0; /* default is no contexts */
@@ -275,9 +525,32 @@ librdf_storage_hashes_init_common(librdf_storage* storage, const char *name,
   if((index_predicates=librdf_hash_get_as_boolean(options, "index-predicates"))<0)
     index_predicates=0; /* default is NO index on properties */
   
-  if(index_predicates)
+  if(index_predicates && !indexes)
+    hash_count++;
+
+  if((context->dictionary=librdf_hash_get_as_boolean(options, "dictionary"))<0)
+    context->dictionary=0; /* default is nodes stored in the index hashes */
+
+  if(context->dictionary)
+    hash_count += 2;
+
+  if((context->statistics=librdf_hash_get_as_boolean(options, "statistics"))<0)
+    context->statistics=0; /* default is no statistics */
+
+  if(context->statistics)
     hash_count++;
 
+  context->batch_size=(int)librdf_hash_get_as_long(options, "batch-size");
+  if(context->batch_size <= 0)
+    context->batch_size=LIBRDF_STORAGE_HASHES_DEFAULT_BATCH_SIZE;
+
+  if((context->bulk=librdf_hash_get_as_boolean(options, "bulk"))<0)
+    context->bulk=0; /* default is no bulk loading */
+
+  context->bulk_run_size=(int)librdf_hash_get_as_long(options, "bulk-run-size");
+  if(context->bulk_run_size <= 0)
+    context->bulk_run_size=LIBRDF_STORAGE_HASHES_DEFAULT_BULK_RUN_SIZE;
+
 
   /* Start allocating the arrays */
   context->hashes = LIBRDF_CALLOC(librdf_hash**,
@@ -310,14 +583,19 @@ librdf_storage_hashes_init_common(librdf_storage* storage, const char *name,
     return 1;
   }
   
-  for(i=0; i<3; i++) {
-    status=librdf_storage_hashes_register(storage, name,
-                                          &librdf_storage_hashes_descriptions[i]);
-    if(status)
-      break;
+  if(indexes) {
+    status=(librdf_storage_hashes_register_indexes(storage, name, indexes,
+                                                   1) < 0);
+  } else {
+    for(i=0; i<3; i++) {
+      status=librdf_storage_hashes_register(storage, name,
+                                            &librdf_storage_hashes_descriptions[i]);
+      if(status)
+        break;
+    }
   }
 
-  if(index_predicates && !status)
+  if(index_predicates && !indexes && !status)
     status=librdf_storage_hashes_register(storage, name,
                                           librdf_storage_get_hash_description_by_name("p2so"));
 
@@ -325,6 +603,18 @@ librdf_storage_hashes_init_common(librdf_storage* storage, const char *name,
     librdf_storage_hashes_register(storage, name,
                                    librdf_storage_get_hash_description_by_name("contexts"));
 
+  if(context->dictionary && !status) {
+    status=librdf_storage_hashes_register(storage, name,
+                                          librdf_storage_get_hash_description_by_name("n2i"));
+    if(!status)
+      status=librdf_storage_hashes_register(storage, name,
+                                            librdf_storage_get_hash_description_by_name("i2n"));
+  }
+
+  if(context->statistics && !status)
+    status=librdf_storage_hashes_register(storage, name,
+                                          librdf_storage_get_hash_description_by_name("stats"));
+
 
   /* find indexes for get targets, sources and arcs */
   context->sources_index= -1;
@@ -333,6 +623,11 @@ librdf_storage_hashes_init_common(librdf_storage* storage, const char *name,
   context->p2so_index= -1;
   /* and index for contexts (no key or value fields) */
   context->contexts_index= -1;
+  /* and the node ID dictionary */
+  context->n2i_index= -1;
+  context->i2n_index= -1;
+  /* and the statistics */
+  context->stats_index= -1;
 
   context->all_statements_hash_index= -1;
 
@@ -363,6 +658,12 @@ librdf_storage_hashes_init_common(librdf_storage* storage, const char *name,
     } else if(key_fields == LIBRDF_STATEMENT_PREDICATE &&
               value_fields == (LIBRDF_STATEMENT_SUBJECT|LIBRDF_STATEMENT_OBJECT)) {
       context->p2so_index=i;
+    } else if(!strcmp(context->hash_descriptions[i]->name, "n2i")) {
+      context->n2i_index=i;
+    } else if(!strcmp(context->hash_descriptions[i]->name, "i2n")) {
+      context->i2n_index=i;
+    } else if(!strcmp(context->hash_descriptions[i]->name, "stats")) {
+      context->stats_index=i;
     } else if(!key_fields || !value_fields) {
        context->contexts_index=i;
     }
@@ -461,6 +762,8 @@ librdf_storage_hashes_terminate(librdf_storage* storage)
     LIBRDF_FREE(data, context->key_buffer);
   if(context->value_buffer)
     LIBRDF_FREE(data, context->value_buffer);
+  if(context->node_buffer)
+    LIBRDF_FREE(data, context->node_buffer);
 
   if(context->name)
     LIBRDF_FREE(char*, context->name);
@@ -539,6 +842,203 @@ librdf_storage_hashes_clone(librdf_storage* new_storage, librdf_storage* old_sto
 }
  
 
+/*
+ * librdf_storage_hashes_hash_is_empty:
+ * @hash: hash
+ * 
+ * INTERNAL - Check if a hash has no keys.
+ * 
+ * Return value: non 0 if the hash is empty or cannot be read
+ */
+static int
+librdf_storage_hashes_hash_is_empty(librdf_hash* hash)
+{
+  librdf_hash_cursor* cursor;
+  librdf_hash_datum hd_key; /* on stack */
+  int is_empty=1;
+
+  hd_key.data=NULL;
+  cursor=librdf_new_hash_cursor(hash);
+  if(cursor) {
+    is_empty=(librdf_hash_cursor_get_first(cursor, &hd_key, NULL) != 0);
+    librdf_free_hash_cursor(cursor);
+  }
+
+  return is_empty;
+}
+
+
+/*
+ * librdf_storage_hashes_build_index:
+ * @storage: the storage
+ * @hash_index: the index of the hash to fill
+ * @from_index: the index of the hash to read statements from
+ * 
+ * INTERNAL - Add every statement in one index hash to another.
+ * 
+ * Used to fill an index hash newly added to the indexes option of an
+ * existing store from one of its other index hashes.
+ * 
+ * Return value: non 0 on failure
+ */
+static int
+librdf_storage_hashes_build_index(librdf_storage* storage, int hash_index,
+                                  int from_index)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  librdf_world* world = storage->world;
+  librdf_hash_cursor* cursor;
+  librdf_hash_datum hd_key, hd_value; /* on stack */
+  librdf_statement statement; /* on stack */
+  int status=0;
+  int count=0;
+  int rc;
+
+  librdf_log(world, 0, LIBRDF_LOG_INFO, LIBRDF_FROM_STORAGE, NULL,
+             "Building hashes storage index %s from %s",
+             context->hash_descriptions[hash_index]->name,
+             context->hash_descriptions[from_index]->name);
+
+  cursor=librdf_new_hash_cursor(context->hashes[from_index]);
+  if(!cursor)
+    return 1;
+
+  librdf_statement_init(world, &statement);
+
+  hd_key.data=NULL;
+  for(rc=librdf_hash_cursor_get_first(cursor, &hd_key, &hd_value);
+      !rc;
+      hd_key.data=NULL,
+        rc=librdf_hash_cursor_get_next(cursor, &hd_key, &hd_value)) {
+    librdf_node* context_node=NULL;
+    librdf_node** cnp=context->index_contexts ? &context_node : NULL;
+
+    if(!librdf_storage_hashes_decode_parts(storage, &statement, NULL,
+                                           (unsigned char*)hd_key.data,
+                                           hd_key.size,
+                                           (librdf_statement_part)context->hash_descriptions[from_index]->key_fields) ||
+       !librdf_storage_hashes_decode_parts(storage, &statement, cnp,
+                                           (unsigned char*)hd_value.data,
+                                           hd_value.size,
+                                           (librdf_statement_part)context->hash_descriptions[from_index]->value_fields))
+      status=1;
+    else
+      status=librdf_storage_hashes_add_remove_statement_index(storage,
+                                                              &statement,
+                                                              context_node,
+                                                              hash_index,
+                                                              1, 0);
+
+    librdf_statement_clear(&statement);
+    if(context_node)
+      librdf_free_node(context_node);
+    if(status)
+      break;
+    count++;
+  }
+
+  librdf_free_hash_cursor(cursor);
+
+  if(!status)
+    librdf_log(world, 0, LIBRDF_LOG_INFO, LIBRDF_FROM_STORAGE, NULL,
+               "Added %d statements to hashes storage index %s", count,
+               context->hash_descriptions[hash_index]->name);
+
+  return status;
+}
+
+
+/*
+ * librdf_storage_hashes_full_index:
+ * @storage: the storage
+ *
+ * INTERNAL - Find an index hash holding statements
+ *
+ * Return value: the index of the hash or <0 if all are empty
+ */
+static int
+librdf_storage_hashes_full_index(librdf_storage* storage)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  int i;
+
+  for(i=0; i<context->hash_count; i++) {
+    if(context->hash_descriptions[i]->key_fields &&
+       context->hash_descriptions[i]->value_fields &&
+       !librdf_storage_hashes_hash_is_empty(context->hashes[i]))
+      return i;
+  }
+
+  return -1;
+}
+
+
+/*
+ * librdf_storage_hashes_index_is_missing:
+ * @storage: the storage
+ * @hash_index: the index of the hash
+ *
+ * INTERNAL - Test if an index hash is empty while another has
+ * statements, so needs building
+ *
+ * Return value: non 0 if so
+ */
+static int
+librdf_storage_hashes_index_is_missing(librdf_storage* storage,
+                                       int hash_index)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+
+  if(!context->hash_descriptions[hash_index]->key_fields ||
+     !context->hash_descriptions[hash_index]->value_fields ||
+     !librdf_storage_hashes_hash_is_empty(context->hashes[hash_index]))
+    return 0;
+
+  return (librdf_storage_hashes_full_index(storage) >= 0);
+}
+
+
+/*
+ * librdf_storage_hashes_build_indexes:
+ * @storage: the storage
+ *
+ * INTERNAL - Build every index hash that is empty while another has
+ * statements.
+ *
+ * Return value: non 0 on failure
+ */
+static int
+librdf_storage_hashes_build_indexes(librdf_storage* storage)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  int from_index;
+  int i;
+
+  if(!context->is_writable) {
+    librdf_log(storage->world, 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+               "Cannot build the indexes of a read-only hashes storage");
+    return 1;
+  }
+
+  from_index=librdf_storage_hashes_full_index(storage);
+  if(from_index < 0)
+    return 0;
+
+  for(i=0; i<context->hash_count; i++) {
+    if(i == from_index ||
+       !context->hash_descriptions[i]->key_fields ||
+       !context->hash_descriptions[i]->value_fields ||
+       !librdf_storage_hashes_hash_is_empty(context->hashes[i]))
+      continue;
+
+    if(librdf_storage_hashes_build_index(storage, i, from_index))
+      return 1;
+  }
+
+  return 0;
+}
+
+
 static int
 librdf_storage_hashes_open(librdf_storage* storage, librdf_model* model)
 {
@@ -567,6 +1067,41 @@ librdf_storage_hashes_open(librdf_storage* storage, librdf_model* model)
       break;
   }
 
+  if(!result && context->dictionary) {
+    unsigned char id[LIBRDF_STORAGE_HASHES_NODE_ID_SIZE];
+    librdf_hash_datum hd_key; /* on stack */
+    librdf_hash_datum *hd_value;
+
+    /* ID 0 is never given to a node and maps to the last ID given out */
+    memset(id, 0, sizeof(id));
+    hd_key.data=id; hd_key.size=sizeof(id);
+    context->last_node_id=0;
+    hd_value=librdf_hash_get_one(context->hashes[context->i2n_index], &hd_key);
+    if(hd_value) {
+      if(hd_value->size == sizeof(id))
+        context->last_node_id=librdf_storage_hashes_decode_node_id((unsigned char*)hd_value->data);
+      librdf_free_hash_datum(hd_value);
+    }
+  }
+
+  /* An index hash that is empty while another has statements, such
+   * as one just added to the indexes option, gives wrong answers
+   * until it is built
+   */
+  if(!result && !context->is_new) {
+    for(i=0; i<context->hash_count; i++) {
+      if(librdf_storage_hashes_index_is_missing(storage, i))
+        librdf_log(storage->world, 0, LIBRDF_LOG_WARN, LIBRDF_FROM_STORAGE,
+                   NULL,
+                   "Hashes storage index %s is empty; set feature %s to build it",
+                   context->hash_descriptions[i]->name,
+                   LIBRDF_STORAGE_FEATURE_BUILD_INDEXES);
+    }
+  }
+
+  if(!result && context->statistics)
+    result=librdf_storage_hashes_stats_open(storage);
+
   return result;
 }
 
@@ -585,6 +1120,22 @@ librdf_storage_hashes_close(librdf_storage* storage)
   librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
   int i;
   
+  if(context->statistics)
+    librdf_storage_hashes_stats_save(storage);
+
+  if(context->stats_nodes) {
+    librdf_hash_close(context->stats_nodes);
+    librdf_free_hash(context->stats_nodes);
+    context->stats_nodes=NULL;
+  }
+
+  for(i=0; i < LIBRDF_STORAGE_HASHES_STATS_COUNT; i++) {
+    if(context->stats_sketches[i]) {
+      LIBRDF_FREE(librdf_storage_hashes_sketch*, context->stats_sketches[i]);
+      context->stats_sketches[i]=NULL;
+    }
+  }
+
   for(i=0; i<context->hash_count; i++) {
     if(context->hashes[i])
       librdf_hash_close(context->hashes[i]);
@@ -600,6 +1151,12 @@ librdf_storage_hashes_size(librdf_storage* storage)
   librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
   librdf_hash* any_hash=context->hashes[context->all_statements_hash_index];
 
+  if(context->statistics) {
+    u64 count=context->stats_counts[LIBRDF_STORAGE_HASHES_STATS_STATEMENTS];
+
+    return (count > INT_MAX) ? INT_MAX : (int)count;
+  }
+
   if(!any_hash)
     return -1;
 
@@ -624,133 +1181,2122 @@ librdf_storage_hashes_grow_buffer(unsigned char **buffer, size_t *len,
 }
 
 
-static int
-librdf_storage_hashes_add_remove_statement(librdf_storage* storage, 
-                                           librdf_statement* statement,
-                                           librdf_node* context_node,
-                                           int is_addition)
+static void
+librdf_storage_hashes_encode_node_id(u64 id, unsigned char *buffer)
 {
-  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
   int i;
-  int status=0;
-  librdf_world* world = storage->world;
-
-#if defined(LIBRDF_DEBUG) && LIBRDF_DEBUG > 1
-  if(is_addition)
-    LIBRDF_DEBUG1("Adding statement: ");
-  else
-    LIBRDF_DEBUG1("Removing statement: ");
-  librdf_statement_print(statement, stderr);
-  fputc('\n', stderr);
-#endif  
-
-  for(i=0; i<context->hash_count; i++) {
-    librdf_hash_datum hd_key, hd_value; /* on stack */
-    size_t key_len, value_len;
-
-    /* ENCODE KEY */
-
-    librdf_statement_part fields=(librdf_statement_part)context->hash_descriptions[i]->key_fields;
-    if(!fields)
-      continue;
-    
-    key_len = librdf_statement_encode_parts2(world, statement, NULL, NULL, 0,
-                                             fields);
-    if(!key_len)
-      return 1;
-    if(librdf_storage_hashes_grow_buffer(&context->key_buffer, 
-                                         &context->key_buffer_len, key_len)) {
-      status=1;
-      break;
-    }
-       
-    if(!librdf_statement_encode_parts2(world, statement, NULL,
-                                       context->key_buffer,
-                                       context->key_buffer_len, fields)) {
-      status=1;
-      break;
-    }
-
-    
-    /* ENCODE VALUE */
-    
-    fields=(librdf_statement_part)context->hash_descriptions[i]->value_fields;
-    if(!fields)
-      continue;
-    
-    value_len=librdf_statement_encode_parts2(world, statement, context_node,
-                                             NULL, 0, fields);
-    if(!value_len) {
-      status=1;
-      break;
-    }
-    
-    if(librdf_storage_hashes_grow_buffer(&context->value_buffer, 
-                                         &context->value_buffer_len, value_len)) {
-      status=1;
-      break;
-    }
-       
-    if(!librdf_statement_encode_parts2(world, statement, context_node,
-                                       context->value_buffer,
-                                       context->value_buffer_len, fields)) {
-      status=1;
-      break;
-    }
-
-
-#if defined(LIBRDF_DEBUG) && LIBRDF_DEBUG > 1
-    LIBRDF_DEBUG4("Using %s hash key %d bytes -> value %d bytes\n", context->hash_descriptions[i]->name, key_len, value_len);
-#endif
 
-    /* Finally, store / remove the sucker */
-    hd_key.data=context->key_buffer; hd_key.size=key_len;
-    hd_value.data=context->value_buffer; hd_value.size=value_len;
-    
-    if(is_addition)
-      status=librdf_hash_put(context->hashes[i], &hd_key, &hd_value);
-    else
-      status=librdf_hash_delete(context->hashes[i], &hd_key, &hd_value);
-    
-    if(status)
-      break;
+  /* big endian so IDs sort in order */
+  for(i=LIBRDF_STORAGE_HASHES_NODE_ID_SIZE - 1; i >= 0; i--) {
+    buffer[i]=(unsigned char)(id & 0xff);
+    id >>= 8;
   }
-
-  return status;
 }
 
 
-static int
-librdf_storage_hashes_add_statement(librdf_storage* storage, librdf_statement* statement)
+static u64
+librdf_storage_hashes_decode_node_id(const unsigned char *buffer)
 {
-  /* Do not add duplicate statements */
-  if(librdf_storage_hashes_contains_statement(storage, statement))
-    return 0;
+  u64 id=0;
+  int i;
 
-  return librdf_storage_hashes_add_remove_statement(storage, statement, NULL, 1);
+  for(i=0; i < LIBRDF_STORAGE_HASHES_NODE_ID_SIZE; i++)
+    id=(id << 8) | buffer[i];
+  return id;
 }
 
 
-static int
-librdf_storage_hashes_add_statements(librdf_storage* storage,
-                                     librdf_stream* statement_stream)
+/*
+ * librdf_storage_hashes_node_to_id:
+ * @storage: the storage
+ * @node: node
+ * @add: non 0 to give an ID to a node not in the dictionary
+ * @buffer: buffer to write the ID into
+ * 
+ * INTERNAL - Look up the dictionary ID of a node.
+ * 
+ * A node not in the dictionary gets ID 0 if @add is 0, which matches
+ * nothing in the index hashes.
+ * 
+ * Return value: non 0 on failure
+ */
+static int
+librdf_storage_hashes_node_to_id(librdf_storage* storage, librdf_node* node,
+                                 int add, unsigned char *buffer)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  librdf_hash_datum hd_key, hd_value; /* on stack */
+  librdf_hash_datum *hd_id;
+  unsigned char last_id[LIBRDF_STORAGE_HASHES_NODE_ID_SIZE];
+  size_t len;
+
+  len=librdf_node_encode(node, NULL, 0);
+  if(!len ||
+     librdf_storage_hashes_grow_buffer(&context->node_buffer,
+                                       &context->node_buffer_len, len) ||
+     !librdf_node_encode(node, context->node_buffer, len))
+    return 1;
+
+  hd_key.data=context->node_buffer; hd_key.size=len;
+  hd_id=librdf_hash_get_one(context->hashes[context->n2i_index], &hd_key);
+  if(hd_id) {
+    int status=(hd_id->size != LIBRDF_STORAGE_HASHES_NODE_ID_SIZE);
+
+    if(!status)
+      memcpy(buffer, hd_id->data, LIBRDF_STORAGE_HASHES_NODE_ID_SIZE);
+    librdf_free_hash_datum(hd_id);
+    return status;
+  }
+
+  if(!add) {
+    memset(buffer, 0, LIBRDF_STORAGE_HASHES_NODE_ID_SIZE);
+    return 0;
+  }
+
+  librdf_storage_hashes_encode_node_id(context->last_node_id + 1, buffer);
+
+  /* node -> ID and ID -> node */
+  hd_value.data=buffer; hd_value.size=LIBRDF_STORAGE_HASHES_NODE_ID_SIZE;
+  if(librdf_hash_put(context->hashes[context->n2i_index], &hd_key, &hd_value))
+    return 1;
+  if(librdf_hash_put(context->hashes[context->i2n_index], &hd_value, &hd_key))
+    return 1;
+
+  /* record the last ID given out under ID 0 */
+  context->last_node_id++;
+  memset(last_id, 0, sizeof(last_id));
+  hd_key.data=last_id; hd_key.size=sizeof(last_id);
+  librdf_hash_delete_all(context->hashes[context->i2n_index], &hd_key);
+  hd_value.data=buffer;
+  return librdf_hash_put(context->hashes[context->i2n_index], &hd_key,
+                         &hd_value);
+}
+
+
+/*
+ * librdf_storage_hashes_id_to_node:
+ * @storage: the storage
+ * @buffer: node ID
+ * 
+ * INTERNAL - Get the node with a dictionary ID.
+ * 
+ * Return value: new #librdf_node or NULL on failure
+ */
+static librdf_node*
+librdf_storage_hashes_id_to_node(librdf_storage* storage,
+                                 const unsigned char *buffer)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  librdf_hash_datum hd_key; /* on stack */
+  librdf_hash_datum *hd_value;
+  librdf_node* node;
+
+  hd_key.data=(void*)buffer; hd_key.size=LIBRDF_STORAGE_HASHES_NODE_ID_SIZE;
+  hd_value=librdf_hash_get_one(context->hashes[context->i2n_index], &hd_key);
+  if(!hd_value)
+    return NULL;
+
+  node=librdf_node_decode(storage->world, NULL,
+                          (unsigned char*)hd_value->data, hd_value->size);
+  librdf_free_hash_datum(hd_value);
+  return node;
+}
+
+
+/*
+ * librdf_storage_hashes_encode_parts:
+ * @storage: the storage
+ * @statement: statement to encode
+ * @context_node: context node to encode or NULL
+ * @buffer: buffer or NULL to get the size
+ * @length: buffer size
+ * @fields: statement parts to encode
+ * @add: non 0 to add nodes to the dictionary
+ * 
+ * INTERNAL - Encode parts of a statement for an index hash key or value.
+ * 
+ * With a dictionary each part is its node ID, otherwise the encoding
+ * of librdf_statement_encode_parts2().
+ * 
+ * Return value: the number of bytes written or 0 on failure
+ */
+static size_t
+librdf_storage_hashes_encode_parts(librdf_storage* storage,
+                                   librdf_statement* statement,
+                                   librdf_node* context_node,
+                                   unsigned char *buffer, size_t length,
+                                   librdf_statement_part fields, int add)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  librdf_node* nodes[4];
+  size_t len=0;
+  int i;
+
+  if(!context->dictionary)
+    return librdf_statement_encode_parts2(storage->world, statement,
+                                          context_node, buffer, length,
+                                          fields);
+
+  nodes[0]=(fields & LIBRDF_STATEMENT_SUBJECT) ? librdf_statement_get_subject(statement) : NULL;
+  nodes[1]=(fields & LIBRDF_STATEMENT_PREDICATE) ? librdf_statement_get_predicate(statement) : NULL;
+  nodes[2]=(fields & LIBRDF_STATEMENT_OBJECT) ? librdf_statement_get_object(statement) : NULL;
+  nodes[3]=context_node;
+
+  for(i=0; i < 4; i++) {
+    if(!nodes[i]) {
+      /* a wanted statement part is missing */
+      if(i < 3 && (fields & (LIBRDF_STATEMENT_SUBJECT << i)))
+        return 0;
+      continue;
+    }
+
+    if(buffer) {
+      if(len + LIBRDF_STORAGE_HASHES_NODE_ID_SIZE > length ||
+         librdf_storage_hashes_node_to_id(storage, nodes[i], add,
+                                          buffer + len))
+        return 0;
+    }
+    len += LIBRDF_STORAGE_HASHES_NODE_ID_SIZE;
+  }
+
+  return len;
+}
+
+
+/*
+ * librdf_storage_hashes_decode_parts:
+ * @storage: the storage
+ * @statement: statement to decode into
+ * @context_node: pointer to context node to decode into or NULL
+ * @buffer: buffer
+ * @length: buffer size
+ * @fields: statement parts encoded
+ * 
+ * INTERNAL - Decode parts of a statement from an index hash key or value.
+ * 
+ * Return value: number of bytes used or 0 on failure
+ */
+static size_t
+librdf_storage_hashes_decode_parts(librdf_storage* storage,
+                                   librdf_statement* statement,
+                                   librdf_node** context_node,
+                                   unsigned char *buffer, size_t length,
+                                   librdf_statement_part fields)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  size_t len=0;
+  int i;
+
+  if(!context->dictionary)
+    return librdf_statement_decode2(storage->world, statement, context_node,
+                                    buffer, length);
+
+  for(i=0; i < 4; i++) {
+    librdf_node* node;
+
+    if(i < 3 && !(fields & (LIBRDF_STATEMENT_SUBJECT << i)))
+      continue;
+    /* the context node is only present in values with contexts */
+    if(i == 3 && len == length)
+      break;
+
+    if(len + LIBRDF_STORAGE_HASHES_NODE_ID_SIZE > length)
+      return 0;
+
+    if(i == 3 && !context_node)
+      break;
+
+    node=librdf_storage_hashes_id_to_node(storage, buffer + len);
+    if(!node)
+      return 0;
+    len += LIBRDF_STORAGE_HASHES_NODE_ID_SIZE;
+
+    switch(i) {
+      case 0:
+        librdf_statement_set_subject(statement, node);
+        break;
+      case 1:
+        librdf_statement_set_predicate(statement, node);
+        break;
+      case 2:
+        librdf_statement_set_object(statement, node);
+        break;
+      default:
+        *context_node=node;
+        break;
+    }
+  }
+
+  return len;
+}
+
+
+/*
+ * librdf_storage_hashes_encode_to_buffer:
+ * @storage: the storage
+ * @statement: statement to encode
+ * @context_node: context node or NULL
+ * @buffer: pointer to growing buffer
+ * @buffer_len: pointer to size of the buffer
+ * @fields: statement parts to encode
+ * @add: non 0 to add nodes to the dictionary
+ * 
+ * INTERNAL - Encode parts of a statement into a growing buffer
+ * 
+ * The encoding is tried in the buffer as it is first, so the size is
+ * only computed when the buffer turns out to be too small.
+ * 
+ * Return value: the number of bytes written or 0 on failure
+ */
+static size_t
+librdf_storage_hashes_encode_to_buffer(librdf_storage* storage,
+                                       librdf_statement* statement,
+                                       librdf_node* context_node,
+                                       unsigned char **buffer,
+                                       size_t *buffer_len,
+                                       librdf_statement_part fields, int add)
+{
+  size_t len=0;
+
+  if(*buffer)
+    len=librdf_storage_hashes_encode_parts(storage, statement, context_node,
+                                           *buffer, *buffer_len, fields, add);
+  if(len)
+    return len;
+
+  len=librdf_storage_hashes_encode_parts(storage, statement, context_node,
+                                         NULL, 0, fields, add);
+  if(!len || librdf_storage_hashes_grow_buffer(buffer, buffer_len, len))
+    return 0;
+
+  return librdf_storage_hashes_encode_parts(storage, statement, context_node,
+                                            *buffer, *buffer_len, fields, add);
+}
+
+
+/*
+ * librdf_storage_hashes_add_remove_statement_index:
+ * @storage: the storage
+ * @statement: statement to add or remove
+ * @context_node: context node or NULL
+ * @i: index of the hash to update
+ * @is_addition: non 0 to add the statement, 0 to remove it
+ * @if_absent: non 0 to only add a statement that is not already present
+ * 
+ * INTERNAL - Add or remove a statement in one index hash.
+ * 
+ * With @if_absent the lookup and the insertion are one hash operation.
+ * 
+ * Return value: non 0 on failure, <0 if @if_absent was given and the
+ * statement is already present
+ */
+static int
+librdf_storage_hashes_add_remove_statement_index(librdf_storage* storage, 
+                                                 librdf_statement* statement,
+                                                 librdf_node* context_node,
+                                                 int i, int is_addition,
+                                                 int if_absent)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  librdf_hash_datum hd_key, hd_value; /* on stack */
+  size_t key_len, value_len;
+  librdf_statement_part fields;
+
+  /* ENCODE KEY */
+
+  fields=(librdf_statement_part)context->hash_descriptions[i]->key_fields;
+  if(!fields)
+    return 0;
+    
+  key_len=librdf_storage_hashes_encode_to_buffer(storage, statement, NULL,
+                                                 &context->key_buffer,
+                                                 &context->key_buffer_len,
+                                                 fields, is_addition);
+  if(!key_len)
+    return 1;
+
+    
+  /* ENCODE VALUE */
+    
+  fields=(librdf_statement_part)context->hash_descriptions[i]->value_fields;
+  if(!fields)
+    return 0;
+    
+  value_len=librdf_storage_hashes_encode_to_buffer(storage, statement,
+                                                   context_node,
+                                                   &context->value_buffer,
+                                                   &context->value_buffer_len,
+                                                   fields, is_addition);
+  if(!value_len)
+    return 1;
+
+
+#if defined(LIBRDF_DEBUG) && LIBRDF_DEBUG > 1
+  LIBRDF_DEBUG4("Using %s hash key %d bytes -> value %d bytes\n", context->hash_descriptions[i]->name, key_len, value_len);
+#endif
+
+  /* Finally, store / remove the sucker */
+  hd_key.data=context->key_buffer; hd_key.size=key_len;
+  hd_value.data=context->value_buffer; hd_value.size=value_len;
+
+  if(!is_addition)
+    return librdf_hash_delete(context->hashes[i], &hd_key, &hd_value);
+
+  if(if_absent) {
+    int status=librdf_hash_put_if_absent(context->hashes[i], &hd_key,
+                                         &hd_value);
+    return (status > 0) ? -1 : (status < 0);
+  }
+
+  return librdf_hash_put(context->hashes[i], &hd_key, &hd_value);
+}
+
+
+/*
+ * librdf_storage_hashes_stats_get:
+ * @hash: the stats hash
+ * @key: key
+ * 
+ * INTERNAL - Get a count from the stats hash.
+ * 
+ * Return value: the count or 0 if there is none
+ */
+static u64
+librdf_storage_hashes_stats_get(librdf_hash* hash, librdf_hash_datum* key)
+{
+  librdf_hash_datum *hd_value;
+  u64 count=0;
+
+  hd_value=librdf_hash_get_one(hash, key);
+  if(hd_value) {
+    if(hd_value->size == LIBRDF_STORAGE_HASHES_NODE_ID_SIZE)
+      count=librdf_storage_hashes_decode_node_id((unsigned char*)hd_value->data);
+    librdf_free_hash_datum(hd_value);
+  }
+
+  return count;
+}
+
+
+/*
+ * librdf_storage_hashes_stats_set:
+ * @hash: the stats hash
+ * @key: key
+ * @old_count: count the key has now
+ * @count: new count
+ * 
+ * INTERNAL - Replace a count in the stats hash, deleting it at 0.
+ * 
+ * Return value: non 0 on failure
+ */
+static int
+librdf_storage_hashes_stats_set(librdf_hash* hash, librdf_hash_datum* key,
+                                u64 old_count, u64 count)
+{
+  unsigned char value[LIBRDF_STORAGE_HASHES_NODE_ID_SIZE];
+  librdf_hash_datum hd_value; /* on stack */
+
+  if(old_count && librdf_hash_delete_all(hash, key))
+    return 1;
+
+  if(!count)
+    return 0;
+
+  librdf_storage_hashes_encode_node_id(count, value);
+  hd_value.data=value; hd_value.size=sizeof(value);
+  return librdf_hash_put(hash, key, &hd_value);
+}
+
+
+/*
+ * librdf_storage_hashes_stats_node_get:
+ * @storage: the storage
+ * @key: stats hash key of a predicate count
+ * @count: pointer to set to the count
+ * @saved_count: pointer to set to the count in the stats hash or NULL
+ * 
+ * INTERNAL - Get a per predicate count, changed in memory or saved.
+ * 
+ * Return value: non 0 if the count is changed in memory
+ */
+static int
+librdf_storage_hashes_stats_node_get(librdf_storage* storage,
+                                     librdf_hash_datum* key,
+                                     u64* count, u64* saved_count)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  librdf_hash_datum *hd_value;
+
+  if(context->stats_nodes && context->stats_nodes_count) {
+    hd_value=librdf_hash_get_one(context->stats_nodes, key);
+    if(hd_value) {
+      unsigned char *p=(unsigned char*)hd_value->data;
+
+      *count=librdf_storage_hashes_decode_node_id(p);
+      if(saved_count)
+        *saved_count=librdf_storage_hashes_decode_node_id(p + LIBRDF_STORAGE_HASHES_NODE_ID_SIZE);
+      librdf_free_hash_datum(hd_value);
+      return 1;
+    }
+  }
+
+  *count=librdf_storage_hashes_stats_get(context->hashes[context->stats_index],
+                                         key);
+  if(saved_count)
+    *saved_count=*count;
+  return 0;
+}
+
+
+/*
+ * librdf_storage_hashes_stats_save_nodes:
+ * @storage: the storage
+ * 
+ * INTERNAL - Save the per predicate counts changed in memory in the
+ * stats hash.
+ * 
+ * Return value: non 0 on failure
+ */
+static int
+librdf_storage_hashes_stats_save_nodes(librdf_storage* storage)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  librdf_hash* hash=context->hashes[context->stats_index];
+  librdf_hash_cursor* cursor;
+  librdf_hash_datum hd_key, hd_value; /* on stack */
+  librdf_hash* nodes;
+  int status=0;
+  int rc;
+
+  if(!context->stats_nodes_count)
+    return 0;
+
+  cursor=librdf_new_hash_cursor(context->stats_nodes);
+  if(!cursor)
+    return 1;
+
+  hd_key.data=NULL;
+  for(rc=librdf_hash_cursor_get_first(cursor, &hd_key, &hd_value);
+      !rc && !status;
+      hd_key.data=NULL,
+        rc=librdf_hash_cursor_get_next(cursor, &hd_key, &hd_value)) {
+    unsigned char *p=(unsigned char*)hd_value.data;
+    u64 count=librdf_storage_hashes_decode_node_id(p);
+    u64 saved_count=librdf_storage_hashes_decode_node_id(p + LIBRDF_STORAGE_HASHES_NODE_ID_SIZE);
+
+    if(count != saved_count)
+      status=librdf_storage_hashes_stats_set(hash, &hd_key, saved_count,
+                                             count);
+  }
+  librdf_free_hash_cursor(cursor);
+
+  if(status)
+    return status;
+
+  /* start again with an empty memory hash */
+  nodes=librdf_new_hash(storage->world, "memory");
+  if(!nodes)
+    return 1;
+  if(librdf_hash_open(nodes, NULL, 0, 1, 1, NULL)) {
+    librdf_free_hash(nodes);
+    return 1;
+  }
+  librdf_hash_close(context->stats_nodes);
+  librdf_free_hash(context->stats_nodes);
+  context->stats_nodes=nodes;
+  context->stats_nodes_count=0;
+
+  return 0;
+}
+
+
+/*
+ * librdf_storage_hashes_stats_update_node:
+ * @storage: the storage
+ * @which: LIBRDF_STORAGE_HASHES_STATS_PREDICATES
+ * @node: predicate
+ * @delta: 1 or -1
+ * 
+ * INTERNAL - Count a statement added or removed for its predicate.
+ * 
+ * The count is changed in memory and saved in the stats hash with the
+ * other statistics, or once LIBRDF_STORAGE_HASHES_STATS_NODES_MAX
+ * predicates have changed, so that a predicate is not written for
+ * every statement.
+ * 
+ * The number of different predicates changes when the count of the
+ * predicate goes from or to 0.
+ * 
+ * Return value: non 0 on failure
+ */
+static int
+librdf_storage_hashes_stats_update_node(librdf_storage* storage, int which,
+                                        librdf_node* node, int delta)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  unsigned char value[LIBRDF_STORAGE_HASHES_NODE_ID_SIZE * 2];
+  librdf_hash_datum hd_key, hd_value; /* on stack */
+  size_t size;
+  u64 count, saved_count;
+  int is_changed;
+
+  size=librdf_node_encode(node, NULL, 0) + 1;
+  if(size < 2 ||
+     librdf_storage_hashes_grow_buffer(&context->node_buffer,
+                                       &context->node_buffer_len, size))
+    return 1;
+  context->node_buffer[0]=librdf_storage_hashes_stats_keys[which];
+  if(!librdf_node_encode(node, context->node_buffer + 1, size - 1))
+    return 1;
+
+  hd_key.data=context->node_buffer; hd_key.size=size;
+
+  is_changed=librdf_storage_hashes_stats_node_get(storage, &hd_key,
+                                                  &count, &saved_count);
+  if(delta < 0 && !count)
+    return 0;
+
+  if(!count)
+    context->stats_counts[which]++;
+  else if(count == 1 && delta < 0)
+    context->stats_counts[which]--;
+
+  librdf_storage_hashes_encode_node_id((delta < 0) ? count - 1 : count + 1,
+                                       value);
+  librdf_storage_hashes_encode_node_id(saved_count,
+                                       value + LIBRDF_STORAGE_HASHES_NODE_ID_SIZE);
+  hd_value.data=value; hd_value.size=sizeof(value);
+
+  if(is_changed && librdf_hash_delete_all(context->stats_nodes, &hd_key))
+    return 1;
+  if(librdf_hash_put(context->stats_nodes, &hd_key, &hd_value))
+    return 1;
+
+  if(!is_changed &&
+     ++context->stats_nodes_count >= LIBRDF_STORAGE_HASHES_STATS_NODES_MAX)
+    return librdf_storage_hashes_stats_save_nodes(storage);
+
+  return 0;
+}
+
+
+/*
+ * librdf_storage_hashes_stats_sketch_hash:
+ * @storage: the storage
+ * @node: node
+ * @hash: pointer to set to the hash
+ * 
+ * INTERNAL - Hash the encoded form of a node for the sketches.
+ * 
+ * Return value: non 0 on failure
+ */
+static int
+librdf_storage_hashes_stats_sketch_hash(librdf_storage* storage,
+                                        librdf_node* node, u64* hash)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  size_t size;
+
+  size=librdf_node_encode(node, NULL, 0);
+  if(!size ||
+     librdf_storage_hashes_grow_buffer(&context->node_buffer,
+                                       &context->node_buffer_len, size) ||
+     !librdf_node_encode(node, context->node_buffer, size))
+    return 1;
+
+  *hash=librdf_hash_function_wyhash(context->node_buffer, size, 0);
+  return 0;
+}
+
+
+/* Counter of @row of the count-min sketch for a node @hash */
+#define LIBRDF_STORAGE_HASHES_SKETCH_COLUMN(hash, row) \
+  ((((u32)(hash)) + (row) * (((u32)((hash) >> 32)) | 1)) & (LIBRDF_STORAGE_HASHES_SKETCH_WIDTH - 1))
+
+
+/*
+ * librdf_storage_hashes_stats_sketch_update:
+ * @sketch: sketch
+ * @hash: node hash
+ * @delta: 1 or -1
+ * 
+ * INTERNAL - Count a statement added or removed for a node in a sketch.
+ * 
+ * The HyperLogLog register is the low bits of the hash, set to the
+ * highest position of the first 1 bit in the rest of it.  Removals
+ * leave it as it is.
+ */
+static void
+librdf_storage_hashes_stats_sketch_update(librdf_storage_hashes_sketch* sketch,
+                                          u64 hash, int delta)
+{
+  u64 rest;
+  unsigned char rank;
+  int row;
+
+  for(row=0; row < LIBRDF_STORAGE_HASHES_SKETCH_DEPTH; row++) {
+    u32* counter=&sketch->counters[row][LIBRDF_STORAGE_HASHES_SKETCH_COLUMN(hash, row)];
+
+    if(delta > 0) {
+      if(*counter != 0xFFFFFFFFU)
+        (*counter)++;
+    } else if(*counter)
+      (*counter)--;
+  }
+
+  if(delta < 0)
+    return;
+
+  rest=hash >> LIBRDF_STORAGE_HASHES_SKETCH_REGISTER_BITS;
+  for(rank=1; rank <= 64 - LIBRDF_STORAGE_HASHES_SKETCH_REGISTER_BITS && !(rest & 1); rank++)
+    rest >>= 1;
+  if(sketch->registers[hash & (LIBRDF_STORAGE_HASHES_SKETCH_REGISTERS - 1)] < rank)
+    sketch->registers[hash & (LIBRDF_STORAGE_HASHES_SKETCH_REGISTERS - 1)]=rank;
+}
+
+
+/*
+ * librdf_storage_hashes_stats_sketch_count:
+ * @sketch: sketch
+ * @hash: node hash
+ * 
+ * INTERNAL - Estimate the statements with a node from a sketch.
+ * 
+ * Never less than the real count and with 4 rows of 1024 counters
+ * almost always within 0.3% of all statements above it.
+ * 
+ * Return value: the estimate
+ */
+static u64
+librdf_storage_hashes_stats_sketch_count(librdf_storage_hashes_sketch* sketch,
+                                         u64 hash)
+{
+  u32 count=0xFFFFFFFFU;
+  int row;
+
+  for(row=0; row < LIBRDF_STORAGE_HASHES_SKETCH_DEPTH; row++) {
+    u32 counter=sketch->counters[row][LIBRDF_STORAGE_HASHES_SKETCH_COLUMN(hash, row)];
+
+    if(counter < count)
+      count=counter;
+  }
+
+  return count;
+}
+
+
+/*
+ * librdf_storage_hashes_stats_sketch_distinct:
+ * @sketch: sketch
+ * 
+ * INTERNAL - Estimate the different nodes counted in a sketch.
+ * 
+ * The HyperLogLog estimate, about 1.6% off with 4096 registers,
+ * using linear counting of the empty registers for small counts.
+ * Nodes no longer in any statement are still counted.
+ * 
+ * Return value: the estimate
+ */
+static u64
+librdf_storage_hashes_stats_sketch_distinct(librdf_storage_hashes_sketch* sketch)
+{
+  const double m=LIBRDF_STORAGE_HASHES_SKETCH_REGISTERS;
+  double sum=0.0;
+  double estimate;
+  int zeros=0;
+  int i;
+
+  for(i=0; i < LIBRDF_STORAGE_HASHES_SKETCH_REGISTERS; i++) {
+    sum += 1.0 / (double)((u64)1 << sketch->registers[i]);
+    if(!sketch->registers[i])
+      zeros++;
+  }
+
+  estimate=(0.7213 / (1.0 + 1.079 / m)) * m * m / sum;
+  if(estimate <= 2.5 * m && zeros)
+    estimate=m * log(m / zeros);
+
+  return (u64)(estimate + 0.5);
+}
+
+
+/*
+ * librdf_storage_hashes_stats_sketch_save:
+ * @hash: the stats hash
+ * @key: key
+ * @sketch: sketch
+ * 
+ * INTERNAL - Replace a sketch in the stats hash.
+ * 
+ * Return value: non 0 on failure
+ */
+static int
+librdf_storage_hashes_stats_sketch_save(librdf_hash* hash,
+                                        librdf_hash_datum* key,
+                                        librdf_storage_hashes_sketch* sketch)
+{
+  unsigned char* value;
+  unsigned char* p;
+  librdf_hash_datum hd_value; /* on stack */
+  int row, i;
+  int status;
+
+  value=LIBRDF_MALLOC(unsigned char*, LIBRDF_STORAGE_HASHES_SKETCH_SIZE);
+  if(!value)
+    return 1;
+
+  p=value;
+  for(row=0; row < LIBRDF_STORAGE_HASHES_SKETCH_DEPTH; row++) {
+    for(i=0; i < LIBRDF_STORAGE_HASHES_SKETCH_WIDTH; i++) {
+      u32 counter=sketch->counters[row][i];
+
+      *p++=(unsigned char)(counter >> 24);
+      *p++=(unsigned char)(counter >> 16);
+      *p++=(unsigned char)(counter >> 8);
+      *p++=(unsigned char)counter;
+    }
+  }
+  memcpy(p, sketch->registers, LIBRDF_STORAGE_HASHES_SKETCH_REGISTERS);
+
+  status=(librdf_hash_exists(hash, key, NULL) > 0 &&
+          librdf_hash_delete_all(hash, key));
+  if(!status) {
+    hd_value.data=value; hd_value.size=LIBRDF_STORAGE_HASHES_SKETCH_SIZE;
+    status=librdf_hash_put(hash, key, &hd_value);
+  }
+
+  LIBRDF_FREE(unsigned char*, value);
+  return status;
+}
+
+
+/*
+ * librdf_storage_hashes_stats_sketch_load:
+ * @hash: the stats hash
+ * @key: key
+ * @sketch: sketch
+ * 
+ * INTERNAL - Read a sketch from the stats hash, empty if there is none.
+ */
+static void
+librdf_storage_hashes_stats_sketch_load(librdf_hash* hash,
+                                        librdf_hash_datum* key,
+                                        librdf_storage_hashes_sketch* sketch)
+{
+  librdf_hash_datum *hd_value;
+  const unsigned char* p;
+  int row, i;
+
+  memset(sketch, 0, sizeof(*sketch));
+
+  hd_value=librdf_hash_get_one(hash, key);
+  if(!hd_value)
+    return;
+
+  if(hd_value->size == LIBRDF_STORAGE_HASHES_SKETCH_SIZE) {
+    p=(const unsigned char*)hd_value->data;
+    for(row=0; row < LIBRDF_STORAGE_HASHES_SKETCH_DEPTH; row++) {
+      for(i=0; i < LIBRDF_STORAGE_HASHES_SKETCH_WIDTH; i++) {
+        sketch->counters[row][i]=((u32)p[0] << 24) | ((u32)p[1] << 16) |
+                                 ((u32)p[2] << 8) | (u32)p[3];
+        p += 4;
+      }
+    }
+    memcpy(sketch->registers, p, LIBRDF_STORAGE_HASHES_SKETCH_REGISTERS);
+  }
+
+  librdf_free_hash_datum(hd_value);
+}
+
+
+/*
+ * librdf_storage_hashes_stats_update:
+ * @storage: the storage
+ * @statement: statement added or removed
+ * @delta: 1 if it was added, -1 if it was removed
+ * 
+ * INTERNAL - Update the statistics for a statement added or removed.
+ * 
+ * Return value: non 0 on failure
+ */
+static int
+librdf_storage_hashes_stats_update(librdf_storage* storage,
+                                   librdf_statement* statement, int delta)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  u64* statements=&context->stats_counts[LIBRDF_STORAGE_HASHES_STATS_STATEMENTS];
+  u64 subject_hash, object_hash;
+
+  if(librdf_storage_hashes_stats_sketch_hash(storage,
+                                             librdf_statement_get_subject(statement),
+                                             &subject_hash) ||
+     librdf_storage_hashes_stats_sketch_hash(storage,
+                                             librdf_statement_get_object(statement),
+                                             &object_hash))
+    return 1;
+
+  if(delta > 0)
+    (*statements)++;
+  else if(*statements)
+    (*statements)--;
+  context->stats_dirty=1;
+
+  librdf_storage_hashes_stats_sketch_update(context->stats_sketches[LIBRDF_STORAGE_HASHES_STATS_SUBJECTS],
+                                            subject_hash, delta);
+  librdf_storage_hashes_stats_sketch_update(context->stats_sketches[LIBRDF_STORAGE_HASHES_STATS_OBJECTS],
+                                            object_hash, delta);
+
+  return librdf_storage_hashes_stats_update_node(storage,
+                                                 LIBRDF_STORAGE_HASHES_STATS_PREDICATES,
+                                                 librdf_statement_get_predicate(statement),
+                                                 delta);
+}
+
+
+/*
+ * librdf_storage_hashes_stats_update_encoded:
+ * @storage: the storage
+ * @key: key in the all statements hash
+ * @key_len: key length
+ * @value: value in the all statements hash
+ * @value_len: value length
+ * @delta: 1 if it was added, -1 if it was removed
+ * 
+ * INTERNAL - Update the statistics for a statement added or removed
+ * as a key/value of the all statements hash.
+ * 
+ * Return value: non 0 on failure
+ */
+static int
+librdf_storage_hashes_stats_update_encoded(librdf_storage* storage,
+                                           const unsigned char *key,
+                                           size_t key_len,
+                                           const unsigned char *value,
+                                           size_t value_len, int delta)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  librdf_hash_descriptor* desc=context->hash_descriptions[context->all_statements_hash_index];
+  librdf_statement statement; /* on stack */
+  librdf_node* context_node=NULL;
+  int status=1;
+
+  librdf_statement_init(storage->world, &statement);
+
+  if(librdf_storage_hashes_decode_parts(storage, &statement, NULL,
+                                        (unsigned char*)key, key_len,
+                                        (librdf_statement_part)desc->key_fields) &&
+     librdf_storage_hashes_decode_parts(storage, &statement,
+                                        context->index_contexts ? &context_node : NULL,
+                                        (unsigned char*)value, value_len,
+                                        (librdf_statement_part)desc->value_fields))
+    status=librdf_storage_hashes_stats_update(storage, &statement, delta);
+
+  librdf_statement_clear(&statement);
+  if(context_node)
+    librdf_free_node(context_node);
+
+  return status;
+}
+
+
+/*
+ * librdf_storage_hashes_stats_exists:
+ * @storage: the storage
+ * @statement: statement
+ * @context_node: context node or NULL
+ * 
+ * INTERNAL - Check if a statement is stored with exactly a context node.
+ * 
+ * Return value: >0 if it is, 0 if not, <0 on failure
+ */
+static int
+librdf_storage_hashes_stats_exists(librdf_storage* storage,
+                                   librdf_statement* statement,
+                                   librdf_node* context_node)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  int hash_index=context->all_statements_hash_index;
+  librdf_hash_datum hd_key, hd_value; /* on stack */
+  size_t key_len, value_len;
+
+  key_len=librdf_storage_hashes_encode_to_buffer(storage, statement, NULL,
+                                                 &context->key_buffer,
+                                                 &context->key_buffer_len,
+                                                 (librdf_statement_part)context->hash_descriptions[hash_index]->key_fields,
+                                                 0);
+  value_len=librdf_storage_hashes_encode_to_buffer(storage, statement,
+                                                   context_node,
+                                                   &context->value_buffer,
+                                                   &context->value_buffer_len,
+                                                   (librdf_statement_part)context->hash_descriptions[hash_index]->value_fields,
+                                                   0);
+  if(!key_len || !value_len)
+    return -1;
+
+  hd_key.data=context->key_buffer; hd_key.size=key_len;
+  hd_value.data=context->value_buffer; hd_value.size=value_len;
+
+  return librdf_hash_exists(context->hashes[hash_index], &hd_key, &hd_value);
+}
+
+
+/*
+ * librdf_storage_hashes_stats_save:
+ * @storage: the storage
+ * 
+ * INTERNAL - Save the counts and sketches in the stats hash.
+ *
+ * Done on sync and close.
+ * 
+ * Return value: non 0 on failure
+ */
+static int
+librdf_storage_hashes_stats_save(librdf_storage* storage)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  librdf_hash* hash=context->hashes[context->stats_index];
+  int i;
+
+  if(!context->stats_dirty || !hash)
+    return 0;
+
+  if(librdf_storage_hashes_stats_save_nodes(storage))
+    return 1;
+
+  for(i=0; i < LIBRDF_STORAGE_HASHES_STATS_COUNT; i++) {
+    librdf_hash_datum hd_key; /* on stack */
+
+    hd_key.data=(void*)&librdf_storage_hashes_stats_keys[i]; hd_key.size=1;
+    if(context->stats_sketches[i]) {
+      if(librdf_storage_hashes_stats_sketch_save(hash, &hd_key,
+                                                 context->stats_sketches[i]))
+        return 1;
+    } else if(librdf_storage_hashes_stats_set(hash, &hd_key,
+                                              (librdf_hash_exists(hash, &hd_key, NULL) > 0),
+                                              context->stats_counts[i]))
+      return 1;
+  }
+
+  context->stats_dirty=0;
+  return 0;
+}
+
+
+/*
+ * librdf_storage_hashes_stats_open:
+ * @storage: the storage
+ * 
+ * INTERNAL - Load the counts and sketches from the stats hash.
+ * 
+ * An empty stats hash of a writable store with statements, such as
+ * one opened with the statistics option for the first time, is
+ * filled by counting every statement.  A read only store without
+ * statistics works without them.
+ * 
+ * Return value: non 0 on failure
+ */
+static int
+librdf_storage_hashes_stats_open(librdf_storage* storage)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  librdf_hash* hash=context->hashes[context->stats_index];
+  librdf_hash* any_hash=context->hashes[context->all_statements_hash_index];
+  librdf_hash_cursor* cursor;
+  librdf_hash_datum hd_key, hd_value; /* on stack */
+  int status=0;
+  int rc;
+  int i;
+
+  for(i=0; i < LIBRDF_STORAGE_HASHES_STATS_COUNT; i++) {
+    hd_key.data=(void*)&librdf_storage_hashes_stats_keys[i]; hd_key.size=1;
+    if(i == LIBRDF_STORAGE_HASHES_STATS_SUBJECTS ||
+       i == LIBRDF_STORAGE_HASHES_STATS_OBJECTS) {
+      if(!context->stats_sketches[i]) {
+        context->stats_sketches[i]=LIBRDF_MALLOC(librdf_storage_hashes_sketch*,
+                                                 sizeof(librdf_storage_hashes_sketch));
+        if(!context->stats_sketches[i])
+          return 1;
+      }
+      librdf_storage_hashes_stats_sketch_load(hash, &hd_key,
+                                              context->stats_sketches[i]);
+    } else
+      context->stats_counts[i]=librdf_storage_hashes_stats_get(hash, &hd_key);
+  }
+  context->stats_dirty=0;
+
+  if(!context->stats_nodes) {
+    context->stats_nodes=librdf_new_hash(storage->world, "memory");
+    if(!context->stats_nodes)
+      return 1;
+    if(librdf_hash_open(context->stats_nodes, NULL, 0, 1, 1, NULL)) {
+      librdf_free_hash(context->stats_nodes);
+      context->stats_nodes=NULL;
+      return 1;
+    }
+    context->stats_nodes_count=0;
+  }
+
+  if(!librdf_storage_hashes_hash_is_empty(hash) ||
+     librdf_storage_hashes_hash_is_empty(any_hash))
+    return 0;
+
+  if(!context->is_writable) {
+    context->statistics=0;
+    return 0;
+  }
+
+  librdf_log(storage->world, 0, LIBRDF_LOG_INFO, LIBRDF_FROM_STORAGE, NULL,
+             "Counting hashes storage statements for statistics");
+
+  cursor=librdf_new_hash_cursor(any_hash);
+  if(!cursor)
+    return 1;
+
+  hd_key.data=NULL;
+  for(rc=librdf_hash_cursor_get_first(cursor, &hd_key, &hd_value);
+      !rc && !status;
+      hd_key.data=NULL,
+        rc=librdf_hash_cursor_get_next(cursor, &hd_key, &hd_value))
+    status=librdf_storage_hashes_stats_update_encoded(storage,
+                                                      (unsigned char*)hd_key.data,
+                                                      hd_key.size,
+                                                      (unsigned char*)hd_value.data,
+                                                      hd_value.size, 1);
+
+  librdf_free_hash_cursor(cursor);
+
+  if(!status)
+    status=librdf_storage_hashes_stats_save(storage);
+
+  return status;
+}
+
+
+static int
+librdf_storage_hashes_add_remove_statement(librdf_storage* storage, 
+                                           librdf_statement* statement,
+                                           librdf_node* context_node,
+                                           int is_addition)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  int i;
+  int status=0;
+  int exists=0;
+
+#if defined(LIBRDF_DEBUG) && LIBRDF_DEBUG > 1
+  if(is_addition)
+    LIBRDF_DEBUG1("Adding statement: ");
+  else
+    LIBRDF_DEBUG1("Removing statement: ");
+  librdf_statement_print(statement, stderr);
+  fputc('\n', stderr);
+#endif  
+
+  /* only count statements that are really added or removed */
+  if(context->statistics) {
+    exists=librdf_storage_hashes_stats_exists(storage, statement,
+                                              context_node);
+    if(exists < 0)
+      return 1;
+  }
+
+  for(i=0; i<context->hash_count; i++) {
+    status=librdf_storage_hashes_add_remove_statement_index(storage, statement,
+                                                            context_node, i,
+                                                            is_addition, 0);
+    if(status)
+      break;
+  }
+
+  if(!status && context->statistics && !exists != !is_addition)
+    status=librdf_storage_hashes_stats_update(storage, statement,
+                                              is_addition ? 1 : -1);
+
+  return status;
+}
+
+
+static int
+librdf_storage_hashes_add_statement(librdf_storage* storage, librdf_statement* statement)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  int hash_index=context->all_statements_hash_index;
+  int i;
+  int status;
+
+  if(context->index_contexts) {
+    /* Do not add duplicate statements */
+    if(librdf_storage_hashes_contains_statement(storage, statement))
+      return 0;
+
+    return librdf_storage_hashes_add_remove_statement(storage, statement, NULL, 1);
+  }
+
+  /* Without contexts the all statements index holds exactly the
+   * statement so the duplicate check and the insert there share one
+   * key encoding and key hash.
+   */
+  status=librdf_storage_hashes_add_remove_statement_index(storage, statement,
+                                                          NULL, hash_index,
+                                                          1, 1);
+  /* Do not add duplicate statements */
+  if(status < 0)
+    return 0;
+  if(status)
+    return status;
+
+  for(i=0; i<context->hash_count; i++) {
+    if(i == hash_index)
+      continue;
+    status=librdf_storage_hashes_add_remove_statement_index(storage, statement,
+                                                            NULL, i, 1, 0);
+    if(status)
+      break;
+  }
+
+  if(!status && context->statistics)
+    status=librdf_storage_hashes_stats_update(storage, statement, 1);
+
+  return status;
+}
+
+
+/*
+ * librdf_storage_hashes_batch_init:
+ * @storage: the storage
+ * @batch: batch
+ * @size: number of statements
+ * 
+ * INTERNAL - Allocate a batch of up to @size statements.
+ * 
+ * Return value: non 0 on failure
+ */
+static int
+librdf_storage_hashes_batch_init(librdf_storage* storage,
+                                 librdf_storage_hashes_batch* batch, int size)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  size_t batch_size=LIBRDF_GOOD_CAST(size_t, size);
+
+  memset(batch, 0, sizeof(*batch));
+  batch->size=size;
+  batch->entries=LIBRDF_CALLOC(librdf_storage_hashes_batch_entry*,
+                               batch_size * LIBRDF_GOOD_CAST(size_t, context->hash_count),
+                               sizeof(librdf_storage_hashes_batch_entry));
+  batch->pairs=LIBRDF_CALLOC(librdf_storage_hashes_batch_pair*, batch_size,
+                             sizeof(librdf_storage_hashes_batch_pair));
+  batch->skip=LIBRDF_CALLOC(char*, batch_size, 1);
+  batch->keys=LIBRDF_CALLOC(librdf_hash_datum*, batch_size,
+                            sizeof(librdf_hash_datum));
+  batch->values=LIBRDF_CALLOC(librdf_hash_datum*, batch_size,
+                              sizeof(librdf_hash_datum));
+
+  return (!batch->entries || !batch->pairs || !batch->skip || !batch->keys ||
+          !batch->values);
+}
+
+
+static void
+librdf_storage_hashes_batch_finish(librdf_storage_hashes_batch* batch)
+{
+  if(batch->data)
+    LIBRDF_FREE(data, batch->data);
+  if(batch->entries)
+    LIBRDF_FREE(librdf_storage_hashes_batch_entry, batch->entries);
+  if(batch->pairs)
+    LIBRDF_FREE(librdf_storage_hashes_batch_pair, batch->pairs);
+  if(batch->skip)
+    LIBRDF_FREE(char*, batch->skip);
+  if(batch->keys)
+    LIBRDF_FREE(librdf_hash_datum, batch->keys);
+  if(batch->values)
+    LIBRDF_FREE(librdf_hash_datum, batch->values);
+}
+
+
+/*
+ * librdf_storage_hashes_batch_reserve:
+ * @batch: batch
+ * @len: number of bytes
+ * 
+ * INTERNAL - Grow the data buffer of a batch to have room for @len more bytes.
+ * 
+ * Return value: non 0 on failure
+ */
+static int
+librdf_storage_hashes_batch_reserve(librdf_storage_hashes_batch* batch,
+                                    size_t len)
+{
+  size_t new_size;
+  unsigned char *new_data;
+
+  if(batch->data_len + len <= batch->data_size)
+    return 0;
+
+  new_size=batch->data_size ? batch->data_size : 1024;
+  while(new_size < batch->data_len + len)
+    new_size <<= 1;
+  new_data=LIBRDF_MALLOC(unsigned char*, new_size);
+  if(!new_data)
+    return 1;
+  if(batch->data) {
+    memcpy(new_data, batch->data, batch->data_len);
+    LIBRDF_FREE(data, batch->data);
+  }
+  batch->data=new_data;
+  batch->data_size=new_size;
+  return 0;
+}
+
+
+/*
+ * librdf_storage_hashes_batch_add_statement:
+ * @storage: the storage
+ * @batch: batch
+ * @statement: statement
+ * @context_node: context node or NULL
+ * @add: non 0 to add nodes to the dictionary
+ * 
+ * INTERNAL - Encode the keys and values of a statement for every hash
+ * into a batch.
+ * 
+ * Return value: non 0 on failure
+ */
+static int
+librdf_storage_hashes_batch_add_statement(librdf_storage* storage,
+                                          librdf_storage_hashes_batch* batch,
+                                          librdf_statement* statement,
+                                          librdf_node* context_node, int add)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  librdf_storage_hashes_batch_entry* entry;
+  size_t len=0;
+  int i;
+
+  /* work out the lengths first so the data buffer only grows once */
+  for(i=0; i < context->hash_count; i++) {
+    librdf_statement_part key_fields, value_fields;
+
+    entry=&batch->entries[i * batch->size + batch->count];
+    key_fields=(librdf_statement_part)context->hash_descriptions[i]->key_fields;
+    value_fields=(librdf_statement_part)context->hash_descriptions[i]->value_fields;
+    if(!key_fields || !value_fields) {
+      entry->key_len=entry->value_len=0;
+      continue;
+    }
+
+    entry->key_len=librdf_storage_hashes_encode_parts(storage, statement,
+                                                      NULL, NULL, 0,
+                                                      key_fields, add);
+    entry->value_len=librdf_storage_hashes_encode_parts(storage, statement,
+                                                        context_node, NULL, 0,
+                                                        value_fields, add);
+    if(!entry->key_len || !entry->value_len)
+      return 1;
+    len += entry->key_len + entry->value_len;
+  }
+
+  if(librdf_storage_hashes_batch_reserve(batch, len))
+    return 1;
+
+  for(i=0; i < context->hash_count; i++) {
+    entry=&batch->entries[i * batch->size + batch->count];
+    if(!entry->key_len)
+      continue;
+
+    entry->key_offset=batch->data_len;
+    if(!librdf_storage_hashes_encode_parts(storage, statement, NULL,
+                                           batch->data + batch->data_len,
+                                           entry->key_len,
+                                           (librdf_statement_part)context->hash_descriptions[i]->key_fields,
+                                           add))
+      return 1;
+    batch->data_len += entry->key_len;
+
+    entry->value_offset=batch->data_len;
+    if(!librdf_storage_hashes_encode_parts(storage, statement, context_node,
+                                           batch->data + batch->data_len,
+                                           entry->value_len,
+                                           (librdf_statement_part)context->hash_descriptions[i]->value_fields,
+                                           add))
+      return 1;
+    batch->data_len += entry->value_len;
+  }
+
+  batch->count++;
+  return 0;
+}
+
+
+static int
+librdf_storage_hashes_batch_compare(const void *a, const void *b)
+{
+  const librdf_storage_hashes_batch_pair *pa=(const librdf_storage_hashes_batch_pair*)a;
+  const librdf_storage_hashes_batch_pair *pb=(const librdf_storage_hashes_batch_pair*)b;
+  int result;
+
+  result=memcmp(pa->key, pb->key,
+                pa->key_len < pb->key_len ? pa->key_len : pb->key_len);
+  if(result)
+    return result;
+  if(pa->key_len != pb->key_len)
+    return (pa->key_len < pb->key_len) ? -1 : 1;
+
+  result=memcmp(pa->value, pb->value,
+                pa->value_len < pb->value_len ? pa->value_len : pb->value_len);
+  if(result)
+    return result;
+  if(pa->value_len != pb->value_len)
+    return (pa->value_len < pb->value_len) ? -1 : 1;
+  return 0;
+}
+
+
+/*
+ * librdf_storage_hashes_batch_sort:
+ * @batch: batch
+ * @i: index of the hash
+ * 
+ * INTERNAL - Sort the keys and values of a batch for one hash into
+ * batch->pairs.
+ */
+static void
+librdf_storage_hashes_batch_sort(librdf_storage_hashes_batch* batch, int i)
+{
+  int j;
+
+  for(j=0; j < batch->count; j++) {
+    librdf_storage_hashes_batch_entry* entry;
+
+    entry=&batch->entries[i * batch->size + j];
+    batch->pairs[j].key=batch->data + entry->key_offset;
+    batch->pairs[j].key_len=entry->key_len;
+    batch->pairs[j].value=batch->data + entry->value_offset;
+    batch->pairs[j].value_len=entry->value_len;
+    batch->pairs[j].statement=j;
+  }
+
+  qsort(batch->pairs, LIBRDF_GOOD_CAST(size_t, batch->count),
+        sizeof(librdf_storage_hashes_batch_pair),
+        librdf_storage_hashes_batch_compare);
+}
+
+
+/*
+ * librdf_storage_hashes_batch_datums:
+ * @batch: batch
+ * 
+ * INTERNAL - Point batch->keys and batch->values at the sorted
+ * batch->pairs of statements not skipped.
+ * 
+ * Return value: number of keys and values
+ */
+static int
+librdf_storage_hashes_batch_datums(librdf_storage_hashes_batch* batch)
+{
+  int count=0;
+  int j;
+
+  for(j=0; j < batch->count; j++) {
+    librdf_storage_hashes_batch_pair* pair=&batch->pairs[j];
+
+    if(batch->skip[pair->statement])
+      continue;
+
+    batch->keys[count].data=(void*)pair->key;
+    batch->keys[count].size=pair->key_len;
+    batch->values[count].data=(void*)pair->value;
+    batch->values[count].size=pair->value_len;
+    count++;
+  }
+
+  return count;
+}
+
+
+/*
+ * librdf_storage_hashes_batch_put:
+ * @storage: the storage
+ * @batch: batch
+ * @i: index of the hash
+ * 
+ * INTERNAL - Store the sorted batch->pairs of statements not skipped
+ * in one hash.
+ * 
+ * Return value: non 0 on failure
+ */
+static int
+librdf_storage_hashes_batch_put(librdf_storage* storage,
+                                librdf_storage_hashes_batch* batch, int i)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  int count=librdf_storage_hashes_batch_datums(batch);
+
+  if(!count)
+    return 0;
+
+  return librdf_hash_put_many(context->hashes[i], batch->keys, batch->values,
+                              count);
+}
+
+
+/*
+ * librdf_storage_hashes_batch_delete:
+ * @storage: the storage
+ * @batch: batch
+ * 
+ * INTERNAL - Delete the statements of a batch from every hash, in key
+ * order, and empty the batch.
+ * 
+ * Statements missing from a hash are ignored as when removing them
+ * one at a time.
+ */
+static void
+librdf_storage_hashes_batch_delete(librdf_storage* storage,
+                                   librdf_storage_hashes_batch* batch)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  int i;
+
+  memset(batch->skip, 0, LIBRDF_GOOD_CAST(size_t, batch->count));
+
+  for(i=0; batch->count && i < context->hash_count; i++) {
+    int count;
+
+    if(!context->hash_descriptions[i]->key_fields ||
+       !context->hash_descriptions[i]->value_fields)
+      continue;
+
+    librdf_storage_hashes_batch_sort(batch, i);
+    count=librdf_storage_hashes_batch_datums(batch);
+    librdf_hash_delete_many(context->hashes[i], batch->keys, batch->values,
+                            count);
+  }
+
+  batch->count=0;
+  batch->data_len=0;
+}
+
+
+/*
+ * librdf_storage_hashes_batch_flush:
+ * @storage: the storage
+ * @batch: batch
+ * 
+ * INTERNAL - Store the statements of a batch that are not already
+ * present in every hash, in key order, and empty the batch.
+ * 
+ * Return value: non 0 on failure
+ */
+static int
+librdf_storage_hashes_batch_flush(librdf_storage* storage,
+                                  librdf_storage_hashes_batch* batch)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  int hash_index=context->all_statements_hash_index;
+  librdf_hash_datum hd_key, hd_value; /* on stack */
+  int status=0;
+  int i, j;
+
+  if(!batch->count)
+    return 0;
+
+  /* Do not add duplicate statements: sorting on the all statements
+   * index finds ones repeated in the batch, and the rest are looked up
+   */
+  librdf_storage_hashes_batch_sort(batch, hash_index);
+  for(j=0; j < batch->count; j++) {
+    librdf_storage_hashes_batch_pair* pair=&batch->pairs[j];
+
+    batch->skip[pair->statement]=(j > 0 &&
+                                  !librdf_storage_hashes_batch_compare(pair - 1, pair));
+    if(batch->skip[pair->statement])
+      continue;
+
+    hd_key.data=(void*)pair->key; hd_key.size=pair->key_len;
+    hd_value.data=(void*)pair->value; hd_value.size=pair->value_len;
+    status=librdf_hash_exists(context->hashes[hash_index], &hd_key, &hd_value);
+    if(status < 0)
+      break;
+    batch->skip[pair->statement]=(char)status;
+    status=0;
+  }
+
+  if(!status)
+    status=librdf_storage_hashes_batch_put(storage, batch, hash_index);
+
+  for(j=0; !status && context->statistics && j < batch->count; j++) {
+    librdf_storage_hashes_batch_pair* pair=&batch->pairs[j];
+
+    if(!batch->skip[pair->statement])
+      status=librdf_storage_hashes_stats_update_encoded(storage,
+                                                        pair->key,
+                                                        pair->key_len,
+                                                        pair->value,
+                                                        pair->value_len, 1);
+  }
+
+  for(i=0; !status && i < context->hash_count; i++) {
+    if(i == hash_index ||
+       !context->hash_descriptions[i]->key_fields ||
+       !context->hash_descriptions[i]->value_fields)
+      continue;
+
+    librdf_storage_hashes_batch_sort(batch, i);
+    status=librdf_storage_hashes_batch_put(storage, batch, i);
+  }
+
+  batch->count=0;
+  batch->data_len=0;
+  return (status != 0);
+}
+
+
+/*
+ * librdf_storage_hashes_bulk_spill:
+ * @storage: the storage
+ * @batch: batch
+ * @files: run files for each hash
+ * @run_count: number of runs already spilled
+ *
+ * INTERNAL - Write the keys and values of a batch for every hash,
+ * sorted and without duplicates, as a new run at the end of the hash
+ * run file and empty the batch.
+ *
+ * Each key/value is written as the key and value lengths followed by
+ * the key and the value.
+ *
+ * Return value: non 0 on failure
+ */
+static int
+librdf_storage_hashes_bulk_spill(librdf_storage* storage,
+                                 librdf_storage_hashes_batch* batch,
+                                 librdf_storage_hashes_run_file* files,
+                                 int run_count)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  int i, j;
+
+  for(i=0; i < context->hash_count; i++) {
+    librdf_storage_hashes_run_file* run_file=&files[i];
+    librdf_storage_hashes_offset *new_starts;
+
+    if(!context->hash_descriptions[i]->key_fields ||
+       !context->hash_descriptions[i]->value_fields)
+      continue;
+
+    if(!run_file->file) {
+      run_file->file=tmpfile();
+      if(!run_file->file)
+        return 1;
+    }
+
+    /* starts grows by one offset per run */
+    new_starts=LIBRDF_MALLOC(librdf_storage_hashes_offset*,
+                             sizeof(librdf_storage_hashes_offset) * LIBRDF_GOOD_CAST(size_t, run_count + 2));
+    if(!new_starts)
+      return 1;
+    if(run_file->starts) {
+      memcpy(new_starts, run_file->starts,
+             sizeof(librdf_storage_hashes_offset) * LIBRDF_GOOD_CAST(size_t, run_count + 1));
+      LIBRDF_FREE(librdf_storage_hashes_offset, run_file->starts);
+    }
+    run_file->starts=new_starts;
+    run_file->starts[run_count]=run_file->length;
+
+    librdf_storage_hashes_batch_sort(batch, i);
+    for(j=0; j < batch->count; j++) {
+      librdf_storage_hashes_batch_pair* pair=&batch->pairs[j];
+      size_t lengths[2];
+
+      if(j > 0 && !librdf_storage_hashes_batch_compare(pair - 1, pair))
+        continue;
+
+      lengths[0]=pair->key_len;
+      lengths[1]=pair->value_len;
+      if(fwrite(lengths, sizeof(lengths), 1, run_file->file) != 1 ||
+         fwrite(pair->key, 1, pair->key_len, run_file->file) != pair->key_len ||
+         fwrite(pair->value, 1, pair->value_len, run_file->file) != pair->value_len)
+        return 1;
+      run_file->length += (librdf_storage_hashes_offset)(sizeof(lengths) + pair->key_len + pair->value_len);
+    }
+
+    run_file->starts[run_count + 1]=run_file->length;
+  }
+
+  batch->count=0;
+  batch->data_len=0;
+  return 0;
+}
+
+
+/*
+ * librdf_storage_hashes_run_fill:
+ * @file: run file
+ * @run: run
+ * @len: number of bytes
+ *
+ * INTERNAL - Read from a run until at least @len bytes are buffered.
+ *
+ * Return value: non 0 on failure or if the run ends first
+ */
+static int
+librdf_storage_hashes_run_fill(FILE* file, librdf_storage_hashes_run* run,
+                               size_t len)
+{
+  size_t have=run->buffer_len - run->buffer_pos;
+  size_t want;
+
+  if(have >= len)
+    return 0;
+
+  if(run->buffer_pos) {
+    memmove(run->buffer, run->buffer + run->buffer_pos, have);
+    run->buffer_len=have;
+    run->buffer_pos=0;
+  }
+
+  if(len > run->buffer_size) {
+    size_t new_size=run->buffer_size ? run->buffer_size : LIBRDF_STORAGE_HASHES_RUN_BUFFER_SIZE;
+    unsigned char *new_buffer;
+
+    while(new_size < len)
+      new_size <<= 1;
+    new_buffer=LIBRDF_MALLOC(unsigned char*, new_size);
+    if(!new_buffer)
+      return 1;
+    if(run->buffer) {
+      memcpy(new_buffer, run->buffer, have);
+      LIBRDF_FREE(data, run->buffer);
+    }
+    run->buffer=new_buffer;
+    run->buffer_size=new_size;
+  }
+
+  want=run->buffer_size - run->buffer_len;
+  if((librdf_storage_hashes_offset)want > run->end - run->offset)
+    want=(size_t)(run->end - run->offset);
+  if(want < len - have)
+    return 1;
+
+  if(LIBRDF_STORAGE_HASHES_FSEEK(file, run->offset) ||
+     fread(run->buffer + run->buffer_len, 1, want, file) != want)
+    return 1;
+  run->offset += (librdf_storage_hashes_offset)want;
+  run->buffer_len += want;
+  return 0;
+}
+
+
+/*
+ * librdf_storage_hashes_run_next:
+ * @file: run file
+ * @run: run
+ *
+ * INTERNAL - Read the next key/value of a run into run->pair.
+ *
+ * Return value: 0 on success, >0 at the end of the run, <0 on failure
+ */
+static int
+librdf_storage_hashes_run_next(FILE* file, librdf_storage_hashes_run* run)
+{
+  size_t lengths[2];
+
+  if(run->buffer_pos == run->buffer_len && run->offset == run->end)
+    return 1;
+
+  if(librdf_storage_hashes_run_fill(file, run, sizeof(lengths)))
+    return -1;
+  memcpy(lengths, run->buffer + run->buffer_pos, sizeof(lengths));
+
+  if(librdf_storage_hashes_run_fill(file, run,
+                                    sizeof(lengths) + lengths[0] + lengths[1]))
+    return -1;
+
+  run->pair.key=run->buffer + run->buffer_pos + sizeof(lengths);
+  run->pair.key_len=lengths[0];
+  run->pair.value=run->pair.key + lengths[0];
+  run->pair.value_len=lengths[1];
+  run->buffer_pos += sizeof(lengths) + lengths[0] + lengths[1];
+  return 0;
+}
+
+
+/* restore the heap order of runs below position i */
+static void
+librdf_storage_hashes_merge_sift(librdf_storage_hashes_run* runs, int* heap,
+                                 int heap_len, int i)
+{
+  while(1) {
+    int least=i;
+    int child=2 * i + 1;
+    int tmp;
+
+    if(child < heap_len &&
+       librdf_storage_hashes_batch_compare(&runs[heap[child]].pair,
+                                           &runs[heap[least]].pair) < 0)
+      least=child;
+    child++;
+    if(child < heap_len &&
+       librdf_storage_hashes_batch_compare(&runs[heap[child]].pair,
+                                           &runs[heap[least]].pair) < 0)
+      least=child;
+    if(least == i)
+      break;
+
+    tmp=heap[i]; heap[i]=heap[least]; heap[least]=tmp;
+    i=least;
+  }
+}
+
+
+/*
+ * librdf_storage_hashes_merge_put:
+ * @storage: the storage
+ * @batch: batch holding the merged keys/values in entries
+ * @i: index of the hash
+ *
+ * INTERNAL - Store the merged keys/values of a batch in one hash and
+ * empty the batch.
+ *
+ * Return value: non 0 on failure
+ */
+static int
+librdf_storage_hashes_merge_put(librdf_storage* storage,
+                                librdf_storage_hashes_batch* batch, int i)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  librdf_storage_hashes_batch_entry* entry;
+  int status;
+  int j;
+
+  if(!batch->count)
+    return 0;
+
+  for(j=0; j < batch->count; j++) {
+    entry=&batch->entries[j];
+    batch->keys[j].data=batch->data + entry->key_offset;
+    batch->keys[j].size=entry->key_len;
+    batch->values[j].data=batch->data + entry->value_offset;
+    batch->values[j].size=entry->value_len;
+  }
+
+  status=librdf_hash_put_many(context->hashes[i], batch->keys, batch->values,
+                              batch->count);
+
+  batch->count=0;
+  batch->data_len=0;
+
+  return status;
+}
+
+
+/*
+ * librdf_storage_hashes_bulk_merge:
+ * @storage: the storage
+ * @batch: batch to collect the merged keys/values in
+ * @run_file: run file of the hash
+ * @run_count: number of runs
+ * @i: index of the hash
+ * @check_exists: non 0 if keys/values may already be in the hash
+ *
+ * INTERNAL - Merge the sorted runs of one hash and store each
+ * different key/value in key order.
+ *
+ * Return value: non 0 on failure
+ */
+static int
+librdf_storage_hashes_bulk_merge(librdf_storage* storage,
+                                 librdf_storage_hashes_batch* batch,
+                                 librdf_storage_hashes_run_file* run_file,
+                                 int run_count, int i, int check_exists)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  librdf_storage_hashes_run* runs;
+  librdf_storage_hashes_batch_pair last;
+  unsigned char *last_buffer=NULL;
+  size_t last_buffer_len=0;
+  int* heap;
+  int heap_len=0;
+  int have_last=0;
+  int put_size;
+  int status=0;
+  int j;
+
+  put_size=(context->batch_size < batch->size) ? context->batch_size : batch->size;
+
+  runs=LIBRDF_CALLOC(librdf_storage_hashes_run*,
+                     LIBRDF_GOOD_CAST(size_t, run_count),
+                     sizeof(librdf_storage_hashes_run));
+  heap=LIBRDF_CALLOC(int*, LIBRDF_GOOD_CAST(size_t, run_count), sizeof(int));
+  if(!runs || !heap)
+    status=1;
+
+  for(j=0; !status && j < run_count; j++) {
+    runs[j].offset=run_file->starts[j];
+    runs[j].end=run_file->starts[j + 1];
+    status=librdf_storage_hashes_run_next(run_file->file, &runs[j]);
+    if(status > 0)
+      status=0;
+    else if(!status)
+      heap[heap_len++]=j;
+  }
+
+  for(j=heap_len / 2 - 1; !status && j >= 0; j--)
+    librdf_storage_hashes_merge_sift(runs, heap, heap_len, j);
+
+  batch->count=0;
+  batch->data_len=0;
+
+  while(!status && heap_len) {
+    librdf_storage_hashes_run* run=&runs[heap[0]];
+    librdf_storage_hashes_batch_entry* entry;
+
+    /* Do not add duplicate key/values: equal ones from different runs
+     * come out of the merge together, and others are looked up
+     */
+    if(!have_last || librdf_storage_hashes_batch_compare(&last, &run->pair)) {
+      int exists=0;
+
+      if(check_exists) {
+        librdf_hash_datum hd_key, hd_value; /* on stack */
+
+        hd_key.data=(void*)run->pair.key; hd_key.size=run->pair.key_len;
+        hd_value.data=(void*)run->pair.value; hd_value.size=run->pair.value_len;
+        exists=librdf_hash_exists(context->hashes[i], &hd_key, &hd_value);
+        if(exists < 0) {
+          status=1;
+          break;
+        }
+      }
+
+      /* remember it to compare with the next one */
+      if(librdf_storage_hashes_grow_buffer(&last_buffer, &last_buffer_len,
+                                           run->pair.key_len +
+                                           run->pair.value_len)) {
+        status=1;
+        break;
+      }
+      memcpy(last_buffer, run->pair.key, run->pair.key_len);
+      memcpy(last_buffer + run->pair.key_len, run->pair.value,
+             run->pair.value_len);
+      last.key=last_buffer;
+      last.key_len=run->pair.key_len;
+      last.value=last_buffer + run->pair.key_len;
+      last.value_len=run->pair.value_len;
+      have_last=1;
+
+      if(!exists && context->statistics &&
+         i == context->all_statements_hash_index &&
+         librdf_storage_hashes_stats_update_encoded(storage, run->pair.key,
+                                                    run->pair.key_len,
+                                                    run->pair.value,
+                                                    run->pair.value_len, 1)) {
+        status=1;
+        break;
+      }
+
+      if(!exists) {
+        if(librdf_storage_hashes_batch_reserve(batch, run->pair.key_len +
+                                                      run->pair.value_len)) {
+          status=1;
+          break;
+        }
+
+        entry=&batch->entries[batch->count];
+        entry->key_offset=batch->data_len;
+        entry->key_len=run->pair.key_len;
+        entry->value_offset=batch->data_len + run->pair.key_len;
+        entry->value_len=run->pair.value_len;
+        memcpy(batch->data + batch->data_len, last_buffer,
+               entry->key_len + entry->value_len);
+        batch->data_len += entry->key_len + entry->value_len;
+
+        if(++batch->count == put_size &&
+           librdf_storage_hashes_merge_put(storage, batch, i)) {
+          status=1;
+          break;
+        }
+      }
+    }
+
+    /* move the run on, dropping it from the heap at its end */
+    status=librdf_storage_hashes_run_next(run_file->file, run);
+    if(status < 0)
+      break;
+    if(status > 0) {
+      status=0;
+      heap[0]=heap[--heap_len];
+    }
+    librdf_storage_hashes_merge_sift(runs, heap, heap_len, 0);
+  }
+
+  if(!status)
+    status=librdf_storage_hashes_merge_put(storage, batch, i);
+
+  if(runs) {
+    for(j=0; j < run_count; j++) {
+      if(runs[j].buffer)
+        LIBRDF_FREE(data, runs[j].buffer);
+    }
+    LIBRDF_FREE(librdf_storage_hashes_run, runs);
+  }
+  if(heap)
+    LIBRDF_FREE(int*, heap);
+  if(last_buffer)
+    LIBRDF_FREE(data, last_buffer);
+
+  return (status != 0);
+}
+
+
+/*
+ * librdf_storage_hashes_bulk_add_statements:
+ * @storage: the storage
+ * @statement_stream: stream of statements
+ *
+ * INTERNAL - Add statements via sorted runs on disk.
+ *
+ * The statements are encoded in runs of bulk_run_size and each run is
+ * sorted for every hash and written to a temporary file.  The runs of
+ * each hash are then merged so that the hash is written in key order
+ * and duplicates are dropped during the merge.  Only if the store
+ * already has statements is each one looked up.
+ *
+ * Return value: non 0 on failure
+ */
+static int
+librdf_storage_hashes_bulk_add_statements(librdf_storage* storage,
+                                          librdf_stream* statement_stream)
 {
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  librdf_storage_hashes_batch batch;
+  librdf_storage_hashes_run_file* files;
+  int run_count=0;
+  int check_exists=1;
   int status=0;
+  int i;
+
+  files=LIBRDF_CALLOC(librdf_storage_hashes_run_file*,
+                      LIBRDF_GOOD_CAST(size_t, context->hash_count),
+                      sizeof(librdf_storage_hashes_run_file));
+  if(!files)
+    return 1;
+
+  status=librdf_storage_hashes_batch_init(storage, &batch,
+                                          context->bulk_run_size);
 
-  while(!librdf_stream_end(statement_stream)) {
+  while(!status && !librdf_stream_end(statement_stream)) {
     librdf_statement* statement=librdf_stream_get_object(statement_stream);
 
-    if(statement) {
-      status=librdf_storage_hashes_add_statement(storage, statement);
-    } else
+    if(!statement ||
+       librdf_storage_hashes_batch_add_statement(storage, &batch, statement,
+                                                 NULL, 1)) {
       status=1;
+      break;
+    }
 
-    if(status)
+    if(batch.count == batch.size) {
+      status=librdf_storage_hashes_bulk_spill(storage, &batch, files,
+                                              run_count);
+      run_count++;
+    }
+
+    librdf_stream_next(statement_stream);
+  }
+
+  if(!status) {
+    if(!run_count) {
+      /* it all fitted in memory */
+      status=librdf_storage_hashes_batch_flush(storage, &batch);
+    } else if(batch.count) {
+      status=librdf_storage_hashes_bulk_spill(storage, &batch, files,
+                                              run_count);
+      run_count++;
+    }
+  }
+
+  if(!status && run_count) {
+    /* an empty store needs no lookups */
+    check_exists=!librdf_storage_hashes_hash_is_empty(context->hashes[context->all_statements_hash_index]);
+
+    for(i=0; !status && i < context->hash_count; i++) {
+      if(files[i].file)
+        status=librdf_storage_hashes_bulk_merge(storage, &batch, &files[i],
+                                                run_count, i, check_exists);
+    }
+  }
+
+  librdf_storage_hashes_batch_finish(&batch);
+
+  for(i=0; i < context->hash_count; i++) {
+    if(files[i].file)
+      fclose(files[i].file);
+    if(files[i].starts)
+      LIBRDF_FREE(librdf_storage_hashes_offset, files[i].starts);
+  }
+  LIBRDF_FREE(librdf_storage_hashes_run_file, files);
+
+  return status;
+}
+
+
+static int
+librdf_storage_hashes_add_statements(librdf_storage* storage,
+                                     librdf_stream* statement_stream)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  librdf_storage_hashes_batch batch;
+  int status=0;
+
+  /* With contexts the duplicate check needs a search so statements
+   * are added one at a time
+   */
+  if(context->index_contexts || context->batch_size <= 1) {
+    while(!librdf_stream_end(statement_stream)) {
+      librdf_statement* statement=librdf_stream_get_object(statement_stream);
+
+      if(statement) {
+        status=librdf_storage_hashes_add_statement(storage, statement);
+      } else
+        status=1;
+
+      if(status)
+        break;
+
+      librdf_stream_next(statement_stream);
+    }
+    return status;
+  }
+
+  if(context->bulk)
+    return librdf_storage_hashes_bulk_add_statements(storage,
+                                                     statement_stream);
+
+  status=librdf_storage_hashes_batch_init(storage, &batch,
+                                          context->batch_size);
+
+  while(!status && !librdf_stream_end(statement_stream)) {
+    librdf_statement* statement=librdf_stream_get_object(statement_stream);
+
+    if(!statement ||
+       librdf_storage_hashes_batch_add_statement(storage, &batch, statement,
+                                                 NULL, 1)) {
+      status=1;
       break;
+    }
+
+    if(batch.count == batch.size)
+      status=librdf_storage_hashes_batch_flush(storage, &batch);
 
     librdf_stream_next(statement_stream);
   }
 
+  if(!status)
+    status=librdf_storage_hashes_batch_flush(storage, &batch);
+
+  librdf_storage_hashes_batch_finish(&batch);
+
   return status;
 }
 
@@ -762,84 +3308,104 @@ librdf_storage_hashes_remove_statement(librdf_storage* storage, librdf_statement
 }
 
 
+/*
+ * librdf_storage_hashes_has_value_prefix:
+ * @hash: hash
+ * @key: key
+ * @value: value prefix
+ * 
+ * INTERNAL - Check if any value of a key starts with a given value
+ * 
+ * Only the values of @key are looked at.  A statement encoded
+ * without a context node is a prefix of its encoding with any context
+ * node since node encodings are self-delimiting.
+ * 
+ * Return value: non 0 if a value was found
+ */
+static int
+librdf_storage_hashes_has_value_prefix(librdf_hash* hash,
+                                       librdf_hash_datum *key,
+                                       librdf_hash_datum *value)
+{
+  librdf_hash_cursor* cursor;
+  librdf_hash_datum hd_key, hd_value; /* on stack */
+  int found=0;
+  int status;
+
+  cursor=librdf_new_hash_cursor(hash);
+  if(!cursor)
+    return 0;
+
+  hd_key.data=NULL;
+  hd_value.data=NULL;
+  for(status=librdf_hash_cursor_set(cursor, key, &hd_value);
+      !status;
+      status=librdf_hash_cursor_get_next_value(cursor, &hd_key, &hd_value)) {
+    if(hd_value.size >= value->size &&
+       !memcmp(hd_value.data, value->data, value->size)) {
+      found=1;
+      break;
+    }
+  }
+
+  librdf_free_hash_cursor(cursor);
+  return found;
+}
+
+
 static int
 librdf_storage_hashes_contains_statement(librdf_storage* storage, librdf_statement* statement)
 {
   librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
   librdf_hash_datum hd_key, hd_value; /* on stack */
-  unsigned char *key_buffer, *value_buffer;
   size_t key_len, value_len;
-  int hash_index=context->all_statements_hash_index;
+  int hash_index;
   librdf_statement_part fields;
   int status;
-  librdf_world* world = storage->world;
   
-  if(context->index_contexts) {
-    /* When we have contexts, we have to use find_statements for contains
-     * since a statement is encoded in KEY/VALUE and the VALUE may
-     * contain some context node.
-     */
-    librdf_stream *stream=librdf_storage_hashes_find_statements(storage, statement);
-    
-    if(!stream)
-      return 0;
-    /* librdf_stream_end returns 0 if have more, non-0 at end */
-    status=!librdf_stream_end(stream);
-    /* convert to 0 if at end (not found) and non-zero otherwise (found) */
-    librdf_free_stream(stream);
-    return status;
-  }
+  /* the index with the narrowest keys has the fewest values to check */
+  hash_index=librdf_storage_hashes_find_index(storage,
+                                              LIBRDF_STATEMENT_SUBJECT |
+                                              LIBRDF_STATEMENT_PREDICATE |
+                                              LIBRDF_STATEMENT_OBJECT);
+  if(hash_index < 0)
+    hash_index=context->all_statements_hash_index;
 
   /* ENCODE KEY */
   fields=(librdf_statement_part)context->hash_descriptions[hash_index]->key_fields;
-  key_len = librdf_statement_encode_parts2(world, statement, NULL,
-                                           NULL, 0, fields);
+  key_len=librdf_storage_hashes_encode_to_buffer(storage, statement, NULL,
+                                                 &context->key_buffer,
+                                                 &context->key_buffer_len,
+                                                 fields, 0);
   if(!key_len)
     return 1;
-  key_buffer = LIBRDF_MALLOC(unsigned char*, key_len);
-  if(!key_buffer)
-    return 1;
-       
-  if(!librdf_statement_encode_parts2(world, statement, NULL,
-                                     key_buffer, key_len, fields)) {
-    LIBRDF_FREE(data, key_buffer);
-    return 1;
-  }
 
   /* ENCODE VALUE */
   fields=(librdf_statement_part)context->hash_descriptions[hash_index]->value_fields;
-  value_len = librdf_statement_encode_parts2(world, statement, NULL,
-                                             NULL, 0, fields);
-  if(!value_len) {
-    LIBRDF_FREE(data, key_buffer);
-    return 1;
-  }
-    
-  value_buffer = LIBRDF_MALLOC(unsigned char*, value_len);
-  if(!value_buffer) {
-    LIBRDF_FREE(data, key_buffer);
+  value_len=librdf_storage_hashes_encode_to_buffer(storage, statement, NULL,
+                                                   &context->value_buffer,
+                                                   &context->value_buffer_len,
+                                                   fields, 0);
+  if(!value_len)
     return 1;
-  }
-
-       
-  if(!librdf_statement_encode_parts2(world, statement, NULL,
-                                     value_buffer, value_len, fields)) {
-    LIBRDF_FREE(data, key_buffer);
-    LIBRDF_FREE(data, value_buffer);
-    return 1;
-  }
 
 
 #if defined(LIBRDF_DEBUG) && LIBRDF_DEBUG > 1
   LIBRDF_DEBUG4("Using %s hash key %d bytes -> value %d bytes\n", context->hash_descriptions[hash_index]->name, key_len, value_len);
 #endif
 
-  hd_key.data=key_buffer; hd_key.size=key_len;
-  hd_value.data=value_buffer; hd_value.size=value_len;
+  hd_key.data=context->key_buffer; hd_key.size=key_len;
+  hd_value.data=context->value_buffer; hd_value.size=value_len;
+
+  if(context->index_contexts)
+    /* When we have contexts, the VALUE may also contain some context
+     * node after the encoded statement parts, so look at every value
+     * of the KEY.
+     */
+    return librdf_storage_hashes_has_value_prefix(context->hashes[hash_index],
+                                                  &hd_key, &hd_value);
+
   status=librdf_hash_exists(context->hashes[hash_index], &hd_key, &hd_value);
-  
-  LIBRDF_FREE(data, key_buffer);
-  LIBRDF_FREE(data, value_buffer);
 
   /* DO NOT free statement, ownership was not passed in */
   return status;
@@ -854,17 +3420,29 @@ typedef struct {
   librdf_iterator* iterator;
   librdf_hash_datum *key;
   librdf_hash_datum *value;
-  librdf_node *search_node;
-  librdf_statement current; /* static, shared when search_node not used */
+  unsigned char *key_buffer; /* encoded key when returning only one key */
+  librdf_statement current; /* static, shared */
   int index_contexts; /* true if this storage indexes contexts */
   librdf_node *context_node;
   int current_is_ok; /* true when current statement and context_node fresh */
 } librdf_storage_hashes_serialise_stream_context;
 
 
+/*
+ * librdf_storage_hashes_serialise_common:
+ * @storage: the storage
+ * @hash_index: the index of the hash to iterate over
+ * @search_statement: statement giving the key to return or NULL for all
+ * 
+ * INTERNAL - Create a stream of the statements in one hash, either all
+ * of them or only those with the key fields of the hash given by
+ * @search_statement, decoded from the key and the value.
+ * 
+ * Return value: a new #librdf_stream or NULL on failure
+ */
 static librdf_stream*
 librdf_storage_hashes_serialise_common(librdf_storage* storage, int hash_index,
-                                       librdf_node* search_node, int want)
+                                       librdf_statement* search_statement)
 {
   librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
   librdf_storage_hashes_serialise_stream_context *scontext;
@@ -877,6 +3455,7 @@ librdf_storage_hashes_serialise_common(librdf_storage* storage, int hash_index,
     return NULL;
 
   scontext->hash_context=context;
+  scontext->index=hash_index;
 
   librdf_statement_init(storage->world, &scontext->current);
 
@@ -894,26 +3473,38 @@ librdf_storage_hashes_serialise_common(librdf_storage* storage, int hash_index,
 
   /* scurrent->current_is_ok=0; */
   scontext->index_contexts=context->index_contexts;
-  
-  if(search_node) {
-    scontext->search_node=search_node;
-    scontext->iterator=librdf_storage_hashes_node_iterator_create(storage,
-                                                                  search_node,
-                                                                  NULL,
-                                                                  hash_index,
-                                                                  want);
-  } else {
-    scontext->iterator=librdf_hash_get_all(hash,
-                                           scontext->key, scontext->value);
+
+  scontext->storage=storage;
+  librdf_storage_add_reference(scontext->storage);
+
+  if(search_statement) {
+    librdf_statement_part fields;
+    size_t key_len;
+
+    /* ENCODE KEY */
+    fields=(librdf_statement_part)context->hash_descriptions[hash_index]->key_fields;
+    key_len=librdf_storage_hashes_encode_parts(storage, search_statement,
+                                               NULL, NULL, 0, fields, 0);
+    if(key_len)
+      scontext->key_buffer=LIBRDF_MALLOC(unsigned char*, key_len);
+    if(!scontext->key_buffer ||
+       !librdf_storage_hashes_encode_parts(storage, search_statement, NULL,
+                                           scontext->key_buffer, key_len,
+                                           fields, 0)) {
+      librdf_storage_hashes_serialise_finished((void*)scontext);
+      return NULL;
+    }
+    scontext->key->data=scontext->key_buffer;
+    scontext->key->size=key_len;
   }
+
+  scontext->iterator=librdf_hash_get_all(hash,
+                                         scontext->key, scontext->value);
   if(!scontext->iterator) {
     librdf_storage_hashes_serialise_finished((void*)scontext);
     return librdf_new_empty_stream(storage->world);
   }
 
-  scontext->storage=storage;
-  librdf_storage_add_reference(scontext->storage);
-
   stream=librdf_new_stream(storage->world,
                            (void*)scontext,
                            &librdf_storage_hashes_serialise_end_of_stream,
@@ -936,7 +3527,7 @@ librdf_storage_hashes_serialise(librdf_storage* storage)
   librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
   return librdf_storage_hashes_serialise_common(storage, 
                                                 context->all_statements_hash_index,
-                                                NULL, 0);
+                                                NULL);
 }
 
 
@@ -965,24 +3556,7 @@ librdf_storage_hashes_serialise_get_statement(void* context, int flags)
   librdf_storage_hashes_serialise_stream_context* scontext=(librdf_storage_hashes_serialise_stream_context*)context;
   librdf_hash_datum* hd;
   librdf_node** cnp=NULL;
-  librdf_world* world;
-  
-  world = scontext->storage->world;
   
-  if(scontext->search_node) {
-    switch(flags) {
-      case LIBRDF_ITERATOR_GET_METHOD_GET_OBJECT:
-        return librdf_iterator_get_object(scontext->iterator);
-      case LIBRDF_ITERATOR_GET_METHOD_GET_CONTEXT:
-        return librdf_iterator_get_context(scontext->iterator);
-      default:
-        librdf_log(scontext->iterator->world,
-                   0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
-                   "Unimplemented flags %d seen", flags);
-        return NULL;
-    }
-  }
-    
   switch(flags) {
     case LIBRDF_ITERATOR_GET_METHOD_GET_OBJECT:
     case LIBRDF_ITERATOR_GET_METHOD_GET_CONTEXT:
@@ -1004,19 +3578,29 @@ librdf_storage_hashes_serialise_get_statement(void* context, int flags)
       
       librdf_statement_clear(&scontext->current);
       
-      hd=(librdf_hash_datum*)librdf_iterator_get_key(scontext->iterator);
+      /* when returning one key the iterator only returns values */
+      if(scontext->key_buffer)
+        hd=scontext->key;
+      else
+        hd=(librdf_hash_datum*)librdf_iterator_get_key(scontext->iterator);
       
       /* decode key content */
-      if(!librdf_statement_decode2(world, &scontext->current, NULL,
-                                   (unsigned char*)hd->data, hd->size)) {
+      if(!librdf_storage_hashes_decode_parts(scontext->storage,
+                                             &scontext->current, NULL,
+                                             (unsigned char*)hd->data,
+                                             hd->size,
+                                             (librdf_statement_part)scontext->hash_context->hash_descriptions[scontext->index]->key_fields)) {
         return NULL;
       }
       
       hd=(librdf_hash_datum*)librdf_iterator_get_value(scontext->iterator);
       
       /* decode value content and optional context */
-      if(!librdf_statement_decode2(world, &scontext->current, cnp,
-                                   (unsigned char*)hd->data, hd->size)) {
+      if(!librdf_storage_hashes_decode_parts(scontext->storage,
+                                             &scontext->current, cnp,
+                                             (unsigned char*)hd->data,
+                                             hd->size,
+                                             (librdf_statement_part)scontext->hash_context->hash_descriptions[scontext->index]->value_fields)) {
         return NULL;
       }
 
@@ -1047,6 +3631,9 @@ librdf_storage_hashes_serialise_finished(void* context)
   if(scontext->context_node)
     librdf_free_node(scontext->context_node);
       
+  if(scontext->key_buffer)
+    LIBRDF_FREE(data, scontext->key_buffer);
+      
   if(scontext->key) {
     scontext->key->data=NULL;
     librdf_free_hash_datum(scontext->key);
@@ -1056,12 +3643,55 @@ librdf_storage_hashes_serialise_finished(void* context)
     librdf_free_hash_datum(scontext->value);
   }
 
-  librdf_statement_clear(&scontext->current);
+  librdf_statement_clear(&scontext->current);
+
+  if(scontext->storage)
+    librdf_storage_remove_reference(scontext->storage);
+
+  LIBRDF_FREE(librdf_storage_hashes_serialise_stream_context, scontext);
+}
+
+
+/*
+ * librdf_storage_hashes_find_index:
+ * @storage: the storage
+ * @fields: the statement parts given in a search
+ * 
+ * INTERNAL - Find the hash with the most key fields that are all given
+ * so that a search can look up one key in it.
+ * 
+ * Return value: index of the hash or <0 if there is none
+ */
+static int
+librdf_storage_hashes_find_index(librdf_storage* storage, int fields)
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  int best_index= -1;
+  int best_count=0;
+  int i;
+
+  for(i=0; i<context->hash_count; i++) {
+    int key_fields=context->hash_descriptions[i]->key_fields;
+    int count=0;
+    int part;
+
+    if(!key_fields || !context->hash_descriptions[i]->value_fields ||
+       (key_fields & ~fields))
+      continue;
 
-  if(scontext->storage)
-    librdf_storage_remove_reference(scontext->storage);
+    for(part=LIBRDF_STATEMENT_SUBJECT; part <= LIBRDF_STATEMENT_OBJECT;
+        part <<= 1) {
+      if(key_fields & part)
+        count++;
+    }
 
-  LIBRDF_FREE(librdf_storage_hashes_serialise_stream_context, scontext);
+    if(count > best_count) {
+      best_index=i;
+      best_count=count;
+    }
+  }
+
+  return best_index;
 }
 
 
@@ -1075,7 +3705,11 @@ librdf_storage_hashes_serialise_finished(void* context)
  * Return a stream of statements matching the given statement (or
  * all statements if NULL).  Parts (subject, predicate, object) of the
  * statement can be empty in which case any statement part will match that.
- * Uses #librdf_statement_match to do the matching.
+ * 
+ * The hash with the most key fields given in the statement is used
+ * to look up only the statements with that key.  Any other given parts
+ * and searches that no hash key fits use #librdf_statement_match
+ * to do the matching.
  * 
  * Return value: a #librdf_stream or NULL on failure
  **/
@@ -1084,27 +3718,41 @@ librdf_storage_hashes_find_statements(librdf_storage* storage, librdf_statement*
 {
   librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
   librdf_stream* stream;
+  int fields=0;
+  int hash_index= -1;
+
+  if(librdf_statement_get_subject(statement))
+    fields |= LIBRDF_STATEMENT_SUBJECT;
+  if(librdf_statement_get_predicate(statement))
+    fields |= LIBRDF_STATEMENT_PREDICATE;
+  if(librdf_statement_get_object(statement))
+    fields |= LIBRDF_STATEMENT_OBJECT;
+
+  if(fields)
+    hash_index=librdf_storage_hashes_find_index(storage, fields);
+
+  if(hash_index >= 0) {
+    /* e.g. (s p ?) -> sp2o key (s p) */
+    stream=librdf_storage_hashes_serialise_common(storage, hash_index,
+                                                  statement);
+    /* all done if the key holds every given part */
+    if(!stream || context->hash_descriptions[hash_index]->key_fields == fields)
+      return stream;
+  } else
+    stream=librdf_storage_hashes_serialise(storage);
 
-  if(!librdf_statement_get_subject(statement) &&
-     librdf_statement_get_predicate(statement) &&
-     !librdf_statement_get_object(statement) &&
-     context->p2so_index >= 0) {
-    /* (? p ?) -> (s p o) wanted */
-    stream=librdf_storage_hashes_serialise_common(storage,
-                                                  context->p2so_index,
-                                                  librdf_statement_get_predicate(statement),
-                                                  LIBRDF_STATEMENT_SUBJECT|LIBRDF_STATEMENT_OBJECT);
-  } else {
-    statement=librdf_new_statement_from_statement(statement);
-    if(!statement)
-      return NULL;
+  if(!stream)
+    return NULL;
 
-    stream=librdf_storage_hashes_serialise(storage);
-    if(stream)
-      librdf_stream_add_map(stream, 
-                            &librdf_stream_statement_find_map,
-                            (librdf_stream_map_free_context_handler)&librdf_free_statement, (void*)statement);
+  statement=librdf_new_statement_from_statement(statement);
+  if(!statement) {
+    librdf_free_stream(stream);
+    return NULL;
   }
+
+  librdf_stream_add_map(stream, 
+                        &librdf_stream_statement_find_map,
+                        (librdf_stream_map_free_context_handler)&librdf_free_statement, (void*)statement);
   
   return stream;
 }
@@ -1122,6 +3770,7 @@ typedef struct {
   librdf_node *search_node;
   int index_contexts;
   librdf_node *context_node;
+  int current_is_ok; /* true when statement and context_node are decoded */
 } librdf_storage_hashes_node_iterator_context;
 
 
@@ -1142,40 +3791,93 @@ librdf_storage_hashes_node_iterator_next_method(void* iterator)
   if(librdf_iterator_end(context->iterator))
     return 1;
 
+  context->current_is_ok=0;
   return librdf_iterator_next(context->iterator);
 }
 
 
+/*
+ * librdf_storage_hashes_node_iterator_decode:
+ * @context: node iterator context
+ * 
+ * INTERNAL - Decode the current hash value into the iterator statement
+ * and context node, once per position.
+ * 
+ * Nodes are only decoded when they are first asked for, so moving
+ * through the iterator or only testing for the end decodes nothing.
+ * 
+ * Return value: non 0 on failure
+ */
+static int
+librdf_storage_hashes_node_iterator_decode(librdf_storage_hashes_node_iterator_context* context)
+{
+  librdf_storage_hashes_instance* hcontext=(librdf_storage_hashes_instance*)context->storage->instance;
+  librdf_hash_datum* value;
+
+  if(context->current_is_ok)
+    return 0;
+
+  /* nodes returned for the last position are freed here and not by
+   * the next method so they stay valid until the next get
+   */
+  librdf_statement_clear(&context->statement);
+  if(context->context_node) {
+    librdf_free_node(context->context_node);
+    context->context_node=NULL;
+  }
+
+  value=(librdf_hash_datum*)librdf_iterator_get_value(context->iterator);
+  if(!value)
+    return 1;
+
+  /* decode value content and optional context */
+  if(!librdf_storage_hashes_decode_parts(context->storage,
+                                         &context->statement,
+                                         context->index_contexts ? &context->context_node : NULL,
+                                         (unsigned char*)value->data,
+                                         value->size,
+                                         (librdf_statement_part)hcontext->hash_descriptions[context->hash_index]->value_fields))
+    return 1;
+
+  context->current_is_ok=1;
+  return 0;
+}
+
+
+/*
+ * librdf_storage_hashes_node_iterator_get_method:
+ * @iterator: node iterator context
+ * @flags: type of item to get
+ * 
+ * INTERNAL - Get the node, statement, context node or raw value at
+ * the current position.
+ * 
+ * LIBRDF_ITERATOR_GET_METHOD_GET_VALUE returns the encoded hash value
+ * as a shared #librdf_hash_datum without decoding any node.  Two values
+ * of one iterator are the same node (and context) exactly when their
+ * bytes are equal, so callers that only compare or count results can
+ * avoid creating nodes.
+ * 
+ * Return value: the item or NULL on failure
+ */
 static void*
 librdf_storage_hashes_node_iterator_get_method(void* iterator, int flags) 
 {
   librdf_storage_hashes_node_iterator_context* context=(librdf_storage_hashes_node_iterator_context*)iterator;
   librdf_node* node;
-  librdf_hash_datum* value;
-  librdf_world* world;
-  
-  world = context->storage->world;
   
   if(librdf_iterator_end(context->iterator))
     return NULL;
 
+  if(flags == LIBRDF_ITERATOR_GET_METHOD_GET_VALUE)
+    return librdf_iterator_get_value(context->iterator);
+
   if(flags == LIBRDF_ITERATOR_GET_METHOD_GET_CONTEXT) {
-    /* current stuff is out of date - get new cached answers */
     if(!context->index_contexts)
       return NULL;
 
-    value=(librdf_hash_datum*)librdf_iterator_get_value(context->iterator);
-      
-    if(context->context_node)
-      librdf_free_node(context->context_node);
-    context->context_node=NULL;
-      
-    /* decode value content and optional context */
-    if(!librdf_statement_decode2(world, &context->statement,
-                                 &context->context_node,
-                                 (unsigned char*)value->data, value->size))
+    if(librdf_storage_hashes_node_iterator_decode(context))
       return NULL;
-    librdf_statement_clear(&context->statement);
     
     return context->context_node;
   }
@@ -1190,44 +3892,7 @@ librdf_storage_hashes_node_iterator_get_method(void* iterator, int flags)
 
 
   /* get object */
-  switch(context->want) {
-    case LIBRDF_STATEMENT_SUBJECT: /* SOURCES (subjects) */
-      if((node=librdf_statement_get_subject(&context->statement)))
-         librdf_free_node(node);
-      break;
-      
-    case LIBRDF_STATEMENT_PREDICATE: /* ARCS (predicates) */
-      if((node=librdf_statement_get_predicate(&context->statement)))
-         librdf_free_node(node);
-      break;
-      
-    case LIBRDF_STATEMENT_OBJECT: /* TARGETS (objects) */
-      if((node=librdf_statement_get_object(&context->statement)))
-         librdf_free_node(node);
-      break;
-      
-    case (LIBRDF_STATEMENT_SUBJECT|LIBRDF_STATEMENT_OBJECT): /* p2so */
-      if((node=librdf_statement_get_subject(&context->statement)))
-         librdf_free_node(node);
-      if((node=librdf_statement_get_object(&context->statement)))
-         librdf_free_node(node);
-      break;
-      
-    default: /* error */
-      librdf_log(context->iterator->world,
-                 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
-                 "Illegal statement part %d seen", context->want);
-      return NULL;
-  }
-
-
-  value=(librdf_hash_datum*)librdf_iterator_get_value(context->iterator);
-  if(!value)
-    return NULL;
-
-  if(!librdf_statement_decode2(world, &context->statement, NULL,
-                               (unsigned char*)value->data,
-                               value->size))
+  if(librdf_storage_hashes_node_iterator_decode(context))
     return NULL;
 
   switch(context->want) {
@@ -1246,10 +3911,12 @@ librdf_storage_hashes_node_iterator_get_method(void* iterator, int flags)
     case (LIBRDF_STATEMENT_SUBJECT|LIBRDF_STATEMENT_OBJECT): /* p2so */
       librdf_statement_set_subject(&context->statement2, librdf_statement_get_subject(&context->statement));
       /* fill in the only blank from the node stored in our context */
-      node=librdf_new_node_from_node(context->search_node);
-      if(!node)
-        return NULL;
-      librdf_statement_set_predicate(&context->statement2, node);
+      if(!librdf_statement_get_predicate(&context->statement2)) {
+        node=librdf_new_node_from_node(context->search_node);
+        if(!node)
+          return NULL;
+        librdf_statement_set_predicate(&context->statement2, node);
+      }
       librdf_statement_set_object(&context->statement2, librdf_statement_get_object(&context->statement));
       return (void*)&context->statement2;
       
@@ -1313,7 +3980,6 @@ librdf_storage_hashes_node_iterator_create(librdf_storage* storage,
   librdf_statement_part fields;
   unsigned char *key_buffer;
   librdf_iterator* iterator;
-  librdf_world* world = storage->world;
   
   icontext = LIBRDF_CALLOC(librdf_storage_hashes_node_iterator_context*, 1,
                            sizeof(*icontext));
@@ -1379,8 +4045,10 @@ librdf_storage_hashes_node_iterator_create(librdf_storage* storage,
 
   /* ENCODE KEY */
   fields=(librdf_statement_part)scontext->hash_descriptions[hash_index]->key_fields;
-  icontext->key.size=librdf_statement_encode_parts2(world, &icontext->statement, NULL,
-                                                    NULL, 0, fields);
+  icontext->key.size=librdf_storage_hashes_encode_parts(storage,
+                                                        &icontext->statement,
+                                                        NULL, NULL, 0,
+                                                        fields, 0);
   if(!icontext->key.size) {
     LIBRDF_FREE(librdf_storage_hashes_node_iterator_context, icontext);
     return NULL;
@@ -1396,8 +4064,9 @@ librdf_storage_hashes_node_iterator_create(librdf_storage* storage,
    */
   librdf_storage_add_reference(icontext->storage);
 
-  if(!librdf_statement_encode_parts2(world, &icontext->statement, NULL,
-                                     key_buffer, icontext->key.size, fields)) {
+  if(!librdf_storage_hashes_encode_parts(storage, &icontext->statement,
+                                         NULL, key_buffer,
+                                         icontext->key.size, fields, 0)) {
     LIBRDF_FREE(data, key_buffer);
     librdf_storage_hashes_node_iterator_finished(icontext);
     return NULL;
@@ -1421,8 +4090,13 @@ librdf_storage_hashes_node_iterator_create(librdf_storage* storage,
                                librdf_storage_hashes_node_iterator_next_method,
                                librdf_storage_hashes_node_iterator_get_method,
                                librdf_storage_hashes_node_iterator_finished);
-  if(!iterator)
+  if(!iterator) {
     librdf_storage_hashes_node_iterator_finished(icontext);
+    return NULL;
+  }
+
+  /* only decode a node when the caller asks for it */
+  librdf_iterator_set_lazy(iterator);
   return iterator;
 }
 
@@ -1432,6 +4106,12 @@ librdf_storage_hashes_find_sources(librdf_storage* storage,
                                    librdf_node* arc, librdf_node *target) 
 {
   librdf_storage_hashes_instance* scontext=(librdf_storage_hashes_instance*)storage->instance;
+
+  /* without the index hash, search the statements */
+  if(scontext->sources_index < 0)
+    return librdf_storage_node_stream_to_node_create(storage, arc, target,
+                                                     LIBRDF_STATEMENT_SUBJECT);
+
   return librdf_storage_hashes_node_iterator_create(storage, arc, target,
                                                     scontext->sources_index,
                                                     LIBRDF_STATEMENT_SUBJECT);
@@ -1443,6 +4123,12 @@ librdf_storage_hashes_find_arcs(librdf_storage* storage,
                                 librdf_node* source, librdf_node *target) 
 {
   librdf_storage_hashes_instance* scontext=(librdf_storage_hashes_instance*)storage->instance;
+
+  /* without the index hash, search the statements */
+  if(scontext->arcs_index < 0)
+    return librdf_storage_node_stream_to_node_create(storage, source, target,
+                                                     LIBRDF_STATEMENT_PREDICATE);
+
   return librdf_storage_hashes_node_iterator_create(storage, source, target,
                                                     scontext->arcs_index,
                                                     LIBRDF_STATEMENT_PREDICATE);
@@ -1453,6 +4139,12 @@ librdf_storage_hashes_find_targets(librdf_storage* storage,
                                    librdf_node* source, librdf_node *arc) 
 {
   librdf_storage_hashes_instance* scontext=(librdf_storage_hashes_instance*)storage->instance;
+
+  /* without the index hash, search the statements */
+  if(scontext->targets_index < 0)
+    return librdf_storage_node_stream_to_node_create(storage, source, arc,
+                                                     LIBRDF_STATEMENT_OBJECT);
+
   return librdf_storage_hashes_node_iterator_create(storage, source, arc,
                                                     scontext->targets_index,
                                                     LIBRDF_STATEMENT_OBJECT);
@@ -1555,6 +4247,137 @@ librdf_storage_hashes_context_remove_statement(librdf_storage* storage,
 }
 
 
+/**
+ * librdf_storage_hashes_context_remove_statements:
+ * @storage: #librdf_storage object
+ * @context_node: #librdf_node object
+ *
+ * Remove all statements from a storage context.
+ * 
+ * The statements of the context are read once from the contexts
+ * hash and deleted from every index hash in sorted batches, then the
+ * context is deleted from the contexts hash.
+ * 
+ * Return value: non 0 on failure
+ **/
+static int
+librdf_storage_hashes_context_remove_statements(librdf_storage* storage,
+                                                librdf_node* context_node) 
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  librdf_world* world = storage->world;
+  librdf_hash* contexts_hash;
+  librdf_hash_datum key, next_key, value; /* on stack - not allocated */
+  librdf_hash_cursor* cursor=NULL;
+  librdf_storage_hashes_batch batch; /* on stack */
+  librdf_statement statement; /* on stack */
+  size_t size;
+  int status;
+  int rc;
+  
+  if(context->contexts_index <0) {
+    librdf_log(storage->world, 0, LIBRDF_LOG_WARN, LIBRDF_FROM_STORAGE, NULL,
+               "Storage was created without context support");
+    return 1;
+  }
+  contexts_hash=context->hashes[context->contexts_index];
+
+  size = librdf_node_encode(context_node, NULL, 0);
+  key.data = LIBRDF_MALLOC(char*, size);
+  if(!key.data)
+    return 1;
+  key.size=librdf_node_encode(context_node,
+                               (unsigned char*)key.data, size);
+
+  status=librdf_storage_hashes_batch_init(storage, &batch,
+                                          context->batch_size);
+  if(!status) {
+    cursor=librdf_new_hash_cursor(contexts_hash);
+    status=(cursor == NULL);
+  }
+
+  librdf_statement_init(world, &statement);
+
+  next_key.data=NULL;
+  value.data=NULL;
+  for(rc=status ? 1 : librdf_hash_cursor_set(cursor, &key, &value);
+      !rc;
+      rc=librdf_hash_cursor_get_next_value(cursor, &next_key, &value)) {
+    if(!librdf_statement_decode2(world, &statement, NULL,
+                                 (unsigned char*)value.data, value.size) ||
+       librdf_storage_hashes_batch_add_statement(storage, &batch, &statement,
+                                                 context_node, 0) ||
+       (context->statistics &&
+        librdf_storage_hashes_stats_update(storage, &statement, -1))) {
+      status=1;
+      break;
+    }
+    librdf_statement_clear(&statement);
+
+    if(batch.count == batch.size)
+      librdf_storage_hashes_batch_delete(storage, &batch);
+  }
+  librdf_statement_clear(&statement);
+
+  if(cursor)
+    librdf_free_hash_cursor(cursor);
+
+  if(!status) {
+    librdf_storage_hashes_batch_delete(storage, &batch);
+
+    /* an empty context is not present in the contexts hash */
+    if(librdf_hash_exists(contexts_hash, &key, NULL) > 0)
+      status=librdf_hash_delete_all(contexts_hash, &key);
+  }
+
+  librdf_storage_hashes_batch_finish(&batch);
+  LIBRDF_FREE(data, key.data);
+
+  return status;
+}
+
+
+/**
+ * librdf_storage_hashes_context_size:
+ * @storage: #librdf_storage object
+ * @context_node: #librdf_node object
+ *
+ * Get the number of statements in a storage context.
+ * 
+ * This is the number of values of the context in the contexts hash.
+ * 
+ * Return value: the number of statements or <0 on failure
+ **/
+static int
+librdf_storage_hashes_context_size(librdf_storage* storage,
+                                   librdf_node* context_node) 
+{
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  librdf_hash_datum key; /* on stack - not allocated */
+  size_t size;
+  int count;
+  
+  if(context->contexts_index <0) {
+    librdf_log(storage->world, 0, LIBRDF_LOG_WARN, LIBRDF_FROM_STORAGE, NULL,
+               "Storage was created without context support");
+    return -1;
+  }
+
+  size = librdf_node_encode(context_node, NULL, 0);
+  key.data = LIBRDF_MALLOC(char*, size);
+  if(!key.data)
+    return -1;
+  key.size=librdf_node_encode(context_node,
+                               (unsigned char*)key.data, size);
+
+  count=librdf_hash_key_values_count(context->hashes[context->contexts_index],
+                                     &key);
+  LIBRDF_FREE(data, key.data);
+
+  return count;
+}
+
+
 typedef struct {
   librdf_storage *storage;
   librdf_iterator* iterator;
@@ -1747,6 +4570,9 @@ librdf_storage_hashes_sync(librdf_storage *storage)
   librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
   int i;
   
+  if(context->statistics)
+    librdf_storage_hashes_stats_save(storage);
+
   for(i=0; i<context->hash_count; i++)
     librdf_hash_sync(context->hashes[i]);
   return 0;
@@ -1894,6 +4720,172 @@ librdf_storage_hashes_get_contexts(librdf_storage* storage)
 
 
 
+/*
+ * librdf_storage_hashes_stats_node_from_string:
+ * @storage: the storage
+ * @string: node string
+ *
+ * INTERNAL - Make a node from the node part of a per node statistics
+ * feature URI.
+ *
+ * The node is a URI, _: and a blank node identifier, or a literal
+ * "string" followed by nothing, @language or ^^datatype URI where
+ * the datatype URI may be in <>.  The literal string is all up
+ * to the last " so may contain " itself.
+ *
+ * Return value: new #librdf_node or NULL on failure
+ */
+static librdf_node*
+librdf_storage_hashes_stats_node_from_string(librdf_storage* storage,
+                                             const char *string)
+{
+  const char *end;
+  char *literal;
+  const char *language=NULL;
+  librdf_uri* datatype=NULL;
+  librdf_node* node;
+  size_t len;
+
+  if(!strncmp(string, "_:", 2))
+    return librdf_new_node_from_blank_identifier(storage->world,
+                                                 (const unsigned char*)string + 2);
+
+  if(*string != '"')
+    return librdf_new_node_from_uri_string(storage->world,
+                                           (const unsigned char*)string);
+
+  end=strrchr(string + 1, '"');
+  if(!end)
+    return NULL;
+
+  if(end[1] == '@') {
+    if(end[2])
+      language=end + 2;
+  } else if(end[1] == '^' && end[2] == '^') {
+    const char *uri_string=end + 3;
+
+    len=strlen(uri_string);
+    if(len > 1 && uri_string[0] == '<' && uri_string[len - 1] == '>')
+      datatype=librdf_new_uri2(storage->world,
+                               (const unsigned char*)uri_string + 1, len - 2);
+    else
+      datatype=librdf_new_uri(storage->world,
+                              (const unsigned char*)uri_string);
+    if(!datatype)
+      return NULL;
+  } else if(end[1])
+    return NULL;
+
+  len=end - (string + 1);
+  literal=LIBRDF_MALLOC(char*, len + 1);
+  if(!literal) {
+    if(datatype)
+      librdf_free_uri(datatype);
+    return NULL;
+  }
+  memcpy(literal, string + 1, len);
+  literal[len]='\0';
+
+  node=librdf_new_node_from_typed_literal(storage->world,
+                                          (const unsigned char*)literal,
+                                          language, datatype);
+  LIBRDF_FREE(char*, literal);
+  if(datatype)
+    librdf_free_uri(datatype);
+
+  return node;
+}
+
+
+/*
+ * librdf_storage_hashes_get_statistic:
+ * @storage: the storage
+ * @uri_string: feature URI string
+ *
+ * INTERNAL - Get a statistics feature of a storage.
+ *
+ * The per node features are followed by the node as described for
+ * librdf_storage_hashes_stats_node_from_string().  Subject and object
+ * counts are estimated from their sketches.
+ *
+ * Return value: new #librdf_node count or NULL if no such feature
+ */
+static librdf_node*
+librdf_storage_hashes_get_statistic(librdf_storage* storage,
+                                    const char *uri_string)
+{
+  static const char* const count_features[LIBRDF_STORAGE_HASHES_STATS_COUNT]={
+    LIBRDF_STORAGE_FEATURE_STATISTICS_STATEMENTS,
+    LIBRDF_STORAGE_FEATURE_STATISTICS_SUBJECTS,
+    LIBRDF_STORAGE_FEATURE_STATISTICS_PREDICATES,
+    LIBRDF_STORAGE_FEATURE_STATISTICS_OBJECTS
+  };
+  static const char* const node_features[LIBRDF_STORAGE_HASHES_STATS_COUNT]={
+    NULL,
+    LIBRDF_STORAGE_FEATURE_STATISTICS_SUBJECT,
+    LIBRDF_STORAGE_FEATURE_STATISTICS_PREDICATE,
+    LIBRDF_STORAGE_FEATURE_STATISTICS_OBJECT
+  };
+  librdf_storage_hashes_instance* context=(librdf_storage_hashes_instance*)storage->instance;
+  unsigned char value[24];
+  u64 count=0;
+  int i;
+
+  for(i=0; i < LIBRDF_STORAGE_HASHES_STATS_COUNT; i++) {
+    librdf_storage_hashes_sketch* sketch=context->stats_sketches[i];
+
+    if(!strcmp(uri_string, count_features[i])) {
+      if(sketch)
+        count=librdf_storage_hashes_stats_sketch_distinct(sketch);
+      else
+        count=context->stats_counts[i];
+      break;
+    }
+
+    if(node_features[i] &&
+       !strncmp(uri_string, node_features[i], strlen(node_features[i]))) {
+      const char *node_string=uri_string + strlen(node_features[i]);
+      librdf_hash_datum hd_key; /* on stack */
+      librdf_node* node;
+      size_t size;
+
+      node=librdf_storage_hashes_stats_node_from_string(storage,
+                                                        node_string);
+      if(!node)
+        return NULL;
+
+      if(sketch) {
+        u64 hash;
+
+        if(!librdf_storage_hashes_stats_sketch_hash(storage, node, &hash))
+          count=librdf_storage_hashes_stats_sketch_count(sketch, hash);
+        librdf_free_node(node);
+        break;
+      }
+
+      size=librdf_node_encode(node, NULL, 0) + 1;
+      if(!librdf_storage_hashes_grow_buffer(&context->node_buffer,
+                                            &context->node_buffer_len,
+                                            size)) {
+        context->node_buffer[0]=librdf_storage_hashes_stats_keys[i];
+        librdf_node_encode(node, context->node_buffer + 1, size - 1);
+        hd_key.data=context->node_buffer; hd_key.size=size;
+        librdf_storage_hashes_stats_node_get(storage, &hd_key, &count, NULL);
+      }
+      librdf_free_node(node);
+      break;
+    }
+  }
+
+  if(i == LIBRDF_STORAGE_HASHES_STATS_COUNT)
+    return NULL;
+
+  sprintf((char*)value, "%lu", (unsigned long)count);
+  return librdf_new_node_from_typed_literal(storage->world, 
+                                            value, NULL, NULL);
+}
+
+
 /**
  * librdf_storage_hashes_get_feature:
  * @storage: #librdf_storage object
@@ -1925,10 +4917,56 @@ librdf_storage_hashes_get_feature(librdf_storage* storage, librdf_uri* feature)
                                               value, NULL, NULL);
   }
 
+  if(!strcmp((const char*)uri_string, LIBRDF_STORAGE_FEATURE_BUILD_INDEXES)) {
+    unsigned char value[8];
+    int count=0;
+    int i;
+
+    for(i=0; i<scontext->hash_count; i++)
+      count+=librdf_storage_hashes_index_is_missing(storage, i);
+    sprintf((char*)value, "%d", count);
+    return librdf_new_node_from_typed_literal(storage->world, 
+                                              value, NULL, NULL);
+  }
+
+  if(scontext->statistics)
+    return librdf_storage_hashes_get_statistic(storage, 
+                                               (const char*)uri_string);
+
   return NULL;
 }
 
 
+/**
+ * librdf_storage_hashes_set_feature:
+ * @storage: #librdf_storage object
+ * @feature: #librdf_uri feature property
+ * @value: #librdf_node feature property value
+ *
+ * Set the value of a storage feature.
+ *
+ * Setting LIBRDF_STORAGE_FEATURE_BUILD_INDEXES to any value builds
+ * the index hashes that are empty while another has statements.
+ * 
+ * Return value: non 0 on failure (negative if no such feature)
+ **/
+static int
+librdf_storage_hashes_set_feature(librdf_storage* storage, librdf_uri* feature,
+                                  librdf_node* value)
+{
+  unsigned char *uri_string;
+
+  uri_string=librdf_uri_as_string(feature);
+  if(!uri_string)
+    return -1;
+
+  if(!strcmp((const char*)uri_string, LIBRDF_STORAGE_FEATURE_BUILD_INDEXES))
+    return librdf_storage_hashes_build_indexes(storage);
+
+  return -1;
+}
+
+
 /** Local entry point for dynamically loaded storage module */
 static void
 librdf_storage_hashes_register_factory(librdf_storage_factory *factory) 
@@ -1955,10 +4993,13 @@ librdf_storage_hashes_register_factory(librdf_storage_factory *factory)
 
   factory->context_add_statement    = librdf_storage_hashes_context_add_statement;
   factory->context_remove_statement = librdf_storage_hashes_context_remove_statement;
+  factory->context_remove_statements = librdf_storage_hashes_context_remove_statements;
+  factory->context_size             = librdf_storage_hashes_context_size;
   factory->context_serialise        = librdf_storage_hashes_context_serialise;
   factory->sync                     = librdf_storage_hashes_sync;
   factory->get_contexts             = librdf_storage_hashes_get_contexts;
   factory->get_feature              = librdf_storage_hashes_get_feature;
+  factory->set_feature              = librdf_storage_hashes_set_feature;
 }
 
 
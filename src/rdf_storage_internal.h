@@ -56,8 +56,12 @@ void librdf_init_storage_hashes(librdf_world *world);
 
 void librdf_init_storage_trees(librdf_world *world);
 
+void librdf_init_storage_frozen(librdf_world *world);
+
 void librdf_init_storage_file(librdf_world *world);
 
+librdf_iterator* librdf_storage_node_stream_to_node_create(librdf_storage* storage, librdf_node* node1, librdf_node *node2, librdf_statement_part want);
+
 #ifdef STORAGE_MYSQL
 void librdf_init_storage_mysql(librdf_world *world);
 #endif
@@ -40,6 +40,27 @@
 
 #include <redland.h>
 
+#include <rdf_list_internal.h>
+
+
+/*
+ * With index='yes' every stored statement is also chained into three
+ * hash tables: by the whole statement, for contains and duplicate
+ * checks, and by subject and by predicate for find_statements.  The
+ * list itself still holds the statements in insertion order.
+ */
+#define LIBRDF_STORAGE_LIST_INDEX_STATEMENT 0
+#define LIBRDF_STORAGE_LIST_INDEX_SUBJECT   1
+#define LIBRDF_STORAGE_LIST_INDEX_PREDICATE 2
+#define LIBRDF_STORAGE_LIST_INDEX_COUNT     3
+
+/* initial number of buckets in each table; always a power of 2 */
+#define LIBRDF_STORAGE_LIST_INDEX_MIN_BUCKETS 64
+
+
+typedef struct librdf_storage_list_node_s librdf_storage_list_node;
+typedef struct librdf_storage_list_index_node_s librdf_storage_list_index_node;
+typedef struct librdf_storage_list_find_stream_context_s librdf_storage_list_find_stream_context;
 
 typedef struct
 {
@@ -48,16 +69,35 @@ typedef struct
   /* If this is non-0, contexts are being used */
   int index_contexts;
   librdf_hash* contexts;
+
+  /* If this is non-0, statements are hashed into buckets */
+  int index;
+  librdf_storage_list_index_node** buckets[LIBRDF_STORAGE_LIST_INDEX_COUNT];
+  size_t buckets_size;
+
+  /* open find streams following bucket chains */
+  librdf_storage_list_find_stream_context* find_streams;
   
 } librdf_storage_list_instance;
 
 
 /* These are stored in the list */
-typedef struct
+struct librdf_storage_list_node_s
 {
   librdf_statement *statement;
   librdf_node *context;
-} librdf_storage_list_node;
+};
+
+/* These are stored in the list instead with index='yes', so only
+ * indexed stores pay for the chains */
+struct librdf_storage_list_index_node_s
+{
+  librdf_storage_list_node node; /* first, so either is stored */
+  librdf_list_node* list_node;
+  unsigned int hashes[LIBRDF_STORAGE_LIST_INDEX_COUNT];
+  librdf_storage_list_index_node* next[LIBRDF_STORAGE_LIST_INDEX_COUNT];
+  librdf_storage_list_index_node* prev[LIBRDF_STORAGE_LIST_INDEX_COUNT];
+};
 
 
 /* prototypes for local functions */
@@ -92,6 +132,20 @@ static void librdf_storage_list_context_serialise_finished(void* context);
 /* helper functions for contexts */
 static int librdf_storage_list_node_equals(librdf_storage_list_node *first, librdf_storage_list_node *second);
 
+/* index helper functions */
+static void librdf_storage_list_index_hash(librdf_statement* statement, unsigned int* hashes);
+static librdf_storage_list_node* librdf_storage_list_new_node(librdf_storage_list_instance* context);
+static void librdf_storage_list_index_add(librdf_storage_list_instance* context, librdf_storage_list_node* sln);
+static void librdf_storage_list_index_remove(librdf_storage_list_instance* context, librdf_storage_list_node* sln);
+static librdf_storage_list_index_node* librdf_storage_list_index_find(librdf_storage_list_instance* context, librdf_statement* statement, librdf_node* context_node, int match_context);
+static librdf_stream* librdf_storage_list_index_find_statements(librdf_storage* storage, librdf_statement* statement, int index);
+
+/* index find stream methods */
+static int librdf_storage_list_find_end_of_stream(void* context);
+static int librdf_storage_list_find_next_statement(void* context);
+static void* librdf_storage_list_find_get_statement(void* context, int flags);
+static void librdf_storage_list_find_finished(void* context);
+
 static librdf_iterator* librdf_storage_list_get_contexts(librdf_storage* storage);
 
 /* get_context iterator functions */
@@ -125,6 +179,9 @@ librdf_storage_list_init(librdf_storage* storage, const char *name,
 
   context->index_contexts=index_contexts;
   
+  if((context->index=librdf_hash_get_as_boolean(options, "index"))<0)
+    context->index=0; /* default is no index */
+
   /* no more options, might as well free them now */
   if(options)
     librdf_free_hash(options);
@@ -185,6 +242,21 @@ librdf_storage_list_open(librdf_storage* storage, librdf_model* model)
   librdf_list_set_equals(context->list, 
                          (int (*)(void*, void*))&librdf_storage_list_node_equals);
 
+  if(context->index) {
+    int i;
+
+    context->buckets_size=LIBRDF_STORAGE_LIST_INDEX_MIN_BUCKETS;
+    for(i=0; i < LIBRDF_STORAGE_LIST_INDEX_COUNT; i++) {
+      context->buckets[i]=LIBRDF_CALLOC(librdf_storage_list_index_node**,
+                                        context->buckets_size,
+                                        sizeof(librdf_storage_list_index_node*));
+      if(!context->buckets[i]) {
+        librdf_storage_list_close(storage);
+        return 1;
+      }
+    }
+  }
+
   return 0;
 }
 
@@ -224,10 +296,211 @@ librdf_storage_list_close(librdf_storage* storage)
     }
   }
   
+  if(context->index) {
+    int i;
+
+    for(i=0; i < LIBRDF_STORAGE_LIST_INDEX_COUNT; i++) {
+      if(context->buckets[i]) {
+        LIBRDF_FREE(librdf_storage_list_index_node**, context->buckets[i]);
+        context->buckets[i]=NULL;
+      }
+    }
+  }
+  
   return 0;
 }
 
 
+/* Hash a node by its type and content so equal nodes hash the same */
+static u64
+librdf_storage_list_hash_node(librdf_node* node)
+{
+  librdf_node_type type;
+  const unsigned char* string;
+  size_t len=0;
+  u64 hash;
+
+  if(!node)
+    return 0;
+
+  type=librdf_node_get_type(node);
+  switch(type) {
+    case LIBRDF_NODE_TYPE_RESOURCE:
+      string=librdf_uri_as_counted_string(librdf_node_get_uri(node), &len);
+      return librdf_hash_function_wyhash(string, len, (u64)type);
+
+    case LIBRDF_NODE_TYPE_LITERAL:
+      string=librdf_node_get_literal_value_as_counted_string(node, &len);
+      hash=librdf_hash_function_wyhash(string, len, (u64)type);
+
+      string=(const unsigned char*)librdf_node_get_literal_value_language(node);
+      if(string)
+        hash=librdf_hash_function_wyhash(string, strlen((const char*)string),
+                                         hash);
+
+      if(librdf_node_get_literal_value_datatype_uri(node)) {
+        string=librdf_uri_as_counted_string(librdf_node_get_literal_value_datatype_uri(node), &len);
+        hash=librdf_hash_function_wyhash(string, len, hash);
+      }
+      return hash;
+
+    case LIBRDF_NODE_TYPE_BLANK:
+      string=librdf_node_get_counted_blank_identifier(node, &len);
+      return librdf_hash_function_wyhash(string, len, (u64)type);
+
+    case LIBRDF_NODE_TYPE_UNKNOWN:
+    default:
+      return 0;
+  }
+}
+
+
+/* Compute the statement, subject and predicate hashes of a statement */
+static void
+librdf_storage_list_index_hash(librdf_statement* statement,
+                               unsigned int* hashes)
+{
+  u64 parts[3];
+
+  parts[0]=librdf_storage_list_hash_node(librdf_statement_get_subject(statement));
+  parts[1]=librdf_storage_list_hash_node(librdf_statement_get_predicate(statement));
+  parts[2]=librdf_storage_list_hash_node(librdf_statement_get_object(statement));
+
+  hashes[LIBRDF_STORAGE_LIST_INDEX_STATEMENT]=(unsigned int)librdf_hash_function_wyhash(parts, sizeof(parts), 0);
+  hashes[LIBRDF_STORAGE_LIST_INDEX_SUBJECT]=(unsigned int)parts[0];
+  hashes[LIBRDF_STORAGE_LIST_INDEX_PREDICATE]=(unsigned int)parts[1];
+}
+
+
+static void
+librdf_storage_list_index_link(librdf_storage_list_instance* context,
+                               librdf_storage_list_index_node* sln)
+{
+  int i;
+
+  for(i=0; i < LIBRDF_STORAGE_LIST_INDEX_COUNT; i++) {
+    librdf_storage_list_index_node** bucket;
+
+    bucket=&context->buckets[i][sln->hashes[i] & (context->buckets_size - 1)];
+    sln->prev[i]=NULL;
+    sln->next[i]=*bucket;
+    if(*bucket)
+      (*bucket)->prev[i]=sln;
+    *bucket=sln;
+  }
+}
+
+
+/* Double the tables.  Not done while a find stream walks a chain */
+static void
+librdf_storage_list_index_grow(librdf_storage_list_instance* context)
+{
+  librdf_storage_list_index_node** old_buckets[LIBRDF_STORAGE_LIST_INDEX_COUNT];
+  size_t old_size=context->buckets_size;
+  size_t b;
+  int i;
+
+  for(i=0; i < LIBRDF_STORAGE_LIST_INDEX_COUNT; i++) {
+    old_buckets[i]=context->buckets[i];
+    context->buckets[i]=LIBRDF_CALLOC(librdf_storage_list_index_node**,
+                                      old_size * 2,
+                                      sizeof(librdf_storage_list_index_node*));
+    if(!context->buckets[i]) {
+      /* keep the old tables, they only get slower */
+      while(i >= 0) {
+        if(context->buckets[i])
+          LIBRDF_FREE(librdf_storage_list_index_node**, context->buckets[i]);
+        context->buckets[i]=old_buckets[i];
+        i--;
+      }
+      return;
+    }
+  }
+
+  context->buckets_size=old_size * 2;
+
+  /* relink using the statement chains, which hold every node once */
+  for(b=0; b < old_size; b++) {
+    librdf_storage_list_index_node* sln;
+    librdf_storage_list_index_node* next;
+
+    for(sln=old_buckets[LIBRDF_STORAGE_LIST_INDEX_STATEMENT][b]; sln; sln=next) {
+      next=sln->next[LIBRDF_STORAGE_LIST_INDEX_STATEMENT];
+      librdf_storage_list_index_link(context, sln);
+    }
+  }
+
+  for(i=0; i < LIBRDF_STORAGE_LIST_INDEX_COUNT; i++)
+    LIBRDF_FREE(librdf_storage_list_index_node**, old_buckets[i]);
+}
+
+
+/* Allocate a node to store, with the index fields when indexing */
+static librdf_storage_list_node*
+librdf_storage_list_new_node(librdf_storage_list_instance* context)
+{
+  if(context->index)
+    return (librdf_storage_list_node*)LIBRDF_CALLOC(librdf_storage_list_index_node*, 1,
+                                                    sizeof(librdf_storage_list_index_node));
+
+  return LIBRDF_CALLOC(librdf_storage_list_node*, 1,
+                       sizeof(librdf_storage_list_node));
+}
+
+
+/* Index a node just appended to the list */
+static void
+librdf_storage_list_index_add(librdf_storage_list_instance* context,
+                              librdf_storage_list_node* node)
+{
+  librdf_storage_list_index_node* sln=(librdf_storage_list_index_node*)node;
+
+  if((size_t)librdf_list_size(context->list) > context->buckets_size &&
+     !context->find_streams)
+    librdf_storage_list_index_grow(context);
+
+  sln->list_node=context->list->last;
+  librdf_storage_list_index_hash(sln->node.statement, sln->hashes);
+  librdf_storage_list_index_link(context, sln);
+}
+
+
+/* Find a stored statement equal to @statement and if @match_context
+ * is set, stored in @context_node.
+ */
+static librdf_storage_list_index_node*
+librdf_storage_list_index_find(librdf_storage_list_instance* context,
+                               librdf_statement* statement,
+                               librdf_node* context_node,
+                               int match_context)
+{
+  unsigned int hashes[LIBRDF_STORAGE_LIST_INDEX_COUNT];
+  unsigned int hash;
+  librdf_storage_list_index_node* sln;
+
+  librdf_storage_list_index_hash(statement, hashes);
+  hash=hashes[LIBRDF_STORAGE_LIST_INDEX_STATEMENT];
+
+  for(sln=context->buckets[LIBRDF_STORAGE_LIST_INDEX_STATEMENT][hash & (context->buckets_size - 1)];
+      sln; sln=sln->next[LIBRDF_STORAGE_LIST_INDEX_STATEMENT]) {
+    if(sln->hashes[LIBRDF_STORAGE_LIST_INDEX_STATEMENT] != hash ||
+       !librdf_statement_equals(sln->node.statement, statement))
+      continue;
+
+    if(!match_context)
+      return sln;
+
+    if(!sln->node.context && !context_node)
+      return sln;
+    if(sln->node.context && context_node &&
+       librdf_node_equals(sln->node.context, context_node))
+      return sln;
+  }
+
+  return NULL;
+}
+
+
 static int
 librdf_storage_list_size(librdf_storage* storage)
 {
@@ -269,7 +542,7 @@ librdf_storage_list_add_statements(librdf_storage* storage,
     if(librdf_storage_list_contains_statement(storage, statement))
       continue;
 
-    sln = LIBRDF_MALLOC(librdf_storage_list_node*, sizeof(*sln));
+    sln=librdf_storage_list_new_node(context);
     if(!sln) {
       status=1;
       break;
@@ -283,7 +556,15 @@ librdf_storage_list_add_statements(librdf_storage* storage,
       break;
     }
     sln->context=NULL;
-    librdf_list_add(context->list, sln);
+    if(librdf_list_add(context->list, sln)) {
+      librdf_free_statement(sln->statement);
+      LIBRDF_FREE(librdf_storage_list_node, sln);
+      status=1;
+      break;
+    }
+
+    if(context->index)
+      librdf_storage_list_index_add(context, sln);
   }
   
   return status;
@@ -305,6 +586,9 @@ librdf_storage_list_contains_statement(librdf_storage* storage, librdf_statement
   sln.statement=statement;
   sln.context=NULL;
 
+  if(context->index && librdf_statement_is_complete(statement))
+    return (librdf_storage_list_index_find(context, statement, NULL, 0) != NULL);
+
   if(context->index_contexts) {
     /* When we have contexts, we have to use find_statements for contains
      * since we do not know what context node may be stored for a statement
@@ -444,8 +728,21 @@ librdf_storage_list_serialise_finished(void* context)
 static librdf_stream*
 librdf_storage_list_find_statements(librdf_storage* storage, librdf_statement* statement)
 {
+  librdf_storage_list_instance* context=(librdf_storage_list_instance*)storage->instance;
   librdf_stream* stream;
 
+  if(context->index && statement) {
+    if(librdf_statement_is_complete(statement))
+      return librdf_storage_list_index_find_statements(storage, statement,
+                                                       LIBRDF_STORAGE_LIST_INDEX_STATEMENT);
+    if(librdf_statement_get_subject(statement))
+      return librdf_storage_list_index_find_statements(storage, statement,
+                                                       LIBRDF_STORAGE_LIST_INDEX_SUBJECT);
+    if(librdf_statement_get_predicate(statement))
+      return librdf_storage_list_index_find_statements(storage, statement,
+                                                       LIBRDF_STORAGE_LIST_INDEX_PREDICATE);
+  }
+
   statement=librdf_new_statement_from_statement(statement);
   if(!statement)
     return NULL;
@@ -498,7 +795,7 @@ librdf_storage_list_context_add_statement(librdf_storage* storage,
   }
   
   /* Store statement + node in the storage_list */
-  sln = LIBRDF_MALLOC(librdf_storage_list_node*, sizeof(*sln));
+  sln=librdf_storage_list_new_node(context);
   if(!sln)
     return 1;
 
@@ -526,6 +823,9 @@ librdf_storage_list_context_add_statement(librdf_storage* storage,
     return 1;
   }
 
+  if(context->index)
+    librdf_storage_list_index_add(context, sln);
+
   if(!context->index_contexts || !context_node)
     return 0;
   
@@ -581,10 +881,23 @@ librdf_storage_list_context_remove_statement(librdf_storage* storage,
   search_sln.context=context_node;
 
   /* Remove stored statement+context */
-  sln=(librdf_storage_list_node*)librdf_list_remove(context->list, &search_sln);
+  if(context->index && librdf_statement_is_complete(statement)) {
+    librdf_storage_list_index_node* isln;
+
+    isln=librdf_storage_list_index_find(context, statement, context_node, 1);
+    sln=NULL;
+    if(isln) {
+      librdf_list_remove_node(context->list, isln->list_node);
+      sln=&isln->node;
+    }
+  } else
+    sln=(librdf_storage_list_node*)librdf_list_remove(context->list, &search_sln);
   if(!sln)
     return 1;
 
+  if(context->index)
+    librdf_storage_list_index_remove(context, sln);
+
   librdf_free_statement(sln->statement);
   if(sln->context)
     librdf_free_node(sln->context);
@@ -610,6 +923,233 @@ librdf_storage_list_context_remove_statement(librdf_storage* storage,
 }
 
 
+/* Find stream over one bucket chain of the index */
+struct librdf_storage_list_find_stream_context_s {
+  librdf_storage *storage;
+  int index_contexts;
+  int index;
+  unsigned int hash;
+  librdf_statement* statement;
+  librdf_storage_list_index_node* current;
+  librdf_storage_list_index_node* next;
+  /* copies of the current statement and context once it is removed,
+   * when current is NULL */
+  librdf_statement* removed_statement;
+  librdf_node* removed_context;
+  librdf_storage_list_find_stream_context* prev_stream;
+  librdf_storage_list_find_stream_context* next_stream;
+};
+
+
+/* First matching node from @sln along the stream's chain */
+static librdf_storage_list_index_node*
+librdf_storage_list_find_match(librdf_storage_list_find_stream_context* scontext,
+                               librdf_storage_list_index_node* sln)
+{
+  int index=scontext->index;
+
+  for(; sln; sln=sln->next[index]) {
+    if(sln->hashes[index] == scontext->hash &&
+       librdf_statement_match(sln->node.statement, scontext->statement))
+      break;
+  }
+
+  return sln;
+}
+
+
+/* Unlink a node being removed from the chains, moving any find stream
+ * that was about to step onto it.  A find stream on it keeps copies of
+ * its statement and context until it moves on.
+ */
+static void
+librdf_storage_list_index_remove(librdf_storage_list_instance* context,
+                                 librdf_storage_list_node* node)
+{
+  librdf_storage_list_index_node* sln=(librdf_storage_list_index_node*)node;
+  librdf_storage_list_find_stream_context* scontext;
+  int i;
+
+  for(scontext=context->find_streams; scontext;
+      scontext=scontext->next_stream) {
+    if(scontext->next == sln)
+      scontext->next=librdf_storage_list_find_match(scontext,
+                                                    sln->next[scontext->index]);
+    if(scontext->current == sln) {
+      scontext->current=NULL;
+      scontext->removed_statement=librdf_new_statement_from_statement(sln->node.statement);
+      if(sln->node.context)
+        scontext->removed_context=librdf_new_node_from_node(sln->node.context);
+    }
+  }
+
+  for(i=0; i < LIBRDF_STORAGE_LIST_INDEX_COUNT; i++) {
+    if(sln->prev[i])
+      sln->prev[i]->next[i]=sln->next[i];
+    else
+      context->buckets[i][sln->hashes[i] & (context->buckets_size - 1)]=sln->next[i];
+    if(sln->next[i])
+      sln->next[i]->prev[i]=sln->prev[i];
+  }
+}
+
+
+static librdf_stream*
+librdf_storage_list_index_find_statements(librdf_storage* storage,
+                                          librdf_statement* statement,
+                                          int index)
+{
+  librdf_storage_list_instance* context=(librdf_storage_list_instance*)storage->instance;
+  librdf_storage_list_find_stream_context* scontext;
+  unsigned int hashes[LIBRDF_STORAGE_LIST_INDEX_COUNT];
+  librdf_stream* stream;
+
+  scontext = LIBRDF_CALLOC(librdf_storage_list_find_stream_context*, 1,
+                           sizeof(*scontext));
+  if(!scontext)
+    return NULL;
+
+  scontext->statement=librdf_new_statement_from_statement(statement);
+  if(!scontext->statement) {
+    LIBRDF_FREE(librdf_storage_list_find_stream_context, scontext);
+    return NULL;
+  }
+
+  librdf_storage_list_index_hash(statement, hashes);
+  scontext->index_contexts=context->index_contexts;
+  scontext->index=index;
+  scontext->hash=hashes[index];
+  scontext->current=librdf_storage_list_find_match(scontext,
+                                                   context->buckets[index][scontext->hash & (context->buckets_size - 1)]);
+  if(scontext->current)
+    scontext->next=librdf_storage_list_find_match(scontext,
+                                                  scontext->current->next[index]);
+
+  scontext->next_stream=context->find_streams;
+  if(context->find_streams)
+    context->find_streams->prev_stream=scontext;
+  context->find_streams=scontext;
+
+  scontext->storage=storage;
+  librdf_storage_add_reference(scontext->storage);
+
+  stream=librdf_new_stream(storage->world,
+                           (void*)scontext,
+                           &librdf_storage_list_find_end_of_stream,
+                           &librdf_storage_list_find_next_statement,
+                           &librdf_storage_list_find_get_statement,
+                           &librdf_storage_list_find_finished);
+  if(!stream) {
+    librdf_storage_list_find_finished((void*)scontext);
+    return NULL;
+  }
+  
+  return stream;  
+}
+
+
+static int
+librdf_storage_list_find_end_of_stream(void* context)
+{
+  librdf_storage_list_find_stream_context* scontext=(librdf_storage_list_find_stream_context*)context;
+
+  return (scontext->current == NULL && scontext->removed_statement == NULL);
+}
+
+
+/* Drop the copies kept of a removed current statement */
+static void
+librdf_storage_list_find_clear_removed(librdf_storage_list_find_stream_context* scontext)
+{
+  if(scontext->removed_statement) {
+    librdf_free_statement(scontext->removed_statement);
+    scontext->removed_statement=NULL;
+  }
+  if(scontext->removed_context) {
+    librdf_free_node(scontext->removed_context);
+    scontext->removed_context=NULL;
+  }
+}
+
+
+static int
+librdf_storage_list_find_next_statement(void* context)
+{
+  librdf_storage_list_find_stream_context* scontext=(librdf_storage_list_find_stream_context*)context;
+
+  if(librdf_storage_list_find_end_of_stream(context))
+    return 1;
+
+  librdf_storage_list_find_clear_removed(scontext);
+  scontext->current=scontext->next;
+  if(scontext->current)
+    scontext->next=librdf_storage_list_find_match(scontext,
+                                                  scontext->current->next[scontext->index]);
+
+  return (scontext->current == NULL);
+}
+
+
+static void*
+librdf_storage_list_find_get_statement(void* context, int flags)
+{
+  librdf_storage_list_find_stream_context* scontext=(librdf_storage_list_find_stream_context*)context;
+
+  if(!scontext->current) {
+    switch(flags) {
+      case LIBRDF_ITERATOR_GET_METHOD_GET_OBJECT:
+        return scontext->removed_statement;
+      case LIBRDF_ITERATOR_GET_METHOD_GET_CONTEXT:
+        return scontext->removed_context;
+      default:
+        break;
+    }
+  }
+
+  switch(flags) {
+    case LIBRDF_ITERATOR_GET_METHOD_GET_OBJECT:
+      return scontext->current->node.statement;
+    case LIBRDF_ITERATOR_GET_METHOD_GET_CONTEXT:
+      if(scontext->index_contexts)
+        return scontext->current->node.context;
+      else
+        return NULL;
+    default:
+      librdf_log(scontext->storage->world,
+                 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+                 "Unknown iterator method flag %d", flags);
+      return NULL;
+  }
+}
+
+
+static void
+librdf_storage_list_find_finished(void* context)
+{
+  librdf_storage_list_find_stream_context* scontext=(librdf_storage_list_find_stream_context*)context;
+  librdf_storage_list_instance* instance;
+
+  if(scontext->storage) {
+    instance=(librdf_storage_list_instance*)scontext->storage->instance;
+    if(scontext->prev_stream)
+      scontext->prev_stream->next_stream=scontext->next_stream;
+    else
+      instance->find_streams=scontext->next_stream;
+    if(scontext->next_stream)
+      scontext->next_stream->prev_stream=scontext->prev_stream;
+
+    librdf_storage_remove_reference(scontext->storage);
+  }
+
+  if(scontext->statement)
+    librdf_free_statement(scontext->statement);
+
+  librdf_storage_list_find_clear_removed(scontext);
+
+  LIBRDF_FREE(librdf_storage_list_find_stream_context, scontext);
+}
+
+
 typedef struct {
   librdf_storage *storage;
   librdf_iterator* iterator;
@@ -960,7 +1500,9 @@ librdf_storage_list_get_feature(librdf_storage* storage, librdf_uri* feature)
 static void
 librdf_storage_list_register_factory(librdf_storage_factory *factory) 
 {
+#ifndef STANDALONE
   LIBRDF_ASSERT_CONDITION(!strcmp(factory->name, "memory"));
+#endif
 
   factory->version            = LIBRDF_STORAGE_INTERFACE_VERSION;
   factory->init               = librdf_storage_list_init;
@@ -982,6 +1524,7 @@ librdf_storage_list_register_factory(librdf_storage_factory *factory)
 }
 
 
+#ifndef STANDALONE
 /*
  * librdf_init_storage_list:
  * @world: world object
@@ -994,3 +1537,193 @@ librdf_init_storage_list(librdf_world *world)
   librdf_storage_register_factory(world, "memory", "In memory lists",
                                   &librdf_storage_list_register_factory);
 }
+#endif
+
+
+/* TEST CODE */
+
+
+#ifdef STANDALONE
+
+/* one more prototype */
+int main(int argc, char *argv[]);
+
+#define LIST_TEST_STATEMENTS 1000
+#define LIST_TEST_SUBJECTS 37
+#define LIST_TEST_PREDICATES 5
+
+
+static librdf_statement*
+librdf_storage_list_test_statement(librdf_world* world, int i)
+{
+  char uri[3][64];
+
+  sprintf(uri[0], "http://example.org/s%d", i % LIST_TEST_SUBJECTS);
+  sprintf(uri[1], "http://example.org/p%d", i % LIST_TEST_PREDICATES);
+  sprintf(uri[2], "http://example.org/o%d", i);
+  return librdf_new_statement_from_nodes(world,
+                                         librdf_new_node_from_uri_string(world, (const unsigned char*)uri[0]),
+                                         librdf_new_node_from_uri_string(world, (const unsigned char*)uri[1]),
+                                         librdf_new_node_from_uri_string(world, (const unsigned char*)uri[2]));
+}
+
+
+/* Find statements with the predicate of statement i */
+static librdf_stream*
+librdf_storage_list_test_find(librdf_storage* storage, int i)
+{
+  librdf_statement* statement;
+  librdf_stream* stream;
+
+  statement=librdf_storage_list_test_statement(storage->world, i);
+  librdf_statement_set_subject(statement, NULL);
+  librdf_statement_set_object(statement, NULL);
+  stream=librdf_storage_find_statements(storage, statement);
+  librdf_free_statement(statement);
+  return stream;
+}
+
+
+int
+main(int argc, char *argv[]) 
+{
+  const char *program=librdf_basename((const char*)argv[0]);
+  librdf_world *world;
+  librdf_storage* storage;
+  librdf_storage_list_instance* context;
+  librdf_statement* statement;
+  librdf_statement* first;
+  librdf_stream* stream;
+  librdf_stream* stream2;
+  size_t buckets_size;
+  int expected;
+  int count;
+  int i;
+  int ret = 0;
+
+  world=librdf_new_world();
+  librdf_world_open(world);
+
+  librdf_storage_register_factory(world, "memory-test", "In memory lists test",
+                                  &librdf_storage_list_register_factory);
+
+  storage=librdf_new_storage(world, "memory-test", NULL, "index='yes'");
+  if(!storage) {
+    fprintf(stderr, "%s: Failed to create indexed memory storage\n", program);
+    return 1;
+  }
+  if(librdf_storage_open(storage, NULL)) {
+    fprintf(stderr, "%s: Failed to open indexed memory storage\n", program);
+    return 1;
+  }
+  context=(librdf_storage_list_instance*)storage->instance;
+
+  /* the tables double as statements are added */
+  fprintf(stdout, "%s: Adding %d statements\n", program, LIST_TEST_STATEMENTS);
+  for(i=0; i < LIST_TEST_STATEMENTS; i++) {
+    statement=librdf_storage_list_test_statement(world, i);
+    if(librdf_storage_add_statement(storage, statement)) {
+      fprintf(stderr, "%s: Failed to add statement\n", program);
+      return 1;
+    }
+    librdf_free_statement(statement);
+  }
+  if(context->buckets_size < LIST_TEST_STATEMENTS) {
+    fprintf(stderr, "%s: Tables have %d buckets for %d statements\n", program,
+            (int)context->buckets_size, LIST_TEST_STATEMENTS);
+    ret = 1;
+  }
+  for(i=0; i < LIST_TEST_STATEMENTS; i++) {
+    statement=librdf_storage_list_test_statement(world, i);
+    if(!librdf_storage_contains_statement(storage, statement)) {
+      fprintf(stderr, "%s: Statement %d not found after growing\n", program,
+              i);
+      ret = 1;
+    }
+    librdf_free_statement(statement);
+  }
+
+  /* but not while a find stream walks a chain */
+  stream=librdf_storage_list_test_find(storage, 0);
+  buckets_size=context->buckets_size;
+  for(i=LIST_TEST_STATEMENTS; i < 3 * LIST_TEST_STATEMENTS; i++) {
+    statement=librdf_storage_list_test_statement(world, i);
+    librdf_storage_add_statement(storage, statement);
+    librdf_free_statement(statement);
+  }
+  if(context->buckets_size != buckets_size) {
+    fprintf(stderr, "%s: Tables grew under a find stream\n", program);
+    ret = 1;
+  }
+  librdf_free_stream(stream);
+
+  statement=librdf_storage_list_test_statement(world, 3 * LIST_TEST_STATEMENTS);
+  librdf_storage_add_statement(storage, statement);
+  librdf_free_statement(statement);
+  if(context->buckets_size == buckets_size) {
+    fprintf(stderr, "%s: Tables did not grow after the find stream\n",
+            program);
+    ret = 1;
+  }
+
+  /* remove every statement with predicate 1 but the first found by one
+   * stream, using a second stream that removes each it is on */
+  expected=(3 * LIST_TEST_STATEMENTS + 1) / LIST_TEST_PREDICATES;
+  fprintf(stdout, "%s: Removing %d statements under find streams\n", program,
+          expected - 1);
+  stream=librdf_storage_list_test_find(storage, 1);
+  first=librdf_new_statement_from_statement(librdf_stream_get_object(stream));
+
+  stream2=librdf_storage_list_test_find(storage, 1);
+  for(count=0; !librdf_stream_end(stream2); librdf_stream_next(stream2)) {
+    count++;
+    if(librdf_statement_equals(librdf_stream_get_object(stream2), first))
+      continue;
+    /* the shared statement is freed by removing it */
+    statement=librdf_new_statement_from_statement(librdf_stream_get_object(stream2));
+    if(librdf_storage_remove_statement(storage, statement) ||
+       librdf_storage_contains_statement(storage, statement)) {
+      fprintf(stderr, "%s: Failed to remove statement\n", program);
+      ret = 1;
+    }
+    librdf_free_statement(statement);
+  }
+  librdf_free_stream(stream2);
+  if(count != expected) {
+    fprintf(stderr, "%s: Second stream found %d statements, expected %d\n",
+            program, count, expected);
+    ret = 1;
+  }
+
+  for(count=0; !librdf_stream_end(stream); librdf_stream_next(stream)) {
+    if(!librdf_statement_equals(librdf_stream_get_object(stream), first)) {
+      fprintf(stderr, "%s: First stream found a removed statement\n",
+              program);
+      ret = 1;
+    }
+    count++;
+  }
+  librdf_free_stream(stream);
+  librdf_free_statement(first);
+  if(count != 1) {
+    fprintf(stderr, "%s: First stream found %d statements, expected 1\n",
+            program, count);
+    ret = 1;
+  }
+
+  if(librdf_storage_size(storage) != 3 * LIST_TEST_STATEMENTS + 1 - (expected - 1)) {
+    fprintf(stderr, "%s: Storage has %d statements after removing, expected %d\n",
+            program, librdf_storage_size(storage),
+            3 * LIST_TEST_STATEMENTS + 1 - (expected - 1));
+    ret = 1;
+  }
+
+  librdf_storage_close(storage);
+  librdf_free_storage(storage);
+
+  librdf_free_world(world);
+
+  return ret;
+}
+
+#endif
@@ -112,6 +112,7 @@ typedef void* librdf_storage_instance;
  * @transaction_commit: Commit a transaction. OPTIONAL
  * @transaction_rollback: Rollback a transaction. OPTIONAL
  * @transaction_get_handle: Get opaque data handle passed to transaction_start_with_handle. OPTIONAL
+ * @context_size: Return the number of statements in a context. storage core will count the context_serialise stream if missing. OPTIONAL
  * 
  * A Storage Factory
  */
@@ -240,6 +241,9 @@ struct librdf_storage_factory_s {
 
   /** Storage engine returns query results - OPTIONAL */
   librdf_query_results* (*query_execute)(librdf_storage* storage, librdf_query *query);
+
+  /* Return the number of statements in a context - OPTIONAL */
+  int (*context_size)(librdf_storage* storage, librdf_node* context);
 };
 
 
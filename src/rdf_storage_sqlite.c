@@ -59,6 +59,60 @@ struct librdf_storage_sqlite_query
   librdf_storage_sqlite_query *next;
 };
 
+
+/* Fixed SQL statements prepared once per instance - see sqlite_stmts */
+typedef enum {
+  STMT_URI_GET,
+  STMT_URI_SET,
+  STMT_BLANK_GET,
+  STMT_BLANK_SET,
+  STMT_LITERAL_GET,
+  STMT_LITERAL_SET,
+  STMT_TRIPLE_ADD,
+  STMT_SIZE,
+  STMT_BEGIN,
+  STMT_COMMIT,
+  STMT_ROLLBACK
+} sqlite_stmt_numbers;
+
+#define NSTMTS (STMT_ROLLBACK + 1)
+
+/* Statements matching triples are prepared per shape: the node type
+ * (or none) of the subject, predicate, object and context, 2 bits each.
+ */
+#define NSHAPES 256
+
+typedef enum {
+  MATCH_CONTAINS,
+  MATCH_REMOVE,
+  MATCH_SELECT
+} sqlite_match_numbers;
+
+#define NMATCHES (MATCH_SELECT + 1)
+
+/* default maximum number of entries in the node id cache */
+#define SQLITE_NODE_CACHE_SIZE 4096
+#define SQLITE_NODE_CACHE_SIZE_MAX (1 << 24)
+
+typedef struct
+{
+  /* node encoded with librdf_node_encode */
+  unsigned char *key;
+  size_t key_len;
+  u64 hash;
+
+  int id;
+
+  /* next entry in the same bucket or -1 */
+  int next;
+
+  /* transaction_serial when added inside a transaction, else 0 */
+  unsigned int serial;
+
+  /* CLOCK reference bit */
+  int referenced;
+} librdf_storage_sqlite_node_cache_entry;
+
 typedef struct
 {
   librdf_storage *storage;
@@ -76,6 +130,32 @@ typedef struct
   librdf_storage_sqlite_query *in_stream_queries;
 
   int in_transaction;
+
+  /* prepared statements, created on first use and finalized on close */
+  sqlite3_stmt *stmts[NSTMTS];
+
+  /* prepared statements by match and shape.  A MATCH_SELECT entry is
+   * taken out of here while a stream is using it and put back when
+   * the stream finishes.
+   */
+  sqlite3_stmt *match_stmts[NMATCHES][NSHAPES];
+
+  /* serial number of the current or last transaction */
+  unsigned int transaction_serial;
+
+  /* node to row id cache with CLOCK replacement; size 0 for none */
+  int node_cache_size;
+  int node_cache_count;
+  int node_cache_hand;
+  librdf_storage_sqlite_node_cache_entry *node_cache;
+  int *node_cache_buckets;
+  size_t node_cache_buckets_mask;
+  unsigned long node_cache_hits;
+  unsigned long node_cache_misses;
+
+  /* buffer for encoding nodes */
+  unsigned char *node_buffer;
+  size_t node_buffer_len;
 } librdf_storage_sqlite_instance;
 
 
@@ -146,6 +226,7 @@ librdf_storage_sqlite_init(librdf_storage* storage, const char *name,
 {
   char *name_copy;
   char* synchronous;
+  long cache_size;
   librdf_storage_sqlite_instance* context;
   
   if(!name) {
@@ -179,6 +260,14 @@ librdf_storage_sqlite_init(librdf_storage* storage, const char *name,
   if(librdf_hash_get_as_boolean(options, "new")>0)
     context->is_new = 1; /* default is NOT NEW */
 
+  /* node-cache='0' disables the cache */
+  cache_size = librdf_hash_get_as_long(options, "node-cache");
+  if(cache_size < 0)
+    cache_size = SQLITE_NODE_CACHE_SIZE;
+  else if(cache_size > SQLITE_NODE_CACHE_SIZE_MAX)
+    cache_size = SQLITE_NODE_CACHE_SIZE_MAX;
+  context->node_cache_size = (int)cache_size;
+
   /* Redland default is "PRAGMA synchronous normal" */
   context->synchronous = 1;
 
@@ -281,56 +370,45 @@ static const char * const triples_fields[4][3] = {
   { "contextUri",   NULL,           NULL }
 };
 
+/* parameter index of each triples_fields column in STMT_TRIPLE_ADD */
+static const int triples_params[4][3] = {
+  { 1, 2, 0 },
+  { 3, 0, 0 },
+  { 4, 5, 6 },
+  { 7, 0, 0 }
+};
 
-static int
-librdf_storage_sqlite_get_1int_callback(void *arg,
-                                        int argc, char **argv,
-                                        char **columnNames)
-{
-  int* count_p = (int*)arg;
-  
-  if(argc == 1) {
-    *count_p = argv[0] ? atoi(argv[0]) : 0;
-  }
-  return 0;
-}
-
-
-static unsigned char *
-sqlite_string_escape(const unsigned char *raw, size_t raw_len, size_t *len_p) 
-{
-  size_t escapes = 0;
-  unsigned char *p;
-  unsigned char *escaped;
-  size_t len;
-
-  for(p = (unsigned char*)raw, len = raw_len; len > 0; p++, len--) {
-    if(*p == '\'')
-      escapes++;
-  }
-
-  len = raw_len + escapes + 2; /* for '' */
-  escaped = LIBRDF_MALLOC(unsigned char*, len + 1);
-  if(!escaped)
-    return NULL;
+#define NTRIPLES_PARAMS 7
+
+static const char * const sqlite_stmts[NSTMTS] = {
+  /* STMT_URI_GET */
+  "SELECT id FROM uris WHERE uri = ?1",
+  /* STMT_URI_SET */
+  "INSERT INTO uris (id, uri) VALUES(NULL, ?1)",
+  /* STMT_BLANK_GET */
+  "SELECT id FROM blanks WHERE blank = ?1",
+  /* STMT_BLANK_SET */
+  "INSERT INTO blanks (id, blank) VALUES(NULL, ?1)",
+  /* STMT_LITERAL_GET */
+  "SELECT id FROM literals WHERE text = ?1 AND language IS ?2 AND datatype IS ?3",
+  /* STMT_LITERAL_SET */
+  "INSERT INTO literals (id, text, language, datatype) VALUES(NULL, ?1, ?2, ?3)",
+  /* STMT_TRIPLE_ADD */
+  "INSERT INTO triples (subjectUri, subjectBlank, predicateUri, objectUri, objectBlank, objectLiteral, contextUri) VALUES(?1, ?2, ?3, ?4, ?5, ?6, ?7)",
+  /* STMT_SIZE */
+  "SELECT COUNT(*) FROM triples",
+  /* STMT_BEGIN */
+  "BEGIN IMMEDIATE",
+  /* STMT_COMMIT */
+  "END",
+  /* STMT_ROLLBACK */
+  "ROLLBACK"
+};
 
-  p = escaped;
-  *p++ = '\'';
-  while(raw_len > 0) {
-    if(*raw == '\'') {
-      *p++ = '\'';
-    }
-    *p++ = *raw++;
-    raw_len--;
-  }
-  *p++ = '\'';
-  *p = '\0';
 
-  if(len_p)
-    *len_p = len;
-  
-  return escaped;
-}
+#define SQLITE_SHAPE(node_types) \
+  ((node_types)[0] | ((node_types)[1] << 2) | \
+   ((node_types)[2] << 4) | ((node_types)[3] << 6))
 
 
 static int
@@ -405,47 +483,119 @@ librdf_storage_sqlite_exec(librdf_storage* storage,
 }
 
 
+/*
+ * librdf_storage_sqlite_prepare:
+ * @storage: the storage
+ * @request: SQL statement
+ * @request_len: length of @request or -1 if it is NUL-terminated
+ *
+ * INTERNAL - Compile an SQL statement, logging any error.
+ *
+ * Return value: new statement or NULL on failure
+ */
+static sqlite3_stmt*
+librdf_storage_sqlite_prepare(librdf_storage* storage,
+                              const unsigned char *request,
+                              int request_len)
+{
+  librdf_storage_sqlite_instance* context;
+  sqlite3_stmt *vm = NULL;
+  int status;
+
+  context = (librdf_storage_sqlite_instance*)storage->instance;
+
+#if defined(LIBRDF_DEBUG) && LIBRDF_DEBUG > 2
+  LIBRDF_DEBUG2("SQLite prepare '%s'\n", request);
+#endif
+
+  status = sqlite3_prepare_v2(context->db, (const char*)request, request_len,
+                              &vm, NULL);
+  if(status != SQLITE_OK) {
+    librdf_log(storage->world, 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+               "SQLite database %s SQL compile '%s' failed - %s (%d)",
+               context->name, request, sqlite3_errmsg(context->db), status);
+    if(vm)
+      sqlite3_finalize(vm);
+    return NULL;
+  }
+
+  return vm;
+}
+
+
+/*
+ * librdf_storage_sqlite_get_stmt:
+ * @storage: the storage
+ * @stmt: statement number (STMT_*)
+ *
+ * INTERNAL - Get a fixed prepared statement, compiling it on first use.
+ *
+ * Return value: shared statement or NULL on failure
+ */
+static sqlite3_stmt*
+librdf_storage_sqlite_get_stmt(librdf_storage* storage, int stmt)
+{
+  librdf_storage_sqlite_instance* context;
+
+  context = (librdf_storage_sqlite_instance*)storage->instance;
+
+  if(!context->stmts[stmt])
+    context->stmts[stmt] = librdf_storage_sqlite_prepare(storage,
+                                                         (const unsigned char*)sqlite_stmts[stmt],
+                                                         -1);
+
+  return context->stmts[stmt];
+}
+
+
+/*
+ * librdf_storage_sqlite_step:
+ * @storage: the storage
+ * @vm: bound prepared statement
+ * @value_p: pointer to store the integer first column of the first row (or NULL)
+ *
+ * INTERNAL - Run a prepared statement for at most one row and reset it.
+ *
+ * Return value: <0 on failure, 1 if a row was returned, 0 otherwise
+ */
 static int
-librdf_storage_sqlite_set_helper(librdf_storage *storage,
-                                 int table, 
-                                 const unsigned char *values,
-                                 size_t values_len) 
+librdf_storage_sqlite_step(librdf_storage* storage, sqlite3_stmt *vm,
+                           int *value_p)
 {
   librdf_storage_sqlite_instance* context;
-  int rc;
-  raptor_stringbuffer *sb;
-  unsigned char *request;
+  int status;
+  int result = 0;
 
   context = (librdf_storage_sqlite_instance*)storage->instance;
 
-  sb = raptor_new_stringbuffer();
-  if(!sb)
-    return -1;
+  status = sqlite3_step(vm);
+  if(status == SQLITE_ROW) {
+    if(value_p)
+      *value_p = sqlite3_column_int(vm, 0);
+    result = 1;
+  } else if(status != SQLITE_DONE) {
+    librdf_log(storage->world, 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+               "SQLite database %s SQL exec '%s' failed - %s (%d)",
+               context->name, sqlite3_sql(vm), sqlite3_errmsg(context->db),
+               status);
+    result = -1;
+  }
 
-  raptor_stringbuffer_append_string(sb, 
-                                    (const unsigned char*)"INSERT INTO ", 1);
-  raptor_stringbuffer_append_string(sb,  
-                                    (const unsigned char*)sqlite_tables[table].name, 1);
-  raptor_stringbuffer_append_counted_string(sb,  
-                                    (const unsigned char*)" (id, ", 6, 1);
-  raptor_stringbuffer_append_string(sb,  
-                                    (const unsigned char*)sqlite_tables[table].columns, 1);
-  raptor_stringbuffer_append_counted_string(sb, 
-                                            (const unsigned char*) ") VALUES(NULL, ", 15, 1);
-  raptor_stringbuffer_append_counted_string(sb, values, values_len, 1);
-  raptor_stringbuffer_append_counted_string(sb,  
-                                            (const unsigned char*)");", 2, 1);
-  request=raptor_stringbuffer_as_string(sb);
-
-  rc=librdf_storage_sqlite_exec(storage,
-                                request,
-                                NULL, /* no callback */
-                                NULL, /* arg */
-                                0);
+  /* end the statement so it holds no locks while cached */
+  sqlite3_reset(vm);
 
-  raptor_free_stringbuffer(sb);
+  return result;
+}
+
+
+static int
+librdf_storage_sqlite_set_helper(librdf_storage *storage, sqlite3_stmt *vm)
+{
+  librdf_storage_sqlite_instance* context;
+
+  context = (librdf_storage_sqlite_instance*)storage->instance;
 
-  if(rc)
+  if(librdf_storage_sqlite_step(storage, vm, NULL) < 0)
     return -1;
 
   return LIBRDF_BAD_CAST(int, sqlite3_last_insert_rowid(context->db));
@@ -453,43 +603,44 @@ librdf_storage_sqlite_set_helper(librdf_storage *storage,
 
 
 static int
-librdf_storage_sqlite_get_helper(librdf_storage *storage,
-                                 int table, 
-                                 const unsigned char *expression) 
+librdf_storage_sqlite_get_helper(librdf_storage *storage, sqlite3_stmt *vm)
 {
   int id = -1;
-  int rc;
-  raptor_stringbuffer *sb;
-  unsigned char *request;
 
-  sb = raptor_new_stringbuffer();
-  if(!sb)
+  if(librdf_storage_sqlite_step(storage, vm, &id) < 0)
     return -1;
 
-  raptor_stringbuffer_append_string(sb,  
-                                    (const unsigned char*)"SELECT id FROM ", 1);
-  raptor_stringbuffer_append_string(sb,  
-                                    (const unsigned char*)sqlite_tables[table].name, 1);
-  raptor_stringbuffer_append_counted_string(sb,  
-                                            (const unsigned char*)" WHERE ", 7, 1);
-  raptor_stringbuffer_append_string(sb,  
-                                    (const unsigned char*)expression, 1);
-  raptor_stringbuffer_append_counted_string(sb,  
-                                            (const unsigned char*)";", 1, 1);
-  request=raptor_stringbuffer_as_string(sb);
+  return id;
+}
 
-  rc = librdf_storage_sqlite_exec(storage,
-                                  request,
-                                  librdf_storage_sqlite_get_1int_callback,
-                                  &id,
-                                  0);
 
-  raptor_free_stringbuffer(sb);
+static int
+librdf_storage_sqlite_string_helper(librdf_storage* storage,
+                                    int get_stmt, int set_stmt,
+                                    const unsigned char *string,
+                                    size_t string_len,
+                                    int add_new)
+{
+  sqlite3_stmt *vm;
+  int id;
 
-  if(rc)
+  vm = librdf_storage_sqlite_get_stmt(storage, get_stmt);
+  if(!vm)
     return -1;
 
-  return id;
+  sqlite3_bind_text(vm, 1, (const char*)string,
+                    LIBRDF_GOOD_CAST(int, string_len), SQLITE_STATIC);
+  id = librdf_storage_sqlite_get_helper(storage, vm);
+  if(id >= 0 || !add_new)
+    return id;
+
+  vm = librdf_storage_sqlite_get_stmt(storage, set_stmt);
+  if(!vm)
+    return -1;
+
+  sqlite3_bind_text(vm, 1, (const char*)string,
+                    LIBRDF_GOOD_CAST(int, string_len), SQLITE_STATIC);
+  return librdf_storage_sqlite_set_helper(storage, vm);
 }
 
 
@@ -500,37 +651,12 @@ librdf_storage_sqlite_uri_helper(librdf_storage* storage,
 {
   const unsigned char *uri_string;
   size_t uri_len;
-  unsigned char *expression = NULL;
-  unsigned char *uri_e;
-  size_t uri_e_len;
-  int id = -1;
-  static const char * const field="uri";
 
   uri_string = librdf_uri_as_counted_string(uri, &uri_len);
-  uri_e = sqlite_string_escape(uri_string, uri_len, &uri_e_len);
-  if(!uri_e)
-    goto tidy;
-  
-  expression = LIBRDF_MALLOC(unsigned char*, strlen(field) + 3 + uri_e_len + 1);
-  if(!expression)
-    goto tidy;
-
-  sprintf((char*)expression, "%s = %s", field, uri_e);
-  id = librdf_storage_sqlite_get_helper(storage, TABLE_URIS, expression);
-  if(id >= 0)
-    goto tidy;
-
-  if(add_new)  
-    id = librdf_storage_sqlite_set_helper(storage, TABLE_URIS, uri_e,
-                                          uri_e_len);
-
-  tidy:
-  if(expression)
-    LIBRDF_FREE(char*, expression);
-  if(uri_e)
-    LIBRDF_FREE(char*, uri_e);
 
-  return id;
+  return librdf_storage_sqlite_string_helper(storage,
+                                             STMT_URI_GET, STMT_URI_SET,
+                                             uri_string, uri_len, add_new);
 }
 
 
@@ -539,39 +665,33 @@ librdf_storage_sqlite_blank_helper(librdf_storage* storage,
                                    const unsigned char *blank,
                                    int add_new)
 {
-  size_t blank_len;
-  unsigned char *expression = NULL;
-  unsigned char *blank_e;
-  size_t blank_e_len;
-  int id = -1;
-  static const char * const field="blank";
-
-  blank_len = strlen((const char*)blank);
-  blank_e = sqlite_string_escape(blank, blank_len, &blank_e_len);
-  if(!blank_e)
-    goto tidy;
-  
-  expression = LIBRDF_MALLOC(unsigned char*,
-                             strlen(field) + 3 + blank_e_len + 1);
-  if(!expression)
-    goto tidy;
+  return librdf_storage_sqlite_string_helper(storage,
+                                             STMT_BLANK_GET, STMT_BLANK_SET,
+                                             blank,
+                                             strlen((const char*)blank),
+                                             add_new);
+}
 
-  sprintf((char*)expression, "%s = %s", field, blank_e);
-  id = librdf_storage_sqlite_get_helper(storage, TABLE_BLANKS, expression);
-  if(id >= 0)
-    goto tidy;
 
-  if(add_new)
-    id = librdf_storage_sqlite_set_helper(storage, TABLE_BLANKS, blank_e, 
-                                          blank_e_len);
+static void
+librdf_storage_sqlite_literal_bind(sqlite3_stmt *vm,
+                                   const unsigned char *value,
+                                   size_t value_len,
+                                   const char *language,
+                                   int datatype_id)
+{
+  sqlite3_bind_text(vm, 1, (const char*)value,
+                    LIBRDF_GOOD_CAST(int, value_len), SQLITE_STATIC);
 
-  tidy:
-  if(expression)
-    LIBRDF_FREE(char*, expression);
-  if(blank_e)
-    LIBRDF_FREE(char*, blank_e);
+  if(language)
+    sqlite3_bind_text(vm, 2, language, -1, SQLITE_STATIC);
+  else
+    sqlite3_bind_null(vm, 2);
 
-  return id;
+  if(datatype_id >= 0)
+    sqlite3_bind_int(vm, 3, datatype_id);
+  else
+    sqlite3_bind_null(vm, 3);
 }
 
 
@@ -583,179 +703,376 @@ librdf_storage_sqlite_literal_helper(librdf_storage* storage,
                                      librdf_uri *datatype,
                                      int add_new) 
 {
-  int id = -1;
-  size_t len;
-  unsigned char *value_e;
-  size_t value_e_len;
-  unsigned char *language_e = NULL;
-  size_t language_e_len = 0;
+  sqlite3_stmt *vm;
+  int id;
   int datatype_id = -1;
-  raptor_stringbuffer *sb = NULL;
-  unsigned char *expression;
-
-  value_e = sqlite_string_escape(value, value_len, &value_e_len);
-  if(!value_e)
-    goto tidy;
-
-  sb = raptor_new_stringbuffer();
-  if(!sb)
-    goto tidy;
-
-  raptor_stringbuffer_append_counted_string(sb,  
-                                            (const unsigned char*)"text = ",
-                                            7, 1);
-  raptor_stringbuffer_append_counted_string(sb, value_e, value_e_len, 1);
-  raptor_stringbuffer_append_counted_string(sb, (const unsigned char*)" ", 1, 1);
-
-  if(language) {
-    len = strlen(language);
-    language_e = sqlite_string_escape((unsigned const char*)language, len,
-                                      &language_e_len);
-    if(!language_e)
-      goto tidy;
-
-    raptor_stringbuffer_append_string(sb, (const unsigned char*)"AND language = ", 1);
-    raptor_stringbuffer_append_counted_string(sb, language_e, language_e_len, 1);
-  } else
-    raptor_stringbuffer_append_string(sb, (const unsigned char*)"AND language IS NULL ", 1);
 
   if(datatype) {
     datatype_id = librdf_storage_sqlite_uri_helper(storage, datatype, add_new);
-    raptor_stringbuffer_append_string(sb, (const unsigned char*)"AND datatype = ", 1);
-    raptor_stringbuffer_append_decimal(sb, datatype_id);
-  } else
-    raptor_stringbuffer_append_string(sb, (const unsigned char*)"AND datatype IS NULL ", 1);
-  
-  expression = raptor_stringbuffer_as_string(sb);
-  id = librdf_storage_sqlite_get_helper(storage, TABLE_LITERALS, expression);
-  
-  if(id >= 0 || !add_new)
-    goto tidy;
-  
-  raptor_free_stringbuffer(sb);
-  sb = raptor_new_stringbuffer();
-  if(!sb) {
-    id = -1;
-    goto tidy;
+    /* no such datatype means no such literal */
+    if(datatype_id < 0)
+      return -1;
   }
 
-  raptor_stringbuffer_append_counted_string(sb, value_e, value_e_len, 1);
-
-  raptor_stringbuffer_append_counted_string(sb, (const unsigned char*)", ", 2, 1);
-  if(language_e)
-    raptor_stringbuffer_append_counted_string(sb,language_e, language_e_len, 1);
-  else
-    raptor_stringbuffer_append_counted_string(sb, (const unsigned char*)"NULL", 4, 1);
+  vm = librdf_storage_sqlite_get_stmt(storage, STMT_LITERAL_GET);
+  if(!vm)
+    return -1;
 
-  raptor_stringbuffer_append_counted_string(sb, (const unsigned char*)", ", 2, 1);
-  if(datatype)
-    raptor_stringbuffer_append_decimal(sb, datatype_id);
-  else
-    raptor_stringbuffer_append_counted_string(sb, (const unsigned char*)"NULL", 4, 1);
+  librdf_storage_sqlite_literal_bind(vm, value, value_len, language,
+                                     datatype_id);
+  id = librdf_storage_sqlite_get_helper(storage, vm);
+  if(id >= 0 || !add_new)
+    return id;
 
-  expression = raptor_stringbuffer_as_string(sb);
-  id = librdf_storage_sqlite_set_helper(storage, TABLE_LITERALS, expression,
-                                      raptor_stringbuffer_length(sb));
+  vm = librdf_storage_sqlite_get_stmt(storage, STMT_LITERAL_SET);
+  if(!vm)
+    return -1;
 
-  tidy:
-  if(sb)
-    raptor_free_stringbuffer(sb);
-  if(value_e)
-    LIBRDF_FREE(char*, value_e);
-  if(language_e)
-    LIBRDF_FREE(char*, language_e);
-  
-  return id;
+  librdf_storage_sqlite_literal_bind(vm, value, value_len, language,
+                                     datatype_id);
+  return librdf_storage_sqlite_set_helper(storage, vm);
 }
 
 
 static int
-librdf_storage_sqlite_node_helper(librdf_storage* storage,
-                                  librdf_node* node,
-                                  int* id_p,
-                                  triple_node_type *node_type_p,
-                                  int add_new) 
+librdf_storage_sqlite_node_cache_init(librdf_storage_sqlite_instance* context)
 {
-  int id;
-  triple_node_type node_type;
-  unsigned char *value;
-  size_t value_len;
+  size_t buckets = 1;
+  size_t i;
 
-  if(!node)
+  if(!context->node_cache_size)
+    return 0;
+
+  while(buckets < (size_t)context->node_cache_size)
+    buckets <<= 1;
+
+  context->node_cache = LIBRDF_CALLOC(librdf_storage_sqlite_node_cache_entry*,
+                                      LIBRDF_GOOD_CAST(size_t, context->node_cache_size),
+                                      sizeof(librdf_storage_sqlite_node_cache_entry));
+  context->node_cache_buckets = LIBRDF_MALLOC(int*, buckets * sizeof(int));
+  if(!context->node_cache || !context->node_cache_buckets)
     return 1;
-  
-  switch(librdf_node_get_type(node)) {
-    case LIBRDF_NODE_TYPE_RESOURCE:
-      id = librdf_storage_sqlite_uri_helper(storage,
-                                            librdf_node_get_uri(node),
-                                            add_new);
-      if(id < 0 && add_new)
-        return 1;
 
-      node_type = TRIPLE_URI;
-      break;
+  for(i = 0; i < buckets; i++)
+    context->node_cache_buckets[i] = -1;
+  context->node_cache_buckets_mask = buckets - 1;
+  context->node_cache_count = 0;
+  context->node_cache_hand = 0;
 
-    case LIBRDF_NODE_TYPE_LITERAL:
-      value = librdf_node_get_literal_value_as_counted_string(node, &value_len);
-      id = librdf_storage_sqlite_literal_helper(storage,
-                                                value, value_len,
-                                                librdf_node_get_literal_value_language(node),
-                                                librdf_node_get_literal_value_datatype_uri(node),
-                                                add_new);
-      if(id < 0 && add_new)
-        return 1;
+  return 0;
+}
 
-      node_type = TRIPLE_LITERAL;
-      break;
 
-    case LIBRDF_NODE_TYPE_BLANK:
-      id = librdf_storage_sqlite_blank_helper(storage,
-                                              librdf_node_get_blank_identifier(node),
-                                              add_new);
-      if(id < 0 && add_new)
-        return 1;
+static void
+librdf_storage_sqlite_node_cache_free(librdf_storage_sqlite_instance* context)
+{
+  int i;
 
-      node_type = TRIPLE_BLANK;
-      break;
+  if(context->node_cache) {
+    for(i = 0; i < context->node_cache_count; i++)
+      LIBRDF_FREE(char*, context->node_cache[i].key);
+    LIBRDF_FREE(librdf_storage_sqlite_node_cache_entry*, context->node_cache);
+    context->node_cache = NULL;
+  }
+  context->node_cache_count = 0;
 
-    case LIBRDF_NODE_TYPE_UNKNOWN:
-    default:
-      librdf_log(storage->world,
-                 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
-                 "Do not know how to store node type %d", node->type);
-    return 1;
+  if(context->node_cache_buckets) {
+    LIBRDF_FREE(int*, context->node_cache_buckets);
+    context->node_cache_buckets = NULL;
   }
 
-  if(id_p)
-    *id_p = id;
-  if(node_type_p)
-    *node_type_p = node_type;
-  
-  return 0;
+  if(context->node_buffer) {
+    LIBRDF_FREE(char*, context->node_buffer);
+    context->node_buffer = NULL;
+    context->node_buffer_len = 0;
+  }
 }
 
-                                        
 
+static void
+librdf_storage_sqlite_node_cache_link(librdf_storage_sqlite_instance* context,
+                                      int i)
+{
+  int *bucket;
+
+  bucket = &context->node_cache_buckets[context->node_cache[i].hash & context->node_cache_buckets_mask];
+  context->node_cache[i].next = *bucket;
+  *bucket = i;
+}
+
+
+/*
+ * librdf_storage_sqlite_node_cache_get:
+ * @storage: the storage
+ * @node: node to look up
+ * @key_len_p: pointer to store the encoded @node length on a miss, else 0
+ * @hash_p: pointer to store the encoded @node hash on a miss
+ *
+ * INTERNAL - Look up the row id of a node in the node cache.
+ *
+ * On a miss, the encoded node is left in the node buffer for
+ * librdf_storage_sqlite_node_cache_add.
+ *
+ * Return value: row id or <0 if not cached
+ */
 static int
-librdf_storage_sqlite_statement_helper(librdf_storage* storage,
-                                       librdf_statement* statement,
-                                       librdf_node* context_node,
-                                       triple_node_type node_types[4],
-                                       int node_ids[4],
-                                       const unsigned char* fields[4],
-                                       int add_new) 
+librdf_storage_sqlite_node_cache_get(librdf_storage* storage,
+                                     librdf_node* node,
+                                     size_t *key_len_p, u64 *hash_p)
 {
-  librdf_node* nodes[4];
+  librdf_storage_sqlite_instance* context;
+  librdf_storage_sqlite_node_cache_entry* entry;
+  size_t len;
+  u64 hash;
   int i;
-  
-  nodes[0] = statement ? librdf_statement_get_subject(statement) : NULL;
-  nodes[1] = statement ? librdf_statement_get_predicate(statement) : NULL;
-  nodes[2] = statement ? librdf_statement_get_object(statement) : NULL;
+
+  context = (librdf_storage_sqlite_instance*)storage->instance;
+
+  *key_len_p = 0;
+  if(!context->node_cache)
+    return -1;
+
+  len = librdf_node_encode(node, NULL, 0);
+  if(!len)
+    return -1;
+
+  if(len > context->node_buffer_len) {
+    if(context->node_buffer)
+      LIBRDF_FREE(char*, context->node_buffer);
+    context->node_buffer_len = len + 64;
+    context->node_buffer = LIBRDF_MALLOC(unsigned char*,
+                                         context->node_buffer_len);
+    if(!context->node_buffer) {
+      context->node_buffer_len = 0;
+      return -1;
+    }
+  }
+
+  if(!librdf_node_encode(node, context->node_buffer, len))
+    return -1;
+
+  hash = librdf_hash_function_wyhash(context->node_buffer, len, 0);
+
+  for(i = context->node_cache_buckets[hash & context->node_cache_buckets_mask];
+      i >= 0; i = entry->next) {
+    entry = &context->node_cache[i];
+    if(entry->hash == hash && entry->key_len == len &&
+       !memcmp(entry->key, context->node_buffer, len)) {
+      entry->referenced = 1;
+      context->node_cache_hits++;
+      return entry->id;
+    }
+  }
+
+  context->node_cache_misses++;
+  *key_len_p = len;
+  *hash_p = hash;
+
+  return -1;
+}
+
+
+/*
+ * librdf_storage_sqlite_node_cache_add:
+ * @storage: the storage
+ * @key_len: encoded node length from librdf_storage_sqlite_node_cache_get
+ * @hash: encoded node hash from librdf_storage_sqlite_node_cache_get
+ * @id: row id of the node
+ *
+ * INTERNAL - Add the node in the node buffer to the node cache,
+ * replacing the first entry not used since the CLOCK hand last passed
+ * it when the cache is full.
+ */
+static void
+librdf_storage_sqlite_node_cache_add(librdf_storage* storage,
+                                     size_t key_len, u64 hash, int id)
+{
+  librdf_storage_sqlite_instance* context;
+  librdf_storage_sqlite_node_cache_entry* entry;
+  unsigned char *key;
+  int i;
+
+  context = (librdf_storage_sqlite_instance*)storage->instance;
+
+  key = LIBRDF_MALLOC(unsigned char*, key_len);
+  if(!key)
+    return;
+  memcpy(key, context->node_buffer, key_len);
+
+  if(context->node_cache_count < context->node_cache_size)
+    i = context->node_cache_count++;
+  else {
+    int *link;
+
+    while(context->node_cache[context->node_cache_hand].referenced) {
+      context->node_cache[context->node_cache_hand].referenced = 0;
+      context->node_cache_hand = (context->node_cache_hand + 1) % context->node_cache_size;
+    }
+    i = context->node_cache_hand;
+    context->node_cache_hand = (i + 1) % context->node_cache_size;
+
+    /* unlink the victim from its bucket */
+    entry = &context->node_cache[i];
+    link = &context->node_cache_buckets[entry->hash & context->node_cache_buckets_mask];
+    while(*link != i)
+      link = &context->node_cache[*link].next;
+    *link = entry->next;
+    LIBRDF_FREE(char*, entry->key);
+  }
+
+  entry = &context->node_cache[i];
+  entry->key = key;
+  entry->key_len = key_len;
+  entry->hash = hash;
+  entry->id = id;
+  entry->serial = context->in_transaction ? context->transaction_serial : 0;
+  entry->referenced = 0;
+  librdf_storage_sqlite_node_cache_link(context, i);
+}
+
+
+/*
+ * librdf_storage_sqlite_node_cache_rollback:
+ * @storage: the storage
+ *
+ * INTERNAL - Forget nodes cached during the current transaction since
+ * it did not commit and their rows, and so row ids, are gone.
+ */
+static void
+librdf_storage_sqlite_node_cache_rollback(librdf_storage* storage)
+{
+  librdf_storage_sqlite_instance* context;
+  size_t i;
+  int j;
+  int count = 0;
+
+  context = (librdf_storage_sqlite_instance*)storage->instance;
+
+  if(!context->node_cache)
+    return;
+
+  for(j = 0; j < context->node_cache_count; j++) {
+    if(context->node_cache[j].serial == context->transaction_serial)
+      LIBRDF_FREE(char*, context->node_cache[j].key);
+    else
+      context->node_cache[count++] = context->node_cache[j];
+  }
+
+  if(count == context->node_cache_count)
+    return;
+
+  context->node_cache_count = count;
+  context->node_cache_hand = 0;
+
+  for(i = 0; i <= context->node_cache_buckets_mask; i++)
+    context->node_cache_buckets[i] = -1;
+  for(j = 0; j < count; j++)
+    librdf_storage_sqlite_node_cache_link(context, j);
+}
+
+
+static int
+librdf_storage_sqlite_node_helper(librdf_storage* storage,
+                                  librdf_node* node,
+                                  int* id_p,
+                                  triple_node_type *node_type_p,
+                                  int add_new) 
+{
+  int id;
+  triple_node_type node_type;
+  unsigned char *value;
+  size_t value_len;
+  size_t key_len;
+  u64 hash = 0;
+
+  if(!node)
+    return 1;
+  
+  switch(librdf_node_get_type(node)) {
+    case LIBRDF_NODE_TYPE_RESOURCE:
+      node_type = TRIPLE_URI;
+      break;
+
+    case LIBRDF_NODE_TYPE_LITERAL:
+      node_type = TRIPLE_LITERAL;
+      break;
+
+    case LIBRDF_NODE_TYPE_BLANK:
+      node_type = TRIPLE_BLANK;
+      break;
+
+    case LIBRDF_NODE_TYPE_UNKNOWN:
+    default:
+      librdf_log(storage->world,
+                 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+                 "Do not know how to store node type %d", node->type);
+    return 1;
+  }
+
+  id = librdf_storage_sqlite_node_cache_get(storage, node, &key_len, &hash);
+  if(id >= 0)
+    goto done;
+
+  switch(node_type) {
+    case TRIPLE_URI:
+      id = librdf_storage_sqlite_uri_helper(storage,
+                                            librdf_node_get_uri(node),
+                                            add_new);
+      break;
+
+    case TRIPLE_LITERAL:
+      value = librdf_node_get_literal_value_as_counted_string(node, &value_len);
+      id = librdf_storage_sqlite_literal_helper(storage,
+                                                value, value_len,
+                                                librdf_node_get_literal_value_language(node),
+                                                librdf_node_get_literal_value_datatype_uri(node),
+                                                add_new);
+      break;
+
+    case TRIPLE_BLANK:
+    case TRIPLE_NONE:
+    default:
+      id = librdf_storage_sqlite_blank_helper(storage,
+                                              librdf_node_get_blank_identifier(node),
+                                              add_new);
+      break;
+  }
+
+  if(id < 0) {
+    if(add_new)
+      return 1;
+  } else if(key_len)
+    librdf_storage_sqlite_node_cache_add(storage, key_len, hash, id);
+
+  done:
+  if(id_p)
+    *id_p = id;
+  if(node_type_p)
+    *node_type_p = node_type;
+  
+  return 0;
+}
+
+                                        
+
+static int
+librdf_storage_sqlite_statement_helper(librdf_storage* storage,
+                                       librdf_statement* statement,
+                                       librdf_node* context_node,
+                                       triple_node_type node_types[4],
+                                       int node_ids[4],
+                                       int add_new) 
+{
+  librdf_node* nodes[4];
+  int i;
+  
+  nodes[0] = statement ? librdf_statement_get_subject(statement) : NULL;
+  nodes[1] = statement ? librdf_statement_get_predicate(statement) : NULL;
+  nodes[2] = statement ? librdf_statement_get_object(statement) : NULL;
   nodes[3] = context_node;
     
   for(i = 0; i < 4; i++) {
     if(!nodes[i]) {
-      fields[i] = NULL;
       node_ids[i] = -1;
       node_types[i] = TRIPLE_NONE;
       continue;
@@ -767,14 +1084,229 @@ librdf_storage_sqlite_statement_helper(librdf_storage* storage,
                                          &node_types[i],
                                          add_new))
       return 1;
-
-    fields[i] = (const unsigned char*)triples_fields[i][node_types[i]];
   }
 
   return 0;
 }
 
 
+static void
+sqlite_construct_select_helper(raptor_stringbuffer* sb) 
+{
+  raptor_stringbuffer_append_counted_string(sb, 
+                                            (unsigned char*)"SELECT\n", 7, 1);
+
+  /* If this order is changed MUST CHANGE order in 
+   * librdf_storage_sqlite_get_next_common 
+   */
+  raptor_stringbuffer_append_string(sb, (unsigned char*)
+"  SubjectURIs.uri     AS subjectUri,\n\
+  SubjectBlanks.blank AS subjectBlank,\n\
+  PredicateURIs.uri   AS predicateUri,\n\
+  ObjectURIs.uri      AS objectUri,\n\
+  ObjectBlanks.blank  AS objectBlank,\n\
+  ObjectLiterals.text AS objectLiteralText,\n\
+  ObjectLiterals.language AS objectLiteralLanguage,\n\
+  ObjectLiterals.datatype AS objectLiteralDatatype,\n\
+  ObjectDatatypeURIs.uri  AS objectLiteralDatatypeUri,\n\
+  ContextURIs.uri         AS contextUri\n",
+                                    1);
+  
+  raptor_stringbuffer_append_counted_string(sb, 
+                                            (unsigned char*)"FROM ", 5, 1);
+  raptor_stringbuffer_append_string(sb, 
+                                    (unsigned char*)sqlite_tables[TABLE_TRIPLES].name, 1);
+  raptor_stringbuffer_append_counted_string(sb, 
+                                            (unsigned char*)" AS T\n", 6, 1);
+  
+  raptor_stringbuffer_append_string(sb, (unsigned char*)
+"  LEFT JOIN uris     AS SubjectURIs    ON SubjectURIs.id    = T.subjectUri\n\
+  LEFT JOIN blanks   AS SubjectBlanks  ON SubjectBlanks.id  = T.subjectBlank\n\
+  LEFT JOIN uris     AS PredicateURIs  ON PredicateURIs.id  = T.predicateUri\n\
+  LEFT JOIN uris     AS ObjectURIs     ON ObjectURIs.id     = T.objectUri\n\
+  LEFT JOIN blanks   AS ObjectBlanks   ON ObjectBlanks.id   = T.objectBlank\n\
+  LEFT JOIN literals AS ObjectLiterals ON ObjectLiterals.id = T.objectLiteral\n\
+  LEFT JOIN uris     AS ObjectDatatypeURIs ON ObjectDatatypeURIs.id = objectLiteralDatatype\n\
+  LEFT JOIN uris     AS ContextURIs    ON ContextURIs.id     = T.contextUri\n",
+                                    1);
+}
+
+
+static void
+librdf_storage_sqlite_bind_ids(sqlite3_stmt *vm,
+                               triple_node_type node_types[4],
+                               int node_ids[4])
+{
+  int i;
+
+  /* parameter ?N is the id of triple part N-1, see match_helper */
+  for(i = 0; i < 4; i++) {
+    if(node_types[i] != TRIPLE_NONE)
+      sqlite3_bind_int(vm, i + 1, node_ids[i]);
+  }
+}
+
+
+/*
+ * librdf_storage_sqlite_match_helper:
+ * @storage: the storage
+ * @match: kind of statement (MATCH_*)
+ * @node_types: node types of the triple parts (TRIPLE_NONE for any)
+ *
+ * INTERNAL - Get a prepared statement testing the triples columns given
+ * by @node_types against parameters ?1 to ?4.
+ *
+ * MATCH_CONTAINS and MATCH_REMOVE statements are shared.  A MATCH_SELECT
+ * statement is owned by the caller until given back with
+ * librdf_storage_sqlite_match_release.  A MATCH_REMOVE with no part to
+ * test would delete every triple, so it is refused.
+ *
+ * Return value: statement or NULL on failure
+ */
+static sqlite3_stmt*
+librdf_storage_sqlite_match_helper(librdf_storage* storage,
+                                   int match,
+                                   triple_node_type node_types[4])
+{
+  librdf_storage_sqlite_instance* context;
+  int shape = SQLITE_SHAPE(node_types);
+  sqlite3_stmt *vm;
+  raptor_stringbuffer *sb;
+  const char *prefix = "";
+  int need_where = 1;
+  int i;
+
+  context = (librdf_storage_sqlite_instance*)storage->instance;
+
+  if(match == MATCH_REMOVE) {
+    for(i = 0; i < 4 && node_types[i] == TRIPLE_NONE; i++)
+      ;
+    if(i == 4) {
+      librdf_log(storage->world, 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+                 "Refusing to remove statements matching anything");
+      return NULL;
+    }
+  }
+
+  vm = context->match_stmts[match][shape];
+  if(vm) {
+    if(match == MATCH_SELECT)
+      context->match_stmts[match][shape] = NULL;
+    return vm;
+  }
+
+  sb = raptor_new_stringbuffer();
+  if(!sb)
+    return NULL;
+
+  switch(match) {
+    case MATCH_CONTAINS:
+      raptor_stringbuffer_append_string(sb,
+                                        (const unsigned char*)"SELECT 1 FROM triples", 1);
+      break;
+
+    case MATCH_REMOVE:
+      raptor_stringbuffer_append_string(sb,
+                                        (const unsigned char*)"DELETE FROM triples", 1);
+      break;
+
+    case MATCH_SELECT:
+    default:
+      sqlite_construct_select_helper(sb);
+      prefix = "T.";
+      break;
+  }
+
+  for(i = 0; i < 4; i++) {
+    if(node_types[i] == TRIPLE_NONE)
+      continue;
+
+    if(need_where) {
+      raptor_stringbuffer_append_counted_string(sb,
+                                                (unsigned char*)" WHERE ", 7, 1);
+      need_where = 0;
+    } else
+      raptor_stringbuffer_append_counted_string(sb,
+                                                (unsigned char*)" AND ", 5, 1);
+    raptor_stringbuffer_append_string(sb, (const unsigned char*)prefix, 1);
+    raptor_stringbuffer_append_string(sb,
+                                      (const unsigned char*)triples_fields[i][node_types[i]], 1);
+    raptor_stringbuffer_append_counted_string(sb,
+                                              (unsigned char*)"=?", 2, 1);
+    raptor_stringbuffer_append_decimal(sb, i + 1);
+  }
+
+  if(match == MATCH_CONTAINS)
+    raptor_stringbuffer_append_counted_string(sb,
+                                              (unsigned char*)" LIMIT 1", 8, 1);
+
+  vm = librdf_storage_sqlite_prepare(storage,
+                                     raptor_stringbuffer_as_string(sb),
+                                     LIBRDF_GOOD_CAST(int, raptor_stringbuffer_length(sb)));
+  raptor_free_stringbuffer(sb);
+
+  if(vm && match != MATCH_SELECT)
+    context->match_stmts[match][shape] = vm;
+
+  return vm;
+}
+
+
+/*
+ * librdf_storage_sqlite_match_release:
+ * @storage: the storage
+ * @node_types: node types the statement was made for
+ * @vm: MATCH_SELECT statement from librdf_storage_sqlite_match_helper
+ *
+ * INTERNAL - Give back a select statement for reuse by the next stream
+ * of the same shape, or finalize it if there is already one cached.
+ */
+static void
+librdf_storage_sqlite_match_release(librdf_storage* storage,
+                                    triple_node_type node_types[4],
+                                    sqlite3_stmt *vm)
+{
+  librdf_storage_sqlite_instance* context;
+  sqlite3_stmt **vm_p;
+
+  context = (librdf_storage_sqlite_instance*)storage->instance;
+
+  vm_p = &context->match_stmts[MATCH_SELECT][SQLITE_SHAPE(node_types)];
+  if(!context->db || *vm_p) {
+    sqlite3_finalize(vm);
+    return;
+  }
+
+  sqlite3_reset(vm);
+  sqlite3_clear_bindings(vm);
+  *vm_p = vm;
+}
+
+
+static int
+librdf_storage_sqlite_insert_helper(librdf_storage* storage,
+                                    triple_node_type node_types[4],
+                                    int node_ids[4])
+{
+  sqlite3_stmt *vm;
+  int i;
+
+  vm = librdf_storage_sqlite_get_stmt(storage, STMT_TRIPLE_ADD);
+  if(!vm)
+    return 1;
+
+  for(i = 1; i <= NTRIPLES_PARAMS; i++)
+    sqlite3_bind_null(vm, i);
+
+  for(i = 0; i < 4; i++) {
+    if(node_types[i] != TRIPLE_NONE)
+      sqlite3_bind_int(vm, triples_params[i][node_types[i]], node_ids[i]);
+  }
+
+  return (librdf_storage_sqlite_step(storage, vm, NULL) < 0);
+}
+
+
 static int
 librdf_storage_sqlite_open(librdf_storage* storage, librdf_model* model)
 {
@@ -791,6 +1323,11 @@ librdf_storage_sqlite_open(librdf_storage* storage, librdf_model* model)
   if(context->is_new && db_file_exists)
     unlink(context->name);
 
+  if(librdf_storage_sqlite_node_cache_init(context)) {
+    librdf_storage_sqlite_close(storage);
+    return 1;
+  }
+
   context->db = NULL;
   rc = sqlite3_open(context->name, &context->db);
   if(rc != SQLITE_OK)
@@ -915,14 +1452,35 @@ librdf_storage_sqlite_close(librdf_storage* storage)
 {
   librdf_storage_sqlite_instance* context;
   int status = 0;
+  int i;
   
   context = (librdf_storage_sqlite_instance*)storage->instance;
 
+  for(i = 0; i < NSTMTS; i++) {
+    if(context->stmts[i]) {
+      sqlite3_finalize(context->stmts[i]);
+      context->stmts[i] = NULL;
+    }
+  }
+
+  for(i = 0; i < NMATCHES; i++) {
+    int j;
+
+    for(j = 0; j < NSHAPES; j++) {
+      if(context->match_stmts[i][j]) {
+        sqlite3_finalize(context->match_stmts[i][j]);
+        context->match_stmts[i][j] = NULL;
+      }
+    }
+  }
+
   if(context->db) {
     sqlite3_close(context->db);
     context->db = NULL;
   }
 
+  librdf_storage_sqlite_node_cache_free(context);
+
   return status;
 }
 
@@ -930,16 +1488,13 @@ librdf_storage_sqlite_close(librdf_storage* storage)
 static int
 librdf_storage_sqlite_size(librdf_storage* storage)
 {
-  int count = 0;
+  sqlite3_stmt *vm;
   
-  if(librdf_storage_sqlite_exec(storage,
-                                (unsigned char*)"SELECT COUNT(*) FROM triples;",
-                                librdf_storage_sqlite_get_1int_callback,
-                                &count,
-                                0))
+  vm = librdf_storage_sqlite_get_stmt(storage, STMT_SIZE);
+  if(!vm)
     return -1;
 
-  return count;
+  return librdf_storage_sqlite_get_helper(storage, vm);
 }
 
 
@@ -970,12 +1525,6 @@ librdf_storage_sqlite_add_statements(librdf_storage* storage,
     librdf_node* context_node;
     triple_node_type node_types[4];
     int node_ids[4];
-    const unsigned char* fields[4];
-    raptor_stringbuffer *sb;
-    int i;
-    unsigned char* request;
-    int rc;
-    int max = 3;
     
     statement = librdf_stream_get_object(statement_stream);
     context_node = librdf_stream_get_context2(statement_stream);
@@ -992,59 +1541,14 @@ librdf_storage_sqlite_add_statements(librdf_storage* storage,
     if(librdf_storage_sqlite_statement_helper(storage,
                                               statement,
                                               context_node,
-                                              node_types, node_ids, fields,
+                                              node_types, node_ids,
                                               1)) {
       if(!begin)
         librdf_storage_sqlite_transaction_rollback(storage);
       return -1;
     }
-    
-    if(context_node)
-      max++;
-    
-    /* FIXME no context field used */
-    sb = raptor_new_stringbuffer();
-    if(!sb) {
-      if(!begin)
-        librdf_storage_sqlite_transaction_rollback(storage);
-      return -1;
-    }
 
-    raptor_stringbuffer_append_string(sb,
-                                      (unsigned char*)"INSERT INTO ", 1);
-    raptor_stringbuffer_append_string(sb, 
-                                      (unsigned char*)sqlite_tables[TABLE_TRIPLES].name, 1);
-    raptor_stringbuffer_append_counted_string(sb, 
-                                              (unsigned char*)" ( ", 3, 1);
-    for(i = 0; i < max; i++) {
-      raptor_stringbuffer_append_string(sb, fields[i], 1);
-      if(i < (max-1))
-        raptor_stringbuffer_append_counted_string(sb, 
-                                                  (unsigned char*)", ", 2, 1);
-    }
-    
-    raptor_stringbuffer_append_counted_string(sb, 
-                                              (unsigned char*)") VALUES(", 9, 1);
-    for(i = 0; i < max; i++) {
-      raptor_stringbuffer_append_decimal(sb, node_ids[i]);
-      if(i < (max-1))
-        raptor_stringbuffer_append_counted_string(sb, 
-                                                  (unsigned char*)", ", 2, 1);
-    }
-    raptor_stringbuffer_append_counted_string(sb, 
-                                              (unsigned char*)");", 2, 1);
-    
-    request = raptor_stringbuffer_as_string(sb);
-
-    rc = librdf_storage_sqlite_exec(storage,
-                                    request,
-                                    NULL, /* no callback */
-                                    NULL, /* arg */
-                                    0);
-
-    raptor_free_stringbuffer(sb);
-
-    if(rc) {
+    if(librdf_storage_sqlite_insert_helper(storage, node_types, node_ids)) {
       if(!begin)
         librdf_storage_sqlite_transaction_rollback(storage);
       return 1;
@@ -1068,53 +1572,28 @@ librdf_storage_sqlite_remove_statement(librdf_storage* storage,
 }
 
 
-static int
+static sqlite3_stmt*
 librdf_storage_sqlite_statement_operator_helper(librdf_storage* storage, 
                                                 librdf_statement* statement,
                                                 librdf_node* context_node,
-                                                raptor_stringbuffer* sb,
-                                                int add_new)
+                                                int match)
 {
-  /* librdf_storage_sqlite_instance* context; */
   triple_node_type node_types[4];
   int node_ids[4];
-  const unsigned char* fields[4];
-  int i;
-  int need_and = 0;
-  int max=3;
-  
-  /* context = (librdf_storage_sqlite_instance*)storage->instance; */
-
-  if(context_node)
-    max++;
+  sqlite3_stmt *vm;
   
   if(librdf_storage_sqlite_statement_helper(storage,
                                             statement,
                                             context_node, 
-                                            node_types, node_ids, fields,
-                                            add_new))
-    return 1;
-  
-  raptor_stringbuffer_append_counted_string(sb,
-                                            (const unsigned char*)" FROM ", 6, 1);
-  raptor_stringbuffer_append_string(sb,  
-                                    (const unsigned char*)sqlite_tables[TABLE_TRIPLES].name, 1);
-  raptor_stringbuffer_append_counted_string(sb,  
-                                            (const unsigned char*)" WHERE ", 7, 1);
-  
-  for(i = 0; i < max; i++) {
-    if(need_and)
-      raptor_stringbuffer_append_counted_string(sb, 
-                                                (unsigned char*)" AND ", 5, 1);
-    raptor_stringbuffer_append_string(sb, fields[i], 1);
-    raptor_stringbuffer_append_counted_string(sb,  
-                                              (const unsigned char*)"=", 1, 1);
-    raptor_stringbuffer_append_decimal(sb, node_ids[i]);
-    
-    need_and = 1;
-  }
+                                            node_types, node_ids,
+                                            0))
+    return NULL;
+
+  vm = librdf_storage_sqlite_match_helper(storage, match, node_types);
+  if(vm)
+    librdf_storage_sqlite_bind_ids(vm, node_types, node_ids);
     
-  return 0;
+  return vm;
 }
 
 
@@ -1131,90 +1610,27 @@ librdf_storage_sqlite_context_contains_statement(librdf_storage* storage,
                                                  librdf_node* context_node,
                                                  librdf_statement* statement)
 {
-  raptor_stringbuffer *sb;
-  unsigned char *request;
-  int count = 0;
+  sqlite3_stmt *vm;
   int rc, begin;
 
-  sb = raptor_new_stringbuffer();
-  if(!sb)
-    return -1;
-
   /* returns non-0 if a transaction is already active */
   begin = librdf_storage_sqlite_transaction_start(storage);
 
-  raptor_stringbuffer_append_string(sb, 
-                                    (const unsigned char*)"SELECT 1",
-                                    1);
-
-  if(librdf_storage_sqlite_statement_operator_helper(storage, statement, 
-                                                     context_node, sb, 0)) {
+  vm = librdf_storage_sqlite_statement_operator_helper(storage, statement, 
+                                                       context_node,
+                                                       MATCH_CONTAINS);
+  if(!vm) {
     if(!begin)
       librdf_storage_sqlite_transaction_rollback(storage);
-    raptor_free_stringbuffer(sb);
     return -1;
   }
 
-  raptor_stringbuffer_append_string(sb, (const unsigned char*)" LIMIT 1;", 1);
-  request = raptor_stringbuffer_as_string(sb);
-  
-  rc = librdf_storage_sqlite_exec(storage,
-                                  request,
-                                  librdf_storage_sqlite_get_1int_callback,
-                                  &count,
-                                  0);
-  
-  raptor_free_stringbuffer(sb);
+  rc = librdf_storage_sqlite_step(storage, vm, NULL);
 
   if(!begin)
     librdf_storage_transaction_commit(storage);
 
-  if(rc)  
-    return -1;
-
-  return (count > 0);
-}
-
-
-static void
-sqlite_construct_select_helper(raptor_stringbuffer* sb) 
-{
-  raptor_stringbuffer_append_counted_string(sb, 
-                                            (unsigned char*)"SELECT\n", 7, 1);
-
-  /* If this order is changed MUST CHANGE order in 
-   * librdf_storage_sqlite_get_next_common 
-   */
-  raptor_stringbuffer_append_string(sb, (unsigned char*)
-"  SubjectURIs.uri     AS subjectUri,\n\
-  SubjectBlanks.blank AS subjectBlank,\n\
-  PredicateURIs.uri   AS predicateUri,\n\
-  ObjectURIs.uri      AS objectUri,\n\
-  ObjectBlanks.blank  AS objectBlank,\n\
-  ObjectLiterals.text AS objectLiteralText,\n\
-  ObjectLiterals.language AS objectLiteralLanguage,\n\
-  ObjectLiterals.datatype AS objectLiteralDatatype,\n\
-  ObjectDatatypeURIs.uri  AS objectLiteralDatatypeUri,\n\
-  ContextURIs.uri         AS contextUri\n",
-                                    1);
-  
-  raptor_stringbuffer_append_counted_string(sb, 
-                                            (unsigned char*)"FROM ", 5, 1);
-  raptor_stringbuffer_append_string(sb, 
-                                    (unsigned char*)sqlite_tables[TABLE_TRIPLES].name, 1);
-  raptor_stringbuffer_append_counted_string(sb, 
-                                            (unsigned char*)" AS T\n", 6, 1);
-  
-  raptor_stringbuffer_append_string(sb, (unsigned char*)
-"  LEFT JOIN uris     AS SubjectURIs    ON SubjectURIs.id    = T.subjectUri\n\
-  LEFT JOIN blanks   AS SubjectBlanks  ON SubjectBlanks.id  = T.subjectBlank\n\
-  LEFT JOIN uris     AS PredicateURIs  ON PredicateURIs.id  = T.predicateUri\n\
-  LEFT JOIN uris     AS ObjectURIs     ON ObjectURIs.id     = T.objectUri\n\
-  LEFT JOIN blanks   AS ObjectBlanks   ON ObjectBlanks.id   = T.objectBlank\n\
-  LEFT JOIN literals AS ObjectLiterals ON ObjectLiterals.id = T.objectLiteral\n\
-  LEFT JOIN uris     AS ObjectDatatypeURIs ON ObjectDatatypeURIs.id = objectLiteralDatatype\n\
-  LEFT JOIN uris     AS ContextURIs    ON ContextURIs.id     = T.contextUri\n",
-                                    1);
+  return rc;
 }
 
 
@@ -1227,9 +1643,9 @@ typedef struct {
   librdf_statement *statement;
   librdf_node* context;
 
-  /* OUT from sqlite3_prepare (V3) or sqlite_compile (V2) */
+  /* select statement of shape node_types from match_helper */
+  triple_node_type node_types[4];
   sqlite3_stmt *vm;
-  const char *zTail;
 } librdf_storage_sqlite_serialise_stream_context;
 
 
@@ -1239,60 +1655,27 @@ librdf_storage_sqlite_serialise(librdf_storage* storage)
   librdf_storage_sqlite_instance* context;
   librdf_storage_sqlite_serialise_stream_context* scontext;
   librdf_stream* stream;
-  int status;
-  char *errmsg = NULL;
-  raptor_stringbuffer *sb;
-  unsigned char *request;
-  
-  context = (librdf_storage_sqlite_instance*)storage->instance;
-
-  scontext = LIBRDF_CALLOC(librdf_storage_sqlite_serialise_stream_context*,
-                           1, sizeof(*scontext));
-  if(!scontext)
-    return NULL;
-
-  scontext->storage = storage;
-  librdf_storage_add_reference(scontext->storage);
-
-  scontext->sqlite_context = context;
-  context->in_stream++;
-
-  sb = raptor_new_stringbuffer();
-  if(!sb) {
-    librdf_storage_sqlite_serialise_finished((void*)scontext);
-    return NULL;
-  }
-
-  sqlite_construct_select_helper(sb);
-  raptor_stringbuffer_append_counted_string(sb, 
-                                            (unsigned char*)";", 1, 1);
+  int i;
+  
+  context = (librdf_storage_sqlite_instance*)storage->instance;
 
-  request = raptor_stringbuffer_as_string(sb);
-  if(!request) {
-    raptor_free_stringbuffer(sb);
-    librdf_storage_sqlite_serialise_finished((void*)scontext);
+  scontext = LIBRDF_CALLOC(librdf_storage_sqlite_serialise_stream_context*,
+                           1, sizeof(*scontext));
+  if(!scontext)
     return NULL;
-  }
-
-#if defined(LIBRDF_DEBUG) && LIBRDF_DEBUG > 2
-  LIBRDF_DEBUG2("SQLite prepare '%s'\n", request);
-#endif
 
-  status = sqlite3_prepare(context->db,
-                           (const char*)request,
-                           LIBRDF_GOOD_CAST(int, raptor_stringbuffer_length(sb)),
-                           &scontext->vm,
-                           &scontext->zTail);
-  if(status != SQLITE_OK)
-    errmsg = (char*)sqlite3_errmsg(context->db);
+  scontext->storage = storage;
+  librdf_storage_add_reference(scontext->storage);
 
-  raptor_free_stringbuffer(sb);
+  scontext->sqlite_context = context;
+  context->in_stream++;
 
-  if(status != SQLITE_OK) {
-    librdf_log(storage->world, 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
-               "SQLite database %s SQL compile failed - %s (%d)", 
-               context->name, errmsg, status);
+  for(i = 0; i < 4; i++)
+    scontext->node_types[i] = TRIPLE_NONE;
 
+  scontext->vm = librdf_storage_sqlite_match_helper(storage, MATCH_SELECT,
+                                                    scontext->node_types);
+  if(!scontext->vm) {
     librdf_storage_sqlite_serialise_finished((void*)scontext);
     return NULL;
   }
@@ -1565,21 +1948,9 @@ librdf_storage_sqlite_serialise_finished(void* context)
 
   scontext = (librdf_storage_sqlite_serialise_stream_context*)context;
 
-  if(scontext->vm) {
-    char *errmsg = NULL;
-    int status;
-    
-    status = sqlite3_finalize(scontext->vm);
-    if(status != SQLITE_OK)
-      errmsg = (char*)sqlite3_errmsg(scontext->sqlite_context->db);
-
-    if(status != SQLITE_OK) {
-      librdf_log(scontext->storage->world,
-                 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
-                 "SQLite database %s finalize failed - %s (%d)", 
-                 scontext->sqlite_context->name, errmsg, status);
-    }
-  }
+  if(scontext->vm)
+    librdf_storage_sqlite_match_release(scontext->storage,
+                                        scontext->node_types, scontext->vm);
 
   if(scontext->storage)
     librdf_storage_remove_reference(scontext->storage);
@@ -1609,9 +1980,9 @@ typedef struct {
   librdf_statement *statement;
   librdf_node* context;
 
-  /* OUT from sqlite3_prepare (V3) or sqlite_compile (V2) */
+  /* select statement of shape node_types from match_helper */
+  triple_node_type node_types[4];
   sqlite3_stmt *vm;
-  const char *zTail;
 } librdf_storage_sqlite_find_statements_stream_context;
 
 
@@ -1636,16 +2007,7 @@ librdf_storage_sqlite_find_statements(librdf_storage* storage,
   librdf_storage_sqlite_instance* context;
   librdf_storage_sqlite_find_statements_stream_context* scontext;
   librdf_stream* stream;
-  unsigned char* request;
-  int status;
-  triple_node_type node_types[4];
   int node_ids[4];
-  const unsigned char* fields[4];
-  char *errmsg = NULL;
-  raptor_stringbuffer *sb;
-  int need_where = 1;
-  int need_and = 0;
-  int i;
   
   context = (librdf_storage_sqlite_instance*)storage->instance;
 
@@ -1669,73 +2031,20 @@ librdf_storage_sqlite_find_statements(librdf_storage* storage,
   if(librdf_storage_sqlite_statement_helper(storage,
                                             statement,
                                             NULL, 
-                                            node_types, node_ids, fields,
+                                            scontext->node_types, node_ids,
                                             0)) {
     librdf_storage_sqlite_find_statements_finished((void*)scontext);
     return NULL;
   }
 
-  sb = raptor_new_stringbuffer();
-  if(!sb) {
-    librdf_storage_sqlite_find_statements_finished((void*)scontext);
-    return NULL;
-  }
-
-  sqlite_construct_select_helper(sb);
-
-  for(i = 0; i < 3; i++) {
-    if(node_types[i] == TRIPLE_NONE)
-      continue;
-    
-    if(need_where) {
-      raptor_stringbuffer_append_counted_string(sb, 
-                                                (unsigned char*)" WHERE ", 7, 1);
-      need_where = 0;
-      need_and = 1;
-    } else if(need_and)
-      raptor_stringbuffer_append_counted_string(sb, 
-                                                (unsigned char*)" AND ", 5, 1);
-    raptor_stringbuffer_append_counted_string(sb, 
-                                              (unsigned char*)"T.", 2, 1);
-    raptor_stringbuffer_append_string(sb, fields[i], 1);
-    raptor_stringbuffer_append_counted_string(sb, 
-                                              (unsigned char*)"=", 1, 1);
-    raptor_stringbuffer_append_decimal(sb, node_ids[i]);
-    raptor_stringbuffer_append_counted_string(sb, 
-                                              (unsigned char*)"\n", 1, 1);
-  }
-  raptor_stringbuffer_append_counted_string(sb, 
-                                            (unsigned char*)";", 1, 1);
-  
-  request = raptor_stringbuffer_as_string(sb);
-  if(!request) {
-    raptor_free_stringbuffer(sb);
+  scontext->vm = librdf_storage_sqlite_match_helper(storage, MATCH_SELECT,
+                                                    scontext->node_types);
+  if(!scontext->vm) {
     librdf_storage_sqlite_find_statements_finished((void*)scontext);
     return NULL;
   }
 
-#if defined(LIBRDF_DEBUG) && LIBRDF_DEBUG > 2
-  LIBRDF_DEBUG2("SQLite prepare '%s'\n", request);
-#endif
-
-  status = sqlite3_prepare(context->db,
-                           (const char*)request,
-                           LIBRDF_GOOD_CAST(int, raptor_stringbuffer_length(sb)),
-                           &scontext->vm,
-                           &scontext->zTail);
-  if(status != SQLITE_OK)
-    errmsg = (char*)sqlite3_errmsg(context->db);
-
-  raptor_free_stringbuffer(sb);
-
-  if(status != SQLITE_OK) {
-    librdf_log(storage->world, 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
-               "SQLite database %s SQL compile '%s' failed - %s (%d)", 
-               context->name, request, errmsg, status);
-
-    librdf_storage_sqlite_find_statements_finished((void*)scontext);
-    return NULL;
-  }
+  librdf_storage_sqlite_bind_ids(scontext->vm, scontext->node_types, node_ids);
   
   stream = librdf_new_stream(storage->world,
                              (void*)scontext,
@@ -1837,21 +2146,9 @@ librdf_storage_sqlite_find_statements_finished(void* context)
 
   scontext  = (librdf_storage_sqlite_find_statements_stream_context*)context;
 
-  if(scontext->vm) {
-    char *errmsg = NULL;
-    int status;
-    
-    status = sqlite3_finalize(scontext->vm);
-    if(status != SQLITE_OK)
-      errmsg = (char*)sqlite3_errmsg(scontext->sqlite_context->db);
-
-    if(status != SQLITE_OK) {
-      librdf_log(scontext->storage->world,
-                 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
-                 "SQLite database %s finalize failed - %s (%d)", 
-                 scontext->sqlite_context->name, errmsg, status);
-    }
-  }
+  if(scontext->vm)
+    librdf_storage_sqlite_match_release(scontext->storage,
+                                        scontext->node_types, scontext->vm);
 
   if(scontext->storage)
     librdf_storage_remove_reference(scontext->storage);
@@ -1891,75 +2188,32 @@ librdf_storage_sqlite_context_add_statement(librdf_storage* storage,
   /* librdf_storage_sqlite_instance* context; */
   triple_node_type node_types[4];
   int node_ids[4];
-  const unsigned char* fields[4];
-  raptor_stringbuffer *sb;
-  unsigned char* request;
-  int i;
   int rc, begin;
-  int max=3;
-
-  /* Do not add duplicate statements */
-  if(librdf_storage_sqlite_context_contains_statement(storage, context_node, statement))
-    return 0;
 
   /* context = (librdf_storage_sqlite_instance*)storage->instance; */
 
-  sb = raptor_new_stringbuffer();
-  if(!sb)
-    return -1;
-
   /* returns non-0 if transaction is already active */
   begin = librdf_storage_sqlite_transaction_start(storage);
 
+  /* Do not add duplicate statements */
+  if(librdf_storage_sqlite_context_contains_statement(storage, context_node, statement)) {
+    if(!begin)
+      librdf_storage_transaction_commit(storage);
+    return 0;
+  }
+
   if(librdf_storage_sqlite_statement_helper(storage,
                                             statement,
                                             context_node,
-                                            node_types, node_ids, fields,
+                                            node_types, node_ids,
                                             1)) {
 
     if(!begin)
       librdf_storage_sqlite_transaction_rollback(storage);
-    raptor_free_stringbuffer(sb);
     return -1;
   }
   
-  if(context_node)
-    max++;
-
-  raptor_stringbuffer_append_string(sb, 
-                                    (unsigned char*)"INSERT INTO ", 1);
-  raptor_stringbuffer_append_string(sb, 
-                                    (unsigned char*)sqlite_tables[TABLE_TRIPLES].name, 1);
-  raptor_stringbuffer_append_counted_string(sb, 
-                                            (unsigned char*)" ( ", 3, 1);
-  for(i = 0; i < max; i++) {
-    raptor_stringbuffer_append_string(sb, fields[i], 1);
-    if(i < (max-1))
-      raptor_stringbuffer_append_counted_string(sb, 
-                                                (unsigned char*)", ", 2, 1);
-  }
-  
-  raptor_stringbuffer_append_counted_string(sb, 
-                                            (unsigned char*)") VALUES(", 9, 1);
-  for(i = 0; i < max; i++) {
-    raptor_stringbuffer_append_decimal(sb, node_ids[i]);
-    if(i < (max-1))
-      raptor_stringbuffer_append_counted_string(sb, 
-                                                (unsigned char*)", ", 2, 1);
-  }
-  raptor_stringbuffer_append_counted_string(sb, 
-                                            (unsigned char*)");", 2, 1);
-  
-  request = raptor_stringbuffer_as_string(sb);
-  
-  rc = librdf_storage_sqlite_exec(storage,
-                                  request,
-                                  NULL, /* no callback */
-                                  NULL, /* arg */
-                                  0);
-  
-  raptor_free_stringbuffer(sb);
-  
+  rc = librdf_storage_sqlite_insert_helper(storage, node_types, node_ids);
   if(rc) {
     if(!begin)
       librdf_storage_transaction_rollback(storage);
@@ -1989,37 +2243,17 @@ librdf_storage_sqlite_context_remove_statement(librdf_storage* storage,
                                                librdf_statement* statement) 
 {
   /* librdf_storage_sqlite_instance* context; */
-  int rc;
-  raptor_stringbuffer *sb;
-  unsigned char *request;
+  sqlite3_stmt *vm;
 
   /* context = (librdf_storage_sqlite_instance*)storage->instance; */
 
-  sb = raptor_new_stringbuffer();
-  if(!sb)
-    return -1;
-
-  raptor_stringbuffer_append_string(sb, (const unsigned char*)"DELETE", 1);
-  if(librdf_storage_sqlite_statement_operator_helper(storage, statement,
-                                                     context_node, sb, 0)) {
-    raptor_free_stringbuffer(sb);
+  vm = librdf_storage_sqlite_statement_operator_helper(storage, statement,
+                                                       context_node,
+                                                       MATCH_REMOVE);
+  if(!vm)
     return -1;
-  }
-
-  raptor_stringbuffer_append_counted_string(sb,
-                                            (const unsigned char*)";", 1, 1);
- 
-  request = raptor_stringbuffer_as_string(sb);
-  
-  rc = librdf_storage_sqlite_exec(storage,
-                                  request,
-                                  NULL,
-                                  NULL,
-                                  0);
-  
-  raptor_free_stringbuffer(sb);
 
-  return rc;
+  return (librdf_storage_sqlite_step(storage, vm, NULL) < 0);
 }
 
 
@@ -2027,52 +2261,22 @@ static  int
 librdf_storage_sqlite_context_remove_statements(librdf_storage* storage, 
                                                 librdf_node* context_node)
 {
-  triple_node_type node_types[4];
-  int node_ids[4];
-  const unsigned char* fields[4];
-  raptor_stringbuffer *sb;
-  unsigned char *request;
-  int rc = 0;
-  
+  sqlite3_stmt *vm;
   
-  if(librdf_storage_sqlite_statement_helper(storage,
-                                            NULL,
-                                            context_node,
-                                            node_types, node_ids, fields, 0))
-    return -1;
-    
-  sb = raptor_new_stringbuffer();
-  if(!sb)
+  /* no context would match the statements of every context */
+  if(!context_node) {
+    librdf_log(storage->world, 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
+               "Cannot remove the statements of a NULL context");
     return -1;
+  }
 
-  raptor_stringbuffer_append_counted_string(sb,
-                                    (unsigned char*)"DELETE FROM ", 12, 1);
-  raptor_stringbuffer_append_string(sb, 
-                                    (unsigned char*)sqlite_tables[TABLE_TRIPLES].name, 1);
-
-  raptor_stringbuffer_append_counted_string(sb, 
-                                            (unsigned char*)" WHERE ", 7, 1);
-
-  raptor_stringbuffer_append_string(sb, fields[TRIPLE_CONTEXT], 1);
-  raptor_stringbuffer_append_counted_string(sb, 
-                                            (unsigned char*)"=", 1, 1);
-  raptor_stringbuffer_append_decimal(sb, node_ids[TRIPLE_CONTEXT]);
-  raptor_stringbuffer_append_counted_string(sb, 
-                                            (unsigned char*)"\n", 1, 1);
-  raptor_stringbuffer_append_counted_string(sb, 
-                                            (unsigned char*)";", 1, 1);
-  
-  request = raptor_stringbuffer_as_string(sb);
-
-  rc = librdf_storage_sqlite_exec(storage,
-                                  request,
-                                  NULL, /* no callback */
-                                  NULL, /* arg */
-                                  0);
-
-  raptor_free_stringbuffer(sb);
+  vm = librdf_storage_sqlite_statement_operator_helper(storage, NULL,
+                                                       context_node,
+                                                       MATCH_REMOVE);
+  if(!vm)
+    return -1;
 
-  if(rc)
+  if(librdf_storage_sqlite_step(storage, vm, NULL) < 0)
     return -1;
 
   return 0;
@@ -2090,9 +2294,9 @@ typedef struct {
   librdf_statement *statement;
   librdf_node* context;
 
-  /* OUT from sqlite3_prepare (V3) or sqlite_compile (V2) */
+  /* select statement of shape node_types from match_helper */
+  triple_node_type node_types[4];
   sqlite3_stmt *vm;
-  const char *zTail;
 } librdf_storage_sqlite_context_serialise_stream_context;
 
 
@@ -2112,13 +2316,7 @@ librdf_storage_sqlite_context_serialise(librdf_storage* storage,
   librdf_storage_sqlite_instance* context;
   librdf_storage_sqlite_context_serialise_stream_context* scontext;
   librdf_stream* stream;
-  int status;
-  char *errmsg = NULL;
-  triple_node_type node_types[4];
   int node_ids[4];
-  const unsigned char* fields[4];
-  raptor_stringbuffer *sb;
-  unsigned char *request;
 
   context = (librdf_storage_sqlite_instance*)storage->instance;
 
@@ -2138,61 +2336,20 @@ librdf_storage_sqlite_context_serialise(librdf_storage* storage,
   if(librdf_storage_sqlite_statement_helper(storage,
                                             NULL,
                                             scontext->context_node,
-                                            node_types, node_ids, fields,
+                                            scontext->node_types, node_ids,
                                             0)) {
     librdf_storage_sqlite_context_serialise_finished((void*)scontext);
     return NULL;
   }
 
-  sb = raptor_new_stringbuffer();
-  if(!sb) {
-    librdf_storage_sqlite_context_serialise_finished((void*)scontext);
-    return NULL;
-  }
-
-  sqlite_construct_select_helper(sb);
-  raptor_stringbuffer_append_counted_string(sb, 
-                                            (unsigned char*)" WHERE ", 7, 1);
-  raptor_stringbuffer_append_counted_string(sb, 
-                                            (unsigned char*)"T.", 2, 1);
-  raptor_stringbuffer_append_string(sb, fields[TRIPLE_CONTEXT], 1);
-  raptor_stringbuffer_append_counted_string(sb, 
-                                            (unsigned char*)"=", 1, 1);
-  raptor_stringbuffer_append_decimal(sb, node_ids[TRIPLE_CONTEXT]);
-  raptor_stringbuffer_append_counted_string(sb, 
-                                            (unsigned char*)"\n", 1, 1);
-  raptor_stringbuffer_append_counted_string(sb, 
-                                            (unsigned char*)";", 1, 1);
-  
-  request = raptor_stringbuffer_as_string(sb);
-  if(!request) {
-    raptor_free_stringbuffer(sb);
+  scontext->vm = librdf_storage_sqlite_match_helper(storage, MATCH_SELECT,
+                                                    scontext->node_types);
+  if(!scontext->vm) {
     librdf_storage_sqlite_context_serialise_finished((void*)scontext);
     return NULL;
   }
 
-#if defined(LIBRDF_DEBUG) && LIBRDF_DEBUG > 2
-  LIBRDF_DEBUG2("SQLite prepare '%s'\n", request);
-#endif
-
-  status = sqlite3_prepare(context->db,
-                           (const char*)request,
-                           LIBRDF_GOOD_CAST(int, raptor_stringbuffer_length(sb)),
-                           &scontext->vm,
-                           &scontext->zTail);
-  if(status != SQLITE_OK)
-    errmsg = (char*)sqlite3_errmsg(context->db);
-
-  raptor_free_stringbuffer(sb);
-
-  if(status != SQLITE_OK) {
-    librdf_log(storage->world, 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
-               "SQLite database %s SQL compile failed - %s (%d)", 
-               context->name, errmsg, status);
-
-    librdf_storage_sqlite_context_serialise_finished((void*)scontext);
-    return NULL;
-  }
+  librdf_storage_sqlite_bind_ids(scontext->vm, scontext->node_types, node_ids);
 
   stream = librdf_new_stream(storage->world,
                              (void*)scontext,
@@ -2295,21 +2452,9 @@ librdf_storage_sqlite_context_serialise_finished(void* context)
 
   scontext = (librdf_storage_sqlite_context_serialise_stream_context*)context;
 
-  if(scontext->vm) {
-    char *errmsg = NULL;
-    int status;
-    
-    status = sqlite3_finalize(scontext->vm);
-    if(status != SQLITE_OK)
-      errmsg = (char*)sqlite3_errmsg(scontext->sqlite_context->db);
-
-    if(status != SQLITE_OK) {
-      librdf_log(scontext->storage->world,
-                 0, LIBRDF_LOG_ERROR, LIBRDF_FROM_STORAGE, NULL,
-                 "SQLite database %s finalize failed - %s (%d)", 
-                 scontext->sqlite_context->name, errmsg, status);
-    }
-  }
+  if(scontext->vm)
+    librdf_storage_sqlite_match_release(scontext->storage,
+                                        scontext->node_types, scontext->vm);
 
   if(scontext->storage)
     librdf_storage_remove_reference(scontext->storage);
@@ -2649,10 +2794,11 @@ librdf_storage_sqlite_get_contexts(librdf_storage* storage)
 static librdf_node*
 librdf_storage_sqlite_get_feature(librdf_storage* storage, librdf_uri* feature)
 {
-  /* librdf_storage_sqlite_instance* scontext; */
+  librdf_storage_sqlite_instance* scontext;
   unsigned char *uri_string;
+  unsigned char value[24];
 
-  /* scontext = (librdf_storage_sqlite_instance*)storage->instance; */
+  scontext = (librdf_storage_sqlite_instance*)storage->instance;
 
   if(!feature)
     return NULL;
@@ -2667,10 +2813,35 @@ librdf_storage_sqlite_get_feature(librdf_storage* storage, librdf_uri* feature)
                                               NULL, NULL);
   }
 
+  if(!strcmp((const char*)uri_string, LIBRDF_STORAGE_FEATURE_NODE_CACHE_HITS)) {
+    sprintf((char*)value, "%lu", scontext->node_cache_hits);
+    return librdf_new_node_from_typed_literal(storage->world,
+                                              value, NULL, NULL);
+  }
+
+  if(!strcmp((const char*)uri_string, LIBRDF_STORAGE_FEATURE_NODE_CACHE_MISSES)) {
+    sprintf((char*)value, "%lu", scontext->node_cache_misses);
+    return librdf_new_node_from_typed_literal(storage->world,
+                                              value, NULL, NULL);
+  }
+
   return NULL;
 }
 
 
+static int
+librdf_storage_sqlite_transaction_helper(librdf_storage *storage, int stmt)
+{
+  sqlite3_stmt *vm;
+
+  vm = librdf_storage_sqlite_get_stmt(storage, stmt);
+  if(!vm)
+    return 1;
+
+  return (librdf_storage_sqlite_step(storage, vm, NULL) < 0);
+}
+
+
 /**
  * librdf_storage_sqlite_transaction_start:
  * @storage: #librdf_storage object
@@ -2691,11 +2862,12 @@ librdf_storage_sqlite_transaction_start(librdf_storage *storage)
   if(context->in_transaction)
     return 1;
 
-  rc = librdf_storage_sqlite_exec(storage,
-                                  (unsigned char *)"BEGIN IMMEDIATE;",
-                                  NULL, NULL, 0);
-  if(!rc)
+  rc = librdf_storage_sqlite_transaction_helper(storage, STMT_BEGIN);
+  if(!rc) {
     context->in_transaction = 1;      
+    if(!++context->transaction_serial)
+      context->transaction_serial = 1;
+  }
   
   return rc;
 }
@@ -2721,11 +2893,12 @@ librdf_storage_sqlite_transaction_commit(librdf_storage *storage)
   if(!context->in_transaction)
     return 1;
     
-  rc = librdf_storage_sqlite_exec(storage,
-                                  (unsigned char *)"END;",
-                                  NULL, NULL, 0);
+  rc = librdf_storage_sqlite_transaction_helper(storage, STMT_COMMIT);
   if(!rc)
     context->in_transaction = 0;
+  else
+    /* SQLite may have rolled back already, do not trust the new ids */
+    librdf_storage_sqlite_node_cache_rollback(storage);
 
   return rc;
 }
@@ -2751,12 +2924,12 @@ librdf_storage_sqlite_transaction_rollback(librdf_storage *storage)
   if(!context->in_transaction)
     return 1;
 
-  rc = librdf_storage_sqlite_exec(storage,
-                                  (unsigned char *)"ROLLBACK;",
-                                  NULL, NULL, 0);
+  rc = librdf_storage_sqlite_transaction_helper(storage, STMT_ROLLBACK);
   if(!rc)
     context->in_transaction = 0;
 
+  librdf_storage_sqlite_node_cache_rollback(storage);
+
   return rc;
 }
 
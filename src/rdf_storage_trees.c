@@ -36,6 +36,9 @@
 #ifdef HAVE_STDLIB_H
 #include <stdlib.h>
 #endif
+#ifdef WITH_THREADS
+#include <pthread.h>
+#endif
 /* for ptrdiff_t */
 #ifdef HAVE_STDDEF_H
 #include <stddef.h>
@@ -44,29 +47,102 @@
 
 #include <redland.h>
 
-/* Not yet fully implemented (namely iteration) */
-/*#define RDF_STORAGE_TREES_WITH_CONTEXTS 1*/
+/* Trees of a graph, also used to pick the tree for a pattern */
+#define LIBRDF_STORAGE_TREES_INDEX_SPO 0
+#define LIBRDF_STORAGE_TREES_INDEX_SOP 1
+#define LIBRDF_STORAGE_TREES_INDEX_OPS 2
+#define LIBRDF_STORAGE_TREES_INDEX_PSO 3
+#define LIBRDF_STORAGE_TREES_INDEX_POS 4
+#define LIBRDF_STORAGE_TREES_INDEX_COUNT 5
+
+/* Count B+tree nodes visited by iterators, for tests */
+#if defined(LIBRDF_DEBUG) || defined(STANDALONE)
+#define LIBRDF_STORAGE_TREES_VISIT(tree) (tree)->visits++
+#else
+#define LIBRDF_STORAGE_TREES_VISIT(tree) do { } while(0)
+#endif
+
+/* Items per B+tree node: a leaf of 64 bit pointers is two 64 byte
+ * cache lines */
+#define LIBRDF_STORAGE_TREES_BTREE_ORDER 14
+
+/* Nodes with fewer items are merged with a neighbour when they fit */
+#define LIBRDF_STORAGE_TREES_BTREE_MIN (LIBRDF_STORAGE_TREES_BTREE_ORDER / 2)
+
+/* Spare nodes kept for inserts, which add at most one node per level
+ * and a new root; with half full nodes 2^31 items need 11 levels */
+#define LIBRDF_STORAGE_TREES_BTREE_SPARES 16
+
+#ifdef __GNUC__
+#define LIBRDF_STORAGE_TREES_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define LIBRDF_STORAGE_TREES_PREFETCH(addr) do { } while(0)
+#endif
+
+/* Leaf of a B+tree: statements in order, chained for range scans */
+typedef struct librdf_storage_trees_btree_leaf_s
+{
+  int count;
+  struct librdf_storage_trees_btree_leaf_s* next;
+  void* items[LIBRDF_STORAGE_TREES_BTREE_ORDER];
+} librdf_storage_trees_btree_leaf;
+
+/* Branch of a B+tree: keys[i] is the first item under children[i] */
+typedef struct
+{
+  int count;
+  void* keys[LIBRDF_STORAGE_TREES_BTREE_ORDER];
+  void* children[LIBRDF_STORAGE_TREES_BTREE_ORDER];
+} librdf_storage_trees_btree_branch;
+
+/* Either node, for allocating spares */
+typedef union
+{
+  librdf_storage_trees_btree_leaf leaf;
+  librdf_storage_trees_btree_branch branch;
+} librdf_storage_trees_btree_node;
 
 typedef struct
 {
-#ifdef RDF_STORAGE_TREES_WITH_CONTEXTS
-  librdf_node* context;
+  raptor_data_compare_handler compare;
+  raptor_data_free_handler free_handler; /* NULL if items are shared */
+  void* root; /* a leaf when height is 0 */
+  int height;
+  int size;
+  /* nodes allocated before an insert so it cannot fail half way */
+  void* spares[LIBRDF_STORAGE_TREES_BTREE_SPARES];
+  int spares_count;
+#if defined(LIBRDF_DEBUG) || defined(STANDALONE)
+  long visits;
 #endif
-  raptor_avltree* spo_tree; /* Always present */
-  raptor_avltree* sop_tree; /* Optional */
-  raptor_avltree* ops_tree; /* Optional */
-  raptor_avltree* pso_tree; /* Optional */
+} librdf_storage_trees_btree;
+
+/* Position in a B+tree, on the stack or inside a stream context */
+typedef struct
+{
+  librdf_storage_trees_btree* tree;
+  void* range; /* item to match or NULL for all; not owned */
+  librdf_storage_trees_btree_leaf* leaf; /* NULL at the end */
+  int index;
+} librdf_storage_trees_btree_iterator;
+
+typedef struct
+{
+  librdf_node* context; /* NULL for statements without a context */
+  /* by LIBRDF_STORAGE_TREES_INDEX_; spo is always present and owns
+   * the statements, the others are optional */
+  librdf_storage_trees_btree* trees[LIBRDF_STORAGE_TREES_INDEX_COUNT];
 } librdf_storage_trees_graph;
 
 typedef struct
 {
   librdf_storage_trees_graph* graph; /* Statements without a context */
-#ifdef RDF_STORAGE_TREES_WITH_CONTEXTS
   raptor_avltree* contexts; /* Tree of librdf_storage_trees_graph */
-#endif
-  int index_sop;
-  int index_ops;
-  int index_pso;
+  /* Optional statements of every context graph, sharing them and
+   * ordered by their context after the statement parts */
+  librdf_storage_trees_graph* all_graphs;
+  /* non 0 for the trees kept, by LIBRDF_STORAGE_TREES_INDEX_ */
+  int indexes[LIBRDF_STORAGE_TREES_INDEX_COUNT];
 } librdf_storage_trees_instance;
 
 /* prototypes for local functions */
@@ -78,16 +154,15 @@ static int librdf_storage_trees_add_statement(librdf_storage* storage, librdf_st
 static int librdf_storage_trees_add_statements(librdf_storage* storage, librdf_stream* statement_stream);
 static int librdf_storage_trees_remove_statement(librdf_storage* storage, librdf_statement* statement);
 static int librdf_storage_trees_remove_statement_internal(librdf_storage_trees_graph* graph, librdf_statement* statement);
+static librdf_storage_trees_graph* librdf_storage_trees_find_graph(librdf_storage* storage, librdf_node* context_node);
 static int librdf_storage_trees_contains_statement(librdf_storage* storage, librdf_statement* statement);
 static librdf_stream* librdf_storage_trees_serialise(librdf_storage* storage);
 static librdf_stream* librdf_storage_trees_find_statements(librdf_storage* storage, librdf_statement* statement);
 
 /* graph functions */
-static librdf_storage_trees_graph* librdf_storage_trees_graph_new(librdf_storage* storage, librdf_node* context);
+static librdf_storage_trees_graph* librdf_storage_trees_graph_new(librdf_storage* storage, librdf_node* context, int owns_statements);
 static void librdf_storage_trees_graph_free(void* data);
-#ifdef RDF_STORAGE_TREES_WITH_CONTEXTS
 static int librdf_storage_trees_graph_compare(const void* data1, const void* data2);
-#endif
 
 /* serialising implementing functions */
 static int librdf_storage_trees_serialise_end_of_stream(void* context);
@@ -96,19 +171,62 @@ static void* librdf_storage_trees_serialise_get_statement(void* context, int fla
 static void librdf_storage_trees_serialise_finished(void* context);
 
 /* context functions */
-#ifdef RDF_STORAGE_TREES_WITH_CONTEXTS
 static int librdf_storage_trees_context_add_statement(librdf_storage* storage, librdf_node* context_node, librdf_statement* statement);
 static int librdf_storage_trees_context_remove_statement(librdf_storage* storage, librdf_node* context_node, librdf_statement* statement);
+static int librdf_storage_trees_context_remove_statements(librdf_storage* storage, librdf_node* context_node);
+static int librdf_storage_trees_context_size(librdf_storage* storage, librdf_node* context_node);
 static librdf_stream* librdf_storage_trees_context_serialise(librdf_storage* storage, librdf_node* context_node);
-#endif
+static librdf_stream* librdf_storage_trees_find_statements_in_context(librdf_storage* storage, librdf_statement* statement, librdf_node* context_node);
+static librdf_iterator* librdf_storage_trees_get_contexts(librdf_storage* storage);
+
+/* get_contexts iterator functions */
+static int librdf_storage_trees_get_contexts_is_end(void* iterator);
+static int librdf_storage_trees_get_contexts_next_method(void* iterator);
+static void* librdf_storage_trees_get_contexts_get_method(void* iterator, int flags);
+static void librdf_storage_trees_get_contexts_finished(void* iterator);
 
 /* statement tree functions */
 static int librdf_statement_compare_spo(const void* data1, const void* data2);
 static int librdf_statement_compare_sop(const void* data1, const void* data2);
 static int librdf_statement_compare_ops(const void* data1, const void* data2);
 static int librdf_statement_compare_pso(const void* data1, const void* data2);
+static int librdf_statement_compare_pos(const void* data1, const void* data2);
+
+/* comparison of each tree, by LIBRDF_STORAGE_TREES_INDEX_ */
+static const raptor_data_compare_handler librdf_storage_trees_index_compare[LIBRDF_STORAGE_TREES_INDEX_COUNT] = {
+  librdf_statement_compare_spo,
+  librdf_statement_compare_sop,
+  librdf_statement_compare_ops,
+  librdf_statement_compare_pso,
+  librdf_statement_compare_pos
+};
+
+/* statement parts in the order of each tree, by LIBRDF_STORAGE_TREES_INDEX_ */
+static const librdf_statement_part librdf_storage_trees_index_parts[LIBRDF_STORAGE_TREES_INDEX_COUNT][3] = {
+  { LIBRDF_STATEMENT_SUBJECT, LIBRDF_STATEMENT_PREDICATE, LIBRDF_STATEMENT_OBJECT },
+  { LIBRDF_STATEMENT_SUBJECT, LIBRDF_STATEMENT_OBJECT, LIBRDF_STATEMENT_PREDICATE },
+  { LIBRDF_STATEMENT_OBJECT, LIBRDF_STATEMENT_PREDICATE, LIBRDF_STATEMENT_SUBJECT },
+  { LIBRDF_STATEMENT_PREDICATE, LIBRDF_STATEMENT_SUBJECT, LIBRDF_STATEMENT_OBJECT },
+  { LIBRDF_STATEMENT_PREDICATE, LIBRDF_STATEMENT_OBJECT, LIBRDF_STATEMENT_SUBJECT }
+};
 static void librdf_storage_trees_avl_free(void* data);
 
+/* B+tree functions */
+static librdf_storage_trees_btree* librdf_storage_trees_btree_new(raptor_data_compare_handler compare, raptor_data_free_handler free_handler);
+static void librdf_storage_trees_btree_free(librdf_storage_trees_btree* tree);
+static void librdf_storage_trees_btree_free_node(raptor_data_free_handler free_handler, void* node, int height);
+static int librdf_storage_trees_btree_clear(librdf_storage_trees_btree* tree);
+static int librdf_storage_trees_btree_add(librdf_storage_trees_btree* tree, void* item);
+static void* librdf_storage_trees_btree_search(librdf_storage_trees_btree* tree, const void* item);
+static int librdf_storage_trees_btree_delete(librdf_storage_trees_btree* tree, const void* item);
+static int librdf_storage_trees_btree_size(librdf_storage_trees_btree* tree);
+static void librdf_storage_trees_btree_iterator_init(librdf_storage_trees_btree_iterator* iterator, librdf_storage_trees_btree* tree, void* range);
+static int librdf_storage_trees_btree_iterator_is_end(librdf_storage_trees_btree_iterator* iterator);
+static int librdf_storage_trees_btree_iterator_next(librdf_storage_trees_btree_iterator* iterator);
+static void* librdf_storage_trees_btree_iterator_get(librdf_storage_trees_btree_iterator* iterator);
+static int librdf_storage_trees_btree_build(librdf_storage_trees_btree* tree, void** items, int count);
+static int librdf_storage_trees_sort(void** items, int count, raptor_data_compare_handler compare);
+
 
 static void librdf_storage_trees_register_factory(librdf_storage_factory *factory);
 
@@ -122,6 +240,8 @@ librdf_storage_trees_init(librdf_storage* storage, const char *name,
   const int index_sop_option = librdf_hash_get_as_boolean(options, "index-sop") > 0;
   const int index_ops_option = librdf_hash_get_as_boolean(options, "index-ops") > 0;
   const int index_pso_option = librdf_hash_get_as_boolean(options, "index-pso") > 0;
+  const int index_pos_option = librdf_hash_get_as_boolean(options, "index-pos") > 0;
+  const int index_graphs_option = librdf_hash_get_as_boolean(options, "index-graphs") > 0;
 
   librdf_storage_trees_instance* context;
 
@@ -134,31 +254,37 @@ librdf_storage_trees_init(librdf_storage* storage, const char *name,
 
   librdf_storage_set_instance(storage, context);
 
-#ifdef RDF_STORAGE_TREES_WITH_CONTEXTS
-  /* Support contexts if option given */
-  if (librdf_hash_get_as_boolean(options, "contexts") > 0) {
-    context->contexts=librdf_new_avltree(librdf_storage_trees_graph_compare,
-      librdf_storage_trees_graph_free);
+  /* spo is always indexed, option just exists so user can
+   * specifically /only/ index spo */
+  context->indexes[LIBRDF_STORAGE_TREES_INDEX_SPO]=1;
+
+  /* No indexing options given, index all by default; pos answers no
+   * pattern better than ops or pso so is only kept when asked for */
+  if (!index_spo_option && !index_sop_option && !index_ops_option &&
+      !index_pso_option && !index_pos_option) {
+    context->indexes[LIBRDF_STORAGE_TREES_INDEX_SOP]=1;
+    context->indexes[LIBRDF_STORAGE_TREES_INDEX_OPS]=1;
+    context->indexes[LIBRDF_STORAGE_TREES_INDEX_PSO]=1;
   } else {
-    context->contexts=NULL;
+    context->indexes[LIBRDF_STORAGE_TREES_INDEX_SOP]=index_sop_option;
+    context->indexes[LIBRDF_STORAGE_TREES_INDEX_OPS]=index_ops_option;
+    context->indexes[LIBRDF_STORAGE_TREES_INDEX_PSO]=index_pso_option;
+    context->indexes[LIBRDF_STORAGE_TREES_INDEX_POS]=index_pos_option;
   }
-#endif
+  
+  context->graph = librdf_storage_trees_graph_new(storage, NULL, 1);
 
-  /* No indexing options given, index all by default */
-  if (!index_spo_option && !index_sop_option && !index_ops_option && !index_pso_option) {
-    context->index_sop=1;
-    context->index_ops=1;
-    context->index_pso=1;
+  /* Support contexts if option given */
+  if (librdf_hash_get_as_boolean(options, "contexts") > 0) {
+    context->contexts=raptor_new_avltree(librdf_storage_trees_graph_compare,
+                                         librdf_storage_trees_graph_free,
+                                         /* flags */ 0);
+    if(context->contexts && index_graphs_option)
+      context->all_graphs = librdf_storage_trees_graph_new(storage, NULL, 0);
   } else {
-    /* spo is always indexed, option just exists so user can
-     * specifically /only/ index spo */
-    context->index_sop=index_sop_option;
-    context->index_ops=index_ops_option;
-    context->index_pso=index_pso_option;
+    context->contexts=NULL;
   }
   
-  context->graph = librdf_storage_trees_graph_new(storage, NULL);
-  
   /* no more options, might as well free them now */
   if(options)
     librdf_free_hash(options);
@@ -201,10 +327,16 @@ librdf_storage_trees_close(librdf_storage* storage)
   librdf_storage_trees_graph_free(context->graph);
   context->graph=NULL;
   
-#ifdef RDF_STORAGE_TREES_WITH_CONTEXTS
-  librdf_free_avltree(context->contexts);
-  context->contexts=NULL;
-#endif
+  /* shares the statements of the context graphs so goes first */
+  if(context->all_graphs) {
+    librdf_storage_trees_graph_free(context->all_graphs);
+    context->all_graphs=NULL;
+  }
+
+  if(context->contexts) {
+    raptor_free_avltree(context->contexts);
+    context->contexts=NULL;
+  }
   
   return 0;
 }
@@ -214,8 +346,49 @@ static int
 librdf_storage_trees_size(librdf_storage* storage)
 {
   librdf_storage_trees_instance* context=(librdf_storage_trees_instance*)storage->instance;
+  int size = librdf_storage_trees_btree_size(context->graph->trees[LIBRDF_STORAGE_TREES_INDEX_SPO]);
+
+  if (context->all_graphs) {
+    size += librdf_storage_trees_btree_size(context->all_graphs->trees[LIBRDF_STORAGE_TREES_INDEX_SPO]);
+  } else if (context->contexts) {
+    raptor_avltree_iterator* iterator;
+
+    iterator = raptor_new_avltree_iterator(context->contexts, NULL, NULL, 1);
+    if (!iterator)
+      return -1;
+    for (; !raptor_avltree_iterator_is_end(iterator);
+         raptor_avltree_iterator_next(iterator)) {
+      librdf_storage_trees_graph* graph = (librdf_storage_trees_graph*)
+        raptor_avltree_iterator_get(iterator);
+      size += librdf_storage_trees_btree_size(graph->trees[LIBRDF_STORAGE_TREES_INDEX_SPO]);
+    }
+    raptor_free_avltree_iterator(iterator);
+  }
+
+  return size;
+}
+
+
+/* Add a statement to the optional trees of a graph.  On failure it is
+ * in none of them.  Returns non 0 on failure */
+static int
+librdf_storage_trees_graph_add_indexes(librdf_storage_trees_graph* graph,
+                                       librdf_statement* statement) 
+{
+  int i;
+
+  for (i = LIBRDF_STORAGE_TREES_INDEX_SPO + 1; i < LIBRDF_STORAGE_TREES_INDEX_COUNT; i++) {
+    if (graph->trees[i] &&
+        librdf_storage_trees_btree_add(graph->trees[i], statement) < 0) {
+      while (--i > LIBRDF_STORAGE_TREES_INDEX_SPO) {
+        if (graph->trees[i])
+          librdf_storage_trees_btree_delete(graph->trees[i], statement);
+      }
+      return 1;
+    }
+  }
 
-  return raptor_avltree_size(context->graph->spo_tree);
+  return 0;
 }
 
 
@@ -229,25 +402,43 @@ librdf_storage_trees_add_statement_internal(librdf_storage* storage,
   
   /* copy statement (store single copy in all trees) */
   statement = librdf_new_statement_from_statement(statement);
+  if (!statement)
+    return -1;
+
+  /* the stored statement carries the context of its graph */
+  if (statement->graph)
+    librdf_free_node(statement->graph);
+  statement->graph = graph->context ? librdf_new_node_from_node(graph->context) : NULL;
     
   /* spo_tree owns statement */
-  status = raptor_avltree_add(graph->spo_tree, statement);
+  status = librdf_storage_trees_btree_add(graph->trees[LIBRDF_STORAGE_TREES_INDEX_SPO], statement);
   if (status > 0) /* item already exists; old item remains in tree */
     return 0;
-  else if (status < 0) /* failure */
+  else if (status < 0) { /* failure */
+    librdf_free_statement(statement);
     return status;
+  }
     
-  /* others have null deleters */
-  /* (XXX: corrupt model if insertions fail) */
+  /* others have null deleters; on failure the statement is taken out
+   * of every tree it went in, spo last as it frees the statement */
+  if (librdf_storage_trees_graph_add_indexes(graph, statement)) {
+    librdf_storage_trees_btree_delete(graph->trees[LIBRDF_STORAGE_TREES_INDEX_SPO], statement);
+    return -1;
+  }
 
-  if (context->index_sop)
-    raptor_avltree_add(graph->sop_tree, statement);
-    
-  if (context->index_ops)
-    raptor_avltree_add(graph->ops_tree, statement);
-    
-  if (context->index_pso)
-    raptor_avltree_add(graph->pso_tree, statement);
+  if (graph->context && context->all_graphs) {
+    librdf_storage_trees_graph* all_graphs = context->all_graphs;
+
+    if (librdf_storage_trees_btree_add(all_graphs->trees[LIBRDF_STORAGE_TREES_INDEX_SPO], statement) < 0) {
+      librdf_storage_trees_remove_statement_internal(graph, statement);
+      return -1;
+    }
+    if (librdf_storage_trees_graph_add_indexes(all_graphs, statement)) {
+      librdf_storage_trees_btree_delete(all_graphs->trees[LIBRDF_STORAGE_TREES_INDEX_SPO], statement);
+      librdf_storage_trees_remove_statement_internal(graph, statement);
+      return -1;
+    }
+  }
     
   return status;
 }
@@ -273,12 +464,204 @@ librdf_storage_trees_add_statement(librdf_storage* storage,
 }
 
 
+/* One tree to build in bulk, possibly in its own thread */
+typedef struct {
+  librdf_storage_trees_btree* tree;
+  void** statements; /* deduplicated, in spo order; shared */
+  int count;
+  int status;
+} librdf_storage_trees_bulk_index;
+
+
+/* Sort a copy of the statements in the order of a tree and build it */
+static void*
+librdf_storage_trees_bulk_build_index(void* data)
+{
+  librdf_storage_trees_bulk_index* index=(librdf_storage_trees_bulk_index*)data;
+  void** statements;
+
+  index->status = 1;
+
+  statements = LIBRDF_MALLOC(void**, sizeof(void*) * index->count);
+  if (!statements)
+    return NULL;
+  memcpy(statements, index->statements, sizeof(void*) * index->count);
+
+  if (!librdf_storage_trees_sort(statements, index->count, index->tree->compare))
+    index->status = librdf_storage_trees_btree_build(index->tree, statements,
+                                                     index->count);
+
+  LIBRDF_FREE(void**, statements);
+  return NULL;
+}
+
+
+/*
+ * librdf_storage_trees_bulk_build:
+ * @graph: graph with empty trees
+ * @statements: statements for @graph, owned
+ * @count: number of statements
+ *
+ * INTERNAL - Build the trees of an empty graph from unsorted statements.
+ *
+ * The statements are sorted once in spo order and duplicates freed.
+ * Each other tree sorts its own copy, in parallel when built with
+ * threads, and every tree is then built bottom up in linear time
+ * rather than by one insert per statement.
+ *
+ * Return value: non 0 on failure, when @statements are freed and the
+ * trees left empty
+ */
+static int
+librdf_storage_trees_bulk_build(librdf_storage_trees_graph* graph,
+                                void** statements, int count)
+{
+  librdf_storage_trees_bulk_index indexes[LIBRDF_STORAGE_TREES_INDEX_COUNT];
+#ifdef WITH_THREADS
+  pthread_t threads[LIBRDF_STORAGE_TREES_INDEX_COUNT];
+  int started[LIBRDF_STORAGE_TREES_INDEX_COUNT];
+#endif
+  librdf_storage_trees_btree* spo_tree = graph->trees[LIBRDF_STORAGE_TREES_INDEX_SPO];
+  int status = 0;
+  int unique;
+  int i;
+
+  if (!count)
+    return 0;
+
+  if (librdf_storage_trees_sort(statements, count, spo_tree->compare)) {
+    status = 1;
+    unique = count;
+    goto tidy;
+  }
+
+  /* keep the first of each run of equal statements */
+  for (i = 0, unique = 0; i < count; i++) {
+    if (unique && !spo_tree->compare(statements[unique - 1], statements[i]))
+      librdf_free_statement((librdf_statement*)statements[i]);
+    else
+      statements[unique++] = statements[i];
+  }
+
+  for (i = LIBRDF_STORAGE_TREES_INDEX_SPO + 1; i < LIBRDF_STORAGE_TREES_INDEX_COUNT; i++) {
+    indexes[i].tree = graph->trees[i];
+    indexes[i].statements = statements;
+    indexes[i].count = unique;
+    indexes[i].status = 0;
+#ifdef WITH_THREADS
+    started[i] = (indexes[i].tree &&
+                  !pthread_create(&threads[i], NULL,
+                                  librdf_storage_trees_bulk_build_index,
+                                  &indexes[i]));
+    if (started[i])
+      continue;
+#endif
+    if (indexes[i].tree)
+      librdf_storage_trees_bulk_build_index(&indexes[i]);
+  }
+
+  status = librdf_storage_trees_btree_build(spo_tree, statements, unique);
+
+  for (i = LIBRDF_STORAGE_TREES_INDEX_SPO + 1; i < LIBRDF_STORAGE_TREES_INDEX_COUNT; i++) {
+#ifdef WITH_THREADS
+    if (started[i])
+      pthread_join(threads[i], NULL);
+#endif
+    if (indexes[i].tree && indexes[i].status)
+      status = 1;
+  }
+
+  tidy:
+  if (status) {
+    /* empty every tree again, which the spare root each built tree
+     * keeps makes sure of; the statements are only freed here */
+    for (i = LIBRDF_STORAGE_TREES_INDEX_COUNT - 1; i >= LIBRDF_STORAGE_TREES_INDEX_SPO; i--) {
+      librdf_storage_trees_btree* tree = graph->trees[i];
+      if (tree && tree->size)
+        librdf_storage_trees_btree_clear(tree);
+    }
+    for (i = 0; i < unique; i++)
+      librdf_free_statement((librdf_statement*)statements[i]);
+  }
+
+  return status;
+}
+
+
+/*
+ * librdf_storage_trees_add_statements:
+ * @storage: #librdf_storage object
+ * @statement_stream: #librdf_stream of statements
+ *
+ * INTERNAL - Add a stream of statements (with no context) to the storage.
+ *
+ * While the storage has no statements without a context, the stream is
+ * buffered and its trees built in bulk by
+ * librdf_storage_trees_bulk_build(), as when loading a dataset once to
+ * query it many times.
+ *
+ * Return value: non 0 on failure
+ */
 static int
 librdf_storage_trees_add_statements(librdf_storage* storage,
                                     librdf_stream* statement_stream)
 {
+  librdf_storage_trees_instance* context=(librdf_storage_trees_instance*)storage->instance;
   int status=0;
 
+  if (!librdf_storage_trees_btree_size(context->graph->trees[LIBRDF_STORAGE_TREES_INDEX_SPO])) {
+    void** statements = NULL;
+    int count = 0;
+    int size = 0;
+
+    for(; !librdf_stream_end(statement_stream); librdf_stream_next(statement_stream)) {
+      librdf_statement* statement=librdf_stream_get_object(statement_stream);
+
+      if (!statement) {
+        status=1;
+        break;
+      }
+
+      if (count == size) {
+        void** bigger;
+
+        size = size ? 2 * size : 1024;
+        bigger = LIBRDF_MALLOC(void**, sizeof(void*) * size);
+        if (!bigger) {
+          status=-1;
+          break;
+        }
+        if (count)
+          memcpy(bigger, statements, sizeof(void*) * count);
+        if (statements)
+          LIBRDF_FREE(void**, statements);
+        statements = bigger;
+      }
+
+      /* copy statement (store single copy in all trees) */
+      statement = librdf_new_statement_from_statement(statement);
+      if (!statement) {
+        status=-1;
+        break;
+      }
+      if (statement->graph) {
+        librdf_free_node(statement->graph);
+        statement->graph = NULL;
+      }
+      statements[count++] = statement;
+    }
+
+    if (status < 0) {
+      while (count--)
+        librdf_free_statement((librdf_statement*)statements[count]);
+    } else if (librdf_storage_trees_bulk_build(context->graph, statements, count))
+      status=-1;
+
+    if (statements)
+      LIBRDF_FREE(void**, statements);
+    return status;
+  }
+
   for(; !librdf_stream_end(statement_stream); librdf_stream_next(statement_stream)) {
     librdf_statement* statement=librdf_stream_get_object(statement_stream);
 
@@ -299,16 +682,13 @@ static int
 librdf_storage_trees_remove_statement_internal(librdf_storage_trees_graph* graph,
                                                librdf_statement* statement) 
 {
-  if (graph->sop_tree)
-    raptor_avltree_delete(graph->sop_tree, statement);
-
-  if (graph->ops_tree)
-    raptor_avltree_delete(graph->ops_tree, statement);
+  int i;
 
-  if (graph->pso_tree)
-    raptor_avltree_delete(graph->pso_tree, statement);
-  
-  raptor_avltree_delete(graph->spo_tree, statement);
+  /* spo frees the statement so goes last */
+  for (i = LIBRDF_STORAGE_TREES_INDEX_COUNT - 1; i >= LIBRDF_STORAGE_TREES_INDEX_SPO; i--) {
+    if (graph->trees[i])
+      librdf_storage_trees_btree_delete(graph->trees[i], statement);
+  }
   
   return 0;
 }
@@ -337,22 +717,163 @@ static int
 librdf_storage_trees_contains_statement(librdf_storage* storage, librdf_statement* statement)
 {
   librdf_storage_trees_instance* context=(librdf_storage_trees_instance*)storage->instance;
+  raptor_avltree_iterator* iterator;
+  int found = 0;
+
+  if (librdf_storage_trees_btree_search(context->graph->trees[LIBRDF_STORAGE_TREES_INDEX_SPO], statement) != NULL)
+    return 1;
+
+  /* the statement may be in any context */
+  if (context->all_graphs)
+    return (librdf_storage_trees_btree_search(context->all_graphs->trees[LIBRDF_STORAGE_TREES_INDEX_SPO], statement) != NULL);
+
+  if (!context->contexts)
+    return 0;
+
+  iterator = raptor_new_avltree_iterator(context->contexts, NULL, NULL, 1);
+  if (!iterator)
+    return 0;
+  for (; !found && !raptor_avltree_iterator_is_end(iterator);
+       raptor_avltree_iterator_next(iterator)) {
+    librdf_storage_trees_graph* graph = (librdf_storage_trees_graph*)
+      raptor_avltree_iterator_get(iterator);
+    found = (librdf_storage_trees_btree_search(graph->trees[LIBRDF_STORAGE_TREES_INDEX_SPO], statement) != NULL);
+  }
+  raptor_free_avltree_iterator(iterator);
 
-  return (raptor_avltree_search(context->graph->spo_tree, statement) != NULL);
+  return found;
 }
 
 
 typedef struct {
   librdf_storage *storage;
-  raptor_avltree_iterator *avltree_iterator;
-#ifdef RDF_STORAGE_TREES_WITH_CONTEXTS
-  librdf_node *context_node;
-#endif
+  librdf_statement *range; /* statement to match or NULL for all */
+  int index; /* LIBRDF_STORAGE_TREES_INDEX_ tree to iterate */
+  librdf_storage_trees_btree_iterator iterator;
+  /* graphs to visit after the current one */
+  librdf_storage_trees_graph *next_graph;
+  raptor_avltree_iterator *graphs_iterator;
 } librdf_storage_trees_serialise_stream_context;
 
 
+/* Start iterating the statements of a graph matching a stream range */
+static void
+librdf_storage_trees_graph_iterator(librdf_storage_trees_serialise_stream_context* scontext,
+                                    librdf_storage_trees_graph* graph)
+{
+  /* the stream context owns the range */
+  librdf_storage_trees_btree_iterator_init(&scontext->iterator,
+                                           graph->trees[scontext->index],
+                                           scontext->range);
+}
+
+
+/*
+ * librdf_storage_trees_choose_index:
+ * @context: storage instance
+ * @range: statement to match
+ * @filter: set to non 0 if statements found still need matching
+ *
+ * INTERNAL - Pick the tree to answer a statement pattern from.
+ *
+ * The tree whose ordering starts with the most bound parts of @range
+ * is used, since those parts select one run of the tree.  Unless a
+ * tree starts with every bound part, the rest are matched by filtering
+ * the run; with the default trees this never happens.
+ *
+ * Return value: LIBRDF_STORAGE_TREES_INDEX_ of the tree
+ */
+static int
+librdf_storage_trees_choose_index(librdf_storage_trees_instance* context,
+                                  librdf_statement* range, int* filter)
+{
+  int bound = 0;
+  int parts = 0;
+  int best = LIBRDF_STORAGE_TREES_INDEX_SPO;
+  int best_prefix = -1;
+  int i;
+
+  if (range->subject) {
+    bound |= LIBRDF_STATEMENT_SUBJECT;
+    parts++;
+  }
+  if (range->predicate) {
+    bound |= LIBRDF_STATEMENT_PREDICATE;
+    parts++;
+  }
+  if (range->object) {
+    bound |= LIBRDF_STATEMENT_OBJECT;
+    parts++;
+  }
+
+  for (i = 0; i < LIBRDF_STORAGE_TREES_INDEX_COUNT; i++) {
+    int prefix = 0;
+
+    if (!context->indexes[i])
+      continue;
+
+    while (prefix < 3 && (bound & librdf_storage_trees_index_parts[i][prefix]))
+      prefix++;
+
+    if (prefix > best_prefix) {
+      best = i;
+      best_prefix = prefix;
+    }
+  }
+
+  *filter = (best_prefix < parts);
+  return best;
+}
+
+
+/* Move on to the first graph with a matching statement when the
+ * current one has none left.  Returns non 0 at the end of the stream.
+ */
+static int
+librdf_storage_trees_serialise_next_graph(librdf_storage_trees_serialise_stream_context* scontext)
+{
+  while (librdf_storage_trees_btree_iterator_is_end(&scontext->iterator)) {
+    librdf_storage_trees_graph* graph = NULL;
+
+    if (scontext->next_graph) {
+      graph = scontext->next_graph;
+      scontext->next_graph = NULL;
+    } else if (scontext->graphs_iterator &&
+               !raptor_avltree_iterator_is_end(scontext->graphs_iterator)) {
+      graph = (librdf_storage_trees_graph*)
+        raptor_avltree_iterator_get(scontext->graphs_iterator);
+      raptor_avltree_iterator_next(scontext->graphs_iterator);
+    }
+
+    if (!graph)
+      return 1;
+
+    librdf_storage_trees_graph_iterator(scontext, graph);
+  }
+
+  return 0;
+}
+
+
+/*
+ * librdf_storage_trees_serialise_range:
+ * @storage: the storage
+ * @graph: graph to return statements from or NULL for every graph
+ * @range: statement to match (owned) or NULL for all statements
+ *
+ * INTERNAL - Return a stream of the statements of one or every graph
+ * matching a statement.
+ *
+ * Every graph is the statements without a context followed by the
+ * statements of each context graph, or of the all_graphs trees when
+ * present.
+ *
+ * Return value: a #librdf_stream or NULL on failure
+ */
 static librdf_stream*
-librdf_storage_trees_serialise_range(librdf_storage* storage, librdf_statement* range)
+librdf_storage_trees_serialise_range(librdf_storage* storage,
+                                     librdf_storage_trees_graph* graph,
+                                     librdf_statement* range)
 {
   librdf_storage_trees_instance* context=(librdf_storage_trees_instance*)storage->instance;
   librdf_storage_trees_serialise_stream_context* scontext;
@@ -361,78 +882,48 @@ librdf_storage_trees_serialise_range(librdf_storage* storage, librdf_statement*
   
   scontext = LIBRDF_CALLOC(librdf_storage_trees_serialise_stream_context*, 1,
                            sizeof(*scontext));
-  if(!scontext)
+  if(!scontext) {
+    if (range)
+      librdf_free_statement(range);
     return NULL;
+  }
     
-  scontext->avltree_iterator = NULL;
+  scontext->index = LIBRDF_STORAGE_TREES_INDEX_SPO;
 
   /* ?s ?p ?o */
   if (!range || (!range->subject && !range->predicate && !range->object)) {
-    scontext->avltree_iterator = raptor_new_avltree_iterator(context->graph->spo_tree,
-                                                             /* range */ NULL,
-                                                             /* range free */ NULL,
-                                                             1);
     if (range) {
       librdf_free_statement(range);
       range=NULL;
     }
-  /* s ?p o */
-  } else if (range->subject && !range->predicate && range->object) {
-    if (context->index_sop)
-      scontext->avltree_iterator = raptor_new_avltree_iterator(context->graph->sop_tree,
-                                                               range, 
-                                                               librdf_storage_trees_avl_free,
-                                                               1);
-	else
-		filter=1;
-  /* s _ _ */
-  } else if (range->subject) {
-    scontext->avltree_iterator = raptor_new_avltree_iterator(context->graph->spo_tree,
-                                                             range,
-                                                             librdf_storage_trees_avl_free,
-                                                             1);
-  /* ?s _ o */
-  } else if (range->object) {
-    if (context->index_ops)
-      scontext->avltree_iterator = raptor_new_avltree_iterator(context->graph->ops_tree,
-                                                               range,
-                                                               librdf_storage_trees_avl_free,
-                                                               1);
-	else
-		filter=1;
-  /* ?s p ?o */
-  } else { /* range->predicate != NULL */
-    if (context->index_pso)
-      scontext->avltree_iterator = raptor_new_avltree_iterator(context->graph->pso_tree,
-                                                               range,
-                                                               librdf_storage_trees_avl_free,
-                                                               1);
-	else
-		filter=1;
-  }
+  } else
+    scontext->index = librdf_storage_trees_choose_index(context, range, &filter);
     
   /* If filter is set, we're missing the required index.
-   * Iterate over the entire model and filter the stream.
-   * (With a fully indexed store, this will never happen) */
-  if (filter) {
-    scontext->avltree_iterator = raptor_new_avltree_iterator(context->graph->spo_tree,
-                                                     range,
-                                                     librdf_storage_trees_avl_free,
-                                                     1);
-  }
-
-#ifdef RDF_STORAGE_TREES_WITH_CONTEXTS
-  scontext->context_node=NULL;
-#endif
+   * Iterate over the run of the statements matching the leading bound
+   * parts and filter the stream. */
+  scontext->range = range;
 
-  if(!scontext->avltree_iterator) {
-    LIBRDF_FREE(librdf_storage_trees_serialise_stream_context, scontext);
-    return librdf_new_empty_stream(storage->world);
-  }
-  
   scontext->storage=storage;
   librdf_storage_add_reference(scontext->storage);
 
+  if (!graph) {
+    graph = context->graph;
+    if (context->all_graphs) {
+      scontext->next_graph = context->all_graphs;
+    } else if (context->contexts) {
+      scontext->graphs_iterator = raptor_new_avltree_iterator(context->contexts,
+                                                              NULL, NULL, 1);
+      if(!scontext->graphs_iterator) {
+        librdf_storage_trees_serialise_finished((void*)scontext);
+        return NULL;
+      }
+    }
+  }
+
+  librdf_storage_trees_graph_iterator(scontext, graph);
+  librdf_storage_trees_serialise_next_graph(scontext);
+  
   stream=librdf_new_stream(storage->world,
                            (void*)scontext,
                            &librdf_storage_trees_serialise_end_of_stream,
@@ -460,7 +951,7 @@ librdf_storage_trees_serialise_range(librdf_storage* storage, librdf_statement*
 static librdf_stream*
 librdf_storage_trees_serialise(librdf_storage* storage)
 {
-  return librdf_storage_trees_serialise_range(storage, NULL);
+  return librdf_storage_trees_serialise_range(storage, NULL, NULL);
 }
 
 
@@ -469,7 +960,7 @@ librdf_storage_trees_serialise_end_of_stream(void* context)
 {
   librdf_storage_trees_serialise_stream_context* scontext=(librdf_storage_trees_serialise_stream_context*)context;
 
-  return raptor_avltree_iterator_is_end(scontext->avltree_iterator);
+  return librdf_storage_trees_btree_iterator_is_end(&scontext->iterator);
 }
 
 static int
@@ -477,7 +968,9 @@ librdf_storage_trees_serialise_next_statement(void* context)
 {
   librdf_storage_trees_serialise_stream_context* scontext=(librdf_storage_trees_serialise_stream_context*)context;
 
-  return raptor_avltree_iterator_next(scontext->avltree_iterator);
+  librdf_storage_trees_btree_iterator_next(&scontext->iterator);
+
+  return librdf_storage_trees_serialise_next_graph(scontext);
 }
 
 
@@ -485,18 +978,17 @@ static void*
 librdf_storage_trees_serialise_get_statement(void* context, int flags)
 {
   librdf_storage_trees_serialise_stream_context* scontext=(librdf_storage_trees_serialise_stream_context*)context;
+  librdf_statement* statement;
 
-  if(!scontext->avltree_iterator)
-    return NULL;
+  statement = (librdf_statement*)librdf_storage_trees_btree_iterator_get(&scontext->iterator);
 
   switch(flags) {
     case LIBRDF_ITERATOR_GET_METHOD_GET_OBJECT:
-      return (librdf_statement*)raptor_avltree_iterator_get(scontext->avltree_iterator);
+      return statement;
 
-#ifdef RDF_STORAGE_TREES_WITH_CONTEXTS
     case LIBRDF_ITERATOR_GET_METHOD_GET_CONTEXT:
-      return scontext->context_node;
-#endif
+      /* stored statements carry the context of their graph */
+      return statement ? statement->graph : NULL;
 
     default:
       return NULL;
@@ -509,8 +1001,11 @@ librdf_storage_trees_serialise_finished(void* context)
 {
   librdf_storage_trees_serialise_stream_context* scontext=(librdf_storage_trees_serialise_stream_context*)context;
 
-  if(scontext->avltree_iterator)
-    raptor_free_avltree_iterator(scontext->avltree_iterator);
+  if(scontext->graphs_iterator)
+    raptor_free_avltree_iterator(scontext->graphs_iterator);
+
+  if(scontext->range)
+    librdf_free_statement(scontext->range);
 
   if(scontext->storage)
     librdf_storage_remove_reference(scontext->storage);
@@ -519,7 +1014,37 @@ librdf_storage_trees_serialise_finished(void* context)
 }
 
 
-#ifdef RDF_STORAGE_TREES_WITH_CONTEXTS
+/*
+ * librdf_storage_trees_find_graph:
+ * @storage: #librdf_storage object
+ * @context_node: #librdf_node context or NULL
+ *
+ * INTERNAL - Find the graph of a context.
+ *
+ * Return value: the graph, the graph of statements without a context
+ * if @context_node is NULL, or NULL if the context has no statements
+ */
+static librdf_storage_trees_graph*
+librdf_storage_trees_find_graph(librdf_storage* storage,
+                                librdf_node* context_node)
+{
+  librdf_storage_trees_instance* context=(librdf_storage_trees_instance*)storage->instance;
+  librdf_storage_trees_graph key; /* on stack - only context is used */
+
+  if (!context_node)
+    return context->graph;
+
+  if (!context->contexts) {
+    librdf_log(storage->world, 0, LIBRDF_LOG_WARN, LIBRDF_FROM_STORAGE, NULL,
+               "Storage was created without context support");
+    return NULL;
+  }
+
+  key.context = context_node;
+  return (librdf_storage_trees_graph*)raptor_avltree_search(context->contexts, &key);
+}
+
+
 /**
  * librdf_storage_trees_context_add_statement:
  * @storage: #librdf_storage object
@@ -536,19 +1061,35 @@ librdf_storage_trees_context_add_statement(librdf_storage* storage,
                                            librdf_statement* statement) 
 {
   librdf_storage_trees_instance* context=(librdf_storage_trees_instance*)storage->instance;
-  
-  librdf_storage_trees_graph* key=librdf_storage_trees_graph_new(storage, context_node);
-  librdf_storage_trees_graph* graph=(librdf_storage_trees_graph*)
-    raptor_avltree_search(context->contexts, key);
-  
-  if(graph) {
-    librdf_storage_trees_graph_free(key);
-  } else {
-    raptor_avltree_add(context->contexts, key);
-    graph=key;
+  librdf_storage_trees_graph* graph;
+  int status;
+
+  if (!context_node)
+    return librdf_storage_trees_add_statement(storage, statement);
+
+  if (!context->contexts) {
+    librdf_log(storage->world, 0, LIBRDF_LOG_WARN, LIBRDF_FROM_STORAGE, NULL,
+               "Storage was created without context support");
+    return 1;
+  }
+
+  graph=librdf_storage_trees_find_graph(storage, context_node);
+  if (!graph) {
+    graph=librdf_storage_trees_graph_new(storage, context_node, 1);
+    if (!graph)
+      return -1;
+    if (raptor_avltree_add(context->contexts, graph))
+      return -1;
   }
     
-  return librdf_storage_trees_add_statement_internal(storage, graph, statement);
+  status = librdf_storage_trees_add_statement_internal(storage, graph, statement);
+
+  /* a context graph is only kept while it has statements */
+  if (status < 0 &&
+      !librdf_storage_trees_btree_size(graph->trees[LIBRDF_STORAGE_TREES_INDEX_SPO]))
+    raptor_avltree_delete(context->contexts, graph);
+
+  return status;
 }
 
 
@@ -560,7 +1101,10 @@ librdf_storage_trees_context_add_statement(librdf_storage* storage,
  *
  * Remove a statement from a storage context.
  * 
- * Return value: non 0 on failure
+ * A context graph left empty is removed.
+ * 
+ * Return value: non 0 on failure, -1 if the context has no statements
+ * and 1 if the statement is not in the context
  **/
 static int
 librdf_storage_trees_context_remove_statement(librdf_storage* storage, 
@@ -568,37 +1112,208 @@ librdf_storage_trees_context_remove_statement(librdf_storage* storage,
                                               librdf_statement* statement) 
 {
   librdf_storage_trees_instance* context=(librdf_storage_trees_instance*)storage->instance;
-  librdf_storage_trees_graph* key=librdf_storage_trees_graph_new(storage, context_node);
-  librdf_storage_trees_graph* graph=(librdf_storage_trees_graph*)
-    raptor_avltree_search(context->contexts, &key);
-  librdf_storage_trees_graph_free(key);
-  if (graph) {
-    return librdf_storage_trees_remove_statement_internal(graph, statement);
-  } else {
+  librdf_storage_trees_graph* graph;
+  librdf_statement* stored;
+
+  if (!context_node)
+    return librdf_storage_trees_remove_statement(storage, statement);
+
+  graph=librdf_storage_trees_find_graph(storage, context_node);
+  if (!graph)
     return -1;
-  }
+
+  /* the stored statement has the context to find in all_graphs */
+  stored = (librdf_statement*)
+    librdf_storage_trees_btree_search(graph->trees[LIBRDF_STORAGE_TREES_INDEX_SPO], statement);
+  if (!stored)
+    return 1;
+
+  if (context->all_graphs)
+    librdf_storage_trees_remove_statement_internal(context->all_graphs, stored);
+
+  librdf_storage_trees_remove_statement_internal(graph, statement);
+
+  if (!librdf_storage_trees_btree_size(graph->trees[LIBRDF_STORAGE_TREES_INDEX_SPO]))
+    raptor_avltree_delete(context->contexts, graph);
+
+  return 0;
 }
 
 
 /**
- * librdf_storage_trees_context_serialise:
+ * librdf_storage_trees_context_remove_statements:
  * @storage: #librdf_storage object
  * @context_node: #librdf_node object
  *
- * List all statements in a storage context.
+ * Remove all statements from a storage context.
  * 
- * Return value: #librdf_stream of statements or NULL on failure or context is empty
+ * The graph of the context is freed at once.
+ * 
+ * Return value: non 0 on failure
  **/
-static librdf_stream*
-librdf_storage_trees_context_serialise(librdf_storage* storage,
-                                        librdf_node* context_node) 
+static int
+librdf_storage_trees_context_remove_statements(librdf_storage* storage,
+                                               librdf_node* context_node) 
 {
-  return NULL;
+  librdf_storage_trees_instance* context=(librdf_storage_trees_instance*)storage->instance;
+  librdf_storage_trees_graph* graph;
+
+  if (!context_node || !context->contexts)
+    return 1;
+
+  graph=librdf_storage_trees_find_graph(storage, context_node);
+  if (!graph)
+    return 0;
+
+  if (context->all_graphs) {
+    librdf_storage_trees_btree_iterator iterator;
+
+    for (librdf_storage_trees_btree_iterator_init(&iterator, graph->trees[LIBRDF_STORAGE_TREES_INDEX_SPO], NULL);
+         !librdf_storage_trees_btree_iterator_is_end(&iterator);
+         librdf_storage_trees_btree_iterator_next(&iterator))
+      librdf_storage_trees_remove_statement_internal(context->all_graphs,
+                                                     (librdf_statement*)librdf_storage_trees_btree_iterator_get(&iterator));
+  }
+
+  raptor_avltree_delete(context->contexts, graph);
+
+  return 0;
+}
+
+
+/**
+ * librdf_storage_trees_context_size:
+ * @storage: #librdf_storage object
+ * @context_node: #librdf_node object
+ *
+ * Get the number of statements in a storage context.
+ * 
+ * Return value: the number of statements or <0 on failure
+ **/
+static int
+librdf_storage_trees_context_size(librdf_storage* storage,
+                                  librdf_node* context_node) 
+{
+  librdf_storage_trees_graph* graph;
+
+  graph=librdf_storage_trees_find_graph(storage, context_node);
+
+  return graph ? librdf_storage_trees_btree_size(graph->trees[LIBRDF_STORAGE_TREES_INDEX_SPO]) : 0;
+}
+
+
+/**
+ * librdf_storage_trees_context_serialise:
+ * @storage: #librdf_storage object
+ * @context_node: #librdf_node object
+ *
+ * List all statements in a storage context.
+ * 
+ * Return value: #librdf_stream of statements or NULL on failure or context is empty
+ **/
+static librdf_stream*
+librdf_storage_trees_context_serialise(librdf_storage* storage,
+                                        librdf_node* context_node) 
+{
+  return librdf_storage_trees_find_statements_in_context(storage, NULL,
+                                                         context_node);
+}
+
+
+/**
+ * librdf_storage_trees_find_statements_in_context:
+ * @storage: #librdf_storage object
+ * @statement: #librdf_statement to match or NULL for all
+ * @context_node: #librdf_node object
+ *
+ * Find statements in a storage context.
+ * 
+ * Only the trees of the context graph are searched.
+ * 
+ * Return value: #librdf_stream of statements or NULL on failure
+ **/
+static librdf_stream*
+librdf_storage_trees_find_statements_in_context(librdf_storage* storage,
+                                                librdf_statement* statement,
+                                                librdf_node* context_node) 
+{
+  librdf_storage_trees_graph* graph;
+  librdf_statement* range=NULL;
+
+  graph=librdf_storage_trees_find_graph(storage, context_node);
+  if (!graph)
+    return librdf_new_empty_stream(storage->world);
+
+  if (statement) {
+    range=librdf_new_statement_from_statement(statement);
+    if(!range)
+      return NULL;
+  }
+
+  return librdf_storage_trees_serialise_range(storage, graph, range);
+}
+
+
+typedef struct {
+  librdf_storage *storage;
+  raptor_avltree_iterator *avltree_iterator;
+} librdf_storage_trees_get_contexts_iterator_context;
+
+
+static int
+librdf_storage_trees_get_contexts_is_end(void* iterator)
+{
+  librdf_storage_trees_get_contexts_iterator_context* icontext=(librdf_storage_trees_get_contexts_iterator_context*)iterator;
+
+  return raptor_avltree_iterator_is_end(icontext->avltree_iterator);
+}
+
+
+static int
+librdf_storage_trees_get_contexts_next_method(void* iterator) 
+{
+  librdf_storage_trees_get_contexts_iterator_context* icontext=(librdf_storage_trees_get_contexts_iterator_context*)iterator;
+
+  return raptor_avltree_iterator_next(icontext->avltree_iterator);
+}
+
+
+static void*
+librdf_storage_trees_get_contexts_get_method(void* iterator, int flags) 
+{
+  librdf_storage_trees_get_contexts_iterator_context* icontext=(librdf_storage_trees_get_contexts_iterator_context*)iterator;
+  librdf_storage_trees_graph* graph;
+
+  switch(flags) {
+    case LIBRDF_ITERATOR_GET_METHOD_GET_OBJECT:
+      graph = (librdf_storage_trees_graph*)
+        raptor_avltree_iterator_get(icontext->avltree_iterator);
+      return graph ? graph->context : NULL;
+
+    case LIBRDF_ITERATOR_GET_METHOD_GET_CONTEXT:
+    default:
+      return NULL;
+  }
+}
+
+
+static void
+librdf_storage_trees_get_contexts_finished(void* iterator) 
+{
+  librdf_storage_trees_get_contexts_iterator_context* icontext=(librdf_storage_trees_get_contexts_iterator_context*)iterator;
+
+  if(icontext->avltree_iterator)
+    raptor_free_avltree_iterator(icontext->avltree_iterator);
+
+  if(icontext->storage)
+    librdf_storage_remove_reference(icontext->storage);
+
+  LIBRDF_FREE(librdf_storage_trees_get_contexts_iterator_context, icontext);
 }
 
 
 /**
- * librdf_storage_trees_context_get_contexts:
+ * librdf_storage_trees_get_contexts:
  * @storage: #librdf_storage object
  *
  * List all context nodes in a storage.
@@ -608,9 +1323,41 @@ librdf_storage_trees_context_serialise(librdf_storage* storage,
 static librdf_iterator*
 librdf_storage_trees_get_contexts(librdf_storage* storage) 
 {
-  return NULL;
+  librdf_storage_trees_instance* context=(librdf_storage_trees_instance*)storage->instance;
+  librdf_storage_trees_get_contexts_iterator_context* icontext;
+  librdf_iterator* iterator;
+
+  if(!context->contexts) {
+    librdf_log(storage->world, 0, LIBRDF_LOG_WARN, LIBRDF_FROM_STORAGE, NULL,
+               "Storage was created without context support");
+    return NULL;
+  }
+
+  icontext = LIBRDF_CALLOC(librdf_storage_trees_get_contexts_iterator_context*,
+                           1, sizeof(*icontext));
+  if(!icontext)
+    return NULL;
+
+  icontext->storage=storage;
+  librdf_storage_add_reference(icontext->storage);
+
+  icontext->avltree_iterator=raptor_new_avltree_iterator(context->contexts,
+                                                         NULL, NULL, 1);
+  if(!icontext->avltree_iterator) {
+    librdf_storage_trees_get_contexts_finished(icontext);
+    return NULL;
+  }
+
+  iterator=librdf_new_iterator(storage->world,
+                               (void*)icontext,
+                               &librdf_storage_trees_get_contexts_is_end,
+                               &librdf_storage_trees_get_contexts_next_method,
+                               &librdf_storage_trees_get_contexts_get_method,
+                               &librdf_storage_trees_get_contexts_finished);
+  if(!iterator)
+    librdf_storage_trees_get_contexts_finished(icontext);
+  return iterator;
 }
-#endif
 
 
 /**
@@ -636,7 +1383,7 @@ librdf_storage_trees_find_statements(librdf_storage* storage, librdf_statement*
   if(!range)
     return NULL;
 
-  stream=librdf_storage_trees_serialise_range(storage, range);
+  stream=librdf_storage_trees_serialise_range(storage, NULL, range);
 
   return stream;
 }
@@ -700,6 +1447,19 @@ librdf_storage_trees_node_compare(librdf_node* n1, librdf_node* n2)
 
 
 
+/* Compare the contexts of two statements with equal parts, which
+ * only differ in the all_graphs trees.
+ * NULL contexts act as wildcards. */
+static int
+librdf_storage_trees_context_compare(librdf_statement* a, librdf_statement* b)
+{
+  if (a->graph == NULL || b->graph == NULL)
+    return 0; /* wildcard context match */
+
+  return librdf_storage_trees_node_compare(a->graph, b->graph);
+}
+
+
 /* Compare two statements in (s, p, o) order.
  * NULL fields act as wildcards. */
 static int
@@ -733,7 +1493,10 @@ librdf_statement_compare_spo(const void* data1, const void* data2)
   else
     cmp = librdf_storage_trees_node_compare(a->object, b->object);
 
-  return cmp;
+  if (cmp != 0)
+    return cmp;
+
+  return librdf_storage_trees_context_compare(a, b);
 }
 
 
@@ -770,7 +1533,10 @@ librdf_statement_compare_sop(const void* data1, const void* data2)
   else
     cmp = librdf_storage_trees_node_compare(a->predicate, b->predicate);
 
-  return cmp;
+  if (cmp != 0)
+    return cmp;
+
+  return librdf_storage_trees_context_compare(a, b);
 }
 
 
@@ -807,7 +1573,10 @@ librdf_statement_compare_ops(const void* data1, const void* data2)
   else
     cmp = librdf_storage_trees_node_compare(a->subject, b->subject);
 
-  return cmp;
+  if (cmp != 0)
+    return cmp;
+
+  return librdf_storage_trees_context_compare(a, b);
 }
 
 
@@ -844,7 +1613,50 @@ librdf_statement_compare_pso(const void* data1, const void* data2)
   else
     cmp = librdf_storage_trees_node_compare(a->object, b->object);
   
-  return cmp;
+  if (cmp != 0)
+    return cmp;
+
+  return librdf_storage_trees_context_compare(a, b);
+}
+
+
+/* Compare two statements in (p, o, s) order.
+ * NULL fields act as wildcards. */
+static int
+librdf_statement_compare_pos(const void* data1, const void* data2)
+{
+  librdf_statement* a = (librdf_statement*)data1;
+  librdf_statement* b = (librdf_statement*)data2;
+  int cmp = 0;
+
+  /* Predicate */
+  if (a->predicate == NULL || b->predicate == NULL)
+    return 0; /* wildcard predicate match */
+  else
+    cmp = librdf_storage_trees_node_compare(a->predicate, b->predicate);
+
+  if (cmp != 0)
+    return cmp;
+  
+  /* Object */
+  if (a->object == NULL || b->object == NULL)
+    return 0; /* wildcard object match */
+  else
+    cmp = librdf_storage_trees_node_compare(a->object, b->object);
+  
+  if (cmp != 0)
+    return cmp;
+
+  /* Subject */
+  if (a->subject == NULL || b->subject == NULL)
+    return 0; /* wildcard subject match */
+  else
+    cmp = librdf_storage_trees_node_compare(a->subject, b->subject);
+
+  if (cmp != 0)
+    return cmp;
+
+  return librdf_storage_trees_context_compare(a, b);
 }
 
 
@@ -856,149 +1668,939 @@ librdf_storage_trees_avl_free(void* data)
 }
 
 
-/* graph functions */
+/* B+tree functions
+ *
+ * Statements are kept in leaves of LIBRDF_STORAGE_TREES_BTREE_ORDER
+ * contiguous pointers chained in order, so a range scan walks arrays
+ * rather than following a pointer per statement.  Branches hold the
+ * first item under each child, which is enough to descend since the
+ * items compare with wildcards as the avltree ones did.
+ */
 
-static librdf_storage_trees_graph*
-librdf_storage_trees_graph_new(librdf_storage* storage, librdf_node* context_node)
+/* First position in an array of items where item <= items[i] */
+static int
+librdf_storage_trees_btree_lower_bound(librdf_storage_trees_btree* tree,
+                                       void** items, int count,
+                                       const void* item)
 {
-  librdf_storage_trees_instance* context=(librdf_storage_trees_instance*)storage->instance;
-  librdf_storage_trees_graph* graph;
-
-  graph = LIBRDF_MALLOC(librdf_storage_trees_graph*, sizeof(*graph));
-  
-#ifdef RDF_STORAGE_TREES_WITH_CONTEXTS
-  graph->context=(context_node ? librdf_new_node_from_node(context_node) : NULL);
-#endif
-
-  /* Always create SPO index */
-  graph->spo_tree = raptor_new_avltree(librdf_statement_compare_spo,
-                                       librdf_storage_trees_avl_free,
-                                       /* flags */ 0);
-  if(!graph->spo_tree) {
-    LIBRDF_FREE(librdf_storage_trees_graph, graph);
-    return NULL;
+  int low = 0;
+  int high = count;
+
+  while (low < high) {
+    int mid = (low + high) / 2;
+    if (tree->compare(item, items[mid]) > 0)
+      low = mid + 1;
+    else
+      high = mid;
   }
-  
-  if(context->index_sop)
-    graph->sop_tree = raptor_new_avltree(librdf_statement_compare_sop, NULL,
-                                         /* flags */ 0);
-  else
-    graph->sop_tree=NULL;
-
-  if(context->index_ops)
-    graph->ops_tree = raptor_new_avltree(librdf_statement_compare_ops, NULL,
-                                         /* flags */ 0);
-  else
-    graph->ops_tree=NULL;
-  
-  if(context->index_pso)
-    graph->pso_tree = raptor_new_avltree(librdf_statement_compare_pso, NULL,
-                                         /* flags */ 0);
-  else
-    graph->pso_tree=NULL;
-
-  return graph;
+  return low;
 }
 
 
-#ifdef RDF_STORAGE_TREES_WITH_CONTEXTS
+/* Child of a branch that can hold item: the one before the first key
+ * not less than item, or that key's child when it is item */
 static int
-librdf_storage_trees_graph_compare(const void* data1, const void* data2)
+librdf_storage_trees_btree_child(librdf_storage_trees_btree* tree,
+                                 librdf_storage_trees_btree_branch* branch,
+                                 const void* item, int* is_key)
 {
-  librdf_storage_trees_graph* a = (librdf_storage_trees_graph*)data1;
-  librdf_storage_trees_graph* b = (librdf_storage_trees_graph*)data2;
-  return librdf_storage_trees_node_compare(a->context, b->context);
+  int i = librdf_storage_trees_btree_lower_bound(tree, branch->keys,
+                                                 branch->count, item);
+
+  *is_key = (i < branch->count && !tree->compare(item, branch->keys[i]));
+  if (*is_key)
+    return i;
+  return i ? i - 1 : 0;
 }
-#endif
 
 
-static void
-librdf_storage_trees_graph_free(void* data)
+/* First item under a node, kept up to date as keys of its parent */
+static void*
+librdf_storage_trees_btree_first(void* node, int height)
 {
-  librdf_storage_trees_graph* graph = (librdf_storage_trees_graph*)data;
-  
-#ifdef RDF_STORAGE_TREES_WITH_CONTEXTS
-  librdf_free_node(graph->context);
-#endif
-  
-  /* Extra index trees have null deleters (statements are shared) */
-  if (graph->sop_tree)
-    raptor_free_avltree(graph->sop_tree);
-  if (graph->ops_tree)
-    raptor_free_avltree(graph->ops_tree);
-  if (graph->pso_tree)
-    raptor_free_avltree(graph->pso_tree);
-
-  /* Free spo tree and statements */
-  raptor_free_avltree(graph->spo_tree);
-
-  graph->spo_tree = NULL;
-  graph->sop_tree = NULL;
-  graph->ops_tree = NULL;
-  graph->pso_tree = NULL;
-
-  LIBRDF_FREE(librdf_storage_trees_graph, graph);
+  if (height)
+    return ((librdf_storage_trees_btree_branch*)node)->keys[0];
+  return ((librdf_storage_trees_btree_leaf*)node)->items[0];
 }
 
 
-/**
- * librdf_storage_trees_get_feature:
- * @storage: #librdf_storage object
- * @feature: #librdf_uri feature property
- *
- * Get the value of a storage feature.
- * 
- * Return value: #librdf_node feature value or NULL if no such feature
- * exists or the value is empty.
- **/
-static librdf_node*
-librdf_storage_trees_get_feature(librdf_storage* storage, librdf_uri* feature)
+static librdf_storage_trees_btree*
+librdf_storage_trees_btree_new(raptor_data_compare_handler compare,
+                               raptor_data_free_handler free_handler)
 {
-#ifdef RDF_STORAGE_TREES_WITH_CONTEXTS
-  librdf_storage_trees_instance* scontext=(librdf_storage_trees_instance*)storage->instance;
-  unsigned char *uri_string;
+  librdf_storage_trees_btree* tree;
 
-  if(!feature)
+  tree = LIBRDF_CALLOC(librdf_storage_trees_btree*, 1, sizeof(*tree));
+  if (!tree)
     return NULL;
 
-  uri_string=librdf_uri_as_string(feature);
-  if(!uri_string)
+  tree->root = LIBRDF_CALLOC(librdf_storage_trees_btree_leaf*, 1,
+                             sizeof(librdf_storage_trees_btree_leaf));
+  if (!tree->root) {
+    LIBRDF_FREE(librdf_storage_trees_btree, tree);
     return NULL;
-  
-  if(!strcmp((const char*)uri_string, LIBRDF_MODEL_FEATURE_CONTEXTS)) {
-    unsigned char value[2];
-
-    sprintf((char*)value, "%d", (scontext->contexts != NULL));
-    return librdf_new_node_from_typed_literal(storage->world, 
-                                              value, NULL, NULL);
   }
-#endif
 
-  return NULL;
+  tree->compare = compare;
+  tree->free_handler = free_handler;
+  return tree;
 }
 
 
-/** Local entry point for dynamically loaded storage module */
+/* Free a node and those under it, and their items with free_handler
+ * when not NULL */
 static void
-librdf_storage_trees_register_factory(librdf_storage_factory *factory) 
+librdf_storage_trees_btree_free_node(raptor_data_free_handler free_handler,
+                                     void* node, int height)
 {
-  LIBRDF_ASSERT_CONDITION(!strncmp(factory->name, "trees", 5));
+  int i;
+
+  if (height) {
+    librdf_storage_trees_btree_branch* branch;
+    branch = (librdf_storage_trees_btree_branch*)node;
+    for (i = 0; i < branch->count; i++)
+      librdf_storage_trees_btree_free_node(free_handler, branch->children[i],
+                                           height - 1);
+    LIBRDF_FREE(librdf_storage_trees_btree_branch, branch);
+  } else {
+    librdf_storage_trees_btree_leaf* leaf;
+    leaf = (librdf_storage_trees_btree_leaf*)node;
+    if (free_handler) {
+      for (i = 0; i < leaf->count; i++)
+        free_handler(leaf->items[i]);
+    }
+    LIBRDF_FREE(librdf_storage_trees_btree_leaf, leaf);
+  }
+}
 
-  factory->version                  = LIBRDF_STORAGE_INTERFACE_VERSION;
-  factory->init                     = librdf_storage_trees_init;
-  factory->clone                    = NULL;
-  factory->terminate                = librdf_storage_trees_terminate;
-  factory->open                     = librdf_storage_trees_open;
-  factory->close                    = librdf_storage_trees_close;
-  factory->size                     = librdf_storage_trees_size;
-  factory->add_statement            = librdf_storage_trees_add_statement;
-  factory->add_statements           = librdf_storage_trees_add_statements;
-  factory->remove_statement         = librdf_storage_trees_remove_statement;
-  factory->contains_statement       = librdf_storage_trees_contains_statement;
-  factory->serialise                = librdf_storage_trees_serialise;
 
-  factory->find_statements          = librdf_storage_trees_find_statements;
-  /* These could be implemented, but only if all indexes are available.
+static void
+librdf_storage_trees_btree_free(librdf_storage_trees_btree* tree)
+{
+  librdf_storage_trees_btree_free_node(tree->free_handler, tree->root,
+                                       tree->height);
+  while (tree->spares_count)
+    LIBRDF_FREE(librdf_storage_trees_btree_node,
+                tree->spares[--tree->spares_count]);
+  LIBRDF_FREE(librdf_storage_trees_btree, tree);
+}
+
+
+/*
+ * librdf_storage_trees_btree_clear:
+ * @tree: B+tree
+ *
+ * INTERNAL - Remove every node of a B+tree without freeing the items.
+ *
+ * The new empty root is a spare node when there is one, as there
+ * always is after librdf_storage_trees_btree_build().
+ *
+ * Return value: non 0 on failure, when the tree is unchanged
+ */
+static int
+librdf_storage_trees_btree_clear(librdf_storage_trees_btree* tree)
+{
+  librdf_storage_trees_btree_leaf* root;
+
+  if (tree->spares_count)
+    root = (librdf_storage_trees_btree_leaf*)tree->spares[--tree->spares_count];
+  else {
+    root = LIBRDF_MALLOC(librdf_storage_trees_btree_leaf*, sizeof(*root));
+    if (!root)
+      return 1;
+  }
+  root->count = 0;
+  root->next = NULL;
+
+  librdf_storage_trees_btree_free_node(NULL, tree->root, tree->height);
+  tree->root = root;
+  tree->height = 0;
+  tree->size = 0;
+  return 0;
+}
+
+
+/* Allocate the spare nodes an insert may need.  Returns non 0 on
+ * failure */
+static int
+librdf_storage_trees_btree_reserve(librdf_storage_trees_btree* tree)
+{
+  const int needed = tree->height + 2;
+
+  if (needed > LIBRDF_STORAGE_TREES_BTREE_SPARES)
+    return 1;
+
+  while (tree->spares_count < needed) {
+    void* node;
+
+    node = LIBRDF_MALLOC(void*, sizeof(librdf_storage_trees_btree_node));
+    if (!node)
+      return 1;
+    tree->spares[tree->spares_count++] = node;
+  }
+  return 0;
+}
+
+
+/* Insert item under node.  Sets *split to a new right sibling of node,
+ * taken from the spares of the tree, when node was full.  Returns 0 if
+ * added or >0 if an equal item exists */
+static int
+librdf_storage_trees_btree_insert(librdf_storage_trees_btree* tree,
+                                  void* node, int height, void* item,
+                                  void** split)
+{
+  const int half = LIBRDF_STORAGE_TREES_BTREE_ORDER / 2;
+  librdf_storage_trees_btree_branch* branch;
+  librdf_storage_trees_btree_branch* right;
+  void* child_split = NULL;
+  int is_key;
+  int status;
+  int i;
+
+  *split = NULL;
+
+  if (!height) {
+    librdf_storage_trees_btree_leaf* leaf;
+    librdf_storage_trees_btree_leaf* right_leaf;
+
+    leaf = (librdf_storage_trees_btree_leaf*)node;
+    i = librdf_storage_trees_btree_lower_bound(tree, leaf->items, leaf->count,
+                                               item);
+    if (i < leaf->count && !tree->compare(item, leaf->items[i]))
+      return 1;
+
+    if (leaf->count == LIBRDF_STORAGE_TREES_BTREE_ORDER) {
+      right_leaf = (librdf_storage_trees_btree_leaf*)tree->spares[--tree->spares_count];
+      right_leaf->count = leaf->count - half;
+      memcpy(right_leaf->items, leaf->items + half,
+             sizeof(void*) * right_leaf->count);
+      right_leaf->next = leaf->next;
+      leaf->next = right_leaf;
+      leaf->count = half;
+      *split = right_leaf;
+
+      if (i > half) {
+        i -= half;
+        leaf = right_leaf;
+      }
+    }
+
+    memmove(leaf->items + i + 1, leaf->items + i,
+            sizeof(void*) * (leaf->count - i));
+    leaf->items[i] = item;
+    leaf->count++;
+    return 0;
+  }
+
+  branch = (librdf_storage_trees_btree_branch*)node;
+  i = librdf_storage_trees_btree_child(tree, branch, item, &is_key);
+  if (is_key)
+    return 1;
+
+  status = librdf_storage_trees_btree_insert(tree, branch->children[i],
+                                             height - 1, item, &child_split);
+  if (status)
+    return status;
+
+  /* item may now be the first of the first child */
+  branch->keys[i] = librdf_storage_trees_btree_first(branch->children[i],
+                                                     height - 1);
+  if (!child_split)
+    return 0;
+
+  i++;
+  if (branch->count == LIBRDF_STORAGE_TREES_BTREE_ORDER) {
+    right = (librdf_storage_trees_btree_branch*)tree->spares[--tree->spares_count];
+    right->count = branch->count - half;
+    memcpy(right->keys, branch->keys + half, sizeof(void*) * right->count);
+    memcpy(right->children, branch->children + half,
+           sizeof(void*) * right->count);
+    branch->count = half;
+    *split = right;
+
+    if (i > half) {
+      i -= half;
+      branch = right;
+    }
+  }
+
+  memmove(branch->keys + i + 1, branch->keys + i,
+          sizeof(void*) * (branch->count - i));
+  memmove(branch->children + i + 1, branch->children + i,
+          sizeof(void*) * (branch->count - i));
+  branch->keys[i] = librdf_storage_trees_btree_first(child_split, height - 1);
+  branch->children[i] = child_split;
+  branch->count++;
+  return 0;
+}
+
+
+/*
+ * librdf_storage_trees_btree_add:
+ * @tree: B+tree
+ * @item: item to add, owned by the tree on success
+ *
+ * INTERNAL - Add an item to a B+tree.
+ *
+ * As with raptor_avltree_add(), an item equal to one in the tree is
+ * freed with the free handler of the tree.
+ *
+ * The nodes the insert may split off are allocated first, so on
+ * failure the tree is unchanged and @item is not owned.
+ *
+ * Return value: 0 if added, >0 if an equal item exists, <0 on failure
+ */
+static int
+librdf_storage_trees_btree_add(librdf_storage_trees_btree* tree, void* item)
+{
+  librdf_storage_trees_btree_branch* root;
+  void* split = NULL;
+  int status;
+
+  if (librdf_storage_trees_btree_reserve(tree))
+    return -1;
+
+  status = librdf_storage_trees_btree_insert(tree, tree->root, tree->height,
+                                             item, &split);
+  if (status > 0 && tree->free_handler)
+    tree->free_handler(item);
+  if (status)
+    return status;
+
+  tree->size++;
+  if (!split)
+    return 0;
+
+  root = (librdf_storage_trees_btree_branch*)tree->spares[--tree->spares_count];
+  root->count = 2;
+  root->keys[0] = librdf_storage_trees_btree_first(tree->root, tree->height);
+  root->children[0] = tree->root;
+  root->keys[1] = librdf_storage_trees_btree_first(split, tree->height);
+  root->children[1] = split;
+  tree->root = root;
+  tree->height++;
+  return 0;
+}
+
+
+static void*
+librdf_storage_trees_btree_search(librdf_storage_trees_btree* tree,
+                                  const void* item)
+{
+  librdf_storage_trees_btree_leaf* leaf;
+  void* node = tree->root;
+  int height;
+  int i;
+
+  for (height = tree->height; height; height--) {
+    librdf_storage_trees_btree_branch* branch;
+    int is_key;
+
+    branch = (librdf_storage_trees_btree_branch*)node;
+    i = librdf_storage_trees_btree_child(tree, branch, item, &is_key);
+    if (is_key)
+      return branch->keys[i];
+    node = branch->children[i];
+  }
+
+  leaf = (librdf_storage_trees_btree_leaf*)node;
+  i = librdf_storage_trees_btree_lower_bound(tree, leaf->items, leaf->count,
+                                             item);
+  if (i < leaf->count && !tree->compare(item, leaf->items[i]))
+    return leaf->items[i];
+  return NULL;
+}
+
+
+/* Move items between the ends of two neighbouring arrays so the left
+ * one has target items */
+static void
+librdf_storage_trees_btree_shift(void** left, int left_count,
+                                 void** right, int right_count, int target)
+{
+  int n;
+
+  if (left_count < target) {
+    n = target - left_count;
+    memcpy(left + left_count, right, sizeof(void*) * n);
+    memmove(right, right + n, sizeof(void*) * (right_count - n));
+  } else {
+    n = left_count - target;
+    memmove(right + n, right, sizeof(void*) * right_count);
+    memcpy(right, left + target, sizeof(void*) * n);
+  }
+}
+
+
+/* Even out children i and i + 1 of a branch, merging them into child i
+ * when they fit in one node */
+static void
+librdf_storage_trees_btree_rebalance(librdf_storage_trees_btree_branch* branch,
+                                     int i, int height)
+{
+  int total;
+  int target;
+
+  if (height) {
+    librdf_storage_trees_btree_branch* left = branch->children[i];
+    librdf_storage_trees_btree_branch* right = branch->children[i + 1];
+
+    total = left->count + right->count;
+    if (total > LIBRDF_STORAGE_TREES_BTREE_ORDER) {
+      target = total / 2;
+      librdf_storage_trees_btree_shift(left->keys, left->count,
+                                       right->keys, right->count, target);
+      librdf_storage_trees_btree_shift(left->children, left->count,
+                                       right->children, right->count, target);
+      right->count = total - target;
+      left->count = target;
+      branch->keys[i + 1] = right->keys[0];
+      return;
+    }
+
+    memcpy(left->keys + left->count, right->keys,
+           sizeof(void*) * right->count);
+    memcpy(left->children + left->count, right->children,
+           sizeof(void*) * right->count);
+    left->count = total;
+    branch->keys[i] = left->keys[0]; /* left may have been empty */
+    LIBRDF_FREE(librdf_storage_trees_btree_branch, right);
+  } else {
+    librdf_storage_trees_btree_leaf* left = branch->children[i];
+    librdf_storage_trees_btree_leaf* right = branch->children[i + 1];
+
+    total = left->count + right->count;
+    if (total > LIBRDF_STORAGE_TREES_BTREE_ORDER) {
+      target = total / 2;
+      librdf_storage_trees_btree_shift(left->items, left->count,
+                                       right->items, right->count, target);
+      right->count = total - target;
+      left->count = target;
+      branch->keys[i + 1] = right->items[0];
+      return;
+    }
+
+    memcpy(left->items + left->count, right->items,
+           sizeof(void*) * right->count);
+    left->count = total;
+    left->next = right->next;
+    branch->keys[i] = left->items[0]; /* left may have been empty */
+    LIBRDF_FREE(librdf_storage_trees_btree_leaf, right);
+  }
+
+  branch->count--;
+  memmove(branch->keys + i + 1, branch->keys + i + 2,
+          sizeof(void*) * (branch->count - i - 1));
+  memmove(branch->children + i + 1, branch->children + i + 2,
+          sizeof(void*) * (branch->count - i - 1));
+}
+
+
+/* Remove the item equal to item under node and return it, or NULL */
+static void*
+librdf_storage_trees_btree_remove(librdf_storage_trees_btree* tree,
+                                  void* node, int height, const void* item)
+{
+  librdf_storage_trees_btree_branch* branch;
+  void* removed;
+  void* child;
+  int count;
+  int is_key;
+  int i;
+
+  if (!height) {
+    librdf_storage_trees_btree_leaf* leaf;
+
+    leaf = (librdf_storage_trees_btree_leaf*)node;
+    i = librdf_storage_trees_btree_lower_bound(tree, leaf->items, leaf->count,
+                                               item);
+    if (i == leaf->count || tree->compare(item, leaf->items[i]))
+      return NULL;
+
+    removed = leaf->items[i];
+    leaf->count--;
+    memmove(leaf->items + i, leaf->items + i + 1,
+            sizeof(void*) * (leaf->count - i));
+    return removed;
+  }
+
+  branch = (librdf_storage_trees_btree_branch*)node;
+  i = librdf_storage_trees_btree_child(tree, branch, item, &is_key);
+  child = branch->children[i];
+  removed = librdf_storage_trees_btree_remove(tree, child, height - 1, item);
+  if (!removed)
+    return NULL;
+
+  count = (height > 1) ? ((librdf_storage_trees_btree_branch*)child)->count
+                       : ((librdf_storage_trees_btree_leaf*)child)->count;
+  if (count)
+    branch->keys[i] = librdf_storage_trees_btree_first(child, height - 1);
+
+  /* a child below half full is evened out with a neighbour, so only
+   * the single child of a root can go empty until the root is dropped */
+  if (count < LIBRDF_STORAGE_TREES_BTREE_MIN && branch->count > 1) {
+    if (i + 1 < branch->count)
+      librdf_storage_trees_btree_rebalance(branch, i, height - 1);
+    else
+      librdf_storage_trees_btree_rebalance(branch, i - 1, height - 1);
+  }
+
+  return removed;
+}
+
+
+/*
+ * librdf_storage_trees_btree_delete:
+ * @tree: B+tree
+ * @item: item to match
+ *
+ * INTERNAL - Remove the item equal to @item from a B+tree, freeing it
+ * with the free handler of the tree.
+ *
+ * Return value: non 0 if an item was removed
+ */
+static int
+librdf_storage_trees_btree_delete(librdf_storage_trees_btree* tree,
+                                  const void* item)
+{
+  void* removed;
+
+  removed = librdf_storage_trees_btree_remove(tree, tree->root, tree->height,
+                                              item);
+  if (!removed)
+    return 0;
+
+  tree->size--;
+
+  /* drop roots with a single child */
+  while (tree->height &&
+         ((librdf_storage_trees_btree_branch*)tree->root)->count == 1) {
+    librdf_storage_trees_btree_branch* root;
+    root = (librdf_storage_trees_btree_branch*)tree->root;
+    tree->root = root->children[0];
+    tree->height--;
+    LIBRDF_FREE(librdf_storage_trees_btree_branch, root);
+  }
+
+  if (tree->free_handler)
+    tree->free_handler(removed);
+  return 1;
+}
+
+
+static int
+librdf_storage_trees_btree_size(librdf_storage_trees_btree* tree)
+{
+  return tree->size;
+}
+
+
+/* Check the iterator is still on an item matching its range */
+static void
+librdf_storage_trees_btree_iterator_check(librdf_storage_trees_btree_iterator* iterator)
+{
+  librdf_storage_trees_btree_leaf* leaf = iterator->leaf;
+
+  if (iterator->index == leaf->count) {
+    leaf = leaf->next;
+    iterator->leaf = leaf;
+    iterator->index = 0;
+    if (!leaf)
+      return;
+    LIBRDF_STORAGE_TREES_VISIT(iterator->tree);
+    LIBRDF_STORAGE_TREES_PREFETCH(leaf->next);
+  }
+
+  if (iterator->range &&
+      iterator->tree->compare(iterator->range, leaf->items[iterator->index]))
+    iterator->leaf = NULL;
+}
+
+
+/*
+ * librdf_storage_trees_btree_iterator_init:
+ * @iterator: iterator to set up
+ * @tree: B+tree
+ * @range: item to match (not owned) or NULL for all items
+ *
+ * INTERNAL - Position an iterator on the first item of a B+tree
+ * matching a range.
+ */
+static void
+librdf_storage_trees_btree_iterator_init(librdf_storage_trees_btree_iterator* iterator,
+                                         librdf_storage_trees_btree* tree,
+                                         void* range)
+{
+  librdf_storage_trees_btree_leaf* leaf;
+  void* node = tree->root;
+  int height;
+
+  for (height = tree->height; height; height--) {
+    librdf_storage_trees_btree_branch* branch;
+    int i = 0;
+
+    LIBRDF_STORAGE_TREES_VISIT(tree);
+    branch = (librdf_storage_trees_btree_branch*)node;
+    if (range) {
+      /* the matches may start in the child before the first key
+       * matching, so do not stop on it */
+      i = librdf_storage_trees_btree_lower_bound(tree, branch->keys,
+                                                 branch->count, range);
+      if (i)
+        i--;
+    }
+    node = branch->children[i];
+  }
+
+  LIBRDF_STORAGE_TREES_VISIT(tree);
+  leaf = (librdf_storage_trees_btree_leaf*)node;
+  iterator->tree = tree;
+  iterator->range = range;
+  iterator->leaf = leaf;
+  iterator->index = range ?
+    librdf_storage_trees_btree_lower_bound(tree, leaf->items, leaf->count,
+                                           range) : 0;
+  LIBRDF_STORAGE_TREES_PREFETCH(leaf->next);
+  librdf_storage_trees_btree_iterator_check(iterator);
+}
+
+
+static int
+librdf_storage_trees_btree_iterator_is_end(librdf_storage_trees_btree_iterator* iterator)
+{
+  return (iterator->leaf == NULL);
+}
+
+
+/* Returns non 0 at the end */
+static int
+librdf_storage_trees_btree_iterator_next(librdf_storage_trees_btree_iterator* iterator)
+{
+  if (!iterator->leaf)
+    return 1;
+
+  iterator->index++;
+  librdf_storage_trees_btree_iterator_check(iterator);
+  return (iterator->leaf == NULL);
+}
+
+
+static void*
+librdf_storage_trees_btree_iterator_get(librdf_storage_trees_btree_iterator* iterator)
+{
+  if (!iterator->leaf)
+    return NULL;
+
+  return iterator->leaf->items[iterator->index];
+}
+
+
+/*
+ * librdf_storage_trees_btree_build:
+ * @tree: empty B+tree
+ * @items: items sorted in the order of the tree with no two equal
+ * @count: number of items
+ *
+ * INTERNAL - Fill an empty B+tree from sorted items bottom up.
+ *
+ * Each level is split into as few nodes as can hold it, sharing the
+ * items evenly, so nodes are full or nearly so and the tree is as low
+ * as it can be.  The items are owned by the tree on success.
+ *
+ * Return value: non 0 on failure, when the tree is left empty
+ */
+static int
+librdf_storage_trees_btree_build(librdf_storage_trees_btree* tree,
+                                 void** items, int count)
+{
+  const int order = LIBRDF_STORAGE_TREES_BTREE_ORDER;
+  librdf_storage_trees_btree_leaf* previous = NULL;
+  void** level;
+  int height = 0;
+  int n;
+  int i;
+
+  if (!count)
+    return 0;
+
+  n = (count + order - 1) / order;
+  level = LIBRDF_MALLOC(void**, sizeof(void*) * n);
+  if (!level)
+    return 1;
+
+  for (i = 0; i < n; i++) {
+    librdf_storage_trees_btree_leaf* leaf;
+    int size = count / n + (i < count % n);
+
+    leaf = LIBRDF_MALLOC(librdf_storage_trees_btree_leaf*, sizeof(*leaf));
+    if (!leaf) {
+      while (i--)
+        LIBRDF_FREE(librdf_storage_trees_btree_leaf, level[i]);
+      LIBRDF_FREE(void**, level);
+      return 1;
+    }
+    leaf->count = size;
+    leaf->next = NULL;
+    memcpy(leaf->items, items, sizeof(void*) * size);
+    items += size;
+    if (previous)
+      previous->next = leaf;
+    previous = leaf;
+    level[i] = leaf;
+  }
+
+  while (n > 1) {
+    int m = (n + order - 1) / order;
+    void** up;
+    int child = 0;
+
+    up = LIBRDF_MALLOC(void**, sizeof(void*) * m);
+    if (!up) {
+      for (i = 0; i < n; i++)
+        librdf_storage_trees_btree_free_node(NULL, level[i], height);
+      LIBRDF_FREE(void**, level);
+      return 1;
+    }
+
+    for (i = 0; i < m; i++) {
+      librdf_storage_trees_btree_branch* branch;
+      int size = n / m + (i < n % m);
+      int j;
+
+      branch = LIBRDF_MALLOC(librdf_storage_trees_btree_branch*,
+                             sizeof(*branch));
+      if (!branch) {
+        while (i--)
+          librdf_storage_trees_btree_free_node(NULL, up[i], height + 1);
+        for (; child < n; child++)
+          librdf_storage_trees_btree_free_node(NULL, level[child], height);
+        LIBRDF_FREE(void**, up);
+        LIBRDF_FREE(void**, level);
+        return 1;
+      }
+      branch->count = size;
+      for (j = 0; j < size; j++, child++) {
+        branch->children[j] = level[child];
+        branch->keys[j] = librdf_storage_trees_btree_first(level[child], height);
+      }
+      up[i] = branch;
+    }
+
+    LIBRDF_FREE(void**, level);
+    level = up;
+    n = m;
+    height++;
+  }
+
+  /* replaces the empty root leaf, kept as a spare for
+   * librdf_storage_trees_btree_clear() */
+  if (tree->spares_count < LIBRDF_STORAGE_TREES_BTREE_SPARES)
+    tree->spares[tree->spares_count++] = tree->root;
+  else
+    LIBRDF_FREE(librdf_storage_trees_btree_leaf, tree->root);
+  tree->root = level[0];
+  tree->height = height;
+  tree->size = count;
+  LIBRDF_FREE(void**, level);
+
+  return 0;
+}
+
+
+/*
+ * librdf_storage_trees_sort:
+ * @items: items to sort
+ * @count: number of items
+ * @compare: comparison of items
+ *
+ * INTERNAL - Sort items by a comparison taking the items themselves.
+ *
+ * A bottom up merge sort, since qsort() compares pointers to the
+ * items and the statement comparisons cannot be passed through it.
+ *
+ * Return value: non 0 on failure, when @items are unchanged
+ */
+static int
+librdf_storage_trees_sort(void** items, int count,
+                          raptor_data_compare_handler compare)
+{
+  void** buffer;
+  void** from = items;
+  void** to;
+  int width;
+
+  if (count < 2)
+    return 0;
+
+  buffer = LIBRDF_MALLOC(void**, sizeof(void*) * count);
+  if (!buffer)
+    return 1;
+  to = buffer;
+
+  for (width = 1; width < count; width *= 2) {
+    void** swap;
+    int start;
+
+    for (start = 0; start < count; start += 2 * width) {
+      int middle = (start + width < count) ? start + width : count;
+      int end = (start + 2 * width < count) ? start + 2 * width : count;
+      int i = start;
+      int j = middle;
+      int k = start;
+
+      while (i < middle && j < end)
+        to[k++] = (compare(from[j], from[i]) < 0) ? from[j++] : from[i++];
+      while (i < middle)
+        to[k++] = from[i++];
+      while (j < end)
+        to[k++] = from[j++];
+    }
+
+    swap = from;
+    from = to;
+    to = swap;
+  }
+
+  if (from != items)
+    memcpy(items, from, sizeof(void*) * count);
+  LIBRDF_FREE(void**, buffer);
+
+  return 0;
+}
+
+
+/* graph functions */
+
+/*
+ * librdf_storage_trees_graph_new:
+ * @storage: the storage
+ * @context_node: context node or NULL
+ * @owns_statements: non 0 if the spo tree frees its statements
+ *
+ * INTERNAL - Create the trees of a graph.
+ *
+ * Return value: new graph or NULL on failure
+ */
+static librdf_storage_trees_graph*
+librdf_storage_trees_graph_new(librdf_storage* storage, librdf_node* context_node,
+                               int owns_statements)
+{
+  librdf_storage_trees_instance* context=(librdf_storage_trees_instance*)storage->instance;
+  librdf_storage_trees_graph* graph;
+  int i;
+
+  graph = LIBRDF_CALLOC(librdf_storage_trees_graph*, 1, sizeof(*graph));
+  if(!graph)
+    return NULL;
+  
+  graph->context=(context_node ? librdf_new_node_from_node(context_node) : NULL);
+
+  /* Always create SPO index */
+  graph->trees[LIBRDF_STORAGE_TREES_INDEX_SPO] = librdf_storage_trees_btree_new(librdf_statement_compare_spo,
+                                                   owns_statements ? librdf_storage_trees_avl_free : NULL);
+  if(!graph->trees[LIBRDF_STORAGE_TREES_INDEX_SPO]) {
+    if(graph->context)
+      librdf_free_node(graph->context);
+    LIBRDF_FREE(librdf_storage_trees_graph, graph);
+    return NULL;
+  }
+  
+  for (i = LIBRDF_STORAGE_TREES_INDEX_SPO + 1; i < LIBRDF_STORAGE_TREES_INDEX_COUNT; i++) {
+    if(context->indexes[i])
+      graph->trees[i] = librdf_storage_trees_btree_new(librdf_storage_trees_index_compare[i], NULL);
+  }
+
+  return graph;
+}
+
+
+static int
+librdf_storage_trees_graph_compare(const void* data1, const void* data2)
+{
+  librdf_storage_trees_graph* a = (librdf_storage_trees_graph*)data1;
+  librdf_storage_trees_graph* b = (librdf_storage_trees_graph*)data2;
+  return librdf_storage_trees_node_compare(a->context, b->context);
+}
+
+
+static void
+librdf_storage_trees_graph_free(void* data)
+{
+  librdf_storage_trees_graph* graph = (librdf_storage_trees_graph*)data;
+  int i;
+  
+  if (graph->context)
+    librdf_free_node(graph->context);
+  
+  /* Extra index trees have null deleters (statements are shared),
+   * spo frees the statements so goes last */
+  for (i = LIBRDF_STORAGE_TREES_INDEX_COUNT - 1; i >= LIBRDF_STORAGE_TREES_INDEX_SPO; i--) {
+    if (graph->trees[i])
+      librdf_storage_trees_btree_free(graph->trees[i]);
+    graph->trees[i] = NULL;
+  }
+
+  LIBRDF_FREE(librdf_storage_trees_graph, graph);
+}
+
+
+/**
+ * librdf_storage_trees_get_feature:
+ * @storage: #librdf_storage object
+ * @feature: #librdf_uri feature property
+ *
+ * Get the value of a storage feature.
+ * 
+ * Return value: #librdf_node feature value or NULL if no such feature
+ * exists or the value is empty.
+ **/
+static librdf_node*
+librdf_storage_trees_get_feature(librdf_storage* storage, librdf_uri* feature)
+{
+  librdf_storage_trees_instance* scontext=(librdf_storage_trees_instance*)storage->instance;
+  unsigned char *uri_string;
+
+  if(!feature)
+    return NULL;
+
+  uri_string=librdf_uri_as_string(feature);
+  if(!uri_string)
+    return NULL;
+  
+  if(!strcmp((const char*)uri_string, LIBRDF_MODEL_FEATURE_CONTEXTS)) {
+    unsigned char value[2];
+
+    sprintf((char*)value, "%d", (scontext->contexts != NULL));
+    return librdf_new_node_from_typed_literal(storage->world, 
+                                              value, NULL, NULL);
+  }
+
+  return NULL;
+}
+
+
+/** Local entry point for dynamically loaded storage module */
+static void
+librdf_storage_trees_register_factory(librdf_storage_factory *factory) 
+{
+  LIBRDF_ASSERT_CONDITION(!strncmp(factory->name, "trees", 5));
+
+  factory->version                  = LIBRDF_STORAGE_INTERFACE_VERSION;
+  factory->init                     = librdf_storage_trees_init;
+  factory->clone                    = NULL;
+  factory->terminate                = librdf_storage_trees_terminate;
+  factory->open                     = librdf_storage_trees_open;
+  factory->close                    = librdf_storage_trees_close;
+  factory->size                     = librdf_storage_trees_size;
+  factory->add_statement            = librdf_storage_trees_add_statement;
+  factory->add_statements           = librdf_storage_trees_add_statements;
+  factory->remove_statement         = librdf_storage_trees_remove_statement;
+  factory->contains_statement       = librdf_storage_trees_contains_statement;
+  factory->serialise                = librdf_storage_trees_serialise;
+
+  factory->find_statements          = librdf_storage_trees_find_statements;
+  /* These could be implemented, but only if all indexes are available.
    * If they returned NULL if the indexes weren't available,
    * librdf_storage_find_statements would break, unfortunately.
    * Since these are exposed by model methods, the storage interface
@@ -1008,23 +2610,20 @@ librdf_storage_trees_register_factory(librdf_storage_factory *factory)
   factory->find_arcs                = NULL;
   factory->find_targets             = NULL;
 
-#ifdef RDF_STORAGE_TREES_WITH_CONTEXTS
   factory->context_add_statement    = librdf_storage_trees_context_add_statement;
   factory->context_remove_statement = librdf_storage_trees_context_remove_statement;
+  factory->context_remove_statements = librdf_storage_trees_context_remove_statements;
   factory->context_serialise        = librdf_storage_trees_context_serialise;
+  factory->find_statements_in_context = librdf_storage_trees_find_statements_in_context;
   factory->get_contexts             = librdf_storage_trees_get_contexts;
-#else
-  factory->context_add_statement    = NULL;
-  factory->context_remove_statement = NULL;
-  factory->context_serialise        = NULL;
-  factory->get_contexts             = NULL;
-#endif
+  factory->context_size             = librdf_storage_trees_context_size;
 
   factory->sync                     = NULL;
   factory->get_feature              = librdf_storage_trees_get_feature;
 }
 
 
+#ifndef STANDALONE
 /*
  * librdf_init_storage_trees:
  * @world: world object
@@ -1037,3 +2636,549 @@ librdf_init_storage_trees(librdf_world *world)
   librdf_storage_register_factory(world, "trees", "Balanced trees",
                                   &librdf_storage_trees_register_factory);
 }
+#endif
+
+
+/* TEST CODE */
+
+
+#ifdef STANDALONE
+
+/* one more prototype */
+int main(int argc, char *argv[]);
+
+#define TREES_TEST_SUBJECTS 20
+#define TREES_TEST_PREDICATES 10
+#define TREES_TEST_OBJECTS 10
+#define TREES_TEST_CONTEXTS 3
+
+
+/* Sum and reset the nodes visited in the trees without a context */
+static long
+librdf_storage_trees_test_visits(librdf_storage* storage)
+{
+  librdf_storage_trees_instance* context=(librdf_storage_trees_instance*)storage->instance;
+  long visits = 0;
+  int i;
+
+  for (i = 0; i < LIBRDF_STORAGE_TREES_INDEX_COUNT; i++) {
+    if (context->graph->trees[i]) {
+      visits += context->graph->trees[i]->visits;
+      context->graph->trees[i]->visits = 0;
+    }
+  }
+  return visits;
+}
+
+
+/* Number of statements in the run of the tree chosen for a pattern
+ * that starts with its bound parts, all of them unless filtering */
+static int
+librdf_storage_trees_test_run_size(librdf_storage* storage,
+                                   int has_s, int has_p, int has_o)
+{
+  librdf_storage_trees_instance* context=(librdf_storage_trees_instance*)storage->instance;
+  librdf_statement range; /* on stack - only parts are checked */
+  int run = TREES_TEST_SUBJECTS * TREES_TEST_PREDICATES * TREES_TEST_OBJECTS;
+  int filter;
+  int index;
+  int prefix;
+
+  memset(&range, 0, sizeof(range));
+  range.subject = has_s ? (librdf_node*)&range : NULL;
+  range.predicate = has_p ? (librdf_node*)&range : NULL;
+  range.object = has_o ? (librdf_node*)&range : NULL;
+  index = librdf_storage_trees_choose_index(context, &range, &filter);
+
+  for (prefix = 0; prefix < 3; prefix++) {
+    const int part = librdf_storage_trees_index_parts[index][prefix];
+
+    if (part == LIBRDF_STATEMENT_SUBJECT && has_s)
+      run /= TREES_TEST_SUBJECTS;
+    else if (part == LIBRDF_STATEMENT_PREDICATE && has_p)
+      run /= TREES_TEST_PREDICATES;
+    else if (part == LIBRDF_STATEMENT_OBJECT && has_o)
+      run /= TREES_TEST_OBJECTS;
+    else
+      break;
+  }
+
+  return run;
+}
+
+
+static librdf_node*
+librdf_storage_trees_test_node(librdf_world* world, const char* prefix, int i)
+{
+  char uri[64];
+
+  sprintf(uri, "http://example.org/%s%d", prefix, i);
+  return librdf_new_node_from_uri_string(world, (const unsigned char*)uri);
+}
+
+
+static librdf_statement*
+librdf_storage_trees_test_statement(librdf_world* world, int s, int p, int o)
+{
+  return librdf_new_statement_from_nodes(world,
+                                         librdf_storage_trees_test_node(world, "s", s),
+                                         librdf_storage_trees_test_node(world, "p", p),
+                                         librdf_storage_trees_test_node(world, "o", o));
+}
+
+
+static int
+librdf_storage_trees_test_stream_count(librdf_stream* stream)
+{
+  int count = 0;
+
+  if(!stream)
+    return -1;
+  while(!librdf_stream_end(stream)) {
+    count++;
+    librdf_stream_next(stream);
+  }
+  librdf_free_stream(stream);
+  return count;
+}
+
+
+static int
+librdf_storage_trees_test_contexts_count(librdf_storage* storage)
+{
+  librdf_iterator* iterator;
+  int count = 0;
+
+  iterator = librdf_storage_get_contexts(storage);
+  if(!iterator)
+    return -1;
+  while(!librdf_iterator_end(iterator)) {
+    count++;
+    librdf_iterator_next(iterator);
+  }
+  librdf_free_iterator(iterator);
+  return count;
+}
+
+
+/* Check a storage with contexts: context i holds (s j, p i, o j) for
+ * each subject j and (s 0, p 0, o 0) which is in every context */
+static int
+librdf_storage_trees_test_contexts(librdf_world* world, const char* program,
+                                   const char* options)
+{
+  librdf_storage* storage;
+  librdf_node* contexts[TREES_TEST_CONTEXTS];
+  librdf_node* unknown;
+  librdf_statement* statement;
+  int ret = 0;
+  int c, s;
+  int count;
+
+  fprintf(stdout, "%s: Creating storage with options %s\n", program,
+          options);
+  storage=librdf_new_storage(world, "trees-test", NULL, options);
+  if(!storage) {
+    fprintf(stderr, "%s: Failed to create trees storage\n", program);
+    return 1;
+  }
+
+  for (c = 0; c < TREES_TEST_CONTEXTS; c++) {
+    contexts[c] = librdf_storage_trees_test_node(world, "c", c);
+    for (s = 0; s < TREES_TEST_SUBJECTS; s++) {
+      statement = librdf_storage_trees_test_statement(world, s, c, s);
+      if(librdf_storage_context_add_statement(storage, contexts[c], statement)) {
+        fprintf(stderr, "%s: Failed to add statement to a context\n", program);
+        return 1;
+      }
+      librdf_free_statement(statement);
+    }
+    if(c) {
+      statement = librdf_storage_trees_test_statement(world, 0, 0, 0);
+      librdf_storage_context_add_statement(storage, contexts[c], statement);
+      librdf_free_statement(statement);
+    }
+  }
+  unknown = librdf_storage_trees_test_node(world, "c", TREES_TEST_CONTEXTS);
+
+  count = librdf_storage_trees_test_contexts_count(storage);
+  if(count != TREES_TEST_CONTEXTS) {
+    fprintf(stderr, "%s: Got %d contexts, expected %d\n", program,
+            count, TREES_TEST_CONTEXTS);
+    ret = 1;
+  }
+
+  for (c = 0; c < TREES_TEST_CONTEXTS; c++) {
+    count = librdf_storage_trees_test_stream_count(librdf_storage_context_as_stream(storage, contexts[c]));
+    if(count != TREES_TEST_SUBJECTS + (c ? 1 : 0)) {
+      fprintf(stderr, "%s: Context %d has %d statements, expected %d\n",
+              program, c, count, TREES_TEST_SUBJECTS + (c ? 1 : 0));
+      ret = 1;
+    }
+  }
+
+  /* contains looks in every context */
+  statement = librdf_storage_trees_test_statement(world, 1, 2, 1);
+  if(!librdf_storage_contains_statement(storage, statement)) {
+    fprintf(stderr, "%s: Statement in a context not found\n", program);
+    ret = 1;
+  }
+  librdf_free_statement(statement);
+  statement = librdf_storage_trees_test_statement(world, 1, 2, 2);
+  if(librdf_storage_contains_statement(storage, statement)) {
+    fprintf(stderr, "%s: Statement in no context found\n", program);
+    ret = 1;
+  }
+
+  /* removing from an unknown context or a statement not in the context */
+  if(librdf_storage_context_remove_statement(storage, unknown, statement) != -1 ||
+     !librdf_storage_context_remove_statement(storage, contexts[1], statement)) {
+    fprintf(stderr, "%s: Removing a missing statement did not fail\n", program);
+    ret = 1;
+  }
+  librdf_free_statement(statement);
+
+  /* a statement removed from one context stays in the others */
+  statement = librdf_storage_trees_test_statement(world, 0, 0, 0);
+  if(librdf_storage_context_remove_statement(storage, contexts[1], statement) ||
+     !librdf_storage_contains_statement(storage, statement)) {
+    fprintf(stderr, "%s: Statement in two contexts not kept\n", program);
+    ret = 1;
+  }
+  librdf_free_statement(statement);
+
+  /* emptying a context removes it */
+  for (s = 0; s < TREES_TEST_SUBJECTS; s++) {
+    statement = librdf_storage_trees_test_statement(world, s, 2, s);
+    if(librdf_storage_context_remove_statement(storage, contexts[2], statement)) {
+      fprintf(stderr, "%s: Failed to remove statement from a context\n",
+              program);
+      ret = 1;
+    }
+    librdf_free_statement(statement);
+  }
+  statement = librdf_storage_trees_test_statement(world, 0, 0, 0);
+  librdf_storage_context_remove_statement(storage, contexts[2], statement);
+  librdf_storage_context_remove_statement(storage, contexts[0], statement);
+  if(librdf_storage_contains_statement(storage, statement)) {
+    fprintf(stderr, "%s: Statement removed from every context found\n",
+            program);
+    ret = 1;
+  }
+  librdf_free_statement(statement);
+  statement = librdf_storage_trees_test_statement(world, 1, 2, 1);
+  if(librdf_storage_contains_statement(storage, statement)) {
+    fprintf(stderr, "%s: Statement removed from a context found\n", program);
+    ret = 1;
+  }
+  librdf_free_statement(statement);
+
+  count = librdf_storage_trees_test_contexts_count(storage);
+  if(count != TREES_TEST_CONTEXTS - 1) {
+    fprintf(stderr, "%s: Got %d contexts after emptying one, expected %d\n",
+            program, count, TREES_TEST_CONTEXTS - 1);
+    ret = 1;
+  }
+  count = librdf_storage_trees_test_stream_count(librdf_storage_context_as_stream(storage, contexts[2]));
+  if(count) {
+    fprintf(stderr, "%s: Emptied context has %d statements\n", program,
+            count);
+    ret = 1;
+  }
+
+  for (c = 0; c < TREES_TEST_CONTEXTS; c++)
+    librdf_free_node(contexts[c]);
+  librdf_free_node(unknown);
+  librdf_free_storage(storage);
+
+  return ret;
+}
+
+
+/* A stream of every test statement twice, in a scattered order */
+typedef struct {
+  librdf_world* world;
+  int index;
+  int count;
+  librdf_statement* statement;
+} librdf_storage_trees_test_stream_context;
+
+
+static int
+librdf_storage_trees_test_stream_end(void* context)
+{
+  librdf_storage_trees_test_stream_context* scontext=(librdf_storage_trees_test_stream_context*)context;
+
+  return scontext->index >= scontext->count;
+}
+
+
+static int
+librdf_storage_trees_test_stream_next(void* context)
+{
+  librdf_storage_trees_test_stream_context* scontext=(librdf_storage_trees_test_stream_context*)context;
+
+  if(scontext->statement) {
+    librdf_free_statement(scontext->statement);
+    scontext->statement = NULL;
+  }
+  scontext->index++;
+  return librdf_storage_trees_test_stream_end(context);
+}
+
+
+static void*
+librdf_storage_trees_test_stream_get(void* context, int flags)
+{
+  librdf_storage_trees_test_stream_context* scontext=(librdf_storage_trees_test_stream_context*)context;
+  const int total = TREES_TEST_SUBJECTS * TREES_TEST_PREDICATES * TREES_TEST_OBJECTS;
+  int k;
+
+  if(flags != LIBRDF_ITERATOR_GET_METHOD_GET_OBJECT)
+    return NULL;
+
+  if(!scontext->statement) {
+    /* 7919 is prime so this visits every statement once per total */
+    k = (int)(((long)scontext->index * 7919) % total);
+    scontext->statement = librdf_storage_trees_test_statement(scontext->world,
+                                                              k / (TREES_TEST_PREDICATES * TREES_TEST_OBJECTS),
+                                                              (k / TREES_TEST_OBJECTS) % TREES_TEST_PREDICATES,
+                                                              k % TREES_TEST_OBJECTS);
+  }
+  return scontext->statement;
+}
+
+
+static void
+librdf_storage_trees_test_stream_finished(void* context)
+{
+  librdf_storage_trees_test_stream_context* scontext=(librdf_storage_trees_test_stream_context*)context;
+
+  if(scontext->statement)
+    librdf_free_statement(scontext->statement);
+  LIBRDF_FREE(librdf_storage_trees_test_stream_context, scontext);
+}
+
+
+/* Load the test statements, each twice, with add_statements and check
+ * every tree holds each once in its order */
+static int
+librdf_storage_trees_test_bulk(librdf_world* world, const char* program,
+                               const char* options)
+{
+  const int total = TREES_TEST_SUBJECTS * TREES_TEST_PREDICATES * TREES_TEST_OBJECTS;
+  librdf_storage* storage;
+  librdf_storage_trees_instance* context;
+  librdf_storage_trees_test_stream_context* scontext;
+  librdf_stream* stream;
+  int ret = 0;
+  int i;
+
+  fprintf(stdout, "%s: Loading storage with options %s in bulk\n", program,
+          options ? options : "(none)");
+  storage=librdf_new_storage(world, "trees-test", NULL, options);
+  if(!storage) {
+    fprintf(stderr, "%s: Failed to create trees storage\n", program);
+    return 1;
+  }
+  context=(librdf_storage_trees_instance*)storage->instance;
+
+  scontext = LIBRDF_CALLOC(librdf_storage_trees_test_stream_context*, 1,
+                           sizeof(*scontext));
+  if(!scontext)
+    return 1;
+  scontext->world = world;
+  scontext->count = 2 * total;
+  stream=librdf_new_stream(world, scontext,
+                           librdf_storage_trees_test_stream_end,
+                           librdf_storage_trees_test_stream_next,
+                           librdf_storage_trees_test_stream_get,
+                           librdf_storage_trees_test_stream_finished);
+  if(!stream || librdf_storage_add_statements(storage, stream)) {
+    fprintf(stderr, "%s: Failed to add statements in bulk\n", program);
+    return 1;
+  }
+  librdf_free_stream(stream);
+
+  if(librdf_storage_size(storage) != total) {
+    fprintf(stderr, "%s: Bulk loaded %d statements, expected %d\n", program,
+            librdf_storage_size(storage), total);
+    ret = 1;
+  }
+
+  for (i = 0; i < LIBRDF_STORAGE_TREES_INDEX_COUNT; i++) {
+    librdf_storage_trees_btree* tree = context->graph->trees[i];
+    librdf_storage_trees_btree_leaf* leaf;
+    void* node;
+    void* previous = NULL;
+    int height;
+    int count = 0;
+    int j;
+
+    if(!context->indexes[i])
+      continue;
+
+    for (node = tree->root, height = tree->height; height; height--)
+      node = ((librdf_storage_trees_btree_branch*)node)->children[0];
+
+    for (leaf = (librdf_storage_trees_btree_leaf*)node; leaf; leaf = leaf->next) {
+      for (j = 0; j < leaf->count; j++) {
+        if(previous && tree->compare(previous, leaf->items[j]) >= 0) {
+          fprintf(stderr, "%s: Bulk loaded tree %d is out of order\n",
+                  program, i);
+          ret = 1;
+        }
+        previous = leaf->items[j];
+        count++;
+      }
+    }
+
+    if(count != total || tree->size != total) {
+      fprintf(stderr, "%s: Bulk loaded tree %d has %d statements, expected %d\n",
+              program, i, count, total);
+      ret = 1;
+    }
+  }
+
+  librdf_free_storage(storage);
+
+  return ret;
+}
+
+
+int
+main(int argc, char *argv[]) 
+{
+  const char *program=librdf_basename((const char*)argv[0]);
+  /* stores to test, only the first has every tree */
+  const char* const options[] = {
+    NULL,
+    "index-spo='yes',index-pos='yes'",
+    "index-spo='yes'",
+    "index-pos='yes'"
+  };
+  librdf_world *world;
+  int test;
+  int ret = 0;
+
+  world=librdf_new_world();
+  librdf_world_open(world);
+
+  librdf_storage_register_factory(world, "trees-test", "Balanced trees test",
+                                  &librdf_storage_trees_register_factory);
+
+  for (test = 0; test < (int)(sizeof(options) / sizeof(options[0])); test++) {
+    librdf_storage* storage;
+    int s, p, o;
+    int pattern;
+
+    fprintf(stdout, "%s: Creating storage with options %s\n", program,
+            options[test] ? options[test] : "(none)");
+    storage=librdf_new_storage(world, "trees-test", NULL, options[test]);
+    if(!storage) {
+      fprintf(stderr, "%s: Failed to create trees storage\n", program);
+      return 1;
+    }
+
+    for (s = 0; s < TREES_TEST_SUBJECTS; s++) {
+      for (p = 0; p < TREES_TEST_PREDICATES; p++) {
+        for (o = 0; o < TREES_TEST_OBJECTS; o++) {
+          librdf_statement* statement;
+          statement=librdf_new_statement_from_nodes(world,
+                                                    librdf_storage_trees_test_node(world, "s", s),
+                                                    librdf_storage_trees_test_node(world, "p", p),
+                                                    librdf_storage_trees_test_node(world, "o", o));
+          if(!statement || librdf_storage_add_statement(storage, statement)) {
+            fprintf(stderr, "%s: Failed to add statement\n", program);
+            return 1;
+          }
+          librdf_free_statement(statement);
+        }
+      }
+    }
+
+    /* each of the eight patterns of bound (1) and unbound (0) s p o */
+    for (pattern = 0; pattern < 8; pattern++) {
+      const int has_s = (pattern & 4), has_p = (pattern & 2), has_o = (pattern & 1);
+      int expected = 1;
+      int run;
+      long max_visits;
+      long visits;
+      librdf_statement* statement;
+      librdf_stream* stream;
+      int count = 0;
+
+      if(!has_s)
+        expected *= TREES_TEST_SUBJECTS;
+      if(!has_p)
+        expected *= TREES_TEST_PREDICATES;
+      if(!has_o)
+        expected *= TREES_TEST_OBJECTS;
+
+      statement=librdf_new_statement_from_nodes(world,
+                                                has_s ? librdf_storage_trees_test_node(world, "s", 3) : NULL,
+                                                has_p ? librdf_storage_trees_test_node(world, "p", 4) : NULL,
+                                                has_o ? librdf_storage_trees_test_node(world, "o", 5) : NULL);
+      librdf_storage_trees_test_visits(storage);
+      stream=librdf_storage_find_statements(storage, statement);
+      if(!stream) {
+        fprintf(stderr, "%s: Failed to find statements\n", program);
+        return 1;
+      }
+      while(!librdf_stream_end(stream)) {
+        count++;
+        librdf_stream_next(stream);
+      }
+      librdf_free_stream(stream);
+      librdf_free_statement(statement);
+      visits = librdf_storage_trees_test_visits(storage);
+
+      fprintf(stdout, "%s: Pattern (%s %s %s) matched %d statements visiting %ld nodes\n",
+              program, has_s ? "s" : "?", has_p ? "p" : "?", has_o ? "o" : "?",
+              count, visits);
+
+      if(count != expected) {
+        fprintf(stderr, "%s: Pattern matched %d statements, expected %d\n",
+                program, count, expected);
+        ret = 1;
+      }
+
+      /* a scan descends the (here at most four) levels once, then
+       * visits the leaves of the run of statements starting with the
+       * bound parts the tree orders by first, which are at least half
+       * full, and one past them */
+      run = librdf_storage_trees_test_run_size(storage, has_s, has_p, has_o);
+      max_visits = 6 + run / LIBRDF_STORAGE_TREES_BTREE_MIN;
+      if(visits > max_visits) {
+        fprintf(stderr, "%s: Pattern visited %ld nodes, expected at most %ld\n",
+                program, visits, max_visits);
+        ret = 1;
+      }
+
+      /* the default trees start with every bound part of any pattern */
+      if(!options[test] && run != expected) {
+        fprintf(stderr, "%s: Pattern scanned %d statements, expected %d\n",
+                program, run, expected);
+        ret = 1;
+      }
+    }
+
+    librdf_free_storage(storage);
+  }
+
+  if(librdf_storage_trees_test_bulk(world, program, NULL) ||
+     librdf_storage_trees_test_bulk(world, program,
+                                    "index-sop='yes',index-ops='yes',index-pso='yes',index-pos='yes'"))
+    ret = 1;
+
+  if(librdf_storage_trees_test_contexts(world, program, "contexts='yes'") ||
+     librdf_storage_trees_test_contexts(world, program,
+                                        "contexts='yes',index-graphs='yes'"))
+    ret = 1;
+
+  librdf_free_world(world);
+
+  return ret;
+}
+
+#endif
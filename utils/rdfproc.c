@@ -87,7 +87,8 @@ enum command_type {
   CMD_REMOVE_CONTEXT,
   CMD_CONTEXTS,
   CMD_MATCH,
-  CMD_SIZE
+  CMD_SIZE,
+  CMD_SYNC
 };
 
 typedef struct
@@ -127,6 +128,7 @@ static command commands[]={
   {CMD_CONTEXTS, "contexts", 0, 0, 0},
   {CMD_MATCH, "match", 3, 4, 0},
   {CMD_SIZE, "size", 0, 0, 0},
+  {CMD_SYNC, "sync", 0, 0, 1},
   {(enum command_type)-1, NULL, 0, 0, 0}  
 };
  
@@ -647,6 +649,7 @@ main(int argc, char *argv[])
     puts("  arcs-in | arcs-out NODE                   Show properties in/out of NODE");
     puts("  has-arc-in | has-arc-out NODE ARC         Check for property in/out of NODE.");
     puts("  size                                      Print the number of triples in the graph.");
+    puts("  sync                                      Synchronise the graph with its storage.");
     puts("\nNotation:");
     puts("  nodes are either blank node identifiers like _:ABC,");
     puts("    URIs like http://example.org otherwise are literal strings.");
@@ -1565,6 +1568,14 @@ main(int argc, char *argv[])
         fprintf(stdout, "%s: graph has unknown number of triples\n", program);
       break;
 
+    case CMD_SYNC:
+      if(librdf_model_sync(model)) {
+        fprintf(stderr, "%s: Failed to synchronise graph\n", program);
+        rc=1;
+      } else if(verbosity)
+        fprintf(stdout, "%s: graph synchronised\n", program);
+      break;
+
     default:
       fprintf(stderr, "%s: Unknown command %d\n", program, type);
       return(1);